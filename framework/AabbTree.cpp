@@ -0,0 +1,409 @@
+#include "Common.h"
+
+#include "AabbTree.h"
+#include "Ray.h"
+
+#include <float.h>
+#include <algorithm>
+
+namespace
+{
+	Vec3 Min(const Vec3& a, const Vec3& b)
+	{
+		return Vec3(std::min(a.x, b.x), std::min(a.y, b.y), std::min(a.z, b.z));
+	}
+	Vec3 Max(const Vec3& a, const Vec3& b)
+	{
+		return Vec3(std::max(a.x, b.x), std::max(a.y, b.y), std::max(a.z, b.z));
+	}
+
+	/// Surface area of the union of two boxes.
+	float UnionArea(const Vec3& min0, const Vec3& max0, const Vec3& min1, const Vec3& max1)
+	{
+		Vec3 d = vector::Subtract(Max(max0, max1), Min(min0, min1));
+		return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+	float Area(const Vec3& min, const Vec3& max)
+	{
+		Vec3 d = vector::Subtract(max, min);
+		return 2.0f * (d.x*d.y + d.y*d.z + d.z*d.x);
+	}
+
+	/// Returns true if the sphere is fully within the box.
+	bool Contains(const Vec3& min, const Vec3& max, const Vec3& center, float radius)
+	{
+		return (center.x - radius >= min.x && center.y - radius >= min.y && center.z - radius >= min.z &&
+				center.x + radius <= max.x && center.y + radius <= max.y && center.z + radius <= max.z);
+	}
+
+	/// Slab test, returns the distance along the ray to where it enters the box or FLT_MAX if it misses.
+	/// @param inv_direction Reciprocal of every component of the ray direction.
+	float RayBoxDistance(const Vec3& origin, const Vec3& inv_direction, const Vec3& min, const Vec3& max)
+	{
+		float tx0 = (min.x - origin.x) * inv_direction.x;
+		float tx1 = (max.x - origin.x) * inv_direction.x;
+		float ty0 = (min.y - origin.y) * inv_direction.y;
+		float ty1 = (max.y - origin.y) * inv_direction.y;
+		float tz0 = (min.z - origin.z) * inv_direction.z;
+		float tz1 = (max.z - origin.z) * inv_direction.z;
+
+		float t_enter = std::max(std::max(std::min(tx0, tx1), std::min(ty0, ty1)), std::max(std::min(tz0, tz1), 0.0f));
+		float t_exit = std::min(std::min(std::max(tx0, tx1), std::max(ty0, ty1)), std::max(tz0, tz1));
+		return (t_enter <= t_exit) ? t_enter : FLT_MAX;
+	}
+
+	/// Reciprocal for the slab test, rays parallel to an axis get a huge value rather than infinity to
+	///	avoid 0 * infinity when the origin lies on a slab.
+	float Reciprocal(float v)
+	{
+		if(fabsf(v) < 1e-20f)
+			return (v < 0.0f) ? -1e20f : 1e20f;
+		return 1.0f / v;
+	}
+};
+
+AabbTree::AabbTree(float margin) : _root(-1), _free_node(-1), _leaf_count(0), _margin(margin)
+{
+}
+AabbTree::~AabbTree()
+{
+}
+int AabbTree::Insert(const Vec3& center, float radius, uint32_t user_data)
+{
+	int leaf = AllocateNode();
+	Node& node = _nodes[leaf];
+
+	float extent = radius + _margin;
+	node.min = vector::Subtract(center, Vec3(extent, extent, extent));
+	node.max = vector::Add(center, Vec3(extent, extent, extent));
+	node.center = center;
+	node.radius = radius;
+	node.user_data = user_data;
+	node.height = 0;
+
+	InsertLeaf(leaf);
+	++_leaf_count;
+	return leaf;
+}
+void AabbTree::Remove(int leaf)
+{
+	assert(leaf >= 0 && leaf < (int)_nodes.size() && _nodes[leaf].IsLeaf() && _nodes[leaf].height == 0);
+
+	RemoveLeaf(leaf);
+	FreeNode(leaf);
+	--_leaf_count;
+}
+bool AabbTree::Move(int leaf, const Vec3& center, float radius)
+{
+	assert(leaf >= 0 && leaf < (int)_nodes.size() && _nodes[leaf].IsLeaf() && _nodes[leaf].height == 0);
+
+	Node& node = _nodes[leaf];
+	node.center = center;
+	node.radius = radius;
+	if(Contains(node.min, node.max, center, radius))
+		return false;
+
+	RemoveLeaf(leaf);
+
+	float extent = radius + _margin;
+	node.min = vector::Subtract(center, Vec3(extent, extent, extent));
+	node.max = vector::Add(center, Vec3(extent, extent, extent));
+
+	InsertLeaf(leaf);
+	return true;
+}
+void AabbTree::Clear()
+{
+	_nodes.clear();
+	_root = -1;
+	_free_node = -1;
+	_leaf_count = 0;
+}
+bool AabbTree::RayCast(const Vec3& origin, const Vec3& direction, RayHit& hit) const
+{
+	if(_root == -1)
+		return false;
+
+	Vec3 inv_direction(Reciprocal(direction.x), Reciprocal(direction.y), Reciprocal(direction.z));
+
+	// Nodes left to visit, with the distance to where the ray enters them.
+	int stack[MAX_QUERY_DEPTH];
+	float stack_distance[MAX_QUERY_DEPTH];
+	int stack_size = 0;
+
+	float closest = FLT_MAX;
+	bool found = false;
+
+	float root_distance = RayBoxDistance(origin, inv_direction, _nodes[_root].min, _nodes[_root].max);
+	if(root_distance != FLT_MAX)
+	{
+		stack[0] = _root;
+		stack_distance[0] = root_distance;
+		stack_size = 1;
+	}
+
+	while(stack_size > 0)
+	{
+		--stack_size;
+		if(stack_distance[stack_size] >= closest)
+			continue; // A closer hit was found since the node was pushed.
+
+		const Node& node = _nodes[stack[stack_size]];
+		if(node.IsLeaf())
+		{
+			float distance;
+			if(RaySphereIntersect(origin, direction, node.center, node.radius, distance) && distance < closest)
+			{
+				closest = distance;
+				hit.user_data = node.user_data;
+				hit.distance = distance;
+				found = true;
+			}
+			continue;
+		}
+
+		float d0 = RayBoxDistance(origin, inv_direction, _nodes[node.child[0]].min, _nodes[node.child[0]].max);
+		float d1 = RayBoxDistance(origin, inv_direction, _nodes[node.child[1]].min, _nodes[node.child[1]].max);
+
+		// Push the further child first, the closer one is visited next and may let the other be skipped.
+		int near_child = node.child[0];
+		int far_child = node.child[1];
+		if(d1 < d0)
+		{
+			std::swap(near_child, far_child);
+			std::swap(d0, d1);
+		}
+
+		assert(stack_size + 2 <= MAX_QUERY_DEPTH);
+		if(d1 < closest)
+		{
+			stack[stack_size] = far_child;
+			stack_distance[stack_size] = d1;
+			++stack_size;
+		}
+		if(d0 < closest)
+		{
+			stack[stack_size] = near_child;
+			stack_distance[stack_size] = d0;
+			++stack_size;
+		}
+	}
+	return found;
+}
+uint32_t AabbTree::LeafCount() const
+{
+	return _leaf_count;
+}
+int AabbTree::Height() const
+{
+	return (_root != -1) ? _nodes[_root].height : 0;
+}
+int AabbTree::AllocateNode()
+{
+	int index;
+	if(_free_node != -1)
+	{
+		index = _free_node;
+		_free_node = _nodes[index].parent;
+	}
+	else
+	{
+		index = (int)_nodes.size();
+		_nodes.push_back(Node());
+	}
+
+	Node& node = _nodes[index];
+	node.parent = -1;
+	node.child[0] = -1;
+	node.child[1] = -1;
+	node.height = 0;
+	node.radius = 0.0f;
+	node.user_data = 0;
+	return index;
+}
+void AabbTree::FreeNode(int node)
+{
+	_nodes[node].parent = _free_node;
+	_nodes[node].height = -1;
+	_free_node = node;
+}
+void AabbTree::InsertLeaf(int leaf)
+{
+	if(_root == -1)
+	{
+		_root = leaf;
+		_nodes[leaf].parent = -1;
+		return;
+	}
+
+	Vec3 leaf_min = _nodes[leaf].min;
+	Vec3 leaf_max = _nodes[leaf].max;
+
+	// Descend towards the sibling that adds the least surface area to the tree. Every node on the way down
+	//	grows to include the leaf, which is the inherited cost for both children.
+	int index = _root;
+	while(!_nodes[index].IsLeaf())
+	{
+		const Node& node = _nodes[index];
+
+		float area = Area(node.min, node.max);
+		float combined_area = UnionArea(node.min, node.max, leaf_min, leaf_max);
+
+		// Cost of making a new parent for this node and the leaf
+		float cost = 2.0f * combined_area;
+		// Minimum cost of pushing the leaf further down
+		float inheritance_cost = 2.0f * (combined_area - area);
+
+		float child_cost[2];
+		for(int c = 0; c < 2; ++c)
+		{
+			const Node& child = _nodes[node.child[c]];
+			child_cost[c] = UnionArea(child.min, child.max, leaf_min, leaf_max) + inheritance_cost;
+			if(!child.IsLeaf())
+				child_cost[c] -= Area(child.min, child.max);
+		}
+
+		if(cost < child_cost[0] && cost < child_cost[1])
+			break;
+
+		index = (child_cost[0] < child_cost[1]) ? node.child[0] : node.child[1];
+	}
+
+	int sibling = index;
+
+	// New parent for the sibling and the leaf, nodes may move in memory when allocating.
+	int old_parent = _nodes[sibling].parent;
+	int new_parent = AllocateNode();
+	_nodes[new_parent].parent = old_parent;
+	_nodes[new_parent].min = Min(leaf_min, _nodes[sibling].min);
+	_nodes[new_parent].max = Max(leaf_max, _nodes[sibling].max);
+	_nodes[new_parent].height = _nodes[sibling].height + 1;
+	_nodes[new_parent].child[0] = sibling;
+	_nodes[new_parent].child[1] = leaf;
+
+	if(old_parent != -1)
+	{
+		Node& parent = _nodes[old_parent];
+		parent.child[(parent.child[0] == sibling) ? 0 : 1] = new_parent;
+	}
+	else
+	{
+		_root = new_parent;
+	}
+	_nodes[sibling].parent = new_parent;
+	_nodes[leaf].parent = new_parent;
+
+	RefitAncestors(_nodes[leaf].parent);
+}
+void AabbTree::RemoveLeaf(int leaf)
+{
+	if(leaf == _root)
+	{
+		_root = -1;
+		return;
+	}
+
+	int parent = _nodes[leaf].parent;
+	int grand_parent = _nodes[parent].parent;
+	int sibling = (_nodes[parent].child[0] == leaf) ? _nodes[parent].child[1] : _nodes[parent].child[0];
+
+	// The sibling takes the place of the parent
+	if(grand_parent != -1)
+	{
+		Node& node = _nodes[grand_parent];
+		node.child[(node.child[0] == parent) ? 0 : 1] = sibling;
+		_nodes[sibling].parent = grand_parent;
+		FreeNode(parent);
+
+		RefitAncestors(grand_parent);
+	}
+	else
+	{
+		_root = sibling;
+		_nodes[sibling].parent = -1;
+		FreeNode(parent);
+	}
+	_nodes[leaf].parent = -1;
+}
+void AabbTree::RefitAncestors(int node)
+{
+	int index = node;
+	while(index != -1)
+	{
+		index = Balance(index);
+
+		Node& n = _nodes[index];
+		const Node& child0 = _nodes[n.child[0]];
+		const Node& child1 = _nodes[n.child[1]];
+
+		n.height = 1 + std::max(child0.height, child1.height);
+		n.min = Min(child0.min, child1.min);
+		n.max = Max(child0.max, child1.max);
+
+		index = n.parent;
+	}
+}
+int AabbTree::Balance(int a)
+{
+	Node& node_a = _nodes[a];
+	if(node_a.IsLeaf() || node_a.height < 2)
+		return a;
+
+	int b = node_a.child[0];
+	int c = node_a.child[1];
+	Node& node_b = _nodes[b];
+	Node& node_c = _nodes[c];
+
+	int balance = node_c.height - node_b.height;
+
+	// Rotate the taller child up, the grandchild that is the tallest stays with it.
+	if(balance > 1 || balance < -1)
+	{
+		int up = (balance > 1) ? c : b; // Child rotated up to replace a
+		int other = (balance > 1) ? b : c; // Child staying with a
+		int up_side = (balance > 1) ? 1 : 0; // Side of a that up was on
+		Node& node_up = _nodes[up];
+		Node& node_other = _nodes[other];
+
+		int f = node_up.child[0];
+		int g = node_up.child[1];
+		Node& node_f = _nodes[f];
+		Node& node_g = _nodes[g];
+
+		// a becomes the first child of up, taking the place of up in a's parent.
+		node_up.child[0] = a;
+		node_up.parent = node_a.parent;
+		node_a.parent = up;
+
+		if(node_up.parent != -1)
+		{
+			Node& parent = _nodes[node_up.parent];
+			parent.child[(parent.child[0] == a) ? 0 : 1] = up;
+		}
+		else
+		{
+			_root = up;
+		}
+
+		// The taller grandchild stays with up, the shorter one moves to a.
+		int keep = (node_f.height > node_g.height) ? f : g;
+		int move = (node_f.height > node_g.height) ? g : f;
+		Node& node_keep = _nodes[keep];
+		Node& node_move = _nodes[move];
+
+		node_up.child[1] = keep;
+		node_a.child[up_side] = move;
+		node_move.parent = a;
+
+		node_a.min = Min(node_other.min, node_move.min);
+		node_a.max = Max(node_other.max, node_move.max);
+		node_a.height = 1 + std::max(node_other.height, node_move.height);
+
+		node_up.min = Min(node_a.min, node_keep.min);
+		node_up.max = Max(node_a.max, node_keep.max);
+		node_up.height = 1 + std::max(node_a.height, node_keep.height);
+
+		return up;
+	}
+	return a;
+}
@@ -0,0 +1,95 @@
+#ifndef __AABBTREE_H__
+#define __AABBTREE_H__
+
+/// @brief Dynamic bounding volume hierarchy over bounding spheres, with axis-aligned boxes for the inner nodes.
+///	Leaves are inserted next to the sibling that grows the surface area of the tree the least and the tree
+///	is kept balanced with rotations, so queries stay logarithmic as objects come and go.
+///
+///	The box of every leaf is enlarged by a margin. Objects moving within their enlarged box only update the
+///	sphere stored in the leaf, the tree itself is only changed once an object leaves its box.
+class AabbTree
+{
+public:
+	/// Closest sphere hit by a ray.
+	struct RayHit
+	{
+		uint32_t user_data;
+		float distance; // Distance along the ray to where it enters the sphere.
+	};
+
+	/// Deepest tree the ray queries can traverse, far beyond what a balanced tree reaches.
+	enum { MAX_QUERY_DEPTH = 128 };
+
+	/// @param margin Distance the box of every leaf is enlarged by in every direction.
+	AabbTree(float margin);
+	~AabbTree();
+
+	/// @brief Inserts a bounding sphere into the tree.
+	/// @param user_data Returned by queries hitting the sphere.
+	/// @return Id of the leaf, valid until the leaf is removed or the tree is cleared.
+	int Insert(const Vec3& center, float radius, uint32_t user_data);
+
+	/// @brief Removes a leaf from the tree.
+	void Remove(int leaf);
+
+	/// @brief Updates the bounding sphere of a leaf, reinserting the leaf if it's no longer within its box.
+	/// @return True if the leaf was reinserted.
+	bool Move(int leaf, const Vec3& center, float radius);
+
+	/// @brief Removes all leaves at once.
+	void Clear();
+
+	/// @brief Finds the closest sphere hit by a ray. Subtrees further away than the closest hit so far are
+	///		skipped, and the closer child of every node is visited first.
+	/// @param direction Normalized direction of the ray.
+	/// @return True if any sphere was hit.
+	bool RayCast(const Vec3& origin, const Vec3& direction, RayHit& hit) const;
+
+	/// @brief Returns the number of leaves.
+	uint32_t LeafCount() const;
+
+	/// @brief Returns the height of the tree, 0 if the tree only have a single leaf.
+	int Height() const;
+
+private:
+	struct Node
+	{
+		Vec3 min; // Bounding box, enlarged by the margin for leaves.
+		Vec3 max;
+
+		int parent; // -1 for the root. Next node in the free list for free nodes.
+		int child[2]; // -1 for leaves.
+		int height; // 0 for leaves, -1 for free nodes.
+
+		// Leaves only
+		Vec3 center;
+		float radius;
+		uint32_t user_data;
+
+		bool IsLeaf() const { return child[0] == -1; }
+	};
+
+	int AllocateNode();
+	void FreeNode(int node);
+
+	/// @brief Inserts a leaf next to the sibling with the lowest cost and refits its ancestors.
+	void InsertLeaf(int leaf);
+	/// @brief Detaches a leaf from the tree without freeing it, replacing its parent by its sibling.
+	void RemoveLeaf(int leaf);
+
+	/// @brief Balances the subtree rooted at the specified node, rotating the taller child up if the heights
+	///		of the children differ by more than one.
+	/// @return The node now at the root of the subtree.
+	int Balance(int node);
+
+	/// @brief Balances and refits the bounds and heights of a node and all its ancestors.
+	void RefitAncestors(int node);
+
+	std::vector<Node> _nodes;
+	int _root; // -1 if the tree is empty.
+	int _free_node; // First node in the free list, -1 if the list is empty.
+	uint32_t _leaf_count;
+	float _margin;
+};
+
+#endif // __AABBTREE_H__
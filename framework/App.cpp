@@ -2,14 +2,18 @@
 
 #include "App.h"
 #include "RenderDevice.h"
+#include "ResourceUploader.h"
+#include "FrameAllocator.h"
 
 #include <SDL.h>
 
 
 App::App()
 	: _window(NULL),
+	_gl_context(NULL),
 	_running(false),
-	_render_device(NULL)
+	_render_device(NULL),
+	_resource_uploader(NULL)
 {
 }
 App::~App()
@@ -26,6 +30,9 @@ void App::Run()
 	SDL_Event evt;
 	while(_running)
 	{
+		// Anything allocated from the frame allocator during the previous frame is now released.
+		frame_allocator::ThreadAllocator().Reset();
+
 		uint32_t current_tick = SDL_GetTicks();
 		float dtime = (float)(current_tick - _last_tick)*0.001f;
 		_last_tick = current_tick;
@@ -43,10 +50,16 @@ void App::Run()
 			}
 		}
 
+		// Publish any buffers the upload thread have finished.
+		_resource_uploader->Update();
+
 		_render_device->Clear(GL_COLOR_BUFFER_BIT|GL_DEPTH_BUFFER_BIT);
 
 		Render(dtime);
 
+		// Let the device fence the frame and clean up any released resources.
+		_render_device->EndFrame();
+
 		// Swap buffers for our main window.
 		SDL_GL_SwapWindow(_window);
 	}
@@ -81,6 +94,11 @@ bool App::InitializeSDL(uint32_t window_width, uint32_t window_height)
 	SDL_GL_SetAttribute(SDL_GL_CONTEXT_MINOR_VERSION, 2);
 #endif
 
+#ifdef _DEBUG
+	// Debug contexts report errors and performance warnings through KHR_debug.
+	SDL_GL_SetAttribute(SDL_GL_CONTEXT_FLAGS, SDL_GL_CONTEXT_DEBUG_FLAG);
+#endif
+
 	// Create the primary window for our application.
 	_window = SDL_CreateWindow("Framework", SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED, window_width, window_height, SDL_WINDOW_SHOWN | SDL_WINDOW_OPENGL | SDL_WINDOW_RESIZABLE);
 	if(!_window)
@@ -90,21 +108,43 @@ bool App::InitializeSDL(uint32_t window_width, uint32_t window_height)
 	}
 
 	// Create the opengl context for our main window.
-	SDL_GL_CreateContext(_window);
+	_gl_context = SDL_GL_CreateContext(_window);
+	if(!_gl_context)
+	{
+		debug::Printf("[Error] SDL_GL_CreateContext failed: %s\n", SDL_GetError());
+		return false;
+	}
 
 	// Initialize our opengl device
 	_render_device = new RenderDevice();
 	if(!_render_device->Initialize())
 		return false;
 
+	// The uploader falls back to synchronous uploads if it fails, so that isn't fatal.
+	_resource_uploader = new ResourceUploader(_render_device);
+	_resource_uploader->Initialize(_window, _gl_context);
+
 	return true;
 }
 void App::ShutdownSDL()
 {
+	// Buffers not yet published are released by the uploader, so it's shut down before the device.
+	if(_resource_uploader)
+	{
+		_resource_uploader->Shutdown();
+		delete _resource_uploader;
+		_resource_uploader = NULL;
+	}
+
 	_render_device->Shutdown();
 	delete _render_device;
 	_render_device = NULL;
 
+	if(_gl_context)
+	{
+		SDL_GL_DeleteContext(_gl_context);
+		_gl_context = NULL;
+	}
 	if(_window)
 	{
 		SDL_DestroyWindow(_window);
@@ -112,4 +152,6 @@ void App::ShutdownSDL()
 	}
 
 	SDL_Quit();
+
+	frame_allocator::ReleaseThreadAllocator();
 }
@@ -7,6 +7,7 @@
 struct SDL_Window;
 
 class RenderDevice;
+class ResourceUploader;
 class App
 {
 public:
@@ -42,11 +43,13 @@ protected:
 	void ShutdownSDL();
 
 	SDL_Window* _window;
+	SDL_GLContext _gl_context; // The opengl context for the main window.
 	bool _running; // Specifies whether the framework is currently running, setting this to false will exit the application.
 
 	uint32_t _last_tick; // Keeps of last tick count for calculating frame time.
 
 	RenderDevice* _render_device; // The render device responsible for low-level rendering calls.
+	ResourceUploader* _resource_uploader; // Uploads buffers on a background thread.
 };
 
 
@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <vector>
 #include <map>
+#include <string>
 #include <math.h>
 
 // Constants
@@ -0,0 +1,180 @@
+#include "Common.h"
+
+#include "FrameAllocator.h"
+
+#include <SDL.h>
+
+#include <stdlib.h>
+#include <algorithm>
+
+#ifdef _MSC_VER
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+namespace
+{
+	THREAD_LOCAL FrameAllocator* thread_allocator = NULL;
+
+	/// The allocator is also stored in SDL thread local storage, which destroys it when an SDL thread exits.
+	SDL_SpinLock thread_storage_lock = 0;
+	SDL_TLSID thread_storage = 0;
+
+	void SDLCALL DestroyThreadAllocator(void* allocator)
+	{
+		delete (FrameAllocator*)allocator;
+		thread_allocator = NULL;
+	}
+};
+
+
+FrameAllocator::FrameAllocator(size_t capacity)
+	: _current_block(0),
+	_used(0),
+	_high_water_mark(0)
+{
+	AddBlock(capacity);
+}
+FrameAllocator::~FrameAllocator()
+{
+	for(std::vector<Block>::iterator it = _blocks.begin(); 
+		it != _blocks.end(); ++it)
+	{
+		free(it->memory);
+	}
+	_blocks.clear();
+}
+
+void* FrameAllocator::Allocate(size_t size, size_t alignment)
+{
+	assert(alignment > 0 && (alignment & (alignment - 1)) == 0); // Alignment needs to be a power of two.
+
+	for(;;)
+	{
+		Block& block = _blocks[_current_block];
+
+		// Align the actual address rather than the offset, the block itself may have a smaller alignment.
+		uintptr_t start = (uintptr_t)(block.memory + block.offset);
+		uintptr_t aligned = (start + (alignment - 1)) & ~((uintptr_t)alignment - 1);
+		size_t new_offset = (size_t)(aligned - (uintptr_t)block.memory) + size;
+
+		if(new_offset <= block.size)
+		{
+			_used += new_offset - block.offset;
+			if(_used > _high_water_mark)
+				_high_water_mark = _used;
+
+			block.offset = new_offset;
+			return (void*)aligned;
+		}
+
+		// Current block is full, move on to the next block or create a new one if this is the last one.
+		if(_current_block + 1 < _blocks.size())
+		{
+			_current_block++;
+		}
+		else
+		{
+			AddBlock(std::max(block.size, size + alignment));
+		}
+	}
+}
+FrameAllocator::Marker FrameAllocator::GetMarker() const
+{
+	Marker marker;
+	marker.block = _current_block;
+	marker.offset = _blocks[_current_block].offset;
+	return marker;
+}
+void FrameAllocator::Rewind(const Marker& marker)
+{
+	assert(marker.block <= _current_block);
+	assert(marker.block < _current_block || marker.offset <= _blocks[_current_block].offset);
+
+	// Everything after the marker is freed, including any blocks moved to after the marker was taken.
+	for(uint32_t i = marker.block + 1; i <= _current_block; ++i)
+	{
+		_used -= _blocks[i].offset;
+		_blocks[i].offset = 0;
+	}
+	_used -= _blocks[marker.block].offset - marker.offset;
+	_blocks[marker.block].offset = marker.offset;
+	_current_block = marker.block;
+}
+void FrameAllocator::Reset()
+{
+	if(_blocks.size() > 1)
+	{
+		// We ran out of space at some point, replace all blocks with a single one large enough for the peak usage.
+		size_t capacity = 0;
+		for(std::vector<Block>::iterator it = _blocks.begin(); 
+			it != _blocks.end(); ++it)
+		{
+			capacity += it->size;
+			free(it->memory);
+		}
+		_blocks.clear();
+
+		AddBlock(std::max(capacity, _high_water_mark));
+	}
+
+	_blocks[0].offset = 0;
+	_current_block = 0;
+	_used = 0;
+}
+size_t FrameAllocator::Used() const
+{
+	return _used;
+}
+size_t FrameAllocator::HighWaterMark() const
+{
+	return _high_water_mark;
+}
+void FrameAllocator::AddBlock(size_t size)
+{
+	Block block;
+	block.memory = (uint8_t*)malloc(size);
+	block.size = size;
+	block.offset = 0;
+	assert(block.memory);
+
+	_blocks.push_back(block);
+	_current_block = (uint32_t)_blocks.size() - 1;
+}
+
+
+FrameAllocatorScope::FrameAllocatorScope(FrameAllocator& allocator)
+	: _allocator(allocator),
+	_marker(allocator.GetMarker())
+{
+}
+FrameAllocatorScope::~FrameAllocatorScope()
+{
+	_allocator.Rewind(_marker);
+}
+
+
+FrameAllocator& frame_allocator::ThreadAllocator()
+{
+	if(!thread_allocator)
+	{
+		thread_allocator = new FrameAllocator(THREAD_ALLOCATOR_CAPACITY);
+
+		SDL_AtomicLock(&thread_storage_lock);
+		if(!thread_storage)
+			thread_storage = SDL_TLSCreate();
+		SDL_AtomicUnlock(&thread_storage_lock);
+
+		SDL_TLSSet(thread_storage, thread_allocator, DestroyThreadAllocator);
+	}
+	return *thread_allocator;
+}
+void frame_allocator::ReleaseThreadAllocator()
+{
+	if(thread_allocator)
+		SDL_TLSSet(thread_storage, NULL, NULL);
+
+	delete thread_allocator;
+	thread_allocator = NULL;
+}
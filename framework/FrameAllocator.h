@@ -0,0 +1,97 @@
+#ifndef __FRAMEALLOCATOR_H__
+#define __FRAMEALLOCATOR_H__
+
+/// @brief Bump-pointer allocator for transient data that only lives for the duration of a frame.
+///	Allocations are never freed individually, instead the whole allocator is reset at the start of 
+///	every frame or rewound to a previously taken marker. If a frame needs more memory than the allocator 
+///	holds, additional blocks are taken from the heap and merged into a single larger block at the next 
+///	reset, meaning frames in a steady state never touch the heap.
+class FrameAllocator
+{
+public:
+	enum { DEFAULT_ALIGNMENT = 16 };
+
+	/// @brief A position in the allocator that it later can be rewound to.
+	struct Marker
+	{
+		uint32_t block;
+		size_t offset;
+	};
+
+	/// @param capacity Initial capacity in bytes.
+	FrameAllocator(size_t capacity);
+	~FrameAllocator();
+
+	/// @brief Allocates a block of memory that stays valid until the allocator is reset or rewound.
+	/// @param size Size in bytes.
+	/// @param alignment Alignment of the allocation, needs to be a power of two.
+	void* Allocate(size_t size, size_t alignment = DEFAULT_ALIGNMENT);
+
+	/// @brief Allocates an array of the specified type, no constructors are called.
+	template<typename T>
+	T* AllocateArray(size_t count)
+	{
+		return (T*)Allocate(sizeof(T) * count);
+	}
+
+	/// @brief Returns the current position of the allocator.
+	Marker GetMarker() const;
+
+	/// @brief Rewinds the allocator, releasing everything allocated since the marker was taken.
+	void Rewind(const Marker& marker);
+
+	/// @brief Releases all allocations. Blocks allocated due to running out of space are merged into one.
+	void Reset();
+
+	/// @brief Returns the number of bytes currently allocated, including alignment padding.
+	size_t Used() const;
+
+	/// @brief Returns the largest number of bytes that have been allocated at any one time.
+	size_t HighWaterMark() const;
+
+private:
+	struct Block
+	{
+		uint8_t* memory;
+		size_t size;
+		size_t offset; // Offset to the first free byte in the block.
+	};
+
+	/// @brief Allocates a new block from the heap and makes it the current block.
+	void AddBlock(size_t size);
+
+	std::vector<Block> _blocks;
+	uint32_t _current_block; // Index of the block currently allocated from.
+
+	size_t _used;
+	size_t _high_water_mark;
+};
+
+/// @brief Takes a marker on construction and rewinds the allocator to it on destruction, 
+///	releasing any allocations made within the scope.
+class FrameAllocatorScope
+{
+public:
+	FrameAllocatorScope(FrameAllocator& allocator);
+	~FrameAllocatorScope();
+
+private:
+	FrameAllocator& _allocator;
+	FrameAllocator::Marker _marker;
+};
+
+namespace frame_allocator
+{
+	enum { THREAD_ALLOCATOR_CAPACITY = 1024*1024 };
+
+	/// @brief Returns the frame allocator for the calling thread, each thread have its own allocator 
+	///		which is created on first use. The allocator of a thread created through SDL_CreateThread is 
+	///		destroyed when the thread exits.
+	FrameAllocator& ThreadAllocator();
+
+	/// @brief Destroys the frame allocator for the calling thread, if it have one. Only needed for threads
+	///		not created by SDL, e.g. the main thread.
+	void ReleaseThreadAllocator();
+};
+
+#endif // __FRAMEALLOCATOR_H__
@@ -0,0 +1,250 @@
+#include "Common.h"
+
+#include "FrameCapture.h"
+
+#include <string.h>
+
+namespace
+{
+	const uint32_t capture_magic = 0x4346474f; // "OGFC"
+	const uint32_t capture_version = 4;
+
+	/// Strings and data blocks are padded to keep every value 4-byte aligned.
+	uint32_t PaddedSize(uint32_t size)
+	{
+		return (size + 3) & ~3u;
+	}
+};
+
+
+CaptureWriter::CaptureWriter() : _file(NULL), _command_count(0)
+{
+}
+CaptureWriter::~CaptureWriter()
+{
+	Close();
+}
+
+bool CaptureWriter::Open(const char* path, uint32_t width, uint32_t height)
+{
+	assert(!_file);
+
+	_file = fopen(path, "wb");
+	if(!_file)
+	{
+		debug::Printf("CaptureWriter: Failed to open '%s' for writing.\n", path);
+		return false;
+	}
+	_command_count = 0;
+
+	WriteUInt(capture_magic);
+	WriteUInt(capture_version);
+	WriteUInt(width);
+	WriteUInt(height);
+
+	return true;
+}
+void CaptureWriter::Close()
+{
+	if(_file)
+	{
+		fclose(_file);
+		_file = NULL;
+	}
+}
+void CaptureWriter::BeginCommand(capture_command::Command command)
+{
+	WriteUInt((uint32_t)command);
+	++_command_count;
+}
+void CaptureWriter::WriteInt(int32_t value)
+{
+	fwrite(&value, sizeof(value), 1, _file);
+}
+void CaptureWriter::WriteUInt(uint32_t value)
+{
+	fwrite(&value, sizeof(value), 1, _file);
+}
+void CaptureWriter::WriteFloats(const float* values, uint32_t count)
+{
+	fwrite(values, sizeof(float), count, _file);
+}
+void CaptureWriter::WriteString(const char* str)
+{
+	if(!str)
+		str = "";
+
+	// The terminator is included so the reader can return the string in place.
+	WriteData(str, (uint32_t)strlen(str) + 1);
+}
+void CaptureWriter::WriteData(const void* data, uint32_t size)
+{
+	if(!data)
+		size = 0;
+
+	WriteUInt(size);
+	if(size)
+	{
+		fwrite(data, 1, size, _file);
+
+		const uint8_t padding[4] = { 0, 0, 0, 0 };
+		fwrite(padding, 1, PaddedSize(size) - size, _file);
+	}
+}
+uint32_t CaptureWriter::CommandCount() const
+{
+	return _command_count;
+}
+
+
+CaptureReader::CaptureReader() : _position(0), _failed(false), _width(0), _height(0)
+{
+}
+CaptureReader::~CaptureReader()
+{
+}
+
+bool CaptureReader::Open(const char* path)
+{
+	FILE* file = fopen(path, "rb");
+	if(!file)
+	{
+		debug::Printf("CaptureReader: Failed to open '%s'.\n", path);
+		return false;
+	}
+
+	fseek(file, 0, SEEK_END);
+	long size = ftell(file);
+	fseek(file, 0, SEEK_SET);
+
+	_data.resize(size > 0 ? size : 0);
+	size_t read = _data.size() ? fread(&_data[0], 1, _data.size(), file) : 0;
+	fclose(file);
+
+	_position = 0;
+	_failed = (read != _data.size());
+
+	uint32_t magic = ReadUInt();
+	uint32_t version = ReadUInt();
+	_width = ReadUInt();
+	_height = ReadUInt();
+
+	if(_failed || magic != capture_magic)
+	{
+		debug::Printf("CaptureReader: '%s' is not a frame capture.\n", path);
+		return false;
+	}
+	if(version != capture_version)
+	{
+		debug::Printf("CaptureReader: '%s' have unsupported version %u, expected %u.\n", path, version, capture_version);
+		return false;
+	}
+	return true;
+}
+bool CaptureReader::ReadCommand(capture_command::Command& command)
+{
+	if(_failed || _position >= _data.size())
+		return false;
+
+	uint32_t value = ReadUInt();
+	if(value >= capture_command::CC_COUNT)
+	{
+		debug::Printf("CaptureReader: Invalid command %u at offset %u.\n", value, _position - 4);
+		_failed = true;
+		return false;
+	}
+	command = (capture_command::Command)value;
+	return !_failed;
+}
+int32_t CaptureReader::ReadInt()
+{
+	int32_t value = 0;
+	const uint8_t* data = Read(sizeof(value));
+	if(data)
+		memcpy(&value, data, sizeof(value));
+	return value;
+}
+uint32_t CaptureReader::ReadUInt()
+{
+	uint32_t value = 0;
+	const uint8_t* data = Read(sizeof(value));
+	if(data)
+		memcpy(&value, data, sizeof(value));
+	return value;
+}
+const float* CaptureReader::ReadFloats(uint32_t count)
+{
+	// Every value in the capture is 4-byte aligned so the floats can be used in place.
+	static const float zero[16] = { 0 };
+	const uint8_t* data = ReadArray(count, sizeof(float));
+	return data ? (const float*)data : zero;
+}
+const int32_t* CaptureReader::ReadInts(uint32_t count)
+{
+	return (const int32_t*)ReadArray(count, sizeof(int32_t));
+}
+const char* CaptureReader::ReadString()
+{
+	uint32_t size = 0;
+	const char* str = (const char*)ReadData(size);
+	if(!str || str[size - 1] != '\0')
+		return "";
+	return str;
+}
+const void* CaptureReader::ReadData(uint32_t& size)
+{
+	size = ReadUInt();
+	if(size == 0)
+		return NULL;
+
+	const uint8_t* data = Read(PaddedSize(size));
+	if(!data)
+		size = 0;
+	return data;
+}
+bool CaptureReader::Failed() const
+{
+	return _failed;
+}
+uint32_t CaptureReader::Position() const
+{
+	return _position;
+}
+void CaptureReader::Seek(uint32_t position)
+{
+	assert(position <= _data.size());
+	_position = position;
+}
+uint32_t CaptureReader::Width() const
+{
+	return _width;
+}
+uint32_t CaptureReader::Height() const
+{
+	return _height;
+}
+const uint8_t* CaptureReader::Read(uint32_t size)
+{
+	if(_failed || size > _data.size() - _position)
+	{
+		_failed = true;
+		return NULL;
+	}
+
+	const uint8_t* data = &_data[_position];
+	_position += size;
+	return data;
+}
+const uint8_t* CaptureReader::ReadArray(uint32_t count, uint32_t element_size)
+{
+	// Counts are read from the capture, a corrupt count must not wrap the size around.
+	if(_failed || count > (_data.size() - _position) / element_size)
+	{
+		_failed = true;
+		return NULL;
+	}
+
+	const uint8_t* data = &_data[0] + _position;
+	_position += count * element_size;
+	return data;
+}
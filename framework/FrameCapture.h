@@ -0,0 +1,149 @@
+#ifndef __FRAMECAPTURE_H__
+#define __FRAMECAPTURE_H__
+
+#include <stdio.h>
+
+/// Commands stored in a frame capture. A capture starts with a snapshot of all resources alive when the
+///	capture started, followed by every call made to the render device during one frame, enclosed by
+///	CC_BEGIN_FRAME and CC_END_FRAME. Handles are the ones used by the capturing device.
+namespace capture_command
+{
+	enum Command
+	{
+		CC_CREATE_VERTEX_ARRAY_OBJECT,	// handle
+		CC_RELEASE_VERTEX_ARRAY_OBJECT,	// handle
+		CC_CREATE_VERTEX_BUFFER,		// handle, vertex array object, format, data
+		CC_CREATE_INDEX_BUFFER,			// handle, vertex array object, size, data
+		CC_ATTACH_VERTEX_BUFFER,		// handle, vertex array object, format
+		CC_ATTACH_INDEX_BUFFER,			// handle, vertex array object
+		CC_UPDATE_HARDWARE_BUFFER,		// handle, offset, data
+		CC_COPY_HARDWARE_BUFFER,		// source, destination, size
+		CC_RELEASE_HARDWARE_BUFFER,		// handle
+		CC_CREATE_SHADER,				// handle, vertex shader source, fragment shader source
+		CC_CREATE_SHADER_STAGE,			// handle, stage, source
+		CC_CREATE_SHADER_PIPELINE,		// handle, vertex stage, fragment stage
+		CC_RELEASE_SHADER,				// handle
+		CC_RELEASE_SHADER_STAGE,		// handle
+		CC_CREATE_QUERY,				// handle
+		CC_RELEASE_QUERY,				// handle
+		CC_SET_RENDER_STATE,			// viewport (x, y, width, height), cull face, depth test
+		CC_BIND_SHADER,					// handle
+		CC_SET_UNIFORM,					// name, float count (1, 3, 4, 9 or 16), values
+		CC_DRAW,						// draw mode, vertex offset, vertex count, index count, index offset, index type, base vertex, vertex array object
+		CC_MULTI_DRAW,					// draw mode, index type, base vertex, vertex array object, draw count, index offsets, index counts
+		CC_CLEAR,						// mask
+		CC_SET_CLEAR_COLOR,				// r, g, b, a
+		CC_SET_COLOR_WRITE,				// enable
+		CC_SET_DEPTH_WRITE,				// enable
+		CC_BEGIN_OCCLUSION_QUERY,		// handle
+		CC_END_OCCLUSION_QUERY,
+		CC_BEGIN_CONDITIONAL_RENDER,	// handle
+		CC_END_CONDITIONAL_RENDER,
+		CC_BEGIN_FRAME,
+		CC_END_FRAME,
+
+		CC_COUNT
+	};
+};
+
+/// @brief Writes a frame capture to a binary file.
+///	All values are stored in the native byte order as 32-bit integers or floats, strings and data
+///	blocks are prefixed by their size.
+class CaptureWriter
+{
+public:
+	CaptureWriter();
+	~CaptureWriter();
+
+	/// @brief Opens the file and writes the header.
+	/// @param width Width of the captured viewport, the replayer creates its window with this size.
+	/// @param height Height of the captured viewport.
+	/// @return False if the file couldn't be opened.
+	bool Open(const char* path, uint32_t width, uint32_t height);
+
+	/// @brief Closes the file.
+	void Close();
+
+	/// @brief Starts a new command, its arguments are written after this.
+	void BeginCommand(capture_command::Command command);
+
+	void WriteInt(int32_t value);
+	void WriteUInt(uint32_t value);
+	void WriteFloats(const float* values, uint32_t count);
+
+	/// @brief Writes a string, NULL is written as an empty string.
+	void WriteString(const char* str);
+
+	/// @brief Writes a block of data, NULL is written as an empty block.
+	void WriteData(const void* data, uint32_t size);
+
+	/// @brief Returns the number of commands written.
+	uint32_t CommandCount() const;
+
+private:
+	FILE* _file;
+	uint32_t _command_count;
+};
+
+/// @brief Reads a frame capture written by CaptureWriter.
+///	The whole file is loaded into memory, which means strings and data blocks can be returned directly
+///	without copying and parts of the capture can be read again by seeking.
+class CaptureReader
+{
+public:
+	CaptureReader();
+	~CaptureReader();
+
+	/// @brief Loads the file and validates the header.
+	/// @return False if the file couldn't be read or isn't a capture.
+	bool Open(const char* path);
+
+	/// @brief Reads the next command.
+	/// @return False at the end of the capture or if the capture is corrupt.
+	bool ReadCommand(capture_command::Command& command);
+
+	int32_t ReadInt();
+	uint32_t ReadUInt();
+
+	/// @brief Returns a pointer to the specified number of floats in the capture.
+	const float* ReadFloats(uint32_t count);
+
+	/// @brief Returns a pointer to the specified number of integers in the capture.
+	/// @return NULL if the capture ends before the last integer.
+	const int32_t* ReadInts(uint32_t count);
+
+	/// @brief Returns a pointer to a string in the capture, the string is null-terminated.
+	const char* ReadString();
+
+	/// @brief Returns a pointer to a data block in the capture, NULL if the block is empty.
+	/// @param size Receives the size of the block in bytes.
+	const void* ReadData(uint32_t& size);
+
+	/// @brief Returns true if a read have passed the end of the capture.
+	bool Failed() const;
+
+	/// @brief Returns the current read position.
+	uint32_t Position() const;
+
+	/// @brief Moves the read position to a position returned by Position().
+	void Seek(uint32_t position);
+
+	uint32_t Width() const;
+	uint32_t Height() const;
+
+private:
+	/// @brief Returns a pointer to the next size bytes and advances the read position.
+	const uint8_t* Read(uint32_t size);
+
+	/// @brief Returns a pointer to the next count elements and advances the read position.
+	const uint8_t* ReadArray(uint32_t count, uint32_t element_size);
+
+	std::vector<uint8_t> _data;
+	uint32_t _position;
+	bool _failed;
+
+	uint32_t _width;
+	uint32_t _height;
+};
+
+#endif // __FRAMECAPTURE_H__
@@ -0,0 +1,144 @@
+#include "Common.h"
+
+#include "GeometryArena.h"
+
+#include <algorithm>
+
+
+GeometryArena::GeometryArena(RenderDevice* render_device, vertex_format::VertexFormat format, uint32_t vertex_capacity, uint32_t index_capacity)
+	: _render_device(render_device),
+	_vertex_format(format),
+	_vertex_size(vertex_format::VertexSize(format)),
+	_vertex_allocator(vertex_capacity),
+	_index_allocator(index_capacity)
+{
+	assert(vertex_capacity > 0 && index_capacity > 0);
+
+	_vertex_array_object = _render_device->CreateVertexArrayObject();
+	_vertex_buffer = _render_device->CreateVertexBuffer(_vertex_array_object, _vertex_format, vertex_capacity * _vertex_size, 
+		NULL, "Geometry arena vertices");
+	_index_buffer = _render_device->CreateIndexBuffer(_vertex_array_object, index_capacity, NULL, "Geometry arena indices");
+}
+GeometryArena::~GeometryArena()
+{
+	_render_device->ReleaseHardwareBuffer(_vertex_buffer);
+	_render_device->ReleaseHardwareBuffer(_index_buffer);
+	_render_device->ReleaseVertexArrayObject(_vertex_array_object);
+}
+
+GeometryAllocation GeometryArena::Allocate(uint32_t vertex_count, const void* vertex_data, uint32_t index_count, const uint16_t* index_data)
+{
+	assert(vertex_count > 0);
+
+	GeometryAllocation allocation;
+	allocation.vertex_count = vertex_count;
+	allocation.index_count = index_count;
+
+	allocation.first_vertex = _vertex_allocator.Allocate(vertex_count);
+	if(allocation.first_vertex == RangeAllocator::INVALID_OFFSET)
+	{
+		// Try any ranges the GPU have finished with since the last update before growing.
+		Update();
+		allocation.first_vertex = _vertex_allocator.Allocate(vertex_count);
+	}
+	if(allocation.first_vertex == RangeAllocator::INVALID_OFFSET)
+	{
+		GrowVertexBuffer(vertex_count);
+		allocation.first_vertex = _vertex_allocator.Allocate(vertex_count);
+	}
+	assert(allocation.first_vertex != RangeAllocator::INVALID_OFFSET);
+
+	_render_device->UpdateHardwareBuffer(_vertex_buffer, allocation.first_vertex * _vertex_size, vertex_count * _vertex_size, vertex_data);
+
+	if(index_count > 0)
+	{
+		allocation.first_index = _index_allocator.Allocate(index_count);
+		if(allocation.first_index == RangeAllocator::INVALID_OFFSET)
+		{
+			Update();
+			allocation.first_index = _index_allocator.Allocate(index_count);
+		}
+		if(allocation.first_index == RangeAllocator::INVALID_OFFSET)
+		{
+			GrowIndexBuffer(index_count);
+			allocation.first_index = _index_allocator.Allocate(index_count);
+		}
+		assert(allocation.first_index != RangeAllocator::INVALID_OFFSET);
+
+		_render_device->UpdateHardwareBuffer(_index_buffer, allocation.first_index * sizeof(uint16_t), index_count * sizeof(uint16_t), index_data);
+	}
+
+	return allocation;
+}
+void GeometryArena::Release(const GeometryAllocation& allocation)
+{
+	PendingRelease release;
+	release.allocation = allocation;
+	release.frame = _render_device->FrameNumber();
+	_pending_releases.push_back(release);
+}
+void GeometryArena::Update()
+{
+	// Frames complete in order, so the first release still in use ends the scan.
+	uint32_t count = 0;
+	while(count < _pending_releases.size() && _render_device->IsFrameComplete(_pending_releases[count].frame))
+	{
+		const GeometryAllocation& allocation = _pending_releases[count].allocation;
+		_vertex_allocator.Release(allocation.first_vertex, allocation.vertex_count);
+		if(allocation.index_count > 0)
+			_index_allocator.Release(allocation.first_index, allocation.index_count);
+		++count;
+	}
+	_pending_releases.erase(_pending_releases.begin(), _pending_releases.begin() + count);
+}
+void GeometryArena::SetupDrawCall(const GeometryAllocation& allocation, DrawCall& draw_call) const
+{
+	draw_call.vertex_array_object = _vertex_array_object;
+
+	if(allocation.index_count > 0)
+	{
+		draw_call.index_count = allocation.index_count;
+		draw_call.index_offset = allocation.first_index;
+		draw_call.base_vertex = allocation.first_vertex;
+		draw_call.vertex_offset = 0;
+		draw_call.vertex_count = allocation.vertex_count;
+	}
+	else
+	{
+		draw_call.index_count = 0;
+		draw_call.index_offset = 0;
+		draw_call.base_vertex = 0;
+		draw_call.vertex_offset = allocation.first_vertex;
+		draw_call.vertex_count = allocation.vertex_count;
+	}
+}
+int GeometryArena::VertexArrayObject() const
+{
+	return _vertex_array_object;
+}
+void GeometryArena::GrowVertexBuffer(uint32_t min_capacity)
+{
+	uint32_t old_capacity = _vertex_allocator.Size();
+	uint32_t new_capacity = std::max(old_capacity * 2, old_capacity + min_capacity);
+
+	// Creating the new buffer also binds it to our vertex array object, replacing the old one.
+	int buffer = _render_device->CreateVertexBuffer(_vertex_array_object, _vertex_format, new_capacity * _vertex_size, 
+		NULL, "Geometry arena vertices");
+	_render_device->CopyHardwareBuffer(_vertex_buffer, buffer, old_capacity * _vertex_size);
+	_render_device->ReleaseHardwareBuffer(_vertex_buffer);
+
+	_vertex_buffer = buffer;
+	_vertex_allocator.Grow(new_capacity);
+}
+void GeometryArena::GrowIndexBuffer(uint32_t min_capacity)
+{
+	uint32_t old_capacity = _index_allocator.Size();
+	uint32_t new_capacity = std::max(old_capacity * 2, old_capacity + min_capacity);
+
+	int buffer = _render_device->CreateIndexBuffer(_vertex_array_object, new_capacity, NULL, "Geometry arena indices");
+	_render_device->CopyHardwareBuffer(_index_buffer, buffer, old_capacity * sizeof(uint16_t));
+	_render_device->ReleaseHardwareBuffer(_index_buffer);
+
+	_index_buffer = buffer;
+	_index_allocator.Grow(new_capacity);
+}
@@ -0,0 +1,83 @@
+#ifndef __GEOMETRYARENA_H__
+#define __GEOMETRYARENA_H__
+
+#include "RangeAllocator.h"
+#include "RenderDevice.h"
+
+/// @brief Range of vertices and indices allocated from a GeometryArena.
+struct GeometryAllocation
+{
+	uint32_t first_vertex; // Offset to the first vertex in the vertex buffer, in number of vertices.
+	uint32_t vertex_count;
+
+	uint32_t first_index; // Offset to the first index in the index buffer, in number of indices.
+	uint32_t index_count; // Number of indices, 0 if the geometry isn't indexed.
+
+	GeometryAllocation() : first_vertex(0), vertex_count(0), first_index(0), index_count(0) {}
+};
+
+/// @brief Large shared vertex and index buffers that geometry is sub-allocated from.
+///	All geometry in an arena share the same vertex format and vertex array object, which means 
+///	that several meshes can be drawn after each other without switching any buffers. 
+///	Indices are relative to the first vertex of each allocation and the offset is applied as the 
+///	base vertex when drawing.
+class GeometryArena
+{
+public:
+	/// @param render_device Device used for creating the buffers.
+	/// @param format Vertex format for all geometry in the arena.
+	/// @param vertex_capacity Initial capacity in number of vertices.
+	/// @param index_capacity Initial capacity in number of indices.
+	GeometryArena(RenderDevice* render_device, vertex_format::VertexFormat format, uint32_t vertex_capacity, uint32_t index_capacity);
+	~GeometryArena();
+
+	/// @brief Allocates space for the specified geometry and uploads it, the buffers grow if they're full.
+	/// @param vertex_count Number of vertices.
+	/// @param vertex_data The vertex data, in the vertex format of the arena.
+	/// @param index_count Number of indices, 0 for non-indexed geometry.
+	/// @param index_data The index data, relative to the first vertex of the geometry.
+	/// @return The allocated range.
+	GeometryAllocation Allocate(uint32_t vertex_count, const void* vertex_data, uint32_t index_count, const uint16_t* index_data);
+
+	/// @brief Releases geometry allocated by Allocate. The geometry may still be drawn by commands in flight, 
+	///		so the ranges aren't reused until the GPU have finished the current frame, see Update.
+	void Release(const GeometryAllocation& allocation);
+
+	/// @brief Returns the ranges of released geometry to the arena once the frames they were released in are
+	///		complete, call once every frame.
+	void Update();
+
+	/// @brief Sets up a draw call for rendering the specified geometry.
+	void SetupDrawCall(const GeometryAllocation& allocation, DrawCall& draw_call) const;
+
+	/// @brief Returns the vertex array object shared by all geometry in the arena.
+	int VertexArrayObject() const;
+
+private:
+	struct PendingRelease
+	{
+		GeometryAllocation allocation;
+		uint32_t frame; // Frame the geometry was released in, see RenderDevice::FrameNumber.
+	};
+
+	/// @brief Replaces the vertex buffer with a larger one, keeping the contents.
+	void GrowVertexBuffer(uint32_t min_capacity);
+
+	/// @brief Replaces the index buffer with a larger one, keeping the contents.
+	void GrowIndexBuffer(uint32_t min_capacity);
+
+	RenderDevice* _render_device;
+	vertex_format::VertexFormat _vertex_format;
+	uint32_t _vertex_size; // Size of a single vertex in bytes
+
+	int _vertex_array_object;
+	int _vertex_buffer;
+	int _index_buffer;
+
+	RangeAllocator _vertex_allocator; // Allocates ranges in the vertex buffer, in number of vertices.
+	RangeAllocator _index_allocator; // Allocates ranges in the index buffer, in number of indices.
+
+	std::vector<PendingRelease> _pending_releases; // Released geometry waiting for the GPU, oldest first.
+};
+
+#endif // __GEOMETRYARENA_H__
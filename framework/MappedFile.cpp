@@ -0,0 +1,146 @@
+#include "Common.h"
+
+#include "MappedFile.h"
+
+#ifndef PLATFORM_WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() : _data(NULL), _size(0)
+#ifdef PLATFORM_WIN32
+	, _file(INVALID_HANDLE_VALUE), _mapping(NULL)
+#else
+	, _file(-1)
+#endif
+{
+}
+MappedFile::~MappedFile()
+{
+	Close();
+}
+
+#ifdef PLATFORM_WIN32
+
+bool MappedFile::Open(const char* path)
+{
+	assert(!IsOpen());
+
+	_file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if(_file == INVALID_HANDLE_VALUE)
+	{
+		debug::Printf("MappedFile: Failed to open '%s'.\n", path);
+		return false;
+	}
+
+	LARGE_INTEGER size;
+	if(!GetFileSizeEx(_file, &size) || size.QuadPart == 0)
+	{
+		// Empty files can't be mapped.
+		debug::Printf("MappedFile: '%s' is empty.\n", path);
+		Close();
+		return false;
+	}
+
+	_mapping = CreateFileMappingA(_file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if(_mapping)
+		_data = (const uint8_t*)MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0);
+
+	if(!_data)
+	{
+		debug::Printf("MappedFile: Failed to map '%s' (error %u).\n", path, (uint32_t)GetLastError());
+		Close();
+		return false;
+	}
+
+	_size = (size_t)size.QuadPart;
+	return true;
+}
+void MappedFile::Close()
+{
+	if(_data)
+	{
+		UnmapViewOfFile(_data);
+		_data = NULL;
+	}
+	if(_mapping)
+	{
+		CloseHandle(_mapping);
+		_mapping = NULL;
+	}
+	if(_file != INVALID_HANDLE_VALUE)
+	{
+		CloseHandle(_file);
+		_file = INVALID_HANDLE_VALUE;
+	}
+	_size = 0;
+}
+
+#else
+
+bool MappedFile::Open(const char* path)
+{
+	assert(!IsOpen());
+
+	_file = open(path, O_RDONLY);
+	if(_file == -1)
+	{
+		debug::Printf("MappedFile: Failed to open '%s'.\n", path);
+		return false;
+	}
+
+	struct stat file_stat;
+	if(fstat(_file, &file_stat) != 0 || file_stat.st_size == 0)
+	{
+		// Empty files can't be mapped.
+		debug::Printf("MappedFile: '%s' is empty.\n", path);
+		Close();
+		return false;
+	}
+
+	void* data = mmap(NULL, (size_t)file_stat.st_size, PROT_READ, MAP_PRIVATE, _file, 0);
+	if(data == MAP_FAILED)
+	{
+		debug::Printf("MappedFile: Failed to map '%s'.\n", path);
+		Close();
+		return false;
+	}
+
+	// The whole file is expected to be read front to back when uploading.
+	madvise(data, (size_t)file_stat.st_size, MADV_SEQUENTIAL);
+
+	_data = (const uint8_t*)data;
+	_size = (size_t)file_stat.st_size;
+	return true;
+}
+void MappedFile::Close()
+{
+	if(_data)
+	{
+		munmap((void*)_data, _size);
+		_data = NULL;
+	}
+	if(_file != -1)
+	{
+		close(_file);
+		_file = -1;
+	}
+	_size = 0;
+}
+
+#endif
+
+bool MappedFile::IsOpen() const
+{
+	return _data != NULL;
+}
+const uint8_t* MappedFile::Data() const
+{
+	return _data;
+}
+size_t MappedFile::Size() const
+{
+	return _size;
+}
@@ -0,0 +1,40 @@
+#ifndef __MAPPEDFILE_H__
+#define __MAPPEDFILE_H__
+
+/// @brief Read-only memory mapping of a whole file.
+///	The contents are paged in by the OS on first access, nothing is read or copied when the file is opened.
+class MappedFile
+{
+public:
+	MappedFile();
+	~MappedFile();
+
+	/// @brief Maps the specified file into memory.
+	/// @return False if the file couldn't be opened or mapped.
+	bool Open(const char* path);
+
+	/// @brief Unmaps the file, any pointers to the mapped data become invalid.
+	void Close();
+
+	/// @brief Returns true if a file is currently mapped.
+	bool IsOpen() const;
+
+	/// @brief Returns a pointer to the start of the mapped file.
+	const uint8_t* Data() const;
+
+	/// @brief Returns the size of the mapped file in bytes.
+	size_t Size() const;
+
+private:
+	const uint8_t* _data;
+	size_t _size;
+
+#ifdef PLATFORM_WIN32
+	HANDLE _file;
+	HANDLE _mapping;
+#else
+	int _file; // File descriptor
+#endif
+};
+
+#endif // __MAPPEDFILE_H__
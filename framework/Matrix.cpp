@@ -284,4 +284,68 @@ Mat4x4 matrix::Inverse(const Mat4x4& m)
 
 	return result;
 }
+Mat3x3 matrix::CreateNormalMatrix(const Mat4x4& m)
+{
+	// Only the upper 3x3 part affects normals, translation is ignored for an affine matrix.
+	Vec3 a(m.col[0].x, m.col[0].y, m.col[0].z);
+	Vec3 b(m.col[1].x, m.col[1].y, m.col[1].z);
+	Vec3 c(m.col[2].x, m.col[2].y, m.col[2].z);
+
+	Mat3x3 result;
+
+	// If the matrix only rotates and scales uniformly (M^T M = s^2 I) the inverse transpose is M / s^2. As the
+	//	normals are renormalized anyway the upper 3x3 part can be used directly.
+	float aa = vector::Dot(a, a);
+	float epsilon = 1e-4f * aa;
+	if(	fabsf(aa - vector::Dot(b, b)) <= epsilon && fabsf(aa - vector::Dot(c, c)) <= epsilon &&
+		fabsf(vector::Dot(a, b)) <= epsilon && fabsf(vector::Dot(a, c)) <= epsilon && fabsf(vector::Dot(b, c)) <= epsilon)
+	{
+		result.col[0] = a;
+		result.col[1] = b;
+		result.col[2] = c;
+		return result;
+	}
+
+	// Otherwise use the cofactors, for a matrix with the columns (a, b, c):
+	//	(M^-1)^T = (b x c, c x a, a x b) / det(M), where det(M) = a . (b x c)
+	result.col[0] = vector::Cross(b, c);
+	result.col[1] = vector::Cross(c, a);
+	result.col[2] = vector::Cross(a, b);
+
+	// Dividing by the determinant keeps the correct orientation for mirroring transforms.
+	float inv_det = 1.0f / vector::Dot(a, result.col[0]);
+	for(int i = 0; i < 3; ++i)
+	{
+		result.col[i].x *= inv_det;
+		result.col[i].y *= inv_det;
+		result.col[i].z *= inv_det;
+	}
 
+	return result;
+}
+void matrix::ExtractFrustumPlanes(const Mat4x4& m, Plane planes[6])
+{
+	// Rows of the matrix, a point is inside the frustum if -w <= x, y, z <= w in clip space.
+	Vec4 rows[4];
+	rows[0] = Vec4(m.col[0].x, m.col[1].x, m.col[2].x, m.col[3].x);
+	rows[1] = Vec4(m.col[0].y, m.col[1].y, m.col[2].y, m.col[3].y);
+	rows[2] = Vec4(m.col[0].z, m.col[1].z, m.col[2].z, m.col[3].z);
+	rows[3] = Vec4(m.col[0].w, m.col[1].w, m.col[2].w, m.col[3].w);
+
+	for(int i = 0; i < 6; ++i)
+	{
+		const Vec4& row = rows[i / 2];
+		float sign = (i % 2 == 0) ? 1.0f : -1.0f;
+
+		Vec3 n(rows[3].x + sign * row.x, rows[3].y + sign * row.y, rows[3].z + sign * row.z);
+		float d = rows[3].w + sign * row.w;
+
+		float length = vector::Length(n);
+		if(length > 0.0f)
+		{
+			n = vector::Multiply(n, 1.0f / length);
+			d /= length;
+		}
+		planes[i] = Plane(n, d);
+	}
+}
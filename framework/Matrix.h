@@ -10,6 +10,13 @@ struct Mat4x4
 
 };
 
+/// @brief Column-major 3x3 matrix.
+struct Mat3x3
+{
+	Vec3 col[3]; // Columns
+
+};
+
 namespace matrix
 {
 	/// @brief Creates an identity matrix.
@@ -58,6 +65,16 @@ namespace matrix
 	/// @brief Calculates the inverse of the specified matrix.
 	Mat4x4 Inverse(const Mat4x4& m);
 
+	/// @brief Calculates the matrix for transforming normals by the specified affine matrix, i.e. the inverse 
+	///		transpose of its upper 3x3 part. The result may scale the normals, so they need to be renormalized.
+	Mat3x3 CreateNormalMatrix(const Mat4x4& m);
+
+	/// @brief Extracts the frustum planes from a projection matrix, using Gribb and Hartmann "Fast Extraction 
+	///		of Viewing Frustum Planes from the World-View-Projection Matrix". The planes are in the space the 
+	///		matrix transforms from, e.g. object space for a model-view-projection matrix.
+	/// @param planes Receives the left, right, bottom, top, near and far planes, normalized and facing inwards.
+	void ExtractFrustumPlanes(const Mat4x4& m, Plane planes[6]);
+
 };
 
 #endif // __FRAMEWORK_MATRIX_H__
@@ -0,0 +1,321 @@
+#include "Common.h"
+
+#include "MeshFile.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+namespace
+{
+	uint32_t AlignBlob(uint32_t offset)
+	{
+		return (offset + mesh_file::BLOB_ALIGNMENT - 1) & ~(uint32_t)(mesh_file::BLOB_ALIGNMENT - 1);
+	}
+
+	uint32_t IndexSize(uint32_t index_type)
+	{
+		return (index_type == mesh_file::IT_UINT32) ? sizeof(uint32_t) : sizeof(uint16_t);
+	}
+
+	/// @brief Writes zeros up to the specified offset.
+	void WritePadding(FILE* file, uint32_t& offset, uint32_t target)
+	{
+		const uint8_t zeros[64] = { 0 };
+		while(offset < target)
+		{
+			uint32_t count = std::min(target - offset, (uint32_t)sizeof(zeros));
+			fwrite(zeros, 1, count, file);
+			offset += count;
+		}
+	}
+};
+
+
+bool mesh_file::Write(const char* path, const MeshData& mesh)
+{
+	assert(mesh.format < vertex_format::VF_COUNT);
+	assert(mesh.lod_count <= MAX_LOD_COUNT);
+	assert(mesh.meshlet_count == 0 || mesh.meshlets);
+
+	Header header;
+	memset(&header, 0, sizeof(header));
+	header.magic = MAGIC;
+	header.version = VERSION;
+	header.vertex_format = mesh.format;
+	header.vertex_size = vertex_format::VertexSize(mesh.format);
+	header.vertex_count = mesh.vertex_count;
+	header.index_type = mesh.index_type;
+	header.index_count = mesh.index_count;
+	header.source_hash = mesh.source_hash;
+
+	if(mesh.lod_count == 0)
+	{
+		header.lod_count = 1;
+		header.lods[0].first_index = 0;
+		header.lods[0].index_count = mesh.index_count;
+		header.lods[0].min_screen_size = 0.0f;
+		header.lods[0].error = 0.0f;
+		header.lods[0].first_meshlet = 0;
+		header.lods[0].meshlet_count = mesh.meshlet_count;
+	}
+	else
+	{
+		header.lod_count = mesh.lod_count;
+		memcpy(header.lods, mesh.lods, mesh.lod_count * sizeof(Lod));
+	}
+
+	// Every vertex format starts with the position, quantized positions are transformed to object space.
+	bool quantized = (mesh.format == vertex_format::VF_POSITION3US_NORMAL2S || mesh.format == vertex_format::VF_POSITION3US_NORMAL3I10);
+	vertex_quantizer::Dequantization dequantization = quantized ? mesh.dequantization : vertex_quantizer::Dequantization();
+	const float* dequantization_offset = &dequantization.offset.x;
+	for(int i = 0; i < 3; ++i)
+	{
+		header.dequantization_offset[i] = dequantization_offset[i];
+		header.bounds_min[i] = mesh.vertex_count ? FLT_MAX : 0.0f;
+		header.bounds_max[i] = mesh.vertex_count ? -FLT_MAX : 0.0f;
+	}
+	header.dequantization_scale = dequantization.scale;
+	header.bounding_radius = 0.0f;
+
+	for(uint32_t v = 0; v < mesh.vertex_count; ++v)
+	{
+		const uint8_t* vertex = (const uint8_t*)mesh.vertices + v * header.vertex_size;
+		float length_sq = 0.0f;
+		for(int i = 0; i < 3; ++i)
+		{
+			float position = quantized ? dequantization_offset[i] + ((const uint16_t*)vertex)[i] / 65535.0f * dequantization.scale : ((const float*)vertex)[i];
+			header.bounds_min[i] = std::min(header.bounds_min[i], position);
+			header.bounds_max[i] = std::max(header.bounds_max[i], position);
+			length_sq += position * position;
+		}
+		header.bounding_radius = std::max(header.bounding_radius, length_sq);
+	}
+	header.bounding_radius = sqrtf(header.bounding_radius);
+
+	header.vertex_data_size = mesh.vertex_count * header.vertex_size;
+	header.vertex_data_offset = AlignBlob(sizeof(Header));
+	header.index_data_size = mesh.index_count * IndexSize(mesh.index_type);
+	header.index_data_offset = AlignBlob(header.vertex_data_offset + header.vertex_data_size);
+	header.meshlet_count = mesh.meshlet_count;
+	header.meshlet_data_size = mesh.meshlet_count * sizeof(meshlet::Meshlet);
+	header.meshlet_data_offset = AlignBlob(header.index_data_offset + header.index_data_size);
+
+	FILE* file = fopen(path, "wb");
+	if(!file)
+	{
+		debug::Printf("mesh_file: Failed to open '%s' for writing.\n", path);
+		return false;
+	}
+
+	uint32_t offset = 0;
+	fwrite(&header, sizeof(header), 1, file);
+	offset += sizeof(header);
+
+	WritePadding(file, offset, header.vertex_data_offset);
+	fwrite(mesh.vertices, 1, header.vertex_data_size, file);
+	offset += header.vertex_data_size;
+
+	WritePadding(file, offset, header.index_data_offset);
+	fwrite(mesh.indices, 1, header.index_data_size, file);
+	offset += header.index_data_size;
+
+	if(header.meshlet_count)
+	{
+		WritePadding(file, offset, header.meshlet_data_offset);
+		fwrite(mesh.meshlets, 1, header.meshlet_data_size, file);
+	}
+
+	bool failed = (ferror(file) != 0);
+	fclose(file);
+
+	if(failed)
+	{
+		debug::Printf("mesh_file: Failed to write '%s'.\n", path);
+		remove(path);
+		return false;
+	}
+	return true;
+}
+
+
+MeshFile::MeshFile() : _header(NULL)
+{
+}
+MeshFile::~MeshFile()
+{
+	Close();
+}
+
+bool MeshFile::Open(const char* path)
+{
+	assert(!_header);
+
+	if(!_file.Open(path))
+		return false;
+
+	const mesh_file::Header* header = (const mesh_file::Header*)_file.Data();
+	if(_file.Size() < sizeof(mesh_file::Header) || header->magic != mesh_file::MAGIC)
+	{
+		debug::Printf("MeshFile: '%s' is not a mesh file.\n", path);
+		_file.Close();
+		return false;
+	}
+	if(header->version != mesh_file::VERSION)
+	{
+		debug::Printf("MeshFile: '%s' have unsupported version %u, expected %u.\n", path, header->version, mesh_file::VERSION);
+		_file.Close();
+		return false;
+	}
+
+	// Validate the layout against the size of the file, a truncated file would otherwise fault when uploading.
+	bool valid = header->vertex_format < vertex_format::VF_COUNT &&
+		header->vertex_size == vertex_format::VertexSize((vertex_format::VertexFormat)header->vertex_format) &&
+		header->index_type <= mesh_file::IT_UINT32 &&
+		header->lod_count >= 1 && header->lod_count <= mesh_file::MAX_LOD_COUNT &&
+		(uint64_t)header->vertex_count * header->vertex_size == header->vertex_data_size &&
+		(uint64_t)header->index_count * IndexSize(header->index_type) == header->index_data_size &&
+		(uint64_t)header->vertex_data_offset + header->vertex_data_size <= _file.Size() &&
+		(uint64_t)header->index_data_offset + header->index_data_size <= _file.Size() &&
+		(uint64_t)header->meshlet_count * sizeof(meshlet::Meshlet) == header->meshlet_data_size &&
+		(header->meshlet_count == 0 || (uint64_t)header->meshlet_data_offset + header->meshlet_data_size <= _file.Size());
+
+	for(uint32_t i = 0; valid && i < header->lod_count; ++i)
+	{
+		const mesh_file::Lod& lod = header->lods[i];
+		valid = (uint64_t)lod.first_index + lod.index_count <= header->index_count &&
+			(uint64_t)lod.first_meshlet + lod.meshlet_count <= header->meshlet_count;
+	}
+
+	if(!valid)
+	{
+		debug::Printf("MeshFile: '%s' is corrupt.\n", path);
+		_file.Close();
+		return false;
+	}
+
+	_header = header;
+	return true;
+}
+void MeshFile::Close()
+{
+	_header = NULL;
+	_file.Close();
+}
+const mesh_file::Header& MeshFile::GetHeader() const
+{
+	assert(_header);
+	return *_header;
+}
+vertex_quantizer::Dequantization MeshFile::GetDequantization() const
+{
+	assert(_header);
+	vertex_quantizer::Dequantization dequantization;
+	dequantization.offset = Vec3(_header->dequantization_offset[0], _header->dequantization_offset[1], _header->dequantization_offset[2]);
+	dequantization.scale = _header->dequantization_scale;
+	return dequantization;
+}
+const void* MeshFile::VertexData() const
+{
+	assert(_header);
+	return _file.Data() + _header->vertex_data_offset;
+}
+const void* MeshFile::IndexData() const
+{
+	assert(_header);
+	return _file.Data() + _header->index_data_offset;
+}
+const meshlet::Meshlet* MeshFile::Meshlets() const
+{
+	assert(_header);
+	return _header->meshlet_count ? (const meshlet::Meshlet*)(_file.Data() + _header->meshlet_data_offset) : NULL;
+}
+void MeshFile::GetMeshData(mesh_file::MeshData& mesh) const
+{
+	assert(_header);
+	mesh.format = (vertex_format::VertexFormat)_header->vertex_format;
+	mesh.vertices = VertexData();
+	mesh.vertex_count = _header->vertex_count;
+	mesh.index_type = (mesh_file::IndexType)_header->index_type;
+	mesh.indices = IndexData();
+	mesh.index_count = _header->index_count;
+	mesh.lod_count = _header->lod_count;
+	memcpy(mesh.lods, _header->lods, _header->lod_count * sizeof(mesh_file::Lod));
+	mesh.meshlets = Meshlets();
+	mesh.meshlet_count = _header->meshlet_count;
+	mesh.dequantization = GetDequantization();
+	mesh.source_hash = _header->source_hash;
+}
+void MeshFile::Upload(ResourceUploader& uploader, RenderDevice& device, MeshBuffers& buffers, const char* debug_name) const
+{
+	// The mapped pages are passed straight to glBufferData, the driver reads them from the page cache
+	//	without the data ever being copied or parsed on our side.
+	mesh_file::MeshData mesh;
+	GetMeshData(mesh);
+	mesh_file::Upload(uploader, device, mesh, buffers, debug_name);
+}
+void mesh_file::Upload(ResourceUploader& uploader, RenderDevice& device, const MeshData& mesh, MeshBuffers& buffers, const char* debug_name)
+{
+	assert(mesh.lod_count <= MAX_LOD_COUNT);
+
+	// The buffers are attached to the vertex array object once they're published.
+	buffers.vertex_array_object = device.CreateVertexArrayObject();
+	buffers.vertex_upload = uploader.UploadVertexBuffer(buffers.vertex_array_object, mesh.format,
+		mesh.vertex_count * vertex_format::VertexSize(mesh.format), mesh.vertices, debug_name);
+
+	if(mesh.index_type == IT_UINT32)
+	{
+		buffers.index_upload = uploader.UploadIndexBuffer32(buffers.vertex_array_object, mesh.index_count,
+			(const uint32_t*)mesh.indices, debug_name);
+	}
+	else
+	{
+		buffers.index_upload = uploader.UploadIndexBuffer(buffers.vertex_array_object, mesh.index_count,
+			(const uint16_t*)mesh.indices, debug_name);
+	}
+
+	// A mesh without levels is drawn as a single level covering all indices, as when written to a file.
+	buffers.lod_count = std::max(mesh.lod_count, 1u);
+	for(uint32_t i = 0; i < buffers.lod_count; ++i)
+	{
+		DrawCall& draw_call = buffers.lods[i];
+		draw_call.draw_mode = GL_TRIANGLES;
+		draw_call.vertex_offset = 0;
+		draw_call.vertex_count = mesh.vertex_count;
+		draw_call.index_offset = mesh.lod_count ? mesh.lods[i].first_index : 0;
+		draw_call.index_count = mesh.lod_count ? mesh.lods[i].index_count : mesh.index_count;
+		draw_call.index_type = (mesh.index_type == IT_UINT32) ? GL_UNSIGNED_INT : GL_UNSIGNED_SHORT;
+		draw_call.base_vertex = 0;
+		draw_call.vertex_array_object = buffers.vertex_array_object;
+	}
+}
+ResourceUploader::UploadStatus mesh_file::PollUpload(ResourceUploader& uploader, MeshBuffers& buffers)
+{
+	if(buffers.vertex_upload != -1 && uploader.PollUpload(buffers.vertex_upload, buffers.vertex_buffer) != ResourceUploader::US_PENDING)
+		buffers.vertex_upload = -1;
+	if(buffers.index_upload != -1 && uploader.PollUpload(buffers.index_upload, buffers.index_buffer) != ResourceUploader::US_PENDING)
+		buffers.index_upload = -1;
+
+	if(buffers.vertex_upload != -1 || buffers.index_upload != -1)
+		return ResourceUploader::US_PENDING;
+
+	// Failed uploads leave their buffer handle unset.
+	if(buffers.vertex_buffer == -1 || buffers.index_buffer == -1)
+		return ResourceUploader::US_FAILED;
+	return ResourceUploader::US_READY;
+}
+void MeshFile::Release(RenderDevice& device, MeshBuffers& buffers)
+{
+	// Publishing a buffer attaches it to the vertex array object, which needs to outlive the upload.
+	assert(buffers.vertex_upload == -1 && buffers.index_upload == -1);
+
+	if(buffers.index_buffer != -1)
+		device.ReleaseHardwareBuffer(buffers.index_buffer);
+	if(buffers.vertex_buffer != -1)
+		device.ReleaseHardwareBuffer(buffers.vertex_buffer);
+	if(buffers.vertex_array_object != -1)
+		device.ReleaseVertexArrayObject(buffers.vertex_array_object);
+
+	buffers = MeshBuffers();
+}
@@ -0,0 +1,194 @@
+#ifndef __MESHFILE_H__
+#define __MESHFILE_H__
+
+#include "MappedFile.h"
+#include "RenderDevice.h"
+#include "ResourceUploader.h"
+#include "VertexQuantizer.h"
+#include "Meshlet.h"
+
+/// Binary mesh container laid out so that it can be uploaded straight from a memory mapping.
+///	The file starts with a Header followed by the vertex data, the index data and the meshlets, each starting
+///	at a page boundary. All values are stored in native byte order. The vertex data is stored in the vertex
+///	format specified by the header and the indices are relative to the first vertex. Each level of detail is a
+///	range in the index data and a range of meshlets, all levels share the same vertices.
+namespace mesh_file
+{
+	enum
+	{
+		MAGIC = 0x48534d4f, // "OMSH"
+		VERSION = 4,
+		MAX_LOD_COUNT = 4,
+		BLOB_ALIGNMENT = 4096 // Alignment of the vertex, index and meshlet data within the file.
+	};
+
+	enum IndexType
+	{
+		IT_UINT16,
+		IT_UINT32
+	};
+
+	/// Level of detail, a range of indices in the index data.
+	struct Lod
+	{
+		uint32_t first_index;
+		uint32_t index_count;
+		float min_screen_size; // Smallest projected size the level is used for, see PrimitiveLodChain.
+		float error; // Largest geometric error compared to the first level, in object space units.
+
+		/// Meshlets of the level, a range in the meshlet data. The index ranges of the meshlets are relative
+		///	to the first index of the level and their bounds are in object space. A count of 0 if the level
+		///	haven't been split into meshlets.
+		uint32_t first_meshlet;
+		uint32_t meshlet_count;
+	};
+
+	struct Header
+	{
+		uint32_t magic;
+		uint32_t version;
+
+		uint32_t vertex_format; // vertex_format::VertexFormat
+		uint32_t vertex_size; // Size of a vertex in bytes.
+		uint32_t vertex_count;
+
+		uint32_t index_type; // IndexType
+		uint32_t index_count; // Total number of indices, for all levels of detail.
+
+		uint32_t lod_count;
+		Lod lods[MAX_LOD_COUNT];
+
+		float bounds_min[3]; // Axis-aligned bounding box of the vertex positions, in object space.
+		float bounds_max[3];
+
+		/// Transform from the quantized positions of VF_POSITION3US_* formats to object space, see
+		///	vertex_quantizer::Dequantization. An offset of 0 and a scale of 1 for unquantized formats.
+		float dequantization_offset[3];
+		float dequantization_scale;
+
+		float bounding_radius; // Radius of the bounding sphere centered at the origin, in object space.
+
+		uint32_t vertex_data_offset; // Offset to the vertex data in bytes, from the start of the file.
+		uint32_t vertex_data_size;
+		uint32_t index_data_offset; // Offset to the index data in bytes, from the start of the file.
+		uint32_t index_data_size;
+		uint32_t meshlet_count; // Total number of meshlets, for all levels of detail.
+		uint32_t meshlet_data_offset; // Offset to the meshlets in bytes, from the start of the file.
+		uint32_t meshlet_data_size;
+
+		uint64_t source_hash; // Hash of the file the mesh was imported from, 0 if the mesh wasn't imported.
+	};
+
+	/// Mesh to write to a file.
+	struct MeshData
+	{
+		vertex_format::VertexFormat format;
+		const void* vertices;
+		uint32_t vertex_count;
+
+		IndexType index_type;
+		const void* indices;
+		uint32_t index_count;
+
+		/// Levels of detail, if lod_count is 0 a single level covering all indices is written.
+		Lod lods[MAX_LOD_COUNT];
+		uint32_t lod_count;
+
+		/// Meshlets of all levels, referenced by the meshlet ranges of the levels.
+		const meshlet::Meshlet* meshlets;
+		uint32_t meshlet_count;
+
+		/// Transform from quantized positions to object space, ignored for unquantized formats.
+		vertex_quantizer::Dequantization dequantization;
+
+		uint64_t source_hash;
+
+		MeshData() : format(vertex_format::VF_POSITION3F_NORMAL3F), vertices(NULL), vertex_count(0),
+			index_type(IT_UINT16), indices(NULL), index_count(0), lod_count(0), meshlets(NULL), meshlet_count(0), source_hash(0) {}
+	};
+
+	/// @brief Writes a mesh to a file, the bounds are calculated from the vertex positions.
+	/// @return False if the file couldn't be written.
+	bool Write(const char* path, const MeshData& mesh);
+};
+
+
+/// GPU resources for a mesh loaded from a mesh file.
+struct MeshBuffers
+{
+	int vertex_array_object;
+	int vertex_buffer;
+	int index_buffer;
+
+	/// Uploads of the buffers through a ResourceUploader, -1 once the upload is done. The buffer handles are
+	///	-1 until then, and stay -1 if the upload failed.
+	int vertex_upload;
+	int index_upload;
+
+	DrawCall lods[mesh_file::MAX_LOD_COUNT]; // Draw call for each level of detail.
+	uint32_t lod_count;
+
+	MeshBuffers() : vertex_array_object(-1), vertex_buffer(-1), index_buffer(-1), vertex_upload(-1), index_upload(-1), lod_count(0) {}
+};
+
+namespace mesh_file
+{
+	/// @brief Creates a vertex array object with a draw call for each level of detail, and queues the upload of
+	///		the vertex and index buffers from a mesh in memory. Meshes read from a file are uploaded through 
+	///		MeshFile::Upload. The mesh data needs to stay valid until PollUpload reports the upload as done.
+	/// @param debug_name Optional name used to identify the buffers in memory dumps.
+	void Upload(ResourceUploader& uploader, RenderDevice& device, const MeshData& mesh, MeshBuffers& buffers, const char* debug_name = NULL);
+
+	/// @brief Polls the uploads queued by Upload, storing the handles of the buffers as they're published.
+	/// @return US_PENDING until both buffers are done, then US_READY, or US_FAILED if either buffer failed.
+	ResourceUploader::UploadStatus PollUpload(ResourceUploader& uploader, MeshBuffers& buffers);
+};
+
+/// @brief Reads a mesh file through a memory mapping.
+///	Nothing is parsed or copied when the file is opened, the header is validated in place and the vertex
+///	and index data are handed to the driver directly from the mapped pages.
+class MeshFile
+{
+public:
+	MeshFile();
+	~MeshFile();
+
+	/// @brief Maps the file and validates the header.
+	/// @return False if the file couldn't be mapped or isn't a valid mesh file.
+	bool Open(const char* path);
+
+	/// @brief Unmaps the file.
+	void Close();
+
+	/// @brief Returns the header of the opened file.
+	const mesh_file::Header& GetHeader() const;
+
+	/// @brief Returns the transform from the vertex positions to object space, identity for unquantized formats.
+	vertex_quantizer::Dequantization GetDequantization() const;
+
+	/// @brief Returns a pointer to the vertex data within the mapping.
+	const void* VertexData() const;
+
+	/// @brief Returns a pointer to the index data within the mapping.
+	const void* IndexData() const;
+
+	/// @brief Returns a pointer to the meshlets within the mapping, NULL if the mesh have no meshlets.
+	const meshlet::Meshlet* Meshlets() const;
+
+	/// @brief Describes the mesh with pointers into the mapping, valid until the file is closed.
+	void GetMeshData(mesh_file::MeshData& mesh) const;
+
+	/// @brief Queues the upload of the vertex and index buffers directly from the mapping, see mesh_file::Upload.
+	///	The file needs to stay open until mesh_file::PollUpload reports the upload as done.
+	/// @param debug_name Optional name used to identify the buffers in memory dumps.
+	void Upload(ResourceUploader& uploader, RenderDevice& device, MeshBuffers& buffers, const char* debug_name = NULL) const;
+
+	/// @brief Releases buffers created by Upload, the upload needs to be done.
+	static void Release(RenderDevice& device, MeshBuffers& buffers);
+
+private:
+	MappedFile _file;
+	const mesh_file::Header* _header;
+};
+
+#endif // __MESHFILE_H__
@@ -0,0 +1,1132 @@
+#include "Common.h"
+
+#include "MeshImporter.h"
+#include "MappedFile.h"
+#include "MeshFile.h"
+
+#include <SDL.h>
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+
+namespace
+{
+	/// Files are split into chunks of at least this size, smaller files aren't worth spreading over threads.
+	const size_t min_chunk_size = 256 * 1024;
+
+	/// Largest number of values accepted in a PLY list, e.g. the vertices of a face. Larger counts are
+	///	treated as corrupt data instead of being trusted for sizes and allocations.
+	const uint32_t ply_max_list_count = 1024;
+
+	// Parallel jobs
+
+	typedef void (*JobFunction)(void* data, uint32_t index);
+
+	struct Job
+	{
+		JobFunction function;
+		void* data;
+		uint32_t index;
+	};
+
+	int SDLCALL JobThreadMain(void* data)
+	{
+		Job* job = (Job*)data;
+		job->function(job->data, job->index);
+		return 0;
+	}
+
+	/// @brief Calls the function for every index from 0 to count-1, each on a thread of its own.
+	///		The first index runs on the calling thread, which returns once all calls have finished.
+	void RunParallel(JobFunction function, void* data, uint32_t count)
+	{
+		std::vector<Job> jobs(count);
+		std::vector<SDL_Thread*> threads(count, (SDL_Thread*)NULL);
+		for(uint32_t i = 1; i < count; ++i)
+		{
+			jobs[i].function = function;
+			jobs[i].data = data;
+			jobs[i].index = i;
+			threads[i] = SDL_CreateThread(JobThreadMain, "MeshImporter", &jobs[i]);
+			if(!threads[i])
+				function(data, i); // Run it here instead
+		}
+
+		function(data, 0);
+
+		for(uint32_t i = 1; i < count; ++i)
+		{
+			if(threads[i])
+				SDL_WaitThread(threads[i], NULL);
+		}
+	}
+
+	/// @brief Returns the number of chunks to split a file of the specified size into.
+	uint32_t ChunkCount(size_t size)
+	{
+		size_t cpu_count = std::max(SDL_GetCPUCount(), 1);
+		return (uint32_t)std::min(cpu_count, size / min_chunk_size + 1);
+	}
+
+	/// @brief Splits the text into chunks of roughly equal size, each starting at the beginning of a line.
+	/// @param boundaries Receives the start of each chunk followed by the end of the text.
+	void SplitLines(const char* begin, const char* end, uint32_t count, std::vector<const char*>& boundaries)
+	{
+		boundaries.clear();
+		boundaries.push_back(begin);
+		for(uint32_t i = 1; i < count; ++i)
+		{
+			const char* p = std::max(begin + (end - begin) * i / count, boundaries.back());
+			const char* newline = (const char*)memchr(p, '\n', end - p);
+			boundaries.push_back(newline ? newline + 1 : end);
+		}
+		boundaries.push_back(end);
+	}
+
+	// Text parsing
+
+	bool IsSpace(char c)
+	{
+		return c == ' ' || c == '\t' || c == '\r';
+	}
+	bool IsDigit(char c)
+	{
+		return c >= '0' && c <= '9';
+	}
+	void SkipSpace(const char*& p, const char* end)
+	{
+		while(p < end && IsSpace(*p))
+			++p;
+	}
+	void SkipLine(const char*& p, const char* end)
+	{
+		const char* newline = (const char*)memchr(p, '\n', end - p);
+		p = newline ? newline + 1 : end;
+	}
+	bool AtLineEnd(const char* p, const char* end)
+	{
+		return p >= end || *p == '\n' || *p == '#';
+	}
+
+	/// @brief Parses a decimal integer, leading whitespace is skipped.
+	bool ParseInt(const char*& p, const char* end, int& value)
+	{
+		SkipSpace(p, end);
+
+		bool negative = false;
+		if(p < end && (*p == '-' || *p == '+'))
+		{
+			negative = (*p == '-');
+			++p;
+		}
+		if(p >= end || !IsDigit(*p))
+			return false;
+
+		int result = 0;
+		while(p < end && IsDigit(*p))
+		{
+			result = result * 10 + (*p - '0');
+			++p;
+		}
+		value = negative ? -result : result;
+		return true;
+	}
+
+	/// @brief Parses a decimal floating point number, leading whitespace is skipped.
+	///		This avoids sscanf and strtod, which are slow and depend on the locale for the decimal point.
+	bool ParseFloat(const char*& p, const char* end, float& value)
+	{
+		// Powers of ten that are exactly representable as doubles.
+		static const double powers_of_ten[] = {
+			1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+			1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+		};
+		const int max_exact_power = 22;
+		const int max_mantissa_digits = 18; // Digits that fit in a 64-bit integer
+
+		SkipSpace(p, end);
+		const char* start = p;
+
+		bool negative = false;
+		if(p < end && (*p == '-' || *p == '+'))
+		{
+			negative = (*p == '-');
+			++p;
+		}
+
+		uint64_t mantissa = 0;
+		int exponent = 0;
+		int digits = 0; // Significant digits in the mantissa
+		bool any_digits = false;
+
+		for( ; p < end && IsDigit(*p); ++p)
+		{
+			any_digits = true;
+			if(digits < max_mantissa_digits)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if(mantissa)
+					++digits;
+			}
+			else
+			{
+				++exponent; // Digits beyond the precision only scale the value
+			}
+		}
+		if(p < end && *p == '.')
+		{
+			for(++p; p < end && IsDigit(*p); ++p)
+			{
+				any_digits = true;
+				if(digits < max_mantissa_digits)
+				{
+					mantissa = mantissa * 10 + (*p - '0');
+					if(mantissa)
+						++digits;
+					--exponent;
+				}
+			}
+		}
+		if(!any_digits)
+		{
+			p = start;
+			return false;
+		}
+
+		if(p < end && (*p == 'e' || *p == 'E'))
+		{
+			const char* exponent_start = p;
+			int exponent_value = 0;
+			if(ParseInt(++p, end, exponent_value))
+				exponent += exponent_value;
+			else
+				p = exponent_start; // Not an exponent after all
+		}
+
+		double result = (double)mantissa;
+		if(exponent < 0)
+			result = (exponent >= -max_exact_power) ? result / powers_of_ten[-exponent] : result * pow(10.0, exponent);
+		else if(exponent > 0)
+			result = (exponent <= max_exact_power) ? result * powers_of_ten[exponent] : result * pow(10.0, exponent);
+
+		value = (float)(negative ? -result : result);
+		return true;
+	}
+
+	// Vertex deduplication
+
+	const uint64_t empty_key = ~0ull;
+
+	/// @brief Open addressing hash map from 64-bit keys to vertex indices.
+	class VertexMap
+	{
+	public:
+		/// @param capacity Largest number of keys that will be inserted.
+		VertexMap(uint32_t capacity)
+		{
+			_bits = 4;
+			while((1u << _bits) < capacity * 2)
+				++_bits;
+
+			_keys.resize(1u << _bits, empty_key);
+			_values.resize(1u << _bits);
+		}
+
+		/// @brief Returns the index stored for the key, inserting the specified index if the key is new.
+		uint32_t Insert(uint64_t key, uint32_t index)
+		{
+			assert(key != empty_key);
+
+			uint32_t mask = (1u << _bits) - 1;
+			uint32_t slot = (uint32_t)((key * 0x9e3779b97f4a7c15ull) >> (64 - _bits));
+			while(_keys[slot] != empty_key)
+			{
+				if(_keys[slot] == key)
+					return _values[slot];
+				slot = (slot + 1) & mask;
+			}
+			_keys[slot] = key;
+			_values[slot] = index;
+			return index;
+		}
+
+	private:
+		uint32_t _bits;
+		std::vector<uint64_t> _keys;
+		std::vector<uint32_t> _values;
+	};
+
+	/// @brief Calculates smooth vertex normals from the area-weighted normals of the faces.
+	void CalculateNormals(ImportedMesh& mesh)
+	{
+		float* vertices = &mesh.vertices[0];
+		uint32_t vertex_count = mesh.VertexCount();
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			vertices[v*6+3] = vertices[v*6+4] = vertices[v*6+5] = 0.0f;
+		}
+
+		for(size_t i = 0; i + 2 < mesh.indices.size(); i += 3)
+		{
+			const uint32_t* triangle = &mesh.indices[i];
+			Vec3 p0(vertices[triangle[0]*6], vertices[triangle[0]*6+1], vertices[triangle[0]*6+2]);
+			Vec3 p1(vertices[triangle[1]*6], vertices[triangle[1]*6+1], vertices[triangle[1]*6+2]);
+			Vec3 p2(vertices[triangle[2]*6], vertices[triangle[2]*6+1], vertices[triangle[2]*6+2]);
+
+			// The length of the cross product is twice the area, which gives larger faces more weight.
+			Vec3 normal = vector::Cross(vector::Subtract(p1, p0), vector::Subtract(p2, p0));
+			for(int k = 0; k < 3; ++k)
+			{
+				float* n = vertices + triangle[k]*6 + 3;
+				n[0] += normal.x;
+				n[1] += normal.y;
+				n[2] += normal.z;
+			}
+		}
+
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			Vec3 normal(vertices[v*6+3], vertices[v*6+4], vertices[v*6+5]);
+			if(vector::Length(normal) > 0.0f)
+				vector::Normalize(normal);
+			else
+				normal = Vec3(0.0f, 1.0f, 0.0f);
+
+			vertices[v*6+3] = normal.x;
+			vertices[v*6+4] = normal.y;
+			vertices[v*6+5] = normal.z;
+		}
+	}
+
+	// Wavefront OBJ
+
+	/// Corner of a face, indices refer to the positions and normals of the whole file once resolved.
+	struct ObjCorner
+	{
+		int position;
+		int normal; // -1 if the corner have no normal.
+		bool relative_position; // Negative indices are relative to the start of the chunk until resolved.
+		bool relative_normal;
+	};
+
+	struct ObjChunk
+	{
+		const char* begin;
+		const char* end;
+
+		std::vector<Vec3> positions;
+		std::vector<Vec3> normals;
+		std::vector<ObjCorner> corners; // Three corners for each triangle
+
+		bool failed;
+	};
+
+	/// @brief Parses a vertex reference in a face. Positive indices are absolute, starting at 1, while
+	///		negative indices refers to the vertices preceding the face.
+	bool ParseObjIndex(const char*& p, const char* end, size_t local_count, int& index, bool& relative)
+	{
+		int value = 0;
+		if(!ParseInt(p, end, value) || value == 0)
+			return false;
+
+		relative = (value < 0);
+		index = relative ? (int)local_count + value : value - 1;
+		return true;
+	}
+
+	bool ParseObjFace(const char*& p, const char* end, ObjChunk& chunk, std::vector<ObjCorner>& polygon)
+	{
+		polygon.clear();
+		for(SkipSpace(p, end); !AtLineEnd(p, end); SkipSpace(p, end))
+		{
+			// v, v/vt, v//vn or v/vt/vn
+			ObjCorner corner;
+			corner.normal = -1;
+			corner.relative_normal = false;
+			if(!ParseObjIndex(p, end, chunk.positions.size(), corner.position, corner.relative_position))
+				return false;
+
+			if(p < end && *p == '/')
+			{
+				++p;
+				int texcoord = 0;
+				if(p < end && *p != '/' && !ParseInt(p, end, texcoord))
+					return false; // Texture coordinates are ignored, the vertex format have none.
+
+				if(p < end && *p == '/')
+				{
+					++p;
+					if(!ParseObjIndex(p, end, chunk.normals.size(), corner.normal, corner.relative_normal))
+						return false;
+				}
+			}
+			polygon.push_back(corner);
+		}
+
+		if(polygon.size() < 3)
+			return false;
+
+		// Triangulate as a fan, which works for the convex polygons found in practice.
+		for(size_t k = 1; k + 1 < polygon.size(); ++k)
+		{
+			chunk.corners.push_back(polygon[0]);
+			chunk.corners.push_back(polygon[k]);
+			chunk.corners.push_back(polygon[k + 1]);
+		}
+		return true;
+	}
+
+	void ParseObjChunk(void* data, uint32_t index)
+	{
+		ObjChunk& chunk = ((ObjChunk*)data)[index];
+		const char* p = chunk.begin;
+		const char* end = chunk.end;
+
+		std::vector<ObjCorner> polygon;
+		while(p < end && !chunk.failed)
+		{
+			SkipSpace(p, end);
+			if(end - p > 2 && p[0] == 'v' && IsSpace(p[1]))
+			{
+				p += 2;
+				Vec3 position;
+				chunk.failed = !ParseFloat(p, end, position.x) || !ParseFloat(p, end, position.y) || !ParseFloat(p, end, position.z);
+				chunk.positions.push_back(position);
+			}
+			else if(end - p > 3 && p[0] == 'v' && p[1] == 'n' && IsSpace(p[2]))
+			{
+				p += 3;
+				Vec3 normal;
+				chunk.failed = !ParseFloat(p, end, normal.x) || !ParseFloat(p, end, normal.y) || !ParseFloat(p, end, normal.z);
+				chunk.normals.push_back(normal);
+			}
+			else if(end - p > 2 && p[0] == 'f' && IsSpace(p[1]))
+			{
+				p += 2;
+				chunk.failed = !ParseObjFace(p, end, chunk, polygon);
+			}
+			// Anything else, e.g. comments, texture coordinates, groups and materials, is ignored.
+
+			SkipLine(p, end);
+		}
+	}
+
+	bool ImportObj(const char* text, size_t size, ImportedMesh& mesh)
+	{
+		std::vector<const char*> boundaries;
+		SplitLines(text, text + size, ChunkCount(size), boundaries);
+
+		uint32_t chunk_count = (uint32_t)boundaries.size() - 1;
+		std::vector<ObjChunk> chunks(chunk_count);
+		for(uint32_t i = 0; i < chunk_count; ++i)
+		{
+			chunks[i].begin = boundaries[i];
+			chunks[i].end = boundaries[i + 1];
+			chunks[i].failed = false;
+		}
+
+		RunParallel(ParseObjChunk, &chunks[0], chunk_count);
+
+		// Merge the chunks, resolving the indices to the positions and normals of the whole file.
+		std::vector<Vec3> positions;
+		std::vector<Vec3> normals;
+		std::vector<ObjCorner> corners;
+		for(std::vector<ObjChunk>::iterator it = chunks.begin(); it != chunks.end(); ++it)
+		{
+			if(it->failed)
+			{
+				debug::Printf("mesh_importer: Invalid OBJ data at offset %u.\n", (uint32_t)(it->begin - text));
+				return false;
+			}
+
+			int position_base = (int)positions.size();
+			int normal_base = (int)normals.size();
+			for(std::vector<ObjCorner>::iterator c = it->corners.begin(); c != it->corners.end(); ++c)
+			{
+				ObjCorner corner = *c;
+				if(corner.relative_position)
+					corner.position += position_base;
+				if(corner.relative_normal)
+					corner.normal += normal_base;
+				corners.push_back(corner);
+			}
+			positions.insert(positions.end(), it->positions.begin(), it->positions.end());
+			normals.insert(normals.end(), it->normals.begin(), it->normals.end());
+
+			// Release the chunk early, large files would otherwise hold everything twice.
+			std::vector<ObjCorner>().swap(it->corners);
+			std::vector<Vec3>().swap(it->positions);
+			std::vector<Vec3>().swap(it->normals);
+		}
+
+		// The normals in the file are only used if every corner have one.
+		bool has_normals = !normals.empty();
+		for(std::vector<ObjCorner>::iterator c = corners.begin(); c != corners.end(); ++c)
+		{
+			if(c->position < 0 || c->position >= (int)positions.size() || c->normal >= (int)normals.size())
+			{
+				debug::Printf("mesh_importer: OBJ face refers to a vertex that doesn't exist.\n");
+				return false;
+			}
+			if(c->normal < 0)
+				has_normals = false;
+		}
+
+		// Corners sharing both position and normal become the same vertex.
+		VertexMap vertex_map((uint32_t)corners.size());
+		mesh.vertices.clear();
+		mesh.indices.clear();
+		mesh.indices.reserve(corners.size());
+		for(std::vector<ObjCorner>::iterator c = corners.begin(); c != corners.end(); ++c)
+		{
+			uint32_t normal_key = has_normals ? (uint32_t)c->normal : 0;
+			uint64_t key = ((uint64_t)c->position << 32) | normal_key;
+
+			uint32_t vertex = vertex_map.Insert(key, mesh.VertexCount());
+			if(vertex == mesh.VertexCount())
+			{
+				const Vec3& position = positions[c->position];
+				Vec3 normal = has_normals ? normals[c->normal] : Vec3(0.0f, 0.0f, 0.0f);
+				float v[6] = { position.x, position.y, position.z, normal.x, normal.y, normal.z };
+				mesh.vertices.insert(mesh.vertices.end(), v, v + 6);
+			}
+			mesh.indices.push_back(vertex);
+		}
+
+		if(!has_normals)
+			CalculateNormals(mesh);
+		return true;
+	}
+
+	// PLY
+
+	enum PlyType
+	{
+		PLY_INT8,
+		PLY_UINT8,
+		PLY_INT16,
+		PLY_UINT16,
+		PLY_INT32,
+		PLY_UINT32,
+		PLY_FLOAT32,
+		PLY_FLOAT64,
+		PLY_INVALID
+	};
+
+	struct PlyProperty
+	{
+		std::string name;
+		PlyType type;
+		bool is_list;
+		PlyType count_type; // Type of the element count for lists.
+	};
+
+	struct PlyElement
+	{
+		std::string name;
+		uint32_t count;
+		std::vector<PlyProperty> properties;
+	};
+
+	struct PlyHeader
+	{
+		bool binary;
+		std::vector<PlyElement> elements;
+		const char* body; // Start of the data following the header.
+
+		int vertex_element; // Index of the vertex and face elements, -1 if missing.
+		int face_element;
+		int vertex_properties[6]; // Index of x, y, z, nx, ny and nz among the vertex properties, -1 if missing.
+		int face_indices; // Index of the list of vertex indices among the face properties.
+	};
+
+	PlyType ParsePlyType(const std::string& name)
+	{
+		const char* names[][2] = {
+			{ "char", "int8" }, { "uchar", "uint8" }, { "short", "int16" }, { "ushort", "uint16" },
+			{ "int", "int32" }, { "uint", "uint32" }, { "float", "float32" }, { "double", "float64" }
+		};
+		for(int i = 0; i < PLY_INVALID; ++i)
+		{
+			if(name == names[i][0] || name == names[i][1])
+				return (PlyType)i;
+		}
+		return PLY_INVALID;
+	}
+	uint32_t PlyTypeSize(PlyType type)
+	{
+		const uint32_t sizes[] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+		return sizes[type];
+	}
+
+	/// @brief Reads a little endian binary value and converts it to a double.
+	double ReadPlyValue(const uint8_t*& p, PlyType type)
+	{
+		double value = 0.0;
+		switch(type)
+		{
+		case PLY_INT8:		{ int8_t v; memcpy(&v, p, 1); value = v; } break;
+		case PLY_UINT8:		{ uint8_t v; memcpy(&v, p, 1); value = v; } break;
+		case PLY_INT16:		{ int16_t v; memcpy(&v, p, 2); value = v; } break;
+		case PLY_UINT16:	{ uint16_t v; memcpy(&v, p, 2); value = v; } break;
+		case PLY_INT32:		{ int32_t v; memcpy(&v, p, 4); value = v; } break;
+		case PLY_UINT32:	{ uint32_t v; memcpy(&v, p, 4); value = v; } break;
+		case PLY_FLOAT32:	{ float v; memcpy(&v, p, 4); value = v; } break;
+		case PLY_FLOAT64:	{ double v; memcpy(&v, p, 8); value = v; } break;
+		default: assert(false); break;
+		};
+		p += PlyTypeSize(type);
+		return value;
+	}
+
+	/// @brief Parses the count of a PLY element, which needs to be a plain decimal number within 32 bits.
+	/// @return False for negative, non-numeric or too large counts.
+	bool ParsePlyCount(const std::string& word, uint32_t& count)
+	{
+		if(word.empty() || word.size() > 10)
+			return false;
+
+		uint64_t value = 0;
+		for(std::string::const_iterator it = word.begin(); it != word.end(); ++it)
+		{
+			if(*it < '0' || *it > '9')
+				return false;
+			value = value * 10 + (*it - '0');
+		}
+		if(value > 0xffffffffull)
+			return false;
+
+		count = (uint32_t)value;
+		return true;
+	}
+
+	/// @brief Returns the smallest number of bytes a binary element can take up, with every list empty.
+	uint64_t PlyMinElementSize(const PlyElement& element)
+	{
+		uint64_t size = 0;
+		for(std::vector<PlyProperty>::const_iterator it = element.properties.begin(); it != element.properties.end(); ++it)
+			size += PlyTypeSize(it->is_list ? it->count_type : it->type);
+		return size;
+	}
+
+	/// @brief Splits a header line into words.
+	void SplitWords(const char* begin, const char* end, std::vector<std::string>& words)
+	{
+		words.clear();
+		const char* p = begin;
+		for(SkipSpace(p, end); p < end; SkipSpace(p, end))
+		{
+			const char* word = p;
+			while(p < end && !IsSpace(*p))
+				++p;
+			words.push_back(std::string(word, p));
+		}
+	}
+
+	bool ParsePlyHeader(const char* text, size_t size, PlyHeader& header)
+	{
+		const char* p = text;
+		const char* end = text + size;
+
+		header.binary = false;
+		header.body = NULL;
+
+		std::vector<std::string> words;
+		bool first_line = true;
+		while(p < end)
+		{
+			const char* line_end = (const char*)memchr(p, '\n', end - p);
+			if(!line_end)
+				return false;
+
+			SplitWords(p, line_end, words);
+			p = line_end + 1;
+
+			if(first_line)
+			{
+				if(words.size() != 1 || words[0] != "ply")
+					return false;
+				first_line = false;
+			}
+			else if(words.empty() || words[0] == "comment" || words[0] == "obj_info")
+			{
+				continue;
+			}
+			else if(words[0] == "format" && words.size() >= 2)
+			{
+				if(words[1] == "binary_little_endian")
+				{
+					header.binary = true;
+				}
+				else if(words[1] != "ascii")
+				{
+					debug::Printf("mesh_importer: Unsupported PLY format '%s'.\n", words[1].c_str());
+					return false;
+				}
+			}
+			else if(words[0] == "element" && words.size() == 3)
+			{
+				PlyElement element;
+				element.name = words[1];
+				if(!ParsePlyCount(words[2], element.count))
+				{
+					debug::Printf("mesh_importer: Invalid PLY element count '%s'.\n", words[2].c_str());
+					return false;
+				}
+				header.elements.push_back(element);
+			}
+			else if(words[0] == "property" && !header.elements.empty())
+			{
+				PlyProperty property;
+				property.is_list = (words.size() == 5 && words[1] == "list");
+				if(property.is_list)
+				{
+					property.count_type = ParsePlyType(words[2]);
+					property.type = ParsePlyType(words[3]);
+					property.name = words[4];
+				}
+				else if(words.size() == 3)
+				{
+					property.count_type = PLY_INVALID;
+					property.type = ParsePlyType(words[1]);
+					property.name = words[2];
+				}
+				else
+				{
+					return false;
+				}
+
+				if(property.type == PLY_INVALID || (property.is_list && property.count_type == PLY_INVALID))
+					return false;
+				header.elements.back().properties.push_back(property);
+			}
+			else if(words[0] == "end_header")
+			{
+				header.body = p;
+				break;
+			}
+		}
+		if(!header.body)
+			return false;
+
+		// Find the properties we're interested in
+		const char* vertex_property_names[6] = { "x", "y", "z", "nx", "ny", "nz" };
+		header.vertex_element = header.face_element = header.face_indices = -1;
+		for(int i = 0; i < 6; ++i)
+			header.vertex_properties[i] = -1;
+
+		for(uint32_t e = 0; e < header.elements.size(); ++e)
+		{
+			const PlyElement& element = header.elements[e];
+			if(element.name == "vertex")
+			{
+				header.vertex_element = e;
+				for(uint32_t i = 0; i < element.properties.size(); ++i)
+				{
+					for(int k = 0; k < 6; ++k)
+					{
+						if(!element.properties[i].is_list && element.properties[i].name == vertex_property_names[k])
+							header.vertex_properties[k] = i;
+					}
+				}
+			}
+			else if(element.name == "face")
+			{
+				header.face_element = e;
+				for(uint32_t i = 0; i < element.properties.size(); ++i)
+				{
+					const PlyProperty& property = element.properties[i];
+					if(property.is_list && (property.name == "vertex_indices" || property.name == "vertex_index"))
+						header.face_indices = i;
+				}
+			}
+		}
+
+		return	header.vertex_element != -1 && header.face_element != -1 && header.face_indices != -1 &&
+				header.vertex_properties[0] != -1 && header.vertex_properties[1] != -1 && header.vertex_properties[2] != -1;
+	}
+
+	bool HasPlyNormals(const PlyHeader& header)
+	{
+		return header.vertex_properties[3] != -1 && header.vertex_properties[4] != -1 && header.vertex_properties[5] != -1;
+	}
+
+	/// @brief Adds a polygon to the triangle list as a fan.
+	/// @return False if the polygon refers to a vertex that doesn't exist.
+	bool AddPlyPolygon(const uint32_t* polygon, uint32_t count, uint32_t vertex_count, std::vector<uint32_t>& indices)
+	{
+		for(uint32_t k = 0; k < count; ++k)
+		{
+			if(polygon[k] >= vertex_count)
+				return false;
+		}
+		for(uint32_t k = 1; k + 1 < count; ++k)
+		{
+			indices.push_back(polygon[0]);
+			indices.push_back(polygon[k]);
+			indices.push_back(polygon[k + 1]);
+		}
+		return true;
+	}
+
+	struct PlyChunk
+	{
+		const char* begin;
+		const char* end;
+		uint32_t first_line; // Line number of the first line in the chunk, counted from the start of the body.
+
+		std::vector<uint32_t> indices; // Triangles of the faces within the chunk.
+		bool failed;
+	};
+
+	struct PlyAsciiJob
+	{
+		const PlyHeader* header;
+		std::vector<PlyChunk> chunks;
+		float* vertices; // Vertices are written straight to their final position, the chunks never overlap.
+		uint32_t vertex_count;
+	};
+
+	void CountPlyLines(void* data, uint32_t index)
+	{
+		PlyChunk& chunk = ((PlyAsciiJob*)data)->chunks[index];
+		uint32_t count = 0;
+		for(const char* p = chunk.begin; p < chunk.end; ++p)
+		{
+			if(*p == '\n')
+				++count;
+		}
+		chunk.first_line = count; // Turned into the first line number once all chunks are counted.
+	}
+
+	void ParsePlyAsciiChunk(void* data, uint32_t index)
+	{
+		PlyAsciiJob& job = *(PlyAsciiJob*)data;
+		PlyChunk& chunk = job.chunks[index];
+		const PlyHeader& header = *job.header;
+
+		// Find the element containing the first line of the chunk.
+		uint32_t element = 0;
+		uint32_t element_first_line = 0;
+		while(element < header.elements.size() && chunk.first_line >= element_first_line + header.elements[element].count)
+		{
+			element_first_line += header.elements[element].count;
+			++element;
+		}
+
+		std::vector<uint32_t> polygon;
+		const char* p = chunk.begin;
+		const char* end = chunk.end;
+		for(uint32_t line = chunk.first_line; p < end && element < header.elements.size() && !chunk.failed; ++line)
+		{
+			while(element < header.elements.size() && line >= element_first_line + header.elements[element].count)
+			{
+				element_first_line += header.elements[element].count;
+				++element;
+			}
+			if(element >= header.elements.size())
+				break;
+
+			const std::vector<PlyProperty>& properties = header.elements[element].properties;
+			if((int)element == header.vertex_element)
+			{
+				float* vertex = job.vertices + (size_t)(line - element_first_line) * 6;
+				for(uint32_t i = 0; i < properties.size() && !chunk.failed; ++i)
+				{
+					float value = 0.0f;
+					if(properties[i].is_list)
+					{
+						int count = 0;
+						chunk.failed = !ParseInt(p, end, count) || count < 0 || count > (int)ply_max_list_count;
+						for(int k = 0; k < count && !chunk.failed; ++k)
+							chunk.failed = !ParseFloat(p, end, value);
+						continue;
+					}
+
+					chunk.failed = !ParseFloat(p, end, value);
+					for(int k = 0; k < 6; ++k)
+					{
+						if(header.vertex_properties[k] == (int)i)
+							vertex[k] = value;
+					}
+				}
+			}
+			else if((int)element == header.face_element)
+			{
+				for(uint32_t i = 0; i < properties.size() && !chunk.failed; ++i)
+				{
+					if(!properties[i].is_list)
+					{
+						float value;
+						chunk.failed = !ParseFloat(p, end, value);
+						continue;
+					}
+
+					int count = 0;
+					chunk.failed = !ParseInt(p, end, count) || count < 0 || count > (int)ply_max_list_count;
+					polygon.clear();
+					for(int k = 0; k < count && !chunk.failed; ++k)
+					{
+						int vertex = 0;
+						chunk.failed = !ParseInt(p, end, vertex);
+						polygon.push_back((uint32_t)vertex);
+					}
+
+					if(!chunk.failed && (int)i == header.face_indices && count >= 3)
+						chunk.failed = !AddPlyPolygon(&polygon[0], count, job.vertex_count, chunk.indices);
+				}
+			}
+			SkipLine(p, end);
+		}
+	}
+
+	bool ImportPlyAscii(const PlyHeader& header, const char* end, ImportedMesh& mesh)
+	{
+		uint32_t vertex_count = header.elements[header.vertex_element].count;
+
+		PlyAsciiJob job;
+		job.header = &header;
+		job.vertices = NULL;
+		job.vertex_count = vertex_count;
+
+		std::vector<const char*> boundaries;
+		SplitLines(header.body, end, ChunkCount(end - header.body), boundaries);
+
+		uint32_t chunk_count = (uint32_t)boundaries.size() - 1;
+		job.chunks.resize(chunk_count);
+		for(uint32_t i = 0; i < chunk_count; ++i)
+		{
+			job.chunks[i].begin = boundaries[i];
+			job.chunks[i].end = boundaries[i + 1];
+			job.chunks[i].failed = false;
+		}
+
+		// Elements are identified by line number, so the lines are counted before the chunks can be parsed.
+		RunParallel(CountPlyLines, &job, chunk_count);
+		uint32_t line = 0;
+		for(uint32_t i = 0; i < chunk_count; ++i)
+		{
+			uint32_t count = job.chunks[i].first_line;
+			job.chunks[i].first_line = line;
+			line += count;
+		}
+
+		// Every element takes up a line, so counts beyond the number of lines are rejected before they're
+		//	trusted for any allocation.
+		uint64_t body_lines = line;
+		if(end > header.body && end[-1] != '\n')
+			++body_lines; // Last line without a line break
+
+		uint64_t element_lines = 0;
+		for(std::vector<PlyElement>::const_iterator it = header.elements.begin(); it != header.elements.end(); ++it)
+			element_lines += it->count;
+		if(element_lines > body_lines)
+		{
+			debug::Printf("mesh_importer: PLY header declares %llu elements but the body only has %llu lines.\n", 
+				(unsigned long long)element_lines, (unsigned long long)body_lines);
+			return false;
+		}
+
+		mesh.vertices.assign((size_t)vertex_count * 6, 0.0f);
+		job.vertices = vertex_count ? &mesh.vertices[0] : NULL;
+
+		RunParallel(ParsePlyAsciiChunk, &job, chunk_count);
+
+		mesh.indices.clear();
+		for(std::vector<PlyChunk>::iterator it = job.chunks.begin(); it != job.chunks.end(); ++it)
+		{
+			if(it->failed)
+			{
+				debug::Printf("mesh_importer: Invalid PLY data at line %u of the body.\n", it->first_line);
+				return false;
+			}
+			mesh.indices.insert(mesh.indices.end(), it->indices.begin(), it->indices.end());
+		}
+		return true;
+	}
+
+	/// Binary files have nothing to parse, so they're read on a single thread.
+	bool ImportPlyBinary(const PlyHeader& header, const char* end, ImportedMesh& mesh)
+	{
+		const uint8_t* p = (const uint8_t*)header.body;
+		const uint8_t* data_end = (const uint8_t*)end;
+
+		// The counts come straight from the file, so they're checked against the size of the data before 
+		//	they're trusted for any allocation.
+		uint64_t min_size = 0;
+		for(std::vector<PlyElement>::const_iterator it = header.elements.begin(); it != header.elements.end(); ++it)
+			min_size += it->count * PlyMinElementSize(*it);
+		if(min_size > (uint64_t)(data_end - p))
+		{
+			debug::Printf("mesh_importer: PLY header declares more elements than the file holds.\n");
+			return false;
+		}
+
+		uint32_t vertex_count = header.elements[header.vertex_element].count;
+		mesh.vertices.assign((size_t)vertex_count * 6, 0.0f);
+		mesh.indices.clear();
+
+		std::vector<uint32_t> polygon;
+		for(uint32_t e = 0; e < header.elements.size(); ++e)
+		{
+			const PlyElement& element = header.elements[e];
+			for(uint32_t n = 0; n < element.count; ++n)
+			{
+				for(uint32_t i = 0; i < element.properties.size(); ++i)
+				{
+					const PlyProperty& property = element.properties[i];
+					uint32_t count = 1;
+					if(property.is_list)
+					{
+						if(data_end - p < (ptrdiff_t)PlyTypeSize(property.count_type))
+							return false;
+						count = (uint32_t)ReadPlyValue(p, property.count_type);
+						if(count > ply_max_list_count)
+							return false;
+					}
+					// Checked in 64 bits, the count is read straight from the file.
+					if((uint64_t)PlyTypeSize(property.type) * count > (uint64_t)(data_end - p))
+						return false;
+
+					if((int)e == header.vertex_element && !property.is_list)
+					{
+						float value = (float)ReadPlyValue(p, property.type);
+						for(int k = 0; k < 6; ++k)
+						{
+							if(header.vertex_properties[k] == (int)i)
+								mesh.vertices[(size_t)n * 6 + k] = value;
+						}
+					}
+					else if((int)e == header.face_element && (int)i == header.face_indices)
+					{
+						polygon.resize(count);
+						for(uint32_t k = 0; k < count; ++k)
+							polygon[k] = (uint32_t)ReadPlyValue(p, property.type);
+
+						if(count >= 3 && !AddPlyPolygon(&polygon[0], count, vertex_count, mesh.indices))
+							return false;
+					}
+					else
+					{
+						p += PlyTypeSize(property.type) * count;
+					}
+				}
+			}
+		}
+		return true;
+	}
+
+	bool ImportPly(const char* text, size_t size, ImportedMesh& mesh)
+	{
+		PlyHeader header;
+		if(!ParsePlyHeader(text, size, header))
+		{
+			debug::Printf("mesh_importer: Invalid or unsupported PLY header.\n");
+			return false;
+		}
+
+		bool result = header.binary ?
+			ImportPlyBinary(header, text + size, mesh) : ImportPlyAscii(header, text + size, mesh);
+		if(!result)
+		{
+			debug::Printf("mesh_importer: Failed to read PLY data.\n");
+			return false;
+		}
+
+		if(!HasPlyNormals(header))
+			CalculateNormals(mesh);
+		return true;
+	}
+
+	// Binary cache
+
+	/// @brief 64-bit FNV-1a hash
+	uint64_t HashData(const uint8_t* data, size_t size)
+	{
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for(size_t i = 0; i < size; ++i)
+		{
+			hash ^= data[i];
+			hash *= 0x100000001b3ull;
+		}
+		return hash ? hash : 1; // 0 means the mesh wasn't imported
+	}
+
+	bool FileExists(const char* path)
+	{
+		FILE* file = fopen(path, "rb");
+		if(!file)
+			return false;
+		fclose(file);
+		return true;
+	}
+
+	bool HasExtension(const char* path, const char* extension)
+	{
+		const char* dot = strrchr(path, '.');
+		if(!dot)
+			return false;
+
+		for(++dot; *dot && *extension; ++dot, ++extension)
+		{
+			if(tolower(*dot) != *extension)
+				return false;
+		}
+		return *dot == '\0' && *extension == '\0';
+	}
+};
+
+
+bool mesh_importer::Import(const char* path, ImportedMesh& mesh)
+{
+	bool obj = HasExtension(path, "obj");
+	bool ply = HasExtension(path, "ply");
+	if(!obj && !ply)
+	{
+		debug::Printf("mesh_importer: Unknown file type '%s', expected .obj or .ply.\n", path);
+		return false;
+	}
+
+	MappedFile file;
+	if(!file.Open(path))
+		return false;
+
+	const char* text = (const char*)file.Data();
+	bool result = obj ? ImportObj(text, file.Size(), mesh) : ImportPly(text, file.Size(), mesh);
+	if(!result)
+	{
+		debug::Printf("mesh_importer: Failed to import '%s'.\n", path);
+		mesh.vertices.clear();
+		mesh.indices.clear();
+		return false;
+	}
+
+	mesh.source_hash = HashData(file.Data(), file.Size());
+	return true;
+}
+bool mesh_importer::OpenCache(const char* path, MeshFile& file)
+{
+	std::string cache_path = CachePath(path);
+	if(!FileExists(cache_path.c_str()))
+		return false;
+
+	MappedFile source;
+	if(!source.Open(path))
+		return false;
+
+	if(!file.Open(cache_path.c_str()))
+		return false;
+
+	if(file.GetHeader().source_hash != HashData(source.Data(), source.Size()))
+	{
+		file.Close(); // Outdated
+		return false;
+	}
+	return true;
+}
+std::string mesh_importer::CachePath(const char* path)
+{
+	return std::string(path) + ".mesh";
+}
@@ -0,0 +1,43 @@
+#ifndef __MESHIMPORTER_H__
+#define __MESHIMPORTER_H__
+
+class MeshFile;
+
+/// Mesh imported from a source file, in the VF_POSITION3F_NORMAL3F vertex format.
+struct ImportedMesh
+{
+	std::vector<float> vertices; // Position (Px, Py, Pz) followed by the normal (Nx, Ny, Nz) for each vertex.
+	std::vector<uint32_t> indices; // Triangle list
+
+	uint64_t source_hash; // Hash of the source file, tags the mesh cache built from the mesh.
+
+	ImportedMesh() : source_hash(0) {}
+
+	uint32_t VertexCount() const { return (uint32_t)vertices.size() / 6; }
+};
+
+/// @brief Imports triangle meshes from Wavefront OBJ and PLY files.
+///	Text files are split into chunks at line boundaries which are parsed in parallel, one thread per core.
+///	Polygons are triangulated as fans and vertices sharing both position and normal are merged. Meshes
+///	without normals get smooth normals calculated from the faces.
+///
+///	Importing is only the first step of preparing a mesh for rendering, so the importer doesn't cache
+///	anything itself. The caller writes the final mesh to a mesh file next to the source (see CachePath),
+///	tagged with ImportedMesh::source_hash, and opens it through OpenCache on later loads instead of
+///	importing the source again.
+namespace mesh_importer
+{
+	/// @brief Imports the specified OBJ or PLY file, the format is selected by the file extension.
+	/// @return False if the file couldn't be read or parsed.
+	bool Import(const char* path, ImportedMesh& mesh);
+
+	/// @brief Opens the mesh cache of the specified source file, if it was built from the current contents
+	///		of the source.
+	/// @return False if there is no cache or if the source have changed since the cache was written.
+	bool OpenCache(const char* path, MeshFile& file);
+
+	/// @brief Returns the path of the binary cache for the specified source file.
+	std::string CachePath(const char* path);
+};
+
+#endif // __MESHIMPORTER_H__
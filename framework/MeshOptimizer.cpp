@@ -0,0 +1,429 @@
+#include "Common.h"
+
+#include "MeshOptimizer.h"
+#include "FrameAllocator.h"
+
+#include <string.h>
+#include <algorithm>
+
+namespace
+{
+	// Parameters from Forsyth's article, tuned for an LRU cache of 32 entries.
+	const int forsyth_cache_size = 32;
+	const float forsyth_cache_decay_power = 1.5f;
+	const float forsyth_last_triangle_score = 0.75f;
+	const float forsyth_valence_boost_scale = 2.0f;
+	const float forsyth_valence_boost_power = 0.5f;
+
+	/// @brief Scores a vertex based on its position in the cache and the number of triangles still using it.
+	float VertexScore(int cache_position, uint32_t remaining_triangles)
+	{
+		if(remaining_triangles == 0)
+			return -1.0f; // No triangle needs this vertex anymore
+
+		float score = 0.0f;
+		if(cache_position >= 0)
+		{
+			if(cache_position < 3)
+			{
+				// The vertex was used by the last triangle, give it a fixed score to avoid favoring
+				//	triangles strictly following the last one.
+				score = forsyth_last_triangle_score;
+			}
+			else
+			{
+				float scaler = 1.0f / (forsyth_cache_size - 3);
+				score = powf(1.0f - (cache_position - 3) * scaler, forsyth_cache_decay_power);
+			}
+		}
+
+		// Boost vertices with few triangles left, so that lone triangles aren't left behind.
+		score += forsyth_valence_boost_scale * powf((float)remaining_triangles, -forsyth_valence_boost_power);
+		return score;
+	}
+
+	/// Cluster of triangles used when optimizing for overdraw.
+	struct Cluster
+	{
+		uint32_t first_triangle;
+		uint32_t triangle_count;
+		float sort_key;
+
+		bool operator<(const Cluster& other) const
+		{
+			// Descending, clusters facing outwards are drawn first.
+			return sort_key > other.sort_key;
+		}
+	};
+
+	const Vec3& VertexPosition(const void* vertices, uint32_t vertex_stride, uint32_t index)
+	{
+		return *(const Vec3*)((const uint8_t*)vertices + index * vertex_stride);
+	}
+
+	/// @brief Implements mesh_optimizer::AnalyzeVertexCache for both 16-bit and 32-bit indices.
+	template<typename IndexType>
+	mesh_optimizer::VertexCacheStats AnalyzeVertexCacheT(const IndexType* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size)
+	{
+		FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+		FrameAllocatorScope allocator_scope(allocator);
+
+		// Each vertex remembers when it entered the cache, a FIFO cache holds the last cache_size misses.
+		uint32_t* cache_timestamps = allocator.AllocateArray<uint32_t>(vertex_count);
+		memset(cache_timestamps, 0, vertex_count * sizeof(uint32_t));
+
+		uint32_t timestamp = cache_size + 1;
+		for(uint32_t i = 0; i < index_count; ++i)
+		{
+			IndexType index = indices[i];
+			assert(index < vertex_count);
+
+			if(timestamp - cache_timestamps[index] > cache_size)
+			{
+				cache_timestamps[index] = timestamp++;
+			}
+		}
+
+		mesh_optimizer::VertexCacheStats stats;
+		stats.transformed_vertices = timestamp - (cache_size + 1);
+		stats.acmr = (index_count >= 3) ? (float)stats.transformed_vertices / (float)(index_count / 3) : 0.0f;
+		stats.atvr = (vertex_count > 0) ? (float)stats.transformed_vertices / (float)vertex_count : 0.0f;
+		return stats;
+	}
+
+	/// @brief Implements mesh_optimizer::OptimizeVertexCache for both 16-bit and 32-bit indices.
+	template<typename IndexType>
+	void OptimizeVertexCacheT(IndexType* indices, uint32_t index_count, uint32_t vertex_count)
+	{
+		uint32_t triangle_count = index_count / 3;
+		if(triangle_count == 0)
+			return;
+
+		FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+		FrameAllocatorScope allocator_scope(allocator);
+
+		// Build the list of triangles using each vertex.
+		uint32_t* remaining = allocator.AllocateArray<uint32_t>(vertex_count); // Number of triangles not yet emitted.
+		uint32_t* first_adjacent = allocator.AllocateArray<uint32_t>(vertex_count); // Offset into the adjacency list.
+		uint32_t* adjacency = allocator.AllocateArray<uint32_t>(index_count);
+		memset(remaining, 0, vertex_count * sizeof(uint32_t));
+
+		for(uint32_t i = 0; i < index_count; ++i)
+		{
+			assert(indices[i] < vertex_count);
+			remaining[indices[i]]++;
+		}
+
+		uint32_t offset = 0;
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			first_adjacent[v] = offset;
+			offset += remaining[v];
+			remaining[v] = 0;
+		}
+		for(uint32_t t = 0; t < triangle_count; ++t)
+		{
+			for(int k = 0; k < 3; ++k)
+			{
+				IndexType v = indices[t*3+k];
+				adjacency[first_adjacent[v] + remaining[v]++] = t;
+			}
+		}
+
+		// Initial scores
+		float* vertex_score = allocator.AllocateArray<float>(vertex_count);
+		for(uint32_t v = 0; v < vertex_count; ++v)
+			vertex_score[v] = VertexScore(-1, remaining[v]);
+
+		float* triangle_score = allocator.AllocateArray<float>(triangle_count);
+		bool* triangle_emitted = allocator.AllocateArray<bool>(triangle_count);
+		int best_triangle = 0;
+		for(uint32_t t = 0; t < triangle_count; ++t)
+		{
+			triangle_score[t] = vertex_score[indices[t*3]] + vertex_score[indices[t*3+1]] + vertex_score[indices[t*3+2]];
+			triangle_emitted[t] = false;
+
+			if(triangle_score[t] > triangle_score[best_triangle])
+				best_triangle = t;
+		}
+
+		// The cache holds 3 extra entries, room for the vertices of a new triangle before the oldest are pushed out.
+		IndexType cache[forsyth_cache_size + 3];
+		IndexType new_cache[forsyth_cache_size + 3];
+		int cache_count = 0;
+
+		IndexType* output = allocator.AllocateArray<IndexType>(index_count);
+		for(uint32_t i = 0; i < triangle_count; ++i)
+		{
+			if(best_triangle < 0)
+			{
+				// None of the triangles using the cached vertices are left, fall back to searching all triangles.
+				float best_score = -1.0f;
+				for(uint32_t t = 0; t < triangle_count; ++t)
+				{
+					if(!triangle_emitted[t] && triangle_score[t] > best_score)
+					{
+						best_score = triangle_score[t];
+						best_triangle = t;
+					}
+				}
+			}
+
+			const IndexType* triangle = indices + best_triangle*3;
+			output[i*3] = triangle[0];
+			output[i*3+1] = triangle[1];
+			output[i*3+2] = triangle[2];
+			triangle_emitted[best_triangle] = true;
+
+			// Remove the triangle from the adjacency of its vertices.
+			for(int k = 0; k < 3; ++k)
+			{
+				IndexType v = triangle[k];
+				uint32_t* adjacent = adjacency + first_adjacent[v];
+				for(uint32_t a = 0; a < remaining[v]; ++a)
+				{
+					if(adjacent[a] == (uint32_t)best_triangle)
+					{
+						adjacent[a] = adjacent[remaining[v] - 1];
+						break;
+					}
+				}
+				remaining[v]--;
+			}
+
+			// The vertices of the triangle move to the front of the cache, followed by the previous entries.
+			int new_cache_count = 0;
+			for(int k = 0; k < 3; ++k)
+				new_cache[new_cache_count++] = triangle[k];
+			for(int c = 0; c < cache_count; ++c)
+			{
+				IndexType v = cache[c];
+				if(v != triangle[0] && v != triangle[1] && v != triangle[2])
+					new_cache[new_cache_count++] = v;
+			}
+
+			// Vertices pushed out of the cache loses their cache score.
+			for(int c = forsyth_cache_size; c < new_cache_count; ++c)
+				vertex_score[new_cache[c]] = VertexScore(-1, remaining[new_cache[c]]);
+			cache_count = std::min(new_cache_count, forsyth_cache_size);
+			memcpy(cache, new_cache, cache_count * sizeof(IndexType));
+
+			// Rescore the cached vertices and their triangles, the next triangle is picked among these.
+			for(int c = 0; c < cache_count; ++c)
+				vertex_score[cache[c]] = VertexScore(c, remaining[cache[c]]);
+
+			best_triangle = -1;
+			float best_score = -1.0f;
+			for(int c = 0; c < cache_count; ++c)
+			{
+				IndexType v = cache[c];
+				const uint32_t* adjacent = adjacency + first_adjacent[v];
+				for(uint32_t a = 0; a < remaining[v]; ++a)
+				{
+					uint32_t t = adjacent[a];
+					triangle_score[t] = vertex_score[indices[t*3]] + vertex_score[indices[t*3+1]] + vertex_score[indices[t*3+2]];
+					if(triangle_score[t] > best_score)
+					{
+						best_score = triangle_score[t];
+						best_triangle = t;
+					}
+				}
+			}
+		}
+
+		memcpy(indices, output, index_count * sizeof(IndexType));
+	}
+
+	/// @brief Implements mesh_optimizer::OptimizeOverdraw for both 16-bit and 32-bit indices.
+	template<typename IndexType>
+	void OptimizeOverdrawT(IndexType* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride, float threshold)
+	{
+		uint32_t triangle_count = index_count / 3;
+		if(triangle_count == 0)
+			return;
+
+		FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+		FrameAllocatorScope allocator_scope(allocator);
+
+		mesh_optimizer::VertexCacheStats original_stats = AnalyzeVertexCacheT(indices, index_count, vertex_count, (uint32_t)mesh_optimizer::DEFAULT_CACHE_SIZE);
+
+		// Split the triangles into clusters, a new cluster starts at every triangle where all three vertices
+		//	miss the cache. Reordering clusters at these points doesn't break the cache locality within them.
+		std::vector<Cluster> clusters;
+
+		uint32_t* cache_timestamps = allocator.AllocateArray<uint32_t>(vertex_count);
+		memset(cache_timestamps, 0, vertex_count * sizeof(uint32_t));
+		uint32_t timestamp = mesh_optimizer::DEFAULT_CACHE_SIZE + 1;
+
+		for(uint32_t t = 0; t < triangle_count; ++t)
+		{
+			int misses = 0;
+			for(int k = 0; k < 3; ++k)
+			{
+				IndexType v = indices[t*3+k];
+				if(timestamp - cache_timestamps[v] > mesh_optimizer::DEFAULT_CACHE_SIZE)
+				{
+					cache_timestamps[v] = timestamp++;
+					++misses;
+				}
+			}
+
+			if(t == 0 || misses == 3)
+			{
+				Cluster cluster;
+				cluster.first_triangle = t;
+				cluster.triangle_count = 0;
+				cluster.sort_key = 0.0f;
+				clusters.push_back(cluster);
+			}
+			clusters.back().triangle_count++;
+		}
+
+		if(clusters.size() < 2)
+			return;
+
+		// The center of the mesh, weighted by triangle area.
+		Vec3 mesh_center(0.0f, 0.0f, 0.0f);
+		float mesh_area = 0.0f;
+		for(uint32_t t = 0; t < triangle_count; ++t)
+		{
+			const Vec3& p0 = VertexPosition(vertices, vertex_stride, indices[t*3]);
+			const Vec3& p1 = VertexPosition(vertices, vertex_stride, indices[t*3+1]);
+			const Vec3& p2 = VertexPosition(vertices, vertex_stride, indices[t*3+2]);
+
+			float area = vector::Length(vector::Cross(vector::Subtract(p1, p0), vector::Subtract(p2, p0)));
+			Vec3 triangle_center = vector::Add(vector::Add(p0, p1), p2);
+			mesh_center = vector::Add(mesh_center, vector::Multiply(triangle_center, area / 3.0f));
+			mesh_area += area;
+		}
+		if(mesh_area > 0.0f)
+			mesh_center = vector::Multiply(mesh_center, 1.0f / mesh_area);
+
+		// Clusters are sorted by how far out they are along their average normal, those are more likely to
+		//	occlude the rest of the mesh.
+		for(std::vector<Cluster>::iterator it = clusters.begin(); it != clusters.end(); ++it)
+		{
+			Vec3 center(0.0f, 0.0f, 0.0f);
+			Vec3 normal(0.0f, 0.0f, 0.0f);
+			float area = 0.0f;
+			for(uint32_t t = it->first_triangle; t < it->first_triangle + it->triangle_count; ++t)
+			{
+				const Vec3& p0 = VertexPosition(vertices, vertex_stride, indices[t*3]);
+				const Vec3& p1 = VertexPosition(vertices, vertex_stride, indices[t*3+1]);
+				const Vec3& p2 = VertexPosition(vertices, vertex_stride, indices[t*3+2]);
+
+				Vec3 n = vector::Cross(vector::Subtract(p1, p0), vector::Subtract(p2, p0)); // Length is twice the area of the triangle
+				float triangle_area = vector::Length(n);
+
+				Vec3 triangle_center = vector::Add(vector::Add(p0, p1), p2);
+				center = vector::Add(center, vector::Multiply(triangle_center, triangle_area / 3.0f));
+				normal = vector::Add(normal, n);
+				area += triangle_area;
+			}
+
+			float normal_length = vector::Length(normal);
+			if(area > 0.0f && normal_length > 0.0f)
+			{
+				center = vector::Multiply(center, 1.0f / area);
+				it->sort_key = vector::Dot(vector::Subtract(center, mesh_center), normal) / normal_length;
+			}
+		}
+
+		std::stable_sort(clusters.begin(), clusters.end());
+
+		IndexType* output = allocator.AllocateArray<IndexType>(index_count);
+		uint32_t output_count = 0;
+		for(std::vector<Cluster>::iterator it = clusters.begin(); it != clusters.end(); ++it)
+		{
+			uint32_t count = it->triangle_count * 3;
+			memcpy(output + output_count, indices + it->first_triangle * 3, count * sizeof(IndexType));
+			output_count += count;
+		}
+		// Any trailing indices not forming a triangle are kept as they are.
+		memcpy(output + output_count, indices + output_count, (index_count - output_count) * sizeof(IndexType));
+
+		mesh_optimizer::VertexCacheStats stats = AnalyzeVertexCacheT(output, index_count, vertex_count, (uint32_t)mesh_optimizer::DEFAULT_CACHE_SIZE);
+		if(stats.acmr <= original_stats.acmr * threshold)
+		{
+			memcpy(indices, output, index_count * sizeof(IndexType));
+		}
+	}
+
+	/// @brief Implements mesh_optimizer::OptimizeVertexFetch for both 16-bit and 32-bit indices.
+	template<typename IndexType>
+	uint32_t OptimizeVertexFetchT(void* vertices, uint32_t vertex_count, uint32_t vertex_size, IndexType* indices, uint32_t index_count)
+	{
+		FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+		FrameAllocatorScope allocator_scope(allocator);
+
+		// The remap is kept in 32 bits, so that no 16-bit index can collide with the unused marker.
+		const uint32_t unused = 0xffffffff;
+
+		uint32_t* remap = allocator.AllocateArray<uint32_t>(vertex_count);
+		for(uint32_t v = 0; v < vertex_count; ++v)
+			remap[v] = unused;
+
+		uint8_t* source = allocator.AllocateArray<uint8_t>(vertex_count * vertex_size);
+		memcpy(source, vertices, vertex_count * vertex_size);
+
+		// Vertices are assigned new positions in the order they're first referenced.
+		uint32_t new_vertex_count = 0;
+		for(uint32_t i = 0; i < index_count; ++i)
+		{
+			IndexType index = indices[i];
+			assert(index < vertex_count);
+
+			if(remap[index] == unused)
+			{
+				assert(new_vertex_count < vertex_count);
+				remap[index] = new_vertex_count;
+				memcpy((uint8_t*)vertices + new_vertex_count * vertex_size, source + index * vertex_size, vertex_size);
+				++new_vertex_count;
+			}
+			indices[i] = (IndexType)remap[index];
+		}
+		assert(new_vertex_count <= vertex_count);
+		return new_vertex_count;
+	}
+};
+
+
+mesh_optimizer::VertexCacheStats mesh_optimizer::AnalyzeVertexCache(const uint16_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size)
+{
+	return AnalyzeVertexCacheT(indices, index_count, vertex_count, cache_size);
+}
+
+mesh_optimizer::VertexCacheStats mesh_optimizer::AnalyzeVertexCache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size)
+{
+	return AnalyzeVertexCacheT(indices, index_count, vertex_count, cache_size);
+}
+
+void mesh_optimizer::OptimizeVertexCache(uint16_t* indices, uint32_t index_count, uint32_t vertex_count)
+{
+	OptimizeVertexCacheT(indices, index_count, vertex_count);
+}
+
+void mesh_optimizer::OptimizeVertexCache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count)
+{
+	OptimizeVertexCacheT(indices, index_count, vertex_count);
+}
+
+void mesh_optimizer::OptimizeOverdraw(uint16_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride, float threshold)
+{
+	OptimizeOverdrawT(indices, index_count, vertices, vertex_count, vertex_stride, threshold);
+}
+
+void mesh_optimizer::OptimizeOverdraw(uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride, float threshold)
+{
+	OptimizeOverdrawT(indices, index_count, vertices, vertex_count, vertex_stride, threshold);
+}
+
+uint32_t mesh_optimizer::OptimizeVertexFetch(void* vertices, uint32_t vertex_count, uint32_t vertex_size, uint16_t* indices, uint32_t index_count)
+{
+	return OptimizeVertexFetchT(vertices, vertex_count, vertex_size, indices, index_count);
+}
+
+uint32_t mesh_optimizer::OptimizeVertexFetch(void* vertices, uint32_t vertex_count, uint32_t vertex_size, uint32_t* indices, uint32_t index_count)
+{
+	return OptimizeVertexFetchT(vertices, vertex_count, vertex_size, indices, index_count);
+}
@@ -0,0 +1,52 @@
+#ifndef __MESHOPTIMIZER_H__
+#define __MESHOPTIMIZER_H__
+
+/// @brief Utilities for reordering indexed triangle lists so that they render faster. The passes are meant
+///	to be run in order before the mesh is uploaded: OptimizeVertexCache, OptimizeOverdraw and lastly
+///	OptimizeVertexFetch, as each pass builds on the order produced by the previous one. Every pass comes in
+///	a 16-bit and a 32-bit index version, the latter for meshes with more than 65536 vertices.
+namespace mesh_optimizer
+{
+	enum { DEFAULT_CACHE_SIZE = 16 };
+
+	/// Statistics for the post-transform vertex cache when rendering a mesh.
+	struct VertexCacheStats
+	{
+		uint32_t transformed_vertices; // Number of cache misses, i.e. vertices passed through the vertex shader.
+		float acmr; // Average cache miss ratio: transformed vertices per triangle, 0.5 is the best possible.
+		float atvr; // Average transformed vertex ratio: transformed vertices per vertex, 1.0 is the best possible.
+	};
+
+	/// @brief Simulates a FIFO post-transform cache for the specified triangle list.
+	/// @param vertex_count Number of vertices referenced by the indices.
+	/// @param cache_size Number of entries in the simulated cache.
+	VertexCacheStats AnalyzeVertexCache(const uint16_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size = DEFAULT_CACHE_SIZE);
+	VertexCacheStats AnalyzeVertexCache(const uint32_t* indices, uint32_t index_count, uint32_t vertex_count, uint32_t cache_size = DEFAULT_CACHE_SIZE);
+
+	/// @brief Reorders the triangles for post-transform vertex cache locality, using Tom Forsyth's
+	///	"Linear-Speed Vertex Cache Optimisation". The triangles are reordered in place.
+	/// @param vertex_count Number of vertices referenced by the indices.
+	void OptimizeVertexCache(uint16_t* indices, uint32_t index_count, uint32_t vertex_count);
+	void OptimizeVertexCache(uint32_t* indices, uint32_t index_count, uint32_t vertex_count);
+
+	/// @brief Reorders the triangles to reduce overdraw, based on the clustering in Sander et al. "Fast
+	///	Triangle Reordering for Vertex Locality and Reduced Overdraw". The triangle list is split into
+	///	clusters at cache boundaries, which are sorted so that clusters facing away from the center of the
+	///	mesh are drawn first. Call this after OptimizeVertexCache, the order within clusters is kept.
+	/// @param vertices Vertex data, each vertex needs to start with its position as 3 floats.
+	/// @param vertex_stride Size of a vertex in bytes.
+	/// @param threshold The largest allowed increase in ACMR, e.g. 1.05 allows 5%. The order is left
+	///		untouched if sorting the clusters would degrade vertex cache efficiency more than this.
+	void OptimizeOverdraw(uint16_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride, float threshold = 1.05f);
+	void OptimizeOverdraw(uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride, float threshold = 1.05f);
+
+	/// @brief Reorders the vertices in the order they're first referenced by the indices, improving
+	///	locality when fetching vertices. The indices are remapped and vertices never referenced are removed.
+	/// @param vertices Vertex data, reordered in place.
+	/// @param vertex_size Size of a vertex in bytes.
+	/// @return The new number of vertices.
+	uint32_t OptimizeVertexFetch(void* vertices, uint32_t vertex_count, uint32_t vertex_size, uint16_t* indices, uint32_t index_count);
+	uint32_t OptimizeVertexFetch(void* vertices, uint32_t vertex_count, uint32_t vertex_size, uint32_t* indices, uint32_t index_count);
+};
+
+#endif // __MESHOPTIMIZER_H__
@@ -0,0 +1,538 @@
+#include "Common.h"
+
+#include "MeshSimplifier.h"
+
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+namespace
+{
+	/// Weight of the planes keeping border edges in place, relative to the faces.
+	const float border_weight = 10.0f;
+
+	/// Levels need to have less than this fraction of the indices of the previous level to be worth keeping.
+	const float min_lod_reduction = 0.95f;
+
+	/// Collapses are rejected if they turn a triangle more than this, as the cosine of the angle.
+	const float max_flip_cosine = 0.25f;
+
+	enum VertexKind
+	{
+		VK_MANIFOLD, // Free to collapse onto any neighbour.
+		VK_BORDER, // On an open border, only collapses along the border.
+		VK_LOCKED // On a seam or non-manifold, never collapsed.
+	};
+
+	/// Sum of squared distances to a set of planes, stored as the symmetric matrix A, the vector b and c.
+	///	The error for a position p is p'Ap + 2b'p + c.
+	struct Quadric
+	{
+		double a00, a11, a22, a01, a02, a12;
+		double b0, b1, b2;
+		double c;
+		double weight; // Sum of the plane weights, used to turn the error into an average.
+
+		Quadric() : a00(0), a11(0), a22(0), a01(0), a02(0), a12(0), b0(0), b1(0), b2(0), c(0), weight(0) {}
+	};
+
+	/// @brief Adds the plane dot(normal, p) + distance = 0 to the quadric.
+	void AddPlane(Quadric& q, const Vec3& normal, float distance, double weight)
+	{
+		double x = normal.x, y = normal.y, z = normal.z, d = distance;
+
+		q.a00 += weight * x * x;
+		q.a11 += weight * y * y;
+		q.a22 += weight * z * z;
+		q.a01 += weight * x * y;
+		q.a02 += weight * x * z;
+		q.a12 += weight * y * z;
+		q.b0 += weight * x * d;
+		q.b1 += weight * y * d;
+		q.b2 += weight * z * d;
+		q.c += weight * d * d;
+		q.weight += weight;
+	}
+
+	void AddQuadric(Quadric& q, const Quadric& other)
+	{
+		q.a00 += other.a00;
+		q.a11 += other.a11;
+		q.a22 += other.a22;
+		q.a01 += other.a01;
+		q.a02 += other.a02;
+		q.a12 += other.a12;
+		q.b0 += other.b0;
+		q.b1 += other.b1;
+		q.b2 += other.b2;
+		q.c += other.c;
+		q.weight += other.weight;
+	}
+
+	/// @brief Returns the root mean square distance from the position to the planes of the quadric.
+	float QuadricError(const Quadric& q, const Vec3& p)
+	{
+		if(q.weight <= 0.0)
+			return 0.0f;
+
+		double x = p.x, y = p.y, z = p.z;
+		double error =	q.a00 * x * x + q.a11 * y * y + q.a22 * z * z +
+						2.0 * (q.a01 * x * y + q.a02 * x * z + q.a12 * y * z) +
+						2.0 * (q.b0 * x + q.b1 * y + q.b2 * z) + q.c;
+
+		return (float)sqrt(std::max(error / q.weight, 0.0));
+	}
+
+	const Vec3& VertexPosition(const void* vertices, uint32_t vertex_stride, uint32_t index)
+	{
+		return *(const Vec3*)((const uint8_t*)vertices + index * vertex_stride);
+	}
+
+	/// @brief Maps every vertex to the first vertex with the same position, welding vertices that were only
+	///		split because of their attributes.
+	void BuildPositionRemap(const void* vertices, uint32_t vertex_count, uint32_t vertex_stride, std::vector<uint32_t>& remap)
+	{
+		uint32_t bits = 4;
+		while((1u << bits) < vertex_count * 2)
+			++bits;
+
+		const uint32_t empty_slot = ~0u;
+		uint32_t mask = (1u << bits) - 1;
+		std::vector<uint32_t> table(1u << bits, empty_slot);
+
+		remap.resize(vertex_count);
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			const Vec3& position = VertexPosition(vertices, vertex_stride, v);
+
+			uint32_t bits_xyz[3];
+			memcpy(bits_xyz, &position, sizeof(bits_xyz));
+			uint32_t hash = (bits_xyz[0] * 73856093u) ^ (bits_xyz[1] * 19349663u) ^ (bits_xyz[2] * 83492791u);
+
+			uint32_t slot = (hash * 0x9e3779b1u) >> (32 - bits);
+			while(table[slot] != empty_slot && memcmp(&VertexPosition(vertices, vertex_stride, table[slot]), &position, sizeof(Vec3)) != 0)
+				slot = (slot + 1) & mask;
+
+			if(table[slot] == empty_slot)
+				table[slot] = v;
+			remap[v] = table[slot];
+		}
+	}
+
+	uint64_t EdgeKey(uint32_t a, uint32_t b)
+	{
+		return ((uint64_t)a << 32) | b;
+	}
+
+	/// Directed edges of the triangles, between welded vertices.
+	class EdgeSet
+	{
+	public:
+		void Build(const std::vector<uint32_t>& indices, const std::vector<uint32_t>& remap)
+		{
+			_edges.clear();
+			_edges.reserve(indices.size());
+			for(size_t i = 0; i < indices.size(); i += 3)
+			{
+				for(int k = 0; k < 3; ++k)
+					_edges.push_back(EdgeKey(remap[indices[i + k]], remap[indices[i + (k + 1) % 3]]));
+			}
+			std::sort(_edges.begin(), _edges.end());
+		}
+
+		bool HasEdge(uint32_t a, uint32_t b) const
+		{
+			return std::binary_search(_edges.begin(), _edges.end(), EdgeKey(a, b));
+		}
+
+		/// @brief An edge is on the border if only one triangle uses it.
+		bool IsBorder(uint32_t a, uint32_t b) const
+		{
+			return HasEdge(a, b) != HasEdge(b, a);
+		}
+
+		const std::vector<uint64_t>& Edges() const
+		{
+			return _edges;
+		}
+
+	private:
+		std::vector<uint64_t> _edges; // Sorted
+	};
+
+	/// @brief Classifies the welded vertices by the edges around them.
+	/// @param seams Specifies which welded vertices have more than one set of attributes.
+	void ClassifyVertices(const EdgeSet& edge_set, const std::vector<bool>& seams, std::vector<uint8_t>& kinds)
+	{
+		const std::vector<uint64_t>& edges = edge_set.Edges();
+		uint32_t vertex_count = (uint32_t)seams.size();
+
+		std::vector<uint8_t> border_edges(vertex_count, 0);
+		kinds.assign(vertex_count, VK_MANIFOLD);
+		for(size_t i = 0; i < edges.size(); ++i)
+		{
+			uint32_t a = (uint32_t)(edges[i] >> 32);
+			uint32_t b = (uint32_t)edges[i];
+
+			// The same directed edge in more than one triangle means the mesh isn't manifold.
+			if(i + 1 < edges.size() && edges[i + 1] == edges[i])
+				kinds[a] = kinds[b] = VK_LOCKED;
+
+			if(!edge_set.HasEdge(b, a))
+			{
+				border_edges[a] = (uint8_t)std::min(border_edges[a] + 1, 255);
+				border_edges[b] = (uint8_t)std::min(border_edges[b] + 1, 255);
+			}
+		}
+
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			if(seams[v])
+				kinds[v] = VK_LOCKED;
+			else if(border_edges[v] && kinds[v] != VK_LOCKED)
+				kinds[v] = (border_edges[v] == 2) ? VK_BORDER : VK_LOCKED; // More than one border passes through the vertex
+		}
+	}
+
+	/// Collapse of the vertex v0 onto the vertex v1.
+	struct Collapse
+	{
+		uint32_t v0;
+		uint32_t v1;
+		float error;
+
+		bool operator<(const Collapse& other) const
+		{
+			return error < other.error;
+		}
+	};
+
+	/// Triangles using each vertex, as ranges in a shared list.
+	struct VertexTriangles
+	{
+		std::vector<uint32_t> offsets; // First entry for each vertex, the last element is the total count.
+		std::vector<uint32_t> triangles;
+
+		void Build(const std::vector<uint32_t>& indices, uint32_t vertex_count)
+		{
+			offsets.assign(vertex_count + 1, 0);
+			for(size_t i = 0; i < indices.size(); ++i)
+				offsets[indices[i] + 1]++;
+			for(uint32_t v = 0; v < vertex_count; ++v)
+				offsets[v + 1] += offsets[v];
+
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			triangles.resize(indices.size());
+			for(size_t i = 0; i < indices.size(); ++i)
+				triangles[fill[indices[i]]++] = (uint32_t)(i / 3);
+		}
+	};
+
+	struct SimplifyState
+	{
+		const void* vertices;
+		uint32_t vertex_stride;
+
+		std::vector<uint32_t> remap; // Welded vertex for each vertex.
+		std::vector<bool> seams; // For each welded vertex, whether it's shared by vertices with different attributes.
+		std::vector<Quadric> quadrics; // For each welded vertex.
+
+		std::vector<uint32_t> indices;
+		EdgeSet edges;
+		std::vector<uint8_t> kinds; // VertexKind for each welded vertex.
+		VertexTriangles vertex_triangles;
+	};
+
+	Vec3 TriangleNormal(const Vec3& p0, const Vec3& p1, const Vec3& p2)
+	{
+		return vector::Cross(vector::Subtract(p1, p0), vector::Subtract(p2, p0));
+	}
+
+	void InitializeQuadrics(SimplifyState& state, uint32_t vertex_count)
+	{
+		state.quadrics.assign(vertex_count, Quadric());
+
+		const std::vector<uint32_t>& indices = state.indices;
+		for(size_t i = 0; i < indices.size(); i += 3)
+		{
+			Vec3 p[3];
+			for(int k = 0; k < 3; ++k)
+				p[k] = VertexPosition(state.vertices, state.vertex_stride, indices[i + k]);
+
+			Vec3 normal = TriangleNormal(p[0], p[1], p[2]);
+			float length = vector::Length(normal);
+			if(length == 0.0f)
+				continue;
+			normal = vector::Multiply(normal, 1.0f / length);
+
+			// Weighted by area so that small triangles don't dominate
+			float distance = -vector::Dot(normal, p[0]);
+			for(int k = 0; k < 3; ++k)
+				AddPlane(state.quadrics[state.remap[indices[i + k]]], normal, distance, length * 0.5f);
+
+			// Border edges get a plane perpendicular to the triangle, which keeps them from moving inwards.
+			for(int k = 0; k < 3; ++k)
+			{
+				uint32_t a = state.remap[indices[i + k]];
+				uint32_t b = state.remap[indices[i + (k + 1) % 3]];
+				if(!state.edges.IsBorder(a, b))
+					continue;
+
+				Vec3 edge = vector::Subtract(p[(k + 1) % 3], p[k]);
+				Vec3 edge_normal = vector::Cross(edge, normal);
+				float edge_length = vector::Length(edge_normal);
+				if(edge_length == 0.0f)
+					continue;
+				edge_normal = vector::Multiply(edge_normal, 1.0f / edge_length);
+
+				float edge_distance = -vector::Dot(edge_normal, p[k]);
+				double weight = vector::Dot(edge, edge) * border_weight;
+				AddPlane(state.quadrics[a], edge_normal, edge_distance, weight);
+				AddPlane(state.quadrics[b], edge_normal, edge_distance, weight);
+			}
+		}
+	}
+
+	bool CanCollapse(const SimplifyState& state, uint32_t v0, uint32_t v1)
+	{
+		uint32_t w0 = state.remap[v0];
+		uint32_t w1 = state.remap[v1];
+		if(w0 == w1)
+			return false;
+
+		switch(state.kinds[w0])
+		{
+		case VK_MANIFOLD:
+			return true;
+		case VK_BORDER:
+			return state.kinds[w1] != VK_MANIFOLD && state.edges.IsBorder(w0, w1);
+		default:
+			return false;
+		};
+	}
+
+	/// @brief Checks whether moving v0 onto v1 would flip any of the triangles around v0 that remain.
+	bool HasTriangleFlips(const SimplifyState& state, uint32_t v0, uint32_t v1)
+	{
+		const Vec3& target = VertexPosition(state.vertices, state.vertex_stride, v1);
+		uint32_t w1 = state.remap[v1];
+
+		for(uint32_t t = state.vertex_triangles.offsets[v0]; t < state.vertex_triangles.offsets[v0 + 1]; ++t)
+		{
+			const uint32_t* triangle = &state.indices[state.vertex_triangles.triangles[t] * 3];
+			if(state.remap[triangle[0]] == w1 || state.remap[triangle[1]] == w1 || state.remap[triangle[2]] == w1)
+				continue; // Removed by the collapse
+
+			Vec3 p[3];
+			Vec3 moved[3];
+			for(int k = 0; k < 3; ++k)
+			{
+				p[k] = VertexPosition(state.vertices, state.vertex_stride, triangle[k]);
+				moved[k] = (triangle[k] == v0) ? target : p[k];
+			}
+
+			Vec3 before = TriangleNormal(p[0], p[1], p[2]);
+			Vec3 after = TriangleNormal(moved[0], moved[1], moved[2]);
+			if(vector::Dot(before, after) < max_flip_cosine * vector::Length(before) * vector::Length(after))
+				return true;
+		}
+		return false;
+	}
+
+	/// @brief Collapses the cheapest edges that don't affect each other.
+	/// @return Number of collapses performed.
+	uint32_t CollapseEdges(SimplifyState& state, uint32_t triangles_to_remove, float target_error, float& result_error)
+	{
+		uint32_t vertex_count = (uint32_t)state.remap.size();
+		std::vector<uint32_t>& indices = state.indices;
+
+		// One candidate for each edge, in the cheaper of the directions allowed. Interior edges are shared
+		//	by two triangles, only the one going from the lower to the higher vertex is used.
+		std::vector<Collapse> collapses;
+		collapses.reserve(indices.size() / 2);
+		for(size_t i = 0; i < indices.size(); i += 3)
+		{
+			for(int k = 0; k < 3; ++k)
+			{
+				uint32_t a = indices[i + k];
+				uint32_t b = indices[i + (k + 1) % 3];
+				uint32_t wa = state.remap[a];
+				uint32_t wb = state.remap[b];
+				if(wa > wb && state.edges.HasEdge(wb, wa))
+					continue;
+
+				Quadric quadric = state.quadrics[wa];
+				AddQuadric(quadric, state.quadrics[wb]);
+
+				Collapse collapse;
+				collapse.error = FLT_MAX;
+				for(int direction = 0; direction < 2; ++direction)
+				{
+					uint32_t v0 = direction ? b : a;
+					uint32_t v1 = direction ? a : b;
+					if(!CanCollapse(state, v0, v1))
+						continue;
+
+					float error = QuadricError(quadric, VertexPosition(state.vertices, state.vertex_stride, v1));
+					if(error < collapse.error)
+					{
+						collapse.v0 = v0;
+						collapse.v1 = v1;
+						collapse.error = error;
+					}
+				}
+				if(collapse.error != FLT_MAX)
+					collapses.push_back(collapse);
+			}
+		}
+		std::sort(collapses.begin(), collapses.end());
+
+		state.vertex_triangles.Build(indices, vertex_count);
+
+		// Vertices around a collapse are locked for the rest of the pass, as their triangles have changed.
+		std::vector<bool> locked(vertex_count, false);
+		std::vector<uint32_t> collapse_remap(vertex_count);
+		for(uint32_t v = 0; v < vertex_count; ++v)
+			collapse_remap[v] = v;
+
+		uint32_t collapse_count = 0;
+		uint32_t removed_triangles = 0;
+		for(std::vector<Collapse>::iterator it = collapses.begin(); it != collapses.end() && removed_triangles < triangles_to_remove; ++it)
+		{
+			if(it->error > target_error)
+				break; // Sorted, so every remaining collapse is worse
+
+			uint32_t w0 = state.remap[it->v0];
+			uint32_t w1 = state.remap[it->v1];
+			if(locked[w0] || locked[w1])
+				continue;
+
+			if(HasTriangleFlips(state, it->v0, it->v1))
+				continue;
+
+			collapse_remap[it->v0] = it->v1;
+			AddQuadric(state.quadrics[w1], state.quadrics[w0]);
+			result_error = std::max(result_error, it->error);
+			++collapse_count;
+
+			for(uint32_t t = state.vertex_triangles.offsets[it->v0]; t < state.vertex_triangles.offsets[it->v0 + 1]; ++t)
+			{
+				const uint32_t* triangle = &indices[state.vertex_triangles.triangles[t] * 3];
+				bool removed = false;
+				for(int k = 0; k < 3; ++k)
+				{
+					locked[state.remap[triangle[k]]] = true;
+					removed = removed || (state.remap[triangle[k]] == w1);
+				}
+				if(removed)
+					++removed_triangles;
+			}
+		}
+
+		// Apply the collapses and drop the triangles that became degenerate.
+		size_t write = 0;
+		for(size_t i = 0; i < indices.size(); i += 3)
+		{
+			uint32_t a = collapse_remap[indices[i]];
+			uint32_t b = collapse_remap[indices[i + 1]];
+			uint32_t c = collapse_remap[indices[i + 2]];
+
+			uint32_t wa = state.remap[a], wb = state.remap[b], wc = state.remap[c];
+			if(wa == wb || wb == wc || wa == wc)
+				continue;
+
+			indices[write++] = a;
+			indices[write++] = b;
+			indices[write++] = c;
+		}
+		indices.resize(write);
+
+		return collapse_count;
+	}
+
+	void InitializeState(SimplifyState& state, const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count,
+		uint32_t vertex_stride)
+	{
+		assert(index_count % 3 == 0);
+
+		state.vertices = vertices;
+		state.vertex_stride = vertex_stride;
+		state.indices.assign(indices, indices + index_count);
+
+		BuildPositionRemap(vertices, vertex_count, vertex_stride, state.remap);
+
+		// Positions shared by more than one vertex are on an attribute seam.
+		state.seams.assign(vertex_count, false);
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			if(state.remap[v] != v)
+				state.seams[state.remap[v]] = true;
+		}
+
+		state.edges.Build(state.indices, state.remap);
+		InitializeQuadrics(state, vertex_count);
+	}
+
+	/// @brief Collapses edges until the target index count or the target error is reached.
+	/// @param error The largest error so far, updated with the errors of the new collapses.
+	void Reduce(SimplifyState& state, uint32_t target_index_count, float target_error, float& error)
+	{
+		while(state.indices.size() > target_index_count)
+		{
+			// The topology changes with every pass, borders can appear where triangles were removed.
+			state.edges.Build(state.indices, state.remap);
+			ClassifyVertices(state.edges, state.seams, state.kinds);
+
+			uint32_t triangles_to_remove = (uint32_t)(state.indices.size() - target_index_count + 2) / 3;
+			if(CollapseEdges(state, triangles_to_remove, target_error, error) == 0)
+				break;
+		}
+	}
+};
+
+
+uint32_t mesh_simplifier::Simplify(uint32_t* destination, const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count,
+	uint32_t vertex_stride, uint32_t target_index_count, float target_error, float* result_error)
+{
+	SimplifyState state;
+	InitializeState(state, indices, index_count, vertices, vertex_count, vertex_stride);
+
+	float error = 0.0f;
+	Reduce(state, target_index_count, target_error, error);
+
+	if(!state.indices.empty())
+		memcpy(destination, &state.indices[0], state.indices.size() * sizeof(uint32_t));
+	if(result_error)
+		*result_error = error;
+	return (uint32_t)state.indices.size();
+}
+uint32_t mesh_simplifier::GenerateLods(const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+	const float* target_ratios, uint32_t lod_count, float target_error, std::vector<uint32_t>& lod_indices, Lod* lods)
+{
+	lod_indices.clear();
+
+	// The levels are snapshots of one simplification, so each level keeps the quadrics of the levels
+	//	before it and the error is measured against the source mesh.
+	SimplifyState state;
+	InitializeState(state, indices, index_count, vertices, vertex_count, vertex_stride);
+
+	float error = 0.0f;
+	uint32_t generated = 0;
+	for(uint32_t i = 0; i < lod_count; ++i)
+	{
+		uint32_t target_index_count = (uint32_t)(index_count / 3 * target_ratios[i]) * 3;
+		Reduce(state, target_index_count, target_error, error);
+
+		uint32_t count = (uint32_t)state.indices.size();
+		if(generated > 0 && count > lods[generated - 1].index_count * min_lod_reduction)
+			break;
+
+		Lod& lod = lods[generated++];
+		lod.first_index = (uint32_t)lod_indices.size();
+		lod.index_count = count;
+		lod.error = error;
+
+		lod_indices.insert(lod_indices.end(), state.indices.begin(), state.indices.end());
+	}
+	return generated;
+}
@@ -0,0 +1,44 @@
+#ifndef __MESHSIMPLIFIER_H__
+#define __MESHSIMPLIFIER_H__
+
+/// @brief Reduces the triangle count of indexed triangle lists by collapsing edges, choosing the collapses
+///	introducing the least error first based on Garland and Heckbert "Surface Simplification Using Quadric
+///	Error Metrics". Vertices are only ever collapsed onto other existing vertices, so the vertex data is
+///	left untouched and all levels of detail can share the same vertex buffer.
+///
+///	Vertices sharing a position but having different attributes, e.g. at UV or normal seams, are locked in
+///	place. Vertices on open borders only collapse along the border, keeping the outline of the mesh.
+namespace mesh_simplifier
+{
+	/// Level of detail, a range of indices in the combined index list.
+	struct Lod
+	{
+		uint32_t first_index;
+		uint32_t index_count;
+		float error; // Largest distance the surface moved compared to the source mesh, in object space units.
+	};
+
+	/// @brief Simplifies a triangle list until it reaches the target index count or any further collapse
+	///	would exceed the target error, whichever comes first.
+	/// @param destination Receives the simplified indices, needs room for index_count indices.
+	/// @param vertices Vertex data, each vertex needs to start with its position as 3 floats.
+	/// @param vertex_stride Size of a vertex in bytes.
+	/// @param target_error Largest allowed error in object space units.
+	/// @param result_error Optional, receives the largest error introduced.
+	/// @return Number of indices written to destination.
+	uint32_t Simplify(uint32_t* destination, const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count,
+		uint32_t vertex_stride, uint32_t target_index_count, float target_error, float* result_error = NULL);
+
+	/// @brief Generates levels of detail for a triangle list, each simplified further from the previous level.
+	/// @param target_ratios Fraction of the triangles to keep at each level, the first level is usually 1.
+	/// @param lod_count Number of levels to generate.
+	/// @param target_error Largest allowed error for any level, levels stop shrinking when it's reached.
+	/// @param lod_indices Receives the indices of all levels, one after the other.
+	/// @param lods Receives the range of each level in lod_indices.
+	/// @return The number of levels generated. Levels that would barely reduce the triangle count from
+	///		the previous level are left out, so this can be less than lod_count.
+	uint32_t GenerateLods(const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+		const float* target_ratios, uint32_t lod_count, float target_error, std::vector<uint32_t>& lod_indices, Lod* lods);
+};
+
+#endif // __MESHSIMPLIFIER_H__
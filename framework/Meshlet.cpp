@@ -0,0 +1,340 @@
+#include "Common.h"
+
+#include "Meshlet.h"
+#include "FrameAllocator.h"
+
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESHLET_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	const Vec3& VertexPosition(const void* vertices, uint32_t vertex_stride, uint32_t index)
+	{
+		return *(const Vec3*)((const uint8_t*)vertices + index * vertex_stride);
+	}
+
+	/// @brief Calculates the bounding sphere and the normal cone of a meshlet.
+	/// @param meshlet_vertices The unique vertices referenced by the meshlet.
+	template<typename T>
+	void CalculateBounds(meshlet::Meshlet& meshlet, const T* indices, const uint32_t* meshlet_vertices, const void* vertices, uint32_t vertex_stride)
+	{
+		// Sphere around the center of the bounding box, not the tightest possible but close for compact meshlets.
+		Vec3 bounds_min(FLT_MAX, FLT_MAX, FLT_MAX);
+		Vec3 bounds_max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+		for(uint32_t i = 0; i < meshlet.vertex_count; ++i)
+		{
+			const Vec3& p = VertexPosition(vertices, vertex_stride, meshlet_vertices[i]);
+			bounds_min = Vec3(std::min(bounds_min.x, p.x), std::min(bounds_min.y, p.y), std::min(bounds_min.z, p.z));
+			bounds_max = Vec3(std::max(bounds_max.x, p.x), std::max(bounds_max.y, p.y), std::max(bounds_max.z, p.z));
+		}
+		meshlet.center = vector::Multiply(vector::Add(bounds_min, bounds_max), 0.5f);
+
+		float radius = 0.0f;
+		for(uint32_t i = 0; i < meshlet.vertex_count; ++i)
+		{
+			const Vec3& p = VertexPosition(vertices, vertex_stride, meshlet_vertices[i]);
+			radius = std::max(radius, vector::Length(vector::Subtract(p, meshlet.center)));
+		}
+		meshlet.radius = radius;
+
+		// The cone axis is the average of the triangle normals, the half angle covers the normal furthest from it.
+		//	Degenerate triangles have no normal and are never rendered, so they're ignored.
+		const T* triangles = indices + meshlet.first_index;
+		uint32_t triangle_count = meshlet.index_count / 3;
+
+		Vec3 normal_sum(0.0f, 0.0f, 0.0f);
+		for(uint32_t t = 0; t < triangle_count; ++t)
+		{
+			const Vec3& a = VertexPosition(vertices, vertex_stride, triangles[t*3]);
+			const Vec3& b = VertexPosition(vertices, vertex_stride, triangles[t*3+1]);
+			const Vec3& c = VertexPosition(vertices, vertex_stride, triangles[t*3+2]);
+
+			Vec3 normal = vector::Cross(vector::Subtract(b, a), vector::Subtract(c, a));
+			float length = vector::Length(normal);
+			if(length > 0.0f)
+				normal_sum = vector::Add(normal_sum, vector::Multiply(normal, 1.0f / length));
+		}
+
+		// Without an axis or with normals pointing in every direction, the meshlet can't be rejected as backfacing.
+		meshlet.cone_axis = Vec3(0.0f, 0.0f, 1.0f);
+		meshlet.cone_cos = 0.0f;
+		meshlet.cone_sin = 1.0f;
+
+		float sum_length = vector::Length(normal_sum);
+		if(sum_length <= 0.0f)
+			return;
+
+		Vec3 axis = vector::Multiply(normal_sum, 1.0f / sum_length);
+		float min_cos = 1.0f;
+		for(uint32_t t = 0; t < triangle_count; ++t)
+		{
+			const Vec3& a = VertexPosition(vertices, vertex_stride, triangles[t*3]);
+			const Vec3& b = VertexPosition(vertices, vertex_stride, triangles[t*3+1]);
+			const Vec3& c = VertexPosition(vertices, vertex_stride, triangles[t*3+2]);
+
+			Vec3 normal = vector::Cross(vector::Subtract(b, a), vector::Subtract(c, a));
+			float length = vector::Length(normal);
+			if(length > 0.0f)
+				min_cos = std::min(min_cos, vector::Dot(normal, axis) / length);
+		}
+
+		meshlet.cone_axis = axis;
+		if(min_cos > 0.0f)
+		{
+			meshlet.cone_cos = min_cos;
+			meshlet.cone_sin = sqrtf(std::max(1.0f - min_cos * min_cos, 0.0f));
+		}
+	}
+
+	template<typename T>
+	void BuildMeshletsFromIndices(const T* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+		std::vector<meshlet::Meshlet>& meshlets, uint32_t max_vertices, uint32_t max_triangles)
+	{
+		assert(index_count % 3 == 0);
+		assert(max_vertices >= 3 && max_vertices <= meshlet::MAX_VERTICES);
+		assert(max_triangles >= 1 && max_triangles <= meshlet::MAX_TRIANGLES);
+
+		FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+		FrameAllocatorScope allocator_scope(allocator);
+
+		// Marks the vertices already referenced by the current meshlet.
+		uint8_t* used = allocator.AllocateArray<uint8_t>(vertex_count);
+		memset(used, 0, vertex_count);
+
+		uint32_t meshlet_vertices[meshlet::MAX_VERTICES];
+
+		meshlet::Meshlet current;
+		current.first_index = 0;
+		current.index_count = 0;
+		current.vertex_count = 0;
+
+		for(uint32_t i = 0; i < index_count; i += 3)
+		{
+			uint32_t a = indices[i], b = indices[i+1], c = indices[i+2];
+			assert(a < vertex_count && b < vertex_count && c < vertex_count);
+
+			uint32_t new_vertices = (used[a] ? 0 : 1) + ((used[b] || b == a) ? 0 : 1) + ((used[c] || c == a || c == b) ? 0 : 1);
+			if(current.vertex_count + new_vertices > max_vertices || current.index_count / 3 >= max_triangles)
+			{
+				CalculateBounds(current, indices, meshlet_vertices, vertices, vertex_stride);
+				meshlets.push_back(current);
+
+				for(uint32_t v = 0; v < current.vertex_count; ++v)
+					used[meshlet_vertices[v]] = 0;
+
+				current.first_index = i;
+				current.index_count = 0;
+				current.vertex_count = 0;
+			}
+
+			const uint32_t triangle[3] = { a, b, c };
+			for(int v = 0; v < 3; ++v)
+			{
+				if(!used[triangle[v]])
+				{
+					used[triangle[v]] = 1;
+					meshlet_vertices[current.vertex_count++] = triangle[v];
+				}
+			}
+			current.index_count += 3;
+		}
+
+		if(current.index_count > 0)
+		{
+			CalculateBounds(current, indices, meshlet_vertices, vertices, vertex_stride);
+			meshlets.push_back(current);
+		}
+	}
+
+	/// @brief Returns the number of bits set in a 4-bit mask.
+	uint32_t CountBits(uint32_t mask)
+	{
+		return (mask & 1) + ((mask >> 1) & 1) + ((mask >> 2) & 1) + ((mask >> 3) & 1);
+	}
+};
+
+
+void meshlet::BuildMeshlets(const uint16_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+							std::vector<Meshlet>& meshlets, uint32_t max_vertices, uint32_t max_triangles)
+{
+	BuildMeshletsFromIndices(indices, index_count, vertices, vertex_count, vertex_stride, meshlets, max_vertices, max_triangles);
+}
+void meshlet::BuildMeshlets(const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+							std::vector<Meshlet>& meshlets, uint32_t max_vertices, uint32_t max_triangles)
+{
+	BuildMeshletsFromIndices(indices, index_count, vertices, vertex_count, vertex_stride, meshlets, max_vertices, max_triangles);
+}
+
+
+MeshletCuller::MeshletCuller(const meshlet::Meshlet* meshlets, uint32_t meshlet_count) : _meshlet_count(meshlet_count)
+{
+	uint32_t padded_count = (meshlet_count + 3) & ~3u;
+	_center_x.resize(padded_count, 0.0f);
+	_center_y.resize(padded_count, 0.0f);
+	_center_z.resize(padded_count, 0.0f);
+	_radius.resize(padded_count, 0.0f);
+	_cone_axis_x.resize(padded_count, 0.0f);
+	_cone_axis_y.resize(padded_count, 0.0f);
+	_cone_axis_z.resize(padded_count, 0.0f);
+	_cone_cos.resize(padded_count, 0.0f);
+	_cone_sin.resize(padded_count, 1.0f);
+	_first_index.resize(padded_count, 0);
+	_index_count.resize(padded_count, 0);
+
+	for(uint32_t i = 0; i < meshlet_count; ++i)
+	{
+		const meshlet::Meshlet& m = meshlets[i];
+		_center_x[i] = m.center.x;
+		_center_y[i] = m.center.y;
+		_center_z[i] = m.center.z;
+		_radius[i] = m.radius;
+		_cone_axis_x[i] = m.cone_axis.x;
+		_cone_axis_y[i] = m.cone_axis.y;
+		_cone_axis_z[i] = m.cone_axis.z;
+		_cone_cos[i] = m.cone_cos;
+		_cone_sin[i] = m.cone_sin;
+		_first_index[i] = m.first_index;
+		_index_count[i] = m.index_count;
+	}
+}
+MeshletCuller::~MeshletCuller()
+{
+}
+uint32_t MeshletCuller::Cull(const Mat4x4& model_view_projection, const Vec3& camera_position, float min_radius_ratio,
+							 int* index_offsets, int* index_counts, MeshletCullStats* stats) const
+{
+	Plane planes[6];
+	matrix::ExtractFrustumPlanes(model_view_projection, planes);
+
+	MeshletCullStats cull_stats;
+	uint32_t range_count = 0;
+	for(uint32_t first = 0; first < _meshlet_count; first += 4)
+	{
+		uint32_t visible = CullGroup(first, planes, camera_position, min_radius_ratio, cull_stats);
+
+		// Meshlets are stored one after the other, so neighbours that are both visible become one range.
+		for(uint32_t i = 0; visible != 0; ++i, visible >>= 1)
+		{
+			if(!(visible & 1))
+				continue;
+
+			int offset = (int)_first_index[first + i];
+			int count = (int)_index_count[first + i];
+			if(range_count > 0 && index_offsets[range_count - 1] + index_counts[range_count - 1] == offset)
+			{
+				index_counts[range_count - 1] += count;
+			}
+			else
+			{
+				index_offsets[range_count] = offset;
+				index_counts[range_count] = count;
+				++range_count;
+			}
+		}
+	}
+
+	if(stats)
+		*stats = cull_stats;
+	return range_count;
+}
+uint32_t MeshletCuller::MeshletCount() const
+{
+	return _meshlet_count;
+}
+uint32_t MeshletCuller::IndexCount() const
+{
+	uint32_t index_count = 0;
+	for(uint32_t i = 0; i < _meshlet_count; ++i)
+		index_count += _index_count[i];
+	return index_count;
+}
+uint32_t MeshletCuller::CullGroup(uint32_t first, const Plane* planes, const Vec3& camera_position, float min_radius_ratio,
+								  MeshletCullStats& stats) const
+{
+	// A meshlet is backfacing if every normal in its cone faces away from every point in its bounding sphere. With
+	//	v = center - camera and phi the angle between v and the axis, the normal closest to facing the camera is at
+	//	the angle phi + alpha from v, which gives the test |v| cos(phi + alpha) > radius, or
+	//	dot(v, axis) * cos(alpha) - |v x axis| * sin(alpha) > radius.
+	uint32_t outside_mask;
+	uint32_t backfacing_mask;
+	uint32_t small_mask;
+
+#ifdef MESHLET_SSE2
+	__m128 cx = _mm_loadu_ps(&_center_x[first]);
+	__m128 cy = _mm_loadu_ps(&_center_y[first]);
+	__m128 cz = _mm_loadu_ps(&_center_z[first]);
+	__m128 radius = _mm_loadu_ps(&_radius[first]);
+	__m128 negative_radius = _mm_sub_ps(_mm_setzero_ps(), radius);
+
+	__m128 outside = _mm_setzero_ps();
+	for(int p = 0; p < 6; ++p)
+	{
+		__m128 distance = _mm_add_ps(_mm_add_ps(_mm_mul_ps(cx, _mm_set1_ps(planes[p].n.x)), _mm_mul_ps(cy, _mm_set1_ps(planes[p].n.y))),
+									 _mm_add_ps(_mm_mul_ps(cz, _mm_set1_ps(planes[p].n.z)), _mm_set1_ps(planes[p].d)));
+		outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, negative_radius));
+	}
+
+	__m128 vx = _mm_sub_ps(cx, _mm_set1_ps(camera_position.x));
+	__m128 vy = _mm_sub_ps(cy, _mm_set1_ps(camera_position.y));
+	__m128 vz = _mm_sub_ps(cz, _mm_set1_ps(camera_position.z));
+	__m128 along_axis = _mm_add_ps(_mm_add_ps(	_mm_mul_ps(vx, _mm_loadu_ps(&_cone_axis_x[first])),
+												_mm_mul_ps(vy, _mm_loadu_ps(&_cone_axis_y[first]))),
+												_mm_mul_ps(vz, _mm_loadu_ps(&_cone_axis_z[first])));
+	__m128 distance_sq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(vx, vx), _mm_mul_ps(vy, vy)), _mm_mul_ps(vz, vz));
+	__m128 across_axis = _mm_sqrt_ps(_mm_max_ps(_mm_sub_ps(distance_sq, _mm_mul_ps(along_axis, along_axis)), _mm_setzero_ps()));
+	__m128 closest = _mm_sub_ps(_mm_mul_ps(along_axis, _mm_loadu_ps(&_cone_cos[first])), _mm_mul_ps(across_axis, _mm_loadu_ps(&_cone_sin[first])));
+	__m128 backfacing = _mm_cmpgt_ps(closest, radius);
+
+	__m128 ratio_sq = _mm_set1_ps(min_radius_ratio * min_radius_ratio);
+	__m128 small = _mm_cmplt_ps(_mm_mul_ps(radius, radius), _mm_mul_ps(ratio_sq, distance_sq));
+
+	outside_mask = (uint32_t)_mm_movemask_ps(outside);
+	backfacing_mask = (uint32_t)_mm_movemask_ps(backfacing);
+	small_mask = (uint32_t)_mm_movemask_ps(small);
+#else
+	outside_mask = 0;
+	backfacing_mask = 0;
+	small_mask = 0;
+	for(uint32_t i = 0; i < 4; ++i)
+	{
+		uint32_t m = first + i;
+		Vec3 center(_center_x[m], _center_y[m], _center_z[m]);
+		float radius = _radius[m];
+
+		for(int p = 0; p < 6; ++p)
+		{
+			if(vector::Dot(planes[p].n, center) + planes[p].d < -radius)
+				outside_mask |= 1 << i;
+		}
+
+		Vec3 v = vector::Subtract(center, camera_position);
+		float along_axis = vector::Dot(v, Vec3(_cone_axis_x[m], _cone_axis_y[m], _cone_axis_z[m]));
+		float distance_sq = vector::Dot(v, v);
+		float across_axis = sqrtf(std::max(distance_sq - along_axis * along_axis, 0.0f));
+		if(along_axis * _cone_cos[m] - across_axis * _cone_sin[m] > radius)
+			backfacing_mask |= 1 << i;
+
+		if(radius * radius < min_radius_ratio * min_radius_ratio * distance_sq)
+			small_mask |= 1 << i;
+	}
+#endif
+
+	// Each culled meshlet is counted by the first test rejecting it, the padding is never counted.
+	uint32_t valid_mask = (1u << std::min(_meshlet_count - first, 4u)) - 1;
+	outside_mask &= valid_mask;
+	backfacing_mask &= valid_mask & ~outside_mask;
+	small_mask &= valid_mask & ~outside_mask & ~backfacing_mask;
+	uint32_t visible_mask = valid_mask & ~(outside_mask | backfacing_mask | small_mask);
+
+	stats.outside_frustum += CountBits(outside_mask);
+	stats.backfacing += CountBits(backfacing_mask);
+	stats.too_small += CountBits(small_mask);
+	stats.visible += CountBits(visible_mask);
+	return visible_mask;
+}
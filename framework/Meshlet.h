@@ -0,0 +1,108 @@
+#ifndef __MESHLET_H__
+#define __MESHLET_H__
+
+/// @brief Splits triangle lists into small clusters (meshlets) with bounds that allow whole clusters to be
+///	culled on the CPU before anything is submitted to the GPU. The clusters are consecutive ranges of the
+///	triangle list, so the indices are left untouched and the surviving ranges can be drawn straight from
+///	the index buffer.
+namespace meshlet
+{
+	enum { MAX_VERTICES = 64, MAX_TRIANGLES = 124 };
+
+	struct Meshlet
+	{
+		uint32_t first_index; // Offset to the first index of the meshlet, relative to the indices it was built from.
+		uint32_t index_count;
+		uint32_t vertex_count; // Number of unique vertices referenced by the meshlet.
+
+		Vec3 center; // Bounding sphere
+		float radius;
+
+		/// Cone containing the normals of all triangles. A half angle of 90 degrees or more means that the
+		///	meshlet can never be backfacing, cone_cos is then 0 and cone_sin 1.
+		Vec3 cone_axis;
+		float cone_cos; // Cosine of the half angle of the cone.
+		float cone_sin; // Sine of the half angle of the cone.
+	};
+
+	/// @brief Splits a triangle list into meshlets, in the order of the triangles. The triangles should be
+	///	optimized for the vertex cache first, see mesh_optimizer::OptimizeVertexCache, as that keeps
+	///	neighbouring triangles together and makes the meshlets compact.
+	/// @param vertices Vertex data, each vertex needs to start with its position as 3 floats.
+	/// @param vertex_stride Size of a vertex in bytes.
+	/// @param max_vertices Largest number of unique vertices in a meshlet, at most MAX_VERTICES.
+	/// @param max_triangles Largest number of triangles in a meshlet, at most MAX_TRIANGLES.
+	/// @param meshlets Receives the meshlets, appended to any meshlets already in the vector.
+	void BuildMeshlets(const uint16_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+		std::vector<Meshlet>& meshlets, uint32_t max_vertices = MAX_VERTICES, uint32_t max_triangles = MAX_TRIANGLES);
+
+	/// @brief Splits a triangle list with 32-bit indices into meshlets.
+	/// @sa BuildMeshlets
+	void BuildMeshlets(const uint32_t* indices, uint32_t index_count, const void* vertices, uint32_t vertex_count, uint32_t vertex_stride,
+		std::vector<Meshlet>& meshlets, uint32_t max_vertices = MAX_VERTICES, uint32_t max_triangles = MAX_TRIANGLES);
+};
+
+/// Number of meshlets rejected by each test during a call to MeshletCuller::Cull.
+struct MeshletCullStats
+{
+	uint32_t visible;
+	uint32_t backfacing;
+	uint32_t outside_frustum;
+	uint32_t too_small;
+
+	MeshletCullStats() : visible(0), backfacing(0), outside_frustum(0), too_small(0) {}
+};
+
+/// @brief Culls the meshlets of a mesh against the camera. The bounds are stored as separate arrays for
+///	every component, letting four meshlets be tested at once with SSE2.
+class MeshletCuller
+{
+public:
+	/// @param meshlets The meshlets of the mesh, in the order they're stored in the index buffer.
+	MeshletCuller(const meshlet::Meshlet* meshlets, uint32_t meshlet_count);
+	~MeshletCuller();
+
+	/// @brief Tests every meshlet for being backfacing, outside the frustum or too small on screen. The ranges
+	///		of consecutive visible meshlets are merged, ready to be drawn with RenderDevice::MultiDraw.
+	/// @param model_view_projection Transform from the object space of the mesh to clip space.
+	/// @param camera_position Position of the camera in object space.
+	/// @param min_radius_ratio Meshlets with a radius smaller than this fraction of their distance to the camera
+	///		are culled, 0 disables the test. Only valid for uniformly scaled meshes.
+	/// @param index_offsets Receives the offset to the first index of each visible range, relative to the indices
+	///		the meshlets were built from. Needs space for MeshletCount() ranges.
+	/// @param index_counts Receives the number of indices of each visible range.
+	/// @param stats Optional, receives the number of meshlets culled by each test.
+	/// @return The number of visible ranges.
+	uint32_t Cull(const Mat4x4& model_view_projection, const Vec3& camera_position, float min_radius_ratio,
+		int* index_offsets, int* index_counts, MeshletCullStats* stats = NULL) const;
+
+	/// @brief Returns the number of meshlets.
+	uint32_t MeshletCount() const;
+
+	/// @brief Returns the total number of indices in all meshlets.
+	uint32_t IndexCount() const;
+
+private:
+	/// @brief Culls four meshlets starting at the specified meshlet.
+	/// @return A mask with a bit set for every visible meshlet.
+	uint32_t CullGroup(uint32_t first, const Plane* planes, const Vec3& camera_position, float min_radius_ratio,
+		MeshletCullStats& stats) const;
+
+	uint32_t _meshlet_count;
+
+	// Bounds, padded to a multiple of four meshlets. The padding is never visible.
+	std::vector<float> _center_x;
+	std::vector<float> _center_y;
+	std::vector<float> _center_z;
+	std::vector<float> _radius;
+	std::vector<float> _cone_axis_x;
+	std::vector<float> _cone_axis_y;
+	std::vector<float> _cone_axis_z;
+	std::vector<float> _cone_cos;
+	std::vector<float> _cone_sin;
+
+	std::vector<uint32_t> _first_index;
+	std::vector<uint32_t> _index_count;
+};
+
+#endif // __MESHLET_H__
@@ -0,0 +1,313 @@
+#include "Common.h"
+
+#include "OcclusionBuffer.h"
+
+#include <algorithm>
+#include <float.h>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define OCCLUSION_BUFFER_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+	/// Clips a polygon against the near plane (z = -w), using the Sutherland-Hodgman algorithm.
+	/// @param output Receives the clipped polygon, needs space for one more vertex than the input.
+	/// @return Number of vertices in the clipped polygon.
+	int ClipNearPlane(const Vec4* input, int count, Vec4* output)
+	{
+		int output_count = 0;
+		for(int i = 0; i < count; ++i)
+		{
+			const Vec4& a = input[i];
+			const Vec4& b = input[(i + 1) % count];
+
+			// Signed distance to the plane, positive in front of it.
+			float da = a.z + a.w;
+			float db = b.z + b.w;
+
+			if(da >= 0.0f)
+				output[output_count++] = a;
+
+			if((da >= 0.0f) != (db >= 0.0f))
+			{
+				float t = da / (da - db);
+				output[output_count++] = Vec4(	a.x + (b.x - a.x) * t, a.y + (b.y - a.y) * t,
+												a.z + (b.z - a.z) * t, a.w + (b.w - a.w) * t);
+			}
+		}
+		return output_count;
+	}
+};
+
+OcclusionBuffer::OcclusionBuffer(uint32_t width, uint32_t height)
+	: _width(width),
+	_height(height),
+	_tiles_dirty(false),
+	_near_distance(0.0f)
+{
+	assert(width > 0 && (width % TILE_WIDTH) == 0);
+	assert(height > 0 && (height % TILE_HEIGHT) == 0);
+
+	_tile_count_x = width / TILE_WIDTH;
+	_tile_count_y = height / TILE_HEIGHT;
+
+	_depth.resize(width * height, 0.0f);
+	_tile_depth.resize(_tile_count_x * _tile_count_y, 0.0f);
+
+	_view = _projection = _view_projection = matrix::CreateIdentity();
+}
+OcclusionBuffer::~OcclusionBuffer()
+{
+}
+
+void OcclusionBuffer::Clear()
+{
+	std::fill(_depth.begin(), _depth.end(), 0.0f);
+	std::fill(_tile_depth.begin(), _tile_depth.end(), 0.0f);
+	_tiles_dirty = false;
+}
+void OcclusionBuffer::SetCamera(const Mat4x4& view, const Mat4x4& projection)
+{
+	_view = view;
+	_projection = projection;
+	_view_projection = matrix::Multiply(projection, view);
+
+	// Distance to the near plane, extracted from the perspective projection.
+	_near_distance = projection.col[3].z / (projection.col[2].z - 1.0f);
+}
+void OcclusionBuffer::RenderTriangles(const Vec3* vertices, const uint16_t* indices, uint32_t index_count)
+{
+	assert((index_count % 3) == 0);
+
+	for(uint32_t i = 0; i < index_count; i += 3)
+	{
+		Vec4 clip[3];
+		for(int v = 0; v < 3; ++v)
+		{
+			const Vec3& p = vertices[indices[i + v]];
+			clip[v] = matrix::Multiply(_view_projection, Vec4(p.x, p.y, p.z, 1.0f));
+		}
+
+		// Only the near plane needs clipping, the other planes are handled by clamping the bounds
+		//	when rasterizing. Clipping a triangle against a single plane results in at most four vertices.
+		Vec4 clipped[4];
+		int count = ClipNearPlane(clip, 3, clipped);
+
+		for(int v = 2; v < count; ++v)
+		{
+			Vec4 triangle[3] = { clipped[0], clipped[v - 1], clipped[v] };
+			RasterizeTriangle(triangle);
+		}
+	}
+}
+bool OcclusionBuffer::IsSphereVisible(const Vec3& center, float radius)
+{
+	Vec4 center_view = matrix::Multiply(_view, Vec4(center.x, center.y, center.z, 1.0f));
+
+	// The camera looks down the negative z-axis.
+	float nearest = -center_view.z - radius;
+	if(nearest <= _near_distance)
+		return true; // The sphere intersects the near plane.
+
+	// Screen rectangle of the sphere, from projecting the corners of its bounding box in view space.
+	float min_x = FLT_MAX, min_y = FLT_MAX, max_x = -FLT_MAX, max_y = -FLT_MAX;
+	for(int i = 0; i < 8; ++i)
+	{
+		Vec4 corner(center_view.x + ((i & 1) ? radius : -radius),
+					center_view.y + ((i & 2) ? radius : -radius),
+					center_view.z + ((i & 4) ? radius : -radius), 1.0f);
+		Vec4 clip = matrix::Multiply(_projection, corner);
+
+		float x = (clip.x / clip.w * 0.5f + 0.5f) * _width;
+		float y = (clip.y / clip.w * 0.5f + 0.5f) * _height;
+		min_x = std::min(min_x, x); max_x = std::max(max_x, x);
+		min_y = std::min(min_y, y); max_y = std::max(max_y, y);
+	}
+
+	if(max_x < 0.0f || max_y < 0.0f || min_x >= (float)_width || min_y >= (float)_height)
+		return false; // Outside the screen
+
+	int x0 = std::max((int)floorf(min_x), 0);
+	int y0 = std::max((int)floorf(min_y), 0);
+	int x1 = std::min((int)floorf(max_x), (int)_width - 1);
+	int y1 = std::min((int)floorf(max_y), (int)_height - 1);
+
+	if(_tiles_dirty)
+		UpdateTiles();
+
+	// The sphere is hidden at a pixel if the occluders there are closer than the nearest point of the sphere.
+	float depth = 1.0f / nearest;
+	for(int ty = y0 / TILE_HEIGHT; ty <= y1 / TILE_HEIGHT; ++ty)
+	{
+		for(int tx = x0 / TILE_WIDTH; tx <= x1 / TILE_WIDTH; ++tx)
+		{
+			// Most tiles are either completely covered by closer occluders or empty, in which case
+			//	the farthest depth of the tile settles it.
+			if(_tile_depth[ty * _tile_count_x + tx] >= depth)
+				continue;
+
+			// Otherwise the pixels of the tile within the rectangle needs to be tested.
+			int px0 = std::max(x0, tx * TILE_WIDTH), px1 = std::min(x1, tx * TILE_WIDTH + TILE_WIDTH - 1);
+			int py0 = std::max(y0, ty * TILE_HEIGHT), py1 = std::min(y1, ty * TILE_HEIGHT + TILE_HEIGHT - 1);
+			for(int y = py0; y <= py1; ++y)
+			{
+				const float* row = &_depth[y * _width];
+				for(int x = px0; x <= px1; ++x)
+				{
+					if(row[x] < depth)
+						return true;
+				}
+			}
+		}
+	}
+	return false;
+}
+uint32_t OcclusionBuffer::Width() const
+{
+	return _width;
+}
+uint32_t OcclusionBuffer::Height() const
+{
+	return _height;
+}
+void OcclusionBuffer::RasterizeTriangle(const Vec4* clip)
+{
+	// Transform to screen space
+	float x[3], y[3], z[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		float inv_w = 1.0f / clip[i].w;
+		x[i] = (clip[i].x * inv_w * 0.5f + 0.5f) * _width;
+		y[i] = (clip[i].y * inv_w * 0.5f + 0.5f) * _height;
+		z[i] = inv_w;
+	}
+
+	float area = (x[1] - x[0]) * (y[2] - y[0]) - (x[2] - x[0]) * (y[1] - y[0]);
+	if(fabsf(area) < 1e-6f)
+		return; // Degenerate
+
+	// Occluders are rendered regardless of their winding, flip clockwise triangles to counter-clockwise.
+	if(area < 0.0f)
+	{
+		std::swap(x[1], x[2]);
+		std::swap(y[1], y[2]);
+		std::swap(z[1], z[2]);
+		area = -area;
+	}
+
+	// Bounds, clamped to the screen
+	int min_x = std::max((int)floorf(std::min(std::min(x[0], x[1]), x[2])), 0);
+	int min_y = std::max((int)floorf(std::min(std::min(y[0], y[1]), y[2])), 0);
+	int max_x = std::min((int)ceilf(std::max(std::max(x[0], x[1]), x[2])), (int)_width - 1);
+	int max_y = std::min((int)ceilf(std::max(std::max(y[0], y[1]), y[2])), (int)_height - 1);
+	if(min_x > max_x || min_y > max_y)
+		return;
+
+	// Edge functions, e = a*x + b*y + c, positive on the inside of the edges (v0, v1), (v1, v2), (v2, v0).
+	float edge_a[3], edge_b[3], edge_c[3];
+	for(int i = 0; i < 3; ++i)
+	{
+		int j = (i + 1) % 3;
+		edge_a[i] = y[i] - y[j];
+		edge_b[i] = x[j] - x[i];
+		edge_c[i] = -(edge_a[i] * x[i] + edge_b[i] * y[i]);
+	}
+
+	// 1/w is linear in screen space, interpolate it with the barycentric coordinates, where the weight of
+	//	each vertex is the edge function of the opposite edge divided by the area.
+	float inv_area = 1.0f / area;
+	float depth_a = (edge_a[1] * z[0] + edge_a[2] * z[1] + edge_a[0] * z[2]) * inv_area;
+	float depth_b = (edge_b[1] * z[0] + edge_b[2] * z[1] + edge_b[0] * z[2]) * inv_area;
+	float depth_c = (edge_c[1] * z[0] + edge_c[2] * z[1] + edge_c[0] * z[2]) * inv_area;
+
+#ifdef OCCLUSION_BUFFER_SSE2
+	// Four pixels at a time, the width is a multiple of the tile width so a group never crosses the end of a row.
+	min_x &= ~3;
+
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 pixel_offset = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f); // Sample at the pixel centers
+
+	__m128 a0 = _mm_set1_ps(edge_a[0]), a1 = _mm_set1_ps(edge_a[1]), a2 = _mm_set1_ps(edge_a[2]);
+	__m128 da = _mm_set1_ps(depth_a);
+
+	for(int py = min_y; py <= max_y; ++py)
+	{
+		float fy = (float)py + 0.5f;
+		__m128 row0 = _mm_set1_ps(edge_b[0] * fy + edge_c[0]);
+		__m128 row1 = _mm_set1_ps(edge_b[1] * fy + edge_c[1]);
+		__m128 row2 = _mm_set1_ps(edge_b[2] * fy + edge_c[2]);
+		__m128 row_depth = _mm_set1_ps(depth_b * fy + depth_c);
+
+		float* row = &_depth[py * _width];
+		for(int px = min_x; px <= max_x; px += 4)
+		{
+			__m128 fx = _mm_add_ps(_mm_set1_ps((float)px), pixel_offset);
+
+			__m128 e0 = _mm_add_ps(_mm_mul_ps(a0, fx), row0);
+			__m128 e1 = _mm_add_ps(_mm_mul_ps(a1, fx), row1);
+			__m128 e2 = _mm_add_ps(_mm_mul_ps(a2, fx), row2);
+
+			__m128 inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+			if(_mm_movemask_ps(inside) == 0)
+				continue;
+
+			// Keep the closest depth, which is the largest 1/w.
+			__m128 current = _mm_loadu_ps(row + px);
+			__m128 depth = _mm_max_ps(current, _mm_add_ps(_mm_mul_ps(da, fx), row_depth));
+			_mm_storeu_ps(row + px, _mm_or_ps(_mm_and_ps(inside, depth), _mm_andnot_ps(inside, current)));
+		}
+	}
+#else
+	for(int py = min_y; py <= max_y; ++py)
+	{
+		float fy = (float)py + 0.5f;
+		float* row = &_depth[py * _width];
+		for(int px = min_x; px <= max_x; ++px)
+		{
+			float fx = (float)px + 0.5f;
+			if(	edge_a[0] * fx + edge_b[0] * fy + edge_c[0] < 0.0f ||
+				edge_a[1] * fx + edge_b[1] * fy + edge_c[1] < 0.0f ||
+				edge_a[2] * fx + edge_b[2] * fy + edge_c[2] < 0.0f)
+				continue;
+
+			float depth = depth_a * fx + depth_b * fy + depth_c;
+			row[px] = std::max(row[px], depth);
+		}
+	}
+#endif
+	_tiles_dirty = true;
+}
+void OcclusionBuffer::UpdateTiles()
+{
+	for(uint32_t ty = 0; ty < _tile_count_y; ++ty)
+	{
+		for(uint32_t tx = 0; tx < _tile_count_x; ++tx)
+		{
+			const float* tile = &_depth[ty * TILE_HEIGHT * _width + tx * TILE_WIDTH];
+
+#ifdef OCCLUSION_BUFFER_SSE2
+			__m128 farthest = _mm_loadu_ps(tile);
+			for(int y = 0; y < TILE_HEIGHT; ++y)
+			{
+				for(int x = 0; x < TILE_WIDTH; x += 4)
+					farthest = _mm_min_ps(farthest, _mm_loadu_ps(tile + y * _width + x));
+			}
+			// Reduce the four lanes to one
+			farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+			farthest = _mm_min_ps(farthest, _mm_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+			_mm_store_ss(&_tile_depth[ty * _tile_count_x + tx], farthest);
+#else
+			float farthest = tile[0];
+			for(int y = 0; y < TILE_HEIGHT; ++y)
+			{
+				for(int x = 0; x < TILE_WIDTH; ++x)
+					farthest = std::min(farthest, tile[y * _width + x]);
+			}
+			_tile_depth[ty * _tile_count_x + tx] = farthest;
+#endif
+		}
+	}
+	_tiles_dirty = false;
+}
@@ -0,0 +1,65 @@
+#ifndef __OCCLUSIONBUFFER_H__
+#define __OCCLUSIONBUFFER_H__
+
+/// @brief Low-resolution depth buffer for software occlusion culling.
+///	A few large occluders are rasterized on the CPU, after which bounding spheres can be tested against the
+///	buffer without involving the GPU. The buffer stores the reciprocal of the view depth (1/w) as it's linear
+///	in screen space, 0 meaning nothing have been rendered. The farthest depth within each tile is kept in a
+///	second level, letting most tests be resolved per tile rather than per pixel.
+class OcclusionBuffer
+{
+public:
+	enum { TILE_WIDTH = 8, TILE_HEIGHT = 8 };
+
+	/// @param width Width of the buffer in pixels, needs to be a multiple of TILE_WIDTH.
+	/// @param height Height of the buffer in pixels, needs to be a multiple of TILE_HEIGHT.
+	OcclusionBuffer(uint32_t width, uint32_t height);
+	~OcclusionBuffer();
+
+	/// @brief Clears the buffer, this should be called before rendering the occluders for a new frame.
+	void Clear();
+
+	/// @brief Specifies the camera used for both rendering occluders and testing.
+	/// @param view The view matrix.
+	/// @param projection The perspective projection matrix.
+	void SetCamera(const Mat4x4& view, const Mat4x4& projection);
+
+	/// @brief Rasterizes occluder triangles into the buffer. The triangles are rendered regardless of winding.
+	/// @param vertices Vertex positions in world space.
+	/// @param indices Three indices for every triangle.
+	/// @param index_count Number of indices.
+	void RenderTriangles(const Vec3* vertices, const uint16_t* indices, uint32_t index_count);
+
+	/// @brief Tests whether a sphere may be visible, the test is conservative and never reports a visible sphere as occluded.
+	/// @param center Center of the sphere in world space.
+	/// @param radius Radius of the sphere.
+	/// @return False if the sphere is either completely hidden by the occluders or outside the screen.
+	bool IsSphereVisible(const Vec3& center, float radius);
+
+	uint32_t Width() const;
+	uint32_t Height() const;
+
+private:
+	/// @brief Rasterizes a single triangle, all vertices needs to be in front of the near plane.
+	/// @param clip Vertex positions in clip space.
+	void RasterizeTriangle(const Vec4* clip);
+
+	/// @brief Recalculates the farthest depth of every tile.
+	void UpdateTiles();
+
+	uint32_t _width;
+	uint32_t _height;
+	uint32_t _tile_count_x;
+	uint32_t _tile_count_y;
+
+	std::vector<float> _depth; // Depth (1/w) for every pixel, row by row starting at the bottom of the screen.
+	std::vector<float> _tile_depth; // Farthest depth (smallest 1/w) within each tile.
+	bool _tiles_dirty; // Specifies whether anything have been rendered since the tiles were updated.
+
+	Mat4x4 _view;
+	Mat4x4 _projection;
+	Mat4x4 _view_projection;
+	float _near_distance; // Distance to the near plane.
+};
+
+#endif // __OCCLUSIONBUFFER_H__
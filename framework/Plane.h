@@ -4,6 +4,7 @@
 /// @brief A 3d plane with the equation a*x + b*y + c*z + d = 0.
 struct Plane
 {
+	Plane() : n(0.0f, 0.0f, 0.0f), d(0.0f) {}
 	Plane(const Vec3& _n, float _d) : n(_n), d(_d) {} 
 
 	Vec3 n; // Plane normal
@@ -0,0 +1,101 @@
+#include "Common.h"
+
+#include "RangeAllocator.h"
+
+
+RangeAllocator::RangeAllocator(uint32_t size)
+	: _size(0),
+	_free_size(0)
+{
+	Grow(size);
+}
+RangeAllocator::~RangeAllocator()
+{
+}
+
+uint32_t RangeAllocator::Allocate(uint32_t size)
+{
+	assert(size > 0);
+
+	// First-fit, the first free range large enough is used.
+	for(std::vector<Range>::iterator it = _free_ranges.begin(); 
+		it != _free_ranges.end(); ++it)
+	{
+		if(it->size >= size)
+		{
+			uint32_t offset = it->offset;
+
+			// Shrink the free range, removing it completely if it was an exact fit.
+			it->offset += size;
+			it->size -= size;
+			if(it->size == 0)
+				_free_ranges.erase(it);
+
+			_free_size -= size;
+			return offset;
+		}
+	}
+	return INVALID_OFFSET;
+}
+void RangeAllocator::Release(uint32_t offset, uint32_t size)
+{
+	assert(offset + size <= _size);
+	if(size == 0)
+		return;
+
+	InsertFreeRange(offset, size);
+	_free_size += size;
+}
+void RangeAllocator::Grow(uint32_t new_size)
+{
+	assert(new_size >= _size);
+	if(new_size == _size)
+		return;
+
+	InsertFreeRange(_size, new_size - _size);
+	_free_size += new_size - _size;
+	_size = new_size;
+}
+uint32_t RangeAllocator::Size() const
+{
+	return _size;
+}
+uint32_t RangeAllocator::FreeSize() const
+{
+	return _free_size;
+}
+void RangeAllocator::InsertFreeRange(uint32_t offset, uint32_t size)
+{
+	// Find the first free range located after the new range
+	std::vector<Range>::iterator next = _free_ranges.begin();
+	while(next != _free_ranges.end() && next->offset < offset)
+		++next;
+
+	assert(next == _free_ranges.end() || offset + size <= next->offset); // Range is already free
+
+	bool merge_prev = (next != _free_ranges.begin() && (next-1)->offset + (next-1)->size == offset);
+	bool merge_next = (next != _free_ranges.end() && offset + size == next->offset);
+
+	if(merge_prev && merge_next)
+	{
+		// Fills the gap between two free ranges, join all three.
+		(next-1)->size += size + next->size;
+		_free_ranges.erase(next);
+	}
+	else if(merge_prev)
+	{
+		(next-1)->size += size;
+	}
+	else if(merge_next)
+	{
+		next->offset = offset;
+		next->size += size;
+	}
+	else
+	{
+		Range range;
+		range.offset = offset;
+		range.size = size;
+		_free_ranges.insert(next, range);
+	}
+}
@@ -0,0 +1,50 @@
+#ifndef __RANGEALLOCATOR_H__
+#define __RANGEALLOCATOR_H__
+
+/// @brief Free-list allocator handing out ranges of a larger block, e.g. regions of a hardware buffer.
+///	The allocator only keeps the bookkeeping, it never touches the memory itself. Free ranges are kept 
+///	sorted by offset so that released ranges can be merged with their neighbours.
+class RangeAllocator
+{
+public:
+	enum { INVALID_OFFSET = 0xffffffff };
+
+	/// @param size Total size of the block that ranges are allocated from.
+	RangeAllocator(uint32_t size);
+	~RangeAllocator();
+
+	/// @brief Allocates a range using a first-fit search.
+	/// @return Offset to the start of the range, or INVALID_OFFSET if no free range was large enough.
+	uint32_t Allocate(uint32_t size);
+
+	/// @brief Releases a range previously returned by Allocate.
+	/// @param offset Offset returned by Allocate.
+	/// @param size Size that was specified when allocating the range.
+	void Release(uint32_t offset, uint32_t size);
+
+	/// @brief Extends the block, making the added space available for allocation.
+	/// @param new_size The new total size, this needs to be larger than the current size.
+	void Grow(uint32_t new_size);
+
+	/// @brief Returns the total size of the block.
+	uint32_t Size() const;
+
+	/// @brief Returns the total amount of free space, which may be fragmented.
+	uint32_t FreeSize() const;
+
+private:
+	struct Range
+	{
+		uint32_t offset;
+		uint32_t size;
+	};
+
+	/// @brief Inserts a free range, merging it with any adjacent ranges.
+	void InsertFreeRange(uint32_t offset, uint32_t size);
+
+	std::vector<Range> _free_ranges; // Free ranges sorted by offset.
+	uint32_t _size;
+	uint32_t _free_size;
+};
+
+#endif // __RANGEALLOCATOR_H__
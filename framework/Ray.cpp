@@ -15,6 +15,27 @@ bool RaySphereIntersect(const Vec3& origin, const Vec3& ray, const Vec3& center,
 	return (bb_c >= 0);
 }
 
+bool RaySphereIntersect(const Vec3& origin, const Vec3& ray, const Vec3& center, float radius, float& distance)
+{
+	Vec3 origin_center = vector::Subtract(origin, center);
+	float b = vector::Dot(ray, origin_center);
+	float c = vector::Dot(origin_center, origin_center) - radius*radius;
+
+	float bb_c = b*b-c; 
+	if(bb_c < 0)
+		return false;
+
+	// Distances to where the ray enters and exits the sphere
+	float s = sqrtf(bb_c);
+	float t0 = -b - s;
+	float t1 = -b + s;
+	if(t1 < 0.0f)
+		return false; // Behind the origin
+
+	distance = (t0 > 0.0f) ? t0 : 0.0f;
+	return true;
+}
+
 bool RayPlaneIntersect(const Vec3& origin, const Vec3& ray, const Plane& plane, Vec3& intersect)
 {
 	float t = -((vector::Dot(origin, plane.n) + plane.d) / vector::Dot(ray, plane.n));
@@ -9,6 +9,15 @@
 /// @return True if the ray intersects, false if not.
 bool RaySphereIntersect(const Vec3& origin, const Vec3& ray, const Vec3& center, float radius);
 
+/// Checks if a ray intersects with a sphere in front of the origin.
+/// @param origin The origin of the ray.
+/// @param ray Normalized direction of the ray.
+/// @param center Center of the sphere.
+/// @param radius Sphere radius.
+/// @param distance Distance along the ray to where it enters the sphere, 0 if the origin is inside the sphere.
+/// @return True if the ray intersects, false if not.
+bool RaySphereIntersect(const Vec3& origin, const Vec3& ray, const Vec3& center, float radius, float& distance);
+
 /// Calculates the intersection point (if any) between a ray and a plane.
 /// @param origin The origin of the ray.
 /// @param ray Vector specifying the direction of the ray.
@@ -1,10 +1,90 @@
 #include "Common.h"
 
 #include "RenderDevice.h"
+#include "FrameAllocator.h"
 
+#include <stdio.h>
+#include <algorithm>
+
+
+namespace
+{
+	const char* memory_category_names[] = 
+	{
+		"Vertex buffer",
+		"Index buffer",
+		"Texture",
+		"Render target"
+	};
+
+#ifndef PLATFORM_MACOSX
+	const char* DebugSourceName(GLenum source)
+	{
+		switch(source)
+		{
+		case GL_DEBUG_SOURCE_API: return "API";
+		case GL_DEBUG_SOURCE_WINDOW_SYSTEM: return "Window system";
+		case GL_DEBUG_SOURCE_SHADER_COMPILER: return "Shader compiler";
+		case GL_DEBUG_SOURCE_THIRD_PARTY: return "Third party";
+		case GL_DEBUG_SOURCE_APPLICATION: return "Application";
+		default: return "Other";
+		};
+	}
+	const char* DebugTypeName(GLenum type)
+	{
+		switch(type)
+		{
+		case GL_DEBUG_TYPE_ERROR: return "Error";
+		case GL_DEBUG_TYPE_DEPRECATED_BEHAVIOR: return "Deprecated";
+		case GL_DEBUG_TYPE_UNDEFINED_BEHAVIOR: return "Undefined behavior";
+		case GL_DEBUG_TYPE_PORTABILITY: return "Portability";
+		case GL_DEBUG_TYPE_PERFORMANCE: return "Performance";
+		case GL_DEBUG_TYPE_MARKER: return "Marker";
+		default: return "Other";
+		};
+	}
+	const char* DebugSeverityName(GLenum severity)
+	{
+		switch(severity)
+		{
+		case GL_DEBUG_SEVERITY_HIGH: return "High";
+		case GL_DEBUG_SEVERITY_MEDIUM: return "Medium";
+		case GL_DEBUG_SEVERITY_LOW: return "Low";
+		default: return "Notification";
+		};
+	}
+#endif
+};
+
+uint32_t vertex_format::VertexSize(VertexFormat format)
+{
+	switch(format)
+	{
+	case VF_POSITION3F:
+		return sizeof(float)*3;
+	case VF_POSITION3F_NORMAL3F:
+		return sizeof(float)*6;
+	case VF_POSITION3US_NORMAL2S:
+		return sizeof(uint16_t)*4 + sizeof(int16_t)*2;
+	case VF_POSITION3US_NORMAL3I10:
+		return sizeof(uint16_t)*4 + sizeof(uint32_t);
+	default:
+		break;
+	};
+	assert(false);
+	return 0;
+}
 
 RenderDevice::RenderDevice()
-	: _current_shader(-1)
+	: _active_query(-1),
+	_frame_number(0),
+	_completed_frames(0),
+	_memory_budget(0),
+	_debug_output(false),
+	_separable_programs(false),
+	_capture(NULL),
+	_current_shader(-1),
+	_current_vertex_array_object(-1)
 {
 }
 RenderDevice::~RenderDevice()
@@ -30,10 +110,66 @@ bool RenderDevice::Initialize()
 	const GLubyte* extensions = glGetString(GL_EXTENSIONS);
 	debug::Printf("Extensions:\n%s\n", extensions);
 
+#ifndef PLATFORM_MACOSX // KHR_debug is not available on OSX.
+	if(GLEW_KHR_debug)
+	{
+		glEnable(GL_DEBUG_OUTPUT);
+		// Synchronous output makes the driver invoke the callback from the calling thread, directly 
+		//	after the call causing the message. This is required as the message statistics are not thread-safe.
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+
+		glDebugMessageCallback(DebugMessageCallback, this);
+		glDebugMessageControl(GL_DONT_CARE, GL_DONT_CARE, GL_DONT_CARE, 0, NULL, GL_TRUE);
+		_debug_output = true;
+	}
+#endif
+
+#ifndef PLATFORM_MACOSX // The OSX context is created as 3.2 core which doesn't have separable programs.
+	_separable_programs = (GLEW_ARB_separate_shader_objects || GLEW_VERSION_4_1);
+#endif
+
+	uint32_t total_kb, available_kb;
+	if(QueryDriverMemoryInfo(total_kb, available_kb))
+	{
+		debug::Printf("Video memory: %u kB total, %u kB available\n", total_kb, available_kb);
+	}
+
 	return true;
 }
 void RenderDevice::Shutdown()
 {
+	if(_capture)
+	{
+		debug::Printf("RenderDevice: Shutting down during a capture, the capture is incomplete.\n");
+		delete _capture;
+		_capture = NULL;
+	}
+	_capture_path.clear();
+
+	// Destroy anything that is still waiting to be released.
+	if(_pending_releases.size())
+	{
+		_release_batches.push_back(ReleaseBatch());
+		_release_batches.back().fence = 0; // No need for a fence as we wait for everything anyway.
+		_release_batches.back().frame = _frame_number;
+		_release_batches.back().releases.swap(_pending_releases);
+	}
+	glFinish();
+	ProcessReleaseBatches(true);
+
+	if(_debug_messages.size())
+		DumpDebugMessageStats();
+
+#ifndef PLATFORM_MACOSX
+	if(_debug_output)
+	{
+		glDebugMessageCallback(NULL, NULL);
+		glDisable(GL_DEBUG_OUTPUT);
+		_debug_output = false;
+	}
+#endif
+	_debug_messages.clear();
+
 	// Release any buffers that are still allocated
 	for(std::vector<GLuint>::iterator it = _hardware_buffers.begin();
 		it != _hardware_buffers.end(); ++it)
@@ -41,6 +177,11 @@ void RenderDevice::Shutdown()
 		glDeleteBuffers(1, &(*it));
 	}
 	_hardware_buffers.clear();
+	_hardware_buffer_memory.clear();
+
+	for(int i = 0; i < memory_category::MC_COUNT; ++i)
+		_memory_stats[i] = MemoryStats();
+	_total_memory_stats = MemoryStats();
 
 	// Release any vertex array objects that are still allocated
 	for(std::vector<GLuint>::iterator it = _vertex_array_objects.begin();
@@ -49,6 +190,7 @@ void RenderDevice::Shutdown()
 		glDeleteVertexArrays(1, &(*it));
 	}
 	_vertex_array_objects.clear();
+	_vertex_array_bindings.clear();
 
 	// Release any remaining shaders
 	for(std::vector<Shader>::iterator it = _shaders.begin(); 
@@ -60,16 +202,103 @@ void RenderDevice::Shutdown()
 			glDeleteShader(it->fragment_shader);
 	
 		glDeleteProgram(it->program);
+
+		if(it->pipeline != 0)
+			glDeleteProgramPipelines(1, &it->pipeline);
 	}
 	_shaders.clear();
+	_shader_pipeline_cache.clear();
+
+	// Release any remaining stage programs
+	for(std::vector<ShaderStage>::iterator it = _shader_stages.begin(); 
+		it != _shader_stages.end(); ++it)
+	{
+		glDeleteProgram(it->program);
+	}
+	_shader_stages.clear();
+	_free_shader_stage_ids.clear();
+	_shader_stage_cache.clear();
+
+	// The variants were all released together with the rest of the shaders.
+	_shader_templates.clear();
+	_free_shader_template_ids.clear();
+
+	// Release any remaining queries
+	for(std::vector<Query>::iterator it = _queries.begin(); 
+		it != _queries.end(); ++it)
+	{
+		if(it->query != 0)
+			glDeleteQueries(1, &it->query);
+	}
+	_queries.clear();
+	_free_query_ids.clear();
+	_active_query = -1;
+}
+void RenderDevice::EndFrame()
+{
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_END_FRAME);
+		debug::Printf("RenderDevice: Captured %u commands.\n", _capture->CommandCount());
+
+		delete _capture;
+		_capture = NULL;
+	}
+
+	// Fence everything released this frame, the objects may still be referenced by commands 
+	//	in flight so we can't destroy them until the GPU have passed this point. Frames without
+	//	releases are fenced as well, which tells when the frame is complete, see IsFrameComplete.
+	_release_batches.push_back(ReleaseBatch());
+
+	ReleaseBatch& batch = _release_batches.back();
+	batch.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	batch.frame = _frame_number;
+	batch.releases.swap(_pending_releases);
+	++_frame_number;
+
+	ProcessReleaseBatches(false);
+
+	// Start counting driver messages for the next frame
+	for(std::map<uint64_t, DebugMessageStats>::iterator it = _debug_messages.begin(); 
+		it != _debug_messages.end(); ++it)
+	{
+		it->second.frame_count = 0;
+	}
+
+	// A requested capture starts with the next frame.
+	if(!_capture_path.empty())
+		StartCapture();
+}
+uint32_t RenderDevice::FrameNumber() const
+{
+	return _frame_number;
+}
+bool RenderDevice::IsFrameComplete(uint32_t frame) const
+{
+	return frame < _completed_frames;
 }
 void RenderDevice::BindShader(int shader_handle)
 {
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_BIND_SHADER, shader_handle);
+
 	if(shader_handle >= 0)
 	{
 		assert((uint32_t)shader_handle < _shaders.size());
 
-		glUseProgram(_shaders[shader_handle].program);
+		const Shader& shader = _shaders[shader_handle];
+		if(shader.pipeline)
+		{
+			// A bound program takes precedence over the pipeline so we need to make sure no program is bound.
+			glUseProgram(0);
+			glBindProgramPipeline(shader.pipeline);
+		}
+		else
+		{
+			if(_separable_programs)
+				glBindProgramPipeline(0);
+			glUseProgram(shader.program);
+		}
 
 		_current_shader = shader_handle;
 	}
@@ -77,6 +306,8 @@ void RenderDevice::BindShader(int shader_handle)
 	{
 		// Unbind current program
 		glUseProgram(0);
+		if(_separable_programs)
+			glBindProgramPipeline(0);
 
 		_current_shader = -1; // Setting the current shader to -1 indicates that no shader is bound.
 	}
@@ -84,91 +315,127 @@ void RenderDevice::BindShader(int shader_handle)
 
 void RenderDevice::SetUniform4f(const char* name, const Vec4& value)
 {
-	if(_current_shader < 0) // Nothing to do if no shader is bound.
-	{
-		debug::Printf("RenderDevice: Failed setting uniform value; no shader bound.\n");
-		return;
-	}
-	
-	assert((uint32_t)_current_shader < _shaders.size());
-	const Shader& shader = _shaders[_current_shader];
+	if(_capture)
+		CaptureUniform(name, &value.x, 4);
 
-	// Find the location of the variable with the specified name
-	GLint location = glGetUniformLocation(shader.program, name);
-	if(location == -1)
+	UniformLocation locations[MAX_PIPELINE_STAGES];
+	int count = FindUniformLocations(name, locations);
+
+	// Set the value at the found location, for pipelines the uniform may exist in several stages
+	for(int i = 0; i < count; ++i)
 	{
-		debug::Printf("RenderDevice: No uniform variable with the name '%s' found.\n", name);
-		return;
+		SetActiveUniformProgram(locations[i].program);
+		glUniform4f(locations[i].location, value.x, value.y, value.z, value.w);
 	}
-
-	// Set the value at the found location
-	glUniform4f(location, value.x, value.y, value.z, value.w);
 }
 void RenderDevice::SetUniform3f(const char* name, const Vec3& value)
 {
-	if(_current_shader < 0) // Nothing to do if no shader is bound.
-	{
-		debug::Printf("RenderDevice: Failed setting uniform value; no shader bound.\n");
-		return;
-	}
-	
-	assert((uint32_t)_current_shader < _shaders.size());
-	const Shader& shader = _shaders[_current_shader];
+	if(_capture)
+		CaptureUniform(name, &value.x, 3);
 
-	// Find the location of the variable with the specified name
-	GLint location = glGetUniformLocation(shader.program, name);
-	if(location == -1)
+	UniformLocation locations[MAX_PIPELINE_STAGES];
+	int count = FindUniformLocations(name, locations);
+
+	// Set the value at the found location, for pipelines the uniform may exist in several stages
+	for(int i = 0; i < count; ++i)
 	{
-		debug::Printf("RenderDevice: No uniform variable with the name '%s' found.\n", name);
-		return;
+		SetActiveUniformProgram(locations[i].program);
+		glUniform3f(locations[i].location, value.x, value.y, value.z);
 	}
-
-	// Set the value at the found location
-	glUniform3f(location, value.x, value.y, value.z);
 }
 void RenderDevice::SetUniform1f(const char* name, float value)
 {
-	if(_current_shader < 0) // Nothing to do if no shader is bound.
+	if(_capture)
+		CaptureUniform(name, &value, 1);
+
+	UniformLocation locations[MAX_PIPELINE_STAGES];
+	int count = FindUniformLocations(name, locations);
+
+	// Set the value at the found location, for pipelines the uniform may exist in several stages
+	for(int i = 0; i < count; ++i)
 	{
-		debug::Printf("RenderDevice: Failed setting uniform value; no shader bound.\n");
-		return;
+		SetActiveUniformProgram(locations[i].program);
+		glUniform1f(locations[i].location, value);
 	}
-	
-	assert((uint32_t)_current_shader < _shaders.size());
-	const Shader& shader = _shaders[_current_shader];
+}
+void RenderDevice::SetUniformMatrix4f(const char* name, const Mat4x4& value)
+{
+	if(_capture)
+		CaptureUniform(name, &value.col[0].x, 16);
 
-	// Find the location of the variable with the specified name
-	GLint location = glGetUniformLocation(shader.program, name);
-	if(location == -1)
+	UniformLocation locations[MAX_PIPELINE_STAGES];
+	int count = FindUniformLocations(name, locations);
+
+	// Set the value at the found location, for pipelines the uniform may exist in several stages
+	for(int i = 0; i < count; ++i)
 	{
-		debug::Printf("RenderDevice: No uniform variable with the name '%s' found.\n", name);
-		return;
+		SetActiveUniformProgram(locations[i].program);
+		glUniformMatrix4fv(locations[i].location, 1, false, (float*)&value);
 	}
+}
+void RenderDevice::SetUniformMatrix3f(const char* name, const Mat3x3& value)
+{
+	if(_capture)
+		CaptureUniform(name, &value.col[0].x, 9);
 
-	// Set the value at the found location
-	glUniform1f(location, value);
+	UniformLocation locations[MAX_PIPELINE_STAGES];
+	int count = FindUniformLocations(name, locations);
+
+	// Set the value at the found location, for pipelines the uniform may exist in several stages
+	for(int i = 0; i < count; ++i)
+	{
+		SetActiveUniformProgram(locations[i].program);
+		glUniformMatrix3fv(locations[i].location, 1, false, (float*)&value);
+	}
 }
-void RenderDevice::SetUniformMatrix4f(const char* name, const Mat4x4& value)
+int RenderDevice::FindUniformLocations(const char* name, UniformLocation* locations)
 {
 	if(_current_shader < 0) // Nothing to do if no shader is bound.
 	{
 		debug::Printf("RenderDevice: Failed setting uniform value; no shader bound.\n");
-		return;
+		return 0;
 	}
 	
 	assert((uint32_t)_current_shader < _shaders.size());
 	const Shader& shader = _shaders[_current_shader];
 
+	// The programs to search, a pipeline have one program for each stage.
+	GLuint programs[MAX_PIPELINE_STAGES];
+	int program_count = 0;
+	if(shader.pipeline)
+	{
+		programs[program_count++] = _shader_stages[shader.vertex_stage].program;
+		programs[program_count++] = _shader_stages[shader.fragment_stage].program;
+	}
+	else
+	{
+		programs[program_count++] = shader.program;
+	}
+
 	// Find the location of the variable with the specified name
-	GLint location = glGetUniformLocation(shader.program, name);
-	if(location == -1)
+	int count = 0;
+	for(int i = 0; i < program_count; ++i)
 	{
-		debug::Printf("RenderDevice: No uniform variable with the name '%s' found.\n", name);
-		return;
+		GLint location = glGetUniformLocation(programs[i], name);
+		if(location != -1)
+		{
+			locations[count].program = programs[i];
+			locations[count].location = location;
+			count++;
+		}
 	}
 
-	// Set the value at the found location
-	glUniformMatrix4fv(location, 1, false, (float*)&value);
+	if(count == 0)
+		debug::Printf("RenderDevice: No uniform variable with the name '%s' found.\n", name);
+
+	return count;
+}
+void RenderDevice::SetActiveUniformProgram(GLuint program)
+{
+	// With a pipeline bound, glUniform* affects the active program of the pipeline.
+	const Shader& shader = _shaders[_current_shader];
+	if(shader.pipeline)
+		glActiveShaderProgram(shader.pipeline, program);
 }
 
 void RenderDevice::Draw(const DrawCall& draw_call)
@@ -176,13 +443,33 @@ void RenderDevice::Draw(const DrawCall& draw_call)
 	assert(	draw_call.vertex_array_object >= 0 &&
 			(uint32_t)draw_call.vertex_array_object < _vertex_array_objects.size());
 
-	glBindVertexArray(_vertex_array_objects[draw_call.vertex_array_object]);
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_DRAW);
+		_capture->WriteUInt(draw_call.draw_mode);
+		_capture->WriteInt(draw_call.vertex_offset);
+		_capture->WriteInt(draw_call.vertex_count);
+		_capture->WriteInt(draw_call.index_count);
+		_capture->WriteInt(draw_call.index_offset);
+		_capture->WriteUInt(draw_call.index_type);
+		_capture->WriteInt(draw_call.base_vertex);
+		_capture->WriteInt(draw_call.vertex_array_object);
+	}
+
+	// Meshes sharing vertex array object can be drawn after each other without rebinding.
+	if(_current_vertex_array_object != draw_call.vertex_array_object)
+	{
+		glBindVertexArray(_vertex_array_objects[draw_call.vertex_array_object]);
+		_current_vertex_array_object = draw_call.vertex_array_object;
+	}
 
 	// Perform the actual draw call.
 	if(draw_call.index_count > 0)
 	{
-		// Draw with index buffer
-		glDrawElements(draw_call.draw_mode, draw_call.index_count, GL_UNSIGNED_SHORT, 0);
+		// Draw with index buffer, the base vertex allows several meshes to share the same buffers.
+		size_t index_size = (draw_call.index_type == GL_UNSIGNED_INT) ? sizeof(uint32_t) : sizeof(uint16_t);
+		glDrawElementsBaseVertex(draw_call.draw_mode, draw_call.index_count, draw_call.index_type, 
+			(void*)(draw_call.index_offset * index_size), draw_call.base_vertex);
 	}
 	else
 	{
@@ -192,22 +479,197 @@ void RenderDevice::Draw(const DrawCall& draw_call)
 
 }
 
+void RenderDevice::MultiDraw(const DrawCall& draw_call, const int* index_offsets, const int* index_counts, int draw_count)
+{
+	assert(	draw_call.vertex_array_object >= 0 &&
+			(uint32_t)draw_call.vertex_array_object < _vertex_array_objects.size());
+
+	if(draw_count <= 0)
+		return;
+
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_MULTI_DRAW);
+		_capture->WriteUInt(draw_call.draw_mode);
+		_capture->WriteUInt(draw_call.index_type);
+		_capture->WriteInt(draw_call.base_vertex);
+		_capture->WriteInt(draw_call.vertex_array_object);
+		_capture->WriteInt(draw_count);
+		for(int i = 0; i < draw_count; ++i)
+			_capture->WriteInt(index_offsets[i]);
+		for(int i = 0; i < draw_count; ++i)
+			_capture->WriteInt(index_counts[i]);
+	}
+
+	if(_current_vertex_array_object != draw_call.vertex_array_object)
+	{
+		glBindVertexArray(_vertex_array_objects[draw_call.vertex_array_object]);
+		_current_vertex_array_object = draw_call.vertex_array_object;
+	}
+
+	FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+	FrameAllocatorScope allocator_scope(allocator);
+
+	// glMultiDrawElementsBaseVertex takes the offsets as pointers and a base vertex for every range.
+	size_t index_size = (draw_call.index_type == GL_UNSIGNED_INT) ? sizeof(uint32_t) : sizeof(uint16_t);
+	const GLvoid** offsets = allocator.AllocateArray<const GLvoid*>(draw_count);
+	GLint* base_vertices = allocator.AllocateArray<GLint>(draw_count);
+	for(int i = 0; i < draw_count; ++i)
+	{
+		offsets[i] = (const GLvoid*)(index_offsets[i] * index_size);
+		base_vertices[i] = draw_call.base_vertex;
+	}
+
+	glMultiDrawElementsBaseVertex(draw_call.draw_mode, (const GLsizei*)index_counts, draw_call.index_type, offsets, draw_count, base_vertices);
+}
+
 void RenderDevice::Clear(GLbitfield mask)
 {
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_CLEAR);
+		_capture->WriteUInt(mask);
+	}
 	glClear(mask);
 }
 
 void RenderDevice::SetClearColor(float r, float g, float b, float a)
 {
+	if(_capture)
+	{
+		float color[4] = { r, g, b, a };
+		_capture->BeginCommand(capture_command::CC_SET_CLEAR_COLOR);
+		_capture->WriteFloats(color, 4);
+	}
 	glClearColor(r, g, b, a);
 }
 
-int RenderDevice::CreateVertexBuffer(int vertex_array_object, vertex_format::VertexFormat vertex_format, uint32_t size, void* vertex_data)
+void RenderDevice::SetColorWrite(bool enable)
+{
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_SET_COLOR_WRITE, enable ? 1 : 0);
+
+	GLboolean mask = enable ? GL_TRUE : GL_FALSE;
+	glColorMask(mask, mask, mask, mask);
+}
+void RenderDevice::SetDepthWrite(bool enable)
+{
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_SET_DEPTH_WRITE, enable ? 1 : 0);
+
+	glDepthMask(enable ? GL_TRUE : GL_FALSE);
+}
+
+int RenderDevice::CreateQuery()
+{
+	Query query;
+	glGenQueries(1, &query.query);
+	query.issued = false;
+
+	int id = -1;
+
+	// Check for any free slots in the query container
+	if(_free_query_ids.size())
+	{
+		id = _free_query_ids.back();
+		_free_query_ids.pop_back();
+
+		_queries[id] = query;
+	}
+	else
+	{
+		id = (int)_queries.size();
+		_queries.push_back(query);
+	}
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_CREATE_QUERY, id);
+
+	return id;
+}
+void RenderDevice::ReleaseQuery(int query)
+{
+	assert(query >= 0 && (uint32_t)query < _queries.size());
+	assert(query != _active_query);
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_RELEASE_QUERY, query);
+
+	// Unlike buffers the driver keeps a query alive until any pending result is written, 
+	//	so it can be deleted directly.
+	glDeleteQueries(1, &_queries[query].query);
+	_queries[query].query = 0;
+	_queries[query].issued = false;
+
+	_free_query_ids.push_back(query);
+}
+void RenderDevice::BeginOcclusionQuery(int query)
+{
+	assert(query >= 0 && (uint32_t)query < _queries.size());
+	assert(_active_query == -1); // Occlusion queries can't be nested
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_BEGIN_OCCLUSION_QUERY, query);
+
+	glBeginQuery(GL_SAMPLES_PASSED, _queries[query].query);
+	_queries[query].issued = true;
+	_active_query = query;
+}
+void RenderDevice::EndOcclusionQuery()
+{
+	assert(_active_query != -1);
+
+	if(_capture)
+		_capture->BeginCommand(capture_command::CC_END_OCCLUSION_QUERY);
+
+	glEndQuery(GL_SAMPLES_PASSED);
+	_active_query = -1;
+}
+bool RenderDevice::GetQueryResult(int query, uint32_t& samples)
+{
+	assert(query >= 0 && (uint32_t)query < _queries.size());
+	assert(query != _active_query);
+
+	if(!_queries[query].issued)
+		return false;
+
+	// Check availability first, asking for the result directly would stall until the GPU have caught up.
+	GLuint available = 0;
+	glGetQueryObjectuiv(_queries[query].query, GL_QUERY_RESULT_AVAILABLE, &available);
+	if(!available)
+		return false;
+
+	GLuint result = 0;
+	glGetQueryObjectuiv(_queries[query].query, GL_QUERY_RESULT, &result);
+	samples = result;
+
+	return true;
+}
+void RenderDevice::BeginConditionalRender(int query)
+{
+	assert(query >= 0 && (uint32_t)query < _queries.size());
+	assert(_queries[query].issued);
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_BEGIN_CONDITIONAL_RENDER, query);
+
+	glBeginConditionalRender(_queries[query].query, GL_QUERY_NO_WAIT);
+}
+void RenderDevice::EndConditionalRender()
+{
+	if(_capture)
+		_capture->BeginCommand(capture_command::CC_END_CONDITIONAL_RENDER);
+
+	glEndConditionalRender();
+}
+
+int RenderDevice::CreateVertexBuffer(int vertex_array_object, vertex_format::VertexFormat vertex_format, uint32_t size, const void* vertex_data, const char* debug_name)
 {
 	assert(	vertex_array_object >= 0 &&
 			(uint32_t)vertex_array_object < _vertex_array_objects.size());
 
 	glBindVertexArray(_vertex_array_objects[vertex_array_object]);
+	_current_vertex_array_object = -1; // We unbind the vertex array when we're done
 
 	// Vertex buffer objects in opengl are objects that allows us to upload data directly to the GPU.
 	//	This means that opengl doesn't need to upload the data everytime we render something. As with 
@@ -229,75 +691,52 @@ int RenderDevice::CreateVertexBuffer(int vertex_array_object, vertex_format::Ver
 				);
 
 	// Bind vertex attributes depending on the specified vertex format.
-	switch(vertex_format)
-	{
-	case vertex_format::VF_POSITION3F:
-		{
-			// Specifies the location and format of the position data.
-			glVertexAttribPointer(	0, // Attribute index 0
-									3, // 3 floats (x, y, z)
-									GL_FLOAT, // Format,
-									GL_FALSE, // Data should not be normalized
-									0, // Buffer only contains positions so no need to specify stride.
-									0 
-								); 
-
-			glEnableVertexAttribArray(0);
-		}
-		break;
-	case vertex_format::VF_POSITION3F_NORMAL3F:
-		{
-			// Specifies the location and format of the position data.
-			glVertexAttribPointer(	0, // Attribute index 0
-									3, // 3 floats (Px, Py, Pz)
-									GL_FLOAT, // Format,
-									GL_FALSE, // Data should not be normalized
-									sizeof(float)*6, 
-									0 
-								); 
-			glEnableVertexAttribArray(0);
+	SetupVertexAttributes(vertex_format);
 
-			// Specifies the location and format of the normal data.
-			glVertexAttribPointer(	1, // Attribute index 1
-									3, // 3 floats (Nx, Ny, Nz)
-									GL_FLOAT, // Format,
-									GL_FALSE, // Data should not be normalized
-									sizeof(float)*6, 
-									(void*)(sizeof(float)*3)
-								); 
-			glEnableVertexAttribArray(1);
-			
-		}
-		break;
-	};
 	glBindVertexArray(0); // Unbind the vertex array
 	
-	int id = -1;
+	ResourceMemory memory;
+	memory.category = memory_category::MC_VERTEX_BUFFER;
+	memory.size = size;
+	if(debug_name)
+	{
+		memory.debug_name = debug_name;
+		SetObjectLabel(GL_BUFFER, buffer, debug_name);
+	}
 
-	// Check for any free slots in the buffer container
-	if(_free_hardware_buffer_ids.size())
-	{
-		id = _free_hardware_buffer_ids.back();
-		_free_hardware_buffer_ids.pop_back();
+	int id = AddHardwareBuffer(buffer, memory);
 
-		_hardware_buffers[id] = buffer;
-	}
-	else
+	_vertex_array_bindings[vertex_array_object].vertex_buffer = id;
+	_vertex_array_bindings[vertex_array_object].format = vertex_format;
+
+	if(_capture)
 	{
-		// Otherwise just push it to the back.
-	
-		id = (int)_hardware_buffers.size();
-		_hardware_buffers.push_back(buffer);
+		_capture->BeginCommand(capture_command::CC_CREATE_VERTEX_BUFFER);
+		_capture->WriteInt(id);
+		_capture->WriteInt(vertex_array_object);
+		_capture->WriteUInt(vertex_format);
+		_capture->WriteUInt(size);
+		_capture->WriteData(vertex_data, size);
+		MarkBufferCaptured(id);
 	}
 
 	return id;
 }
-int RenderDevice::CreateIndexBuffer(int vertex_array_object, uint32_t index_count, uint16_t* index_data)
+int RenderDevice::CreateIndexBuffer(int vertex_array_object, uint32_t index_count, const uint16_t* index_data, const char* debug_name)
+{
+	return CreateIndexBufferFromData(vertex_array_object, index_count * sizeof(uint16_t), index_data, debug_name);
+}
+int RenderDevice::CreateIndexBuffer32(int vertex_array_object, uint32_t index_count, const uint32_t* index_data, const char* debug_name)
+{
+	return CreateIndexBufferFromData(vertex_array_object, index_count * sizeof(uint32_t), index_data, debug_name);
+}
+int RenderDevice::CreateIndexBufferFromData(int vertex_array_object, uint32_t size, const void* index_data, const char* debug_name)
 {
 	assert(	vertex_array_object >= 0 &&
 			(uint32_t)vertex_array_object < _vertex_array_objects.size());
 
 	glBindVertexArray(_vertex_array_objects[vertex_array_object]);
+	_current_vertex_array_object = -1; // We unbind the vertex array when we're done
 
 	GLuint buffer; // The resulting buffer name will be stored here.
 	
@@ -309,43 +748,237 @@ int RenderDevice::CreateIndexBuffer(int vertex_array_object, uint32_t index_coun
 
 	// Upload the data to the buffer.
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, 
-				index_count * sizeof(uint16_t), // The total size of the buffer
+				size, // The total size of the buffer
 				index_data, // The data that should be uploaded
 				GL_STATIC_DRAW // Specifies that the buffer should be static and it should be used for drawing.
 				);
 	
 	glBindVertexArray(0); // Unbind the vertex array
 
-	int id = -1;
+	ResourceMemory memory;
+	memory.category = memory_category::MC_INDEX_BUFFER;
+	memory.size = size;
+	if(debug_name)
+	{
+		memory.debug_name = debug_name;
+		SetObjectLabel(GL_BUFFER, buffer, debug_name);
+	}
 
-	// Check for any free slots in the buffer container
-	if(_free_hardware_buffer_ids.size())
+	int id = AddHardwareBuffer(buffer, memory);
+
+	_vertex_array_bindings[vertex_array_object].index_buffer = id;
+
+	if(_capture)
 	{
-		id = _free_hardware_buffer_ids.back();
-		_free_hardware_buffer_ids.pop_back();
+		_capture->BeginCommand(capture_command::CC_CREATE_INDEX_BUFFER);
+		_capture->WriteInt(id);
+		_capture->WriteInt(vertex_array_object);
+		_capture->WriteUInt(size);
+		_capture->WriteData(index_data, size);
+		MarkBufferCaptured(id);
+	}
 
-		_hardware_buffers[id] = buffer;
+	return id;
+}
+int RenderDevice::RegisterHardwareBuffer(GLuint buffer, memory_category::Category category, uint32_t size, const char* debug_name)
+{
+	assert(category == memory_category::MC_VERTEX_BUFFER || category == memory_category::MC_INDEX_BUFFER);
+
+	ResourceMemory memory;
+	memory.category = category;
+	memory.size = size;
+	if(debug_name)
+	{
+		memory.debug_name = debug_name;
+		SetObjectLabel(GL_BUFFER, buffer, debug_name);
 	}
-	else
+
+	return AddHardwareBuffer(buffer, memory);
+}
+void RenderDevice::AttachVertexBuffer(int vertex_array_object, int buffer, vertex_format::VertexFormat format)
+{
+	assert(	vertex_array_object >= 0 &&
+			(uint32_t)vertex_array_object < _vertex_array_objects.size());
+	assert(	buffer >= 0 &&
+			(uint32_t)buffer < _hardware_buffers.size());
+
+	glBindVertexArray(_vertex_array_objects[vertex_array_object]);
+	_current_vertex_array_object = -1; // We unbind the vertex array when we're done
+
+	// The attribute pointers refer to the buffer bound to GL_ARRAY_BUFFER when they're specified.
+	glBindBuffer(GL_ARRAY_BUFFER, _hardware_buffers[buffer]);
+	SetupVertexAttributes(format);
+
+	glBindVertexArray(0);
+
+	_vertex_array_bindings[vertex_array_object].vertex_buffer = buffer;
+	_vertex_array_bindings[vertex_array_object].format = format;
+
+	// The buffer was created outside the device so it's captured together with its contents.
+	if(_capture)
+		CaptureBuffer(vertex_array_object, false);
+}
+void RenderDevice::AttachIndexBuffer(int vertex_array_object, int buffer)
+{
+	assert(	vertex_array_object >= 0 &&
+			(uint32_t)vertex_array_object < _vertex_array_objects.size());
+	assert(	buffer >= 0 &&
+			(uint32_t)buffer < _hardware_buffers.size());
+
+	glBindVertexArray(_vertex_array_objects[vertex_array_object]);
+	_current_vertex_array_object = -1; // We unbind the vertex array when we're done
+
+	// The index buffer binding is part of the vertex array object state.
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _hardware_buffers[buffer]);
+
+	glBindVertexArray(0);
+
+	_vertex_array_bindings[vertex_array_object].index_buffer = buffer;
+
+	if(_capture)
+		CaptureBuffer(vertex_array_object, true);
+}
+void RenderDevice::SetupVertexAttributes(vertex_format::VertexFormat format)
+{
+	switch(format)
 	{
-		// Otherwise just push it to the back.
-	
-		id = (int)_hardware_buffers.size();
-		_hardware_buffers.push_back(buffer);
+	case vertex_format::VF_POSITION3F:
+		{
+			// Specifies the location and format of the position data.
+			glVertexAttribPointer(	0, // Attribute index 0
+									3, // 3 floats (x, y, z)
+									GL_FLOAT, // Format,
+									GL_FALSE, // Data should not be normalized
+									0, // Buffer only contains positions so no need to specify stride.
+									0 
+								); 
+
+			glEnableVertexAttribArray(0);
+		}
+		break;
+	case vertex_format::VF_POSITION3F_NORMAL3F:
+		{
+			// Specifies the location and format of the position data.
+			glVertexAttribPointer(	0, // Attribute index 0
+									3, // 3 floats (Px, Py, Pz)
+									GL_FLOAT, // Format,
+									GL_FALSE, // Data should not be normalized
+									sizeof(float)*6, 
+									0 
+								); 
+			glEnableVertexAttribArray(0);
+
+			// Specifies the location and format of the normal data.
+			glVertexAttribPointer(	1, // Attribute index 1
+									3, // 3 floats (Nx, Ny, Nz)
+									GL_FLOAT, // Format,
+									GL_FALSE, // Data should not be normalized
+									sizeof(float)*6, 
+									(void*)(sizeof(float)*3)
+								); 
+			glEnableVertexAttribArray(1);
+
+		}
+		break;
+	case vertex_format::VF_POSITION3US_NORMAL2S:
+	case vertex_format::VF_POSITION3US_NORMAL3I10:
+		{
+			GLsizei stride = vertex_format::VertexSize(format);
+
+			// Quantized positions are read as [0, 1], the dequantization is part of the model matrix.
+			glVertexAttribPointer(	0, // Attribute index 0
+									3, // 3 unsigned shorts (Px, Py, Pz), the padding is skipped
+									GL_UNSIGNED_SHORT, // Format,
+									GL_TRUE, // Data should be normalized
+									stride,
+									0
+								);
+			glEnableVertexAttribArray(0);
+
+			if(format == vertex_format::VF_POSITION3US_NORMAL2S)
+			{
+				// The octahedral normal is decoded by the vertex shader.
+				glVertexAttribPointer(	1, // Attribute index 1
+										2, // 2 shorts (Ox, Oy)
+										GL_SHORT, // Format,
+										GL_TRUE, // Data should be normalized
+										stride,
+										(void*)(sizeof(uint16_t)*4)
+									);
+			}
+			else
+			{
+				glVertexAttribPointer(	1, // Attribute index 1
+										4, // Packed (Nx, Ny, Nz, unused), the type requires 4 components
+										GL_INT_2_10_10_10_REV, // Format,
+										GL_TRUE, // Data should be normalized
+										stride,
+										(void*)(sizeof(uint16_t)*4)
+									);
+			}
+			glEnableVertexAttribArray(1);
+		}
+		break;
+	default:
+		assert(false);
+		break;
+	};
+}
+void RenderDevice::UpdateHardwareBuffer(int buffer, uint32_t offset, uint32_t size, const void* data)
+{
+	assert(	buffer >= 0 &&
+			(uint32_t)buffer < _hardware_buffers.size());
+	assert(offset + size <= _hardware_buffer_memory[buffer].size);
+
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_UPDATE_HARDWARE_BUFFER);
+		_capture->WriteInt(buffer);
+		_capture->WriteUInt(offset);
+		_capture->WriteData(data, size);
 	}
 
-	return id;
+	// We use the copy target to avoid disturbing any bindings in the current vertex array object.
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _hardware_buffers[buffer]);
+	glBufferSubData(GL_COPY_WRITE_BUFFER, offset, size, data);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+}
+void RenderDevice::CopyHardwareBuffer(int source, int destination, uint32_t size)
+{
+	assert(	source >= 0 &&
+			(uint32_t)source < _hardware_buffers.size());
+	assert(	destination >= 0 &&
+			(uint32_t)destination < _hardware_buffers.size());
+	assert(size <= _hardware_buffer_memory[source].size && size <= _hardware_buffer_memory[destination].size);
+
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_COPY_HARDWARE_BUFFER);
+		_capture->WriteInt(source);
+		_capture->WriteInt(destination);
+		_capture->WriteUInt(size);
+	}
+
+	// The copy is performed on the GPU, no data is read back.
+	glBindBuffer(GL_COPY_READ_BUFFER, _hardware_buffers[source]);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, _hardware_buffers[destination]);
+	glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0, size);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+	glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
 }
 void RenderDevice::ReleaseHardwareBuffer(int buffer)
 {
 	assert(	buffer >= 0 &&
 			(uint32_t)buffer < _hardware_buffers.size());
 
-	// Delete the buffer
-	glDeleteBuffers(1, &_hardware_buffers[buffer]);
-	_hardware_buffers[buffer] = 0;
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_RELEASE_HARDWARE_BUFFER, buffer);
 
-	_free_hardware_buffer_ids.push_back(buffer);
+	// Queue the buffer for deletion, it will be deleted when the GPU is done with it.
+	PendingRelease release;
+	release.type = RT_HARDWARE_BUFFER;
+	release.handle = buffer;
+	_pending_releases.push_back(release);
 }
 int RenderDevice::CreateVertexArrayObject()
 {
@@ -361,6 +994,7 @@ int RenderDevice::CreateVertexArrayObject()
 		_free_vao_ids.pop_back();
 
 		_vertex_array_objects[id] = vao;
+		_vertex_array_bindings[id] = VertexArrayBinding();
 	}
 	else
 	{
@@ -368,7 +1002,11 @@ int RenderDevice::CreateVertexArrayObject()
 	
 		id = (int)_vertex_array_objects.size();
 		_vertex_array_objects.push_back(vao);
+		_vertex_array_bindings.push_back(VertexArrayBinding());
 	}
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_CREATE_VERTEX_ARRAY_OBJECT, id);
 	
 	return id;
 }
@@ -377,27 +1015,40 @@ void RenderDevice::ReleaseVertexArrayObject(int vertex_array_object)
 	assert(	vertex_array_object >= 0 &&
 			(uint32_t)vertex_array_object < _vertex_array_objects.size());
 
-	// Delete the buffer
-	glDeleteVertexArrays(1, &_vertex_array_objects[vertex_array_object]);
-	_vertex_array_objects[vertex_array_object] = 0; // Mark it as deleted
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_RELEASE_VERTEX_ARRAY_OBJECT, vertex_array_object);
 
-	// Release the id so that it later can be reused
-	_free_vao_ids.push_back(vertex_array_object);
+	// Queue the vertex array object for deletion, it will be deleted when the GPU is done with it.
+	PendingRelease release;
+	release.type = RT_VERTEX_ARRAY_OBJECT;
+	release.handle = vertex_array_object;
+	_pending_releases.push_back(release);
+}
+int RenderDevice::CreateShader(const char* vertex_shader_src, const char* fragment_shader_src, const char* debug_name)
+{
+	return CreateShaderFromSources(&vertex_shader_src, 1, &fragment_shader_src, 1, debug_name);
 }
-int RenderDevice::CreateShader(const char* vertex_shader_src, const char* fragment_shader_src)
+int RenderDevice::CreateShaderFromSources(const char** vertex_shader_src, int vertex_source_count, 
+										  const char** fragment_shader_src, int fragment_source_count, const char* debug_name)
 {
 	Shader shader;
 	shader.vertex_shader = 0;
 	shader.fragment_shader = 0;
+	shader.pipeline = 0;
+	shader.vertex_stage = -1;
+	shader.fragment_stage = -1;
+	shader.ref_count = 1;
 
 	shader.program = glCreateProgram();
+	if(debug_name)
+		SetObjectLabel(GL_PROGRAM, shader.program, debug_name);
 	
 	// Vertex shader
 	{
 		shader.vertex_shader = glCreateShader(GL_VERTEX_SHADER);
 
 		// Load shader source into shader
-		glShaderSource(shader.vertex_shader, 1, &vertex_shader_src, NULL); 
+		glShaderSource(shader.vertex_shader, vertex_source_count, vertex_shader_src, NULL); 
 		// Compile shader
 		glCompileShader(shader.vertex_shader);
 
@@ -419,7 +1070,7 @@ int RenderDevice::CreateShader(const char* vertex_shader_src, const char* fragme
 		shader.fragment_shader = glCreateShader(GL_FRAGMENT_SHADER);
 
 		// Load shader source into shader
-		glShaderSource(shader.fragment_shader, 1, &fragment_shader_src, NULL); 
+		glShaderSource(shader.fragment_shader, fragment_source_count, fragment_shader_src, NULL); 
 		// Compile shader
 		glCompileShader(shader.fragment_shader);
 
@@ -458,46 +1109,539 @@ int RenderDevice::CreateShader(const char* vertex_shader_src, const char* fragme
 		return -1;
 	}
 	
+	int id = AddShader(shader);
+	if(_capture)
+	{
+		std::string vertex_source, fragment_source;
+		for(int i = 0; i < vertex_source_count; ++i)
+			vertex_source += vertex_shader_src[i];
+		for(int i = 0; i < fragment_source_count; ++i)
+			fragment_source += fragment_shader_src[i];
+
+		_capture->BeginCommand(capture_command::CC_CREATE_SHADER);
+		_capture->WriteInt(id);
+		_capture->WriteString(vertex_source.c_str());
+		_capture->WriteString(fragment_source.c_str());
+	}
+	return id;
+}
+void RenderDevice::ReleaseShader(int shader_handle)
+{
+	assert(	shader_handle >= 0 &&
+			(uint32_t)shader_handle < _shaders.size());
+
+	Shader& shader = _shaders[shader_handle];
+	if(shader.pipeline)
+	{
+		// Cached pipelines are shared by everyone creating the same combination of stages.
+		assert(shader.ref_count > 0);
+		if(--shader.ref_count > 0)
+			return;
+
+		uint64_t key = ((uint64_t)shader.vertex_stage << 32) | (uint32_t)shader.fragment_stage;
+		_shader_pipeline_cache.erase(key);
+
+		// The stages can be released now that no pipeline refers to them, the stage handles are only reused 
+		//	after the stages are released so a cached pipeline can never refer to a recycled stage.
+		ReleaseShaderStage(shader.vertex_stage);
+		ReleaseShaderStage(shader.fragment_stage);
+	}
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_RELEASE_SHADER, shader_handle);
+
+	// Queue the shader for deletion, it will be deleted when the GPU is done with it.
+	PendingRelease release;
+	release.type = RT_SHADER;
+	release.handle = shader_handle;
+	_pending_releases.push_back(release);
+}
+bool RenderDevice::SupportsSeparablePrograms() const
+{
+	return _separable_programs;
+}
+int RenderDevice::CreateShaderStage(shader_stage::Stage stage, const char* src, const char* debug_name)
+{
+	if(!_separable_programs)
+	{
+		debug::Printf("RenderDevice: Separable programs are not supported.\n");
+		return -1;
+	}
+
+	// Identical sources share the same stage, the key is a hash of the stage type and the source.
+	uint64_t key = 14695981039346656037ULL; // FNV-1a
+	key = (key ^ (uint8_t)stage) * 1099511628211ULL;
+	for(const char* c = src; *c; ++c)
+	{
+		key = (key ^ (uint8_t)*c) * 1099511628211ULL;
+	}
+
+	std::map<uint64_t, int>::iterator it = _shader_stage_cache.find(key);
+	if(it != _shader_stage_cache.end())
+	{
+		_shader_stages[it->second].ref_count++;
+		return it->second;
+	}
+
+	ShaderStage shader_stage;
+	shader_stage.stage = stage;
+	shader_stage.key = key;
+	shader_stage.ref_count = 1;
+	shader_stage.source = src;
+
+	// Compiles the shader and links it into a program flagged with GL_PROGRAM_SEPARABLE.
+	shader_stage.program = glCreateShaderProgramv((stage == shader_stage::SS_VERTEX) ? GL_VERTEX_SHADER : GL_FRAGMENT_SHADER, 1, &src);
+	
+	// Check if compilation and linking was sucessful
+	int param = -1;
+	glGetProgramiv(shader_stage.program, GL_LINK_STATUS, &param);
+	if(param != GL_TRUE)
+	{
+		debug::Printf("RenderDevice: Failed to create %s stage program %u.\n", 
+			(stage == shader_stage::SS_VERTEX) ? "vertex" : "fragment", shader_stage.program);
+			
+		char info_log[2048];
+		int length = 0;
+
+		// Get the info log for the program
+		glGetProgramInfoLog(shader_stage.program, 2048, &length, info_log);
+
+		debug::Printf("%s\n", info_log);
+
+		glDeleteProgram(shader_stage.program);
+		return -1;
+	}
+
+	if(debug_name)
+		SetObjectLabel(GL_PROGRAM, shader_stage.program, debug_name);
+
 	int id = -1;
 
-	// Check for any free slots in the shader container
-	if(_free_shader_ids.size())
+	// Check for any free slots in the stage container
+	if(_free_shader_stage_ids.size())
 	{
-		id = _free_shader_ids.back();
-		_free_shader_ids.pop_back();
+		id = _free_shader_stage_ids.back();
+		_free_shader_stage_ids.pop_back();
 
-		_shaders[id] = shader;
+		_shader_stages[id] = shader_stage;
 	}
 	else
 	{
 		// Otherwise just push it to the back.
 	
-		id = (int)_shaders.size();
-		_shaders.push_back(shader);
+		id = (int)_shader_stages.size();
+		_shader_stages.push_back(shader_stage);
 	}
 
+	_shader_stage_cache[key] = id;
+
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_CREATE_SHADER_STAGE);
+		_capture->WriteInt(id);
+		_capture->WriteUInt(stage);
+		_capture->WriteString(src);
+	}
 	return id;
 }
-void RenderDevice::ReleaseShader(int shader_handle)
+void RenderDevice::ReleaseShaderStage(int stage)
 {
-	assert(	shader_handle >= 0 &&
-			(uint32_t)shader_handle < _shaders.size());
+	assert(	stage >= 0 &&
+			(uint32_t)stage < _shader_stages.size());
 
-	Shader& shader = _shaders[_current_shader];
-	
-	if(shader.vertex_shader != 0)
-		glDeleteShader(shader.vertex_shader);
-	if(shader.fragment_shader != 0)
-		glDeleteShader(shader.fragment_shader);
-	
-	glDeleteProgram(shader.program);
-	
+	ShaderStage& shader_stage = _shader_stages[stage];
+	assert(shader_stage.ref_count > 0);
+	if(--shader_stage.ref_count > 0)
+		return;
+
+	// No new pipelines should find the stage, the object itself is kept alive until the GPU is done with it.
+	_shader_stage_cache.erase(shader_stage.key);
+
+	if(_capture)
+		CaptureHandleCommand(capture_command::CC_RELEASE_SHADER_STAGE, stage);
+
+	PendingRelease release;
+	release.type = RT_SHADER_STAGE;
+	release.handle = stage;
+	_pending_releases.push_back(release);
+}
+int RenderDevice::CreateShaderPipeline(int vertex_stage, int fragment_stage)
+{
+	assert(	vertex_stage >= 0 &&
+			(uint32_t)vertex_stage < _shader_stages.size());
+	assert(	fragment_stage >= 0 &&
+			(uint32_t)fragment_stage < _shader_stages.size());
+	assert(_shader_stages[vertex_stage].stage == shader_stage::SS_VERTEX);
+	assert(_shader_stages[fragment_stage].stage == shader_stage::SS_FRAGMENT);
+
+	uint64_t key = ((uint64_t)vertex_stage << 32) | (uint32_t)fragment_stage;
+	std::map<uint64_t, int>::iterator it = _shader_pipeline_cache.find(key);
+	if(it != _shader_pipeline_cache.end())
+	{
+		_shaders[it->second].ref_count++;
+		return it->second;
+	}
+
+	// No linking is needed, the pipeline just references the already linked stage programs.
+	Shader shader;
 	shader.vertex_shader = 0;
 	shader.fragment_shader = 0;
 	shader.program = 0;
+	shader.vertex_stage = vertex_stage;
+	shader.fragment_stage = fragment_stage;
+	shader.ref_count = 1;
+
+	// Keep the stages alive, and their handles from being reused, for as long as the pipeline exists.
+	_shader_stages[vertex_stage].ref_count++;
+	_shader_stages[fragment_stage].ref_count++;
+
+	glGenProgramPipelines(1, &shader.pipeline);
+	glUseProgramStages(shader.pipeline, GL_VERTEX_SHADER_BIT, _shader_stages[vertex_stage].program);
+	glUseProgramStages(shader.pipeline, GL_FRAGMENT_SHADER_BIT, _shader_stages[fragment_stage].program);
+
+	int id = AddShader(shader);
+	_shader_pipeline_cache[key] = id;
+
+	if(_capture)
+	{
+		_capture->BeginCommand(capture_command::CC_CREATE_SHADER_PIPELINE);
+		_capture->WriteInt(id);
+		_capture->WriteInt(vertex_stage);
+		_capture->WriteInt(fragment_stage);
+	}
+	return id;
+}
+int RenderDevice::CreateShaderTemplate(const char* vertex_shader_src, const char* fragment_shader_src, const char* debug_name)
+{
+	ShaderTemplate shader_template;
+	shader_template.vertex_shader_src = vertex_shader_src;
+	shader_template.fragment_shader_src = fragment_shader_src;
+	if(debug_name)
+		shader_template.debug_name = debug_name;
+
+	int id = -1;
+
+	// Check for any free slots in the template container
+	if(_free_shader_template_ids.size())
+	{
+		id = _free_shader_template_ids.back();
+		_free_shader_template_ids.pop_back();
+
+		_shader_templates[id] = shader_template;
+	}
+	else
+	{
+		// Otherwise just push it to the back.
+	
+		id = (int)_shader_templates.size();
+		_shader_templates.push_back(shader_template);
+	}
+
+	return id;
+}
+int RenderDevice::GetShaderVariant(int shader_template, const ShaderDefine* defines, int define_count)
+{
+	assert(	shader_template >= 0 &&
+			(uint32_t)shader_template < _shader_templates.size());
+
+	ShaderTemplate& tmpl = _shader_templates[shader_template];
+
+	// The key is a hash of all definitions, computed without building any strings as this is called for every draw.
+	uint64_t key = 14695981039346656037ULL; // FNV-1a
+	for(int i = 0; i < define_count; ++i)
+	{
+		for(const char* c = defines[i].name; *c; ++c)
+		{
+			key = (key ^ (uint8_t)*c) * 1099511628211ULL;
+		}
+		key = (key ^ 0xff) * 1099511628211ULL; // Separator between name and value
+		for(int b = 0; b < 4; ++b)
+		{
+			key = (key ^ (uint8_t)(defines[i].value >> (b*8))) * 1099511628211ULL;
+		}
+	}
+
+	std::map<uint64_t, int>::iterator it = tmpl.variants.find(key);
+	if(it != tmpl.variants.end())
+		return it->second;
+
+	// Not in the cache, build the block of definitions and compile a new variant.
+	std::string define_block;
+	std::string name = tmpl.debug_name;
+	for(int i = 0; i < define_count; ++i)
+	{
+		char line[256];
+		sprintf(line, "#define %.200s %d\n", defines[i].name, defines[i].value);
+		define_block += line;
+		
+		sprintf(line, " %.200s=%d", defines[i].name, defines[i].value);
+		name += line;
+	}
+
+	// The definitions are inserted after the #version directive, which is required to come first in the source.
+	const char* vertex_sources[3];
+	const char* fragment_sources[3];
+	std::string vertex_version, fragment_version;
+	int vertex_source_count = SplitShaderVersion(tmpl.vertex_shader_src, define_block, vertex_version, vertex_sources);
+	int fragment_source_count = SplitShaderVersion(tmpl.fragment_shader_src, define_block, fragment_version, fragment_sources);
+
+	int shader = CreateShaderFromSources(vertex_sources, vertex_source_count, fragment_sources, fragment_source_count, name.c_str());
+	if(shader == -1)
+	{
+		debug::Printf("RenderDevice: Failed to compile variant of shader template '%s':%s\n", tmpl.debug_name.c_str(), name.c_str());
+	}
+
+	// Failed variants are cached as well, they would otherwise be recompiled for every draw asking for them.
+	tmpl.variants[key] = shader;
+	return shader;
+}
+void RenderDevice::ReleaseShaderTemplate(int shader_template)
+{
+	assert(	shader_template >= 0 &&
+			(uint32_t)shader_template < _shader_templates.size());
+
+	ShaderTemplate& tmpl = _shader_templates[shader_template];
+	for(std::map<uint64_t, int>::iterator it = tmpl.variants.begin(); 
+		it != tmpl.variants.end(); ++it)
+	{
+		if(it->second != -1)
+			ReleaseShader(it->second);
+	}
+	tmpl = ShaderTemplate();
 
 	// Release the id so that it later can be reused
-	_free_shader_ids.push_back(shader_handle);
+	_free_shader_template_ids.push_back(shader_template);
+}
+int RenderDevice::SplitShaderVersion(const std::string& source, const std::string& define_block, std::string& version, const char** sources)
+{
+	size_t version_pos = source.find("#version");
+	if(version_pos == std::string::npos)
+	{
+		sources[0] = define_block.c_str();
+		sources[1] = source.c_str();
+		return 2;
+	}
+
+	size_t line_end = source.find('\n', version_pos);
+	if(line_end == std::string::npos)
+		line_end = source.size();
+	else
+		line_end++; // Include the line break
+
+	version = source.substr(0, line_end);
+	sources[0] = version.c_str();
+	sources[1] = define_block.c_str();
+	sources[2] = source.c_str() + line_end;
+	return 3;
+}
+const MemoryStats& RenderDevice::GetMemoryStats(memory_category::Category category) const
+{
+	assert(category >= 0 && category < memory_category::MC_COUNT);
+	return _memory_stats[category];
+}
+const MemoryStats& RenderDevice::GetTotalMemoryStats() const
+{
+	return _total_memory_stats;
+}
+void RenderDevice::DumpMemoryUsage() const
+{
+	debug::Printf("GPU memory usage:\n");
+	for(int i = 0; i < memory_category::MC_COUNT; ++i)
+	{
+		debug::Printf("  %-14s %10llu bytes (peak %10llu bytes) in %u resource(s)\n", memory_category_names[i],
+			(unsigned long long)_memory_stats[i].allocated, (unsigned long long)_memory_stats[i].high_water_mark, 
+			_memory_stats[i].resource_count);
+	}
+	debug::Printf("  %-14s %10llu bytes (peak %10llu bytes) in %u resource(s)\n", "Total",
+		(unsigned long long)_total_memory_stats.allocated, (unsigned long long)_total_memory_stats.high_water_mark, 
+		_total_memory_stats.resource_count);
+	
+	if(_memory_budget)
+		debug::Printf("  Budget: %llu bytes\n", (unsigned long long)_memory_budget);
+
+	// List all live buffers
+	for(uint32_t i = 0; i < _hardware_buffer_memory.size(); ++i)
+	{
+		const ResourceMemory& memory = _hardware_buffer_memory[i];
+		if(_hardware_buffers[i] == 0)
+			continue;
+
+		debug::Printf("  [%4u] %-14s %10u bytes  %s\n", i, memory_category_names[memory.category], memory.size, 
+			memory.debug_name.size() ? memory.debug_name.c_str() : "<unnamed>");
+	}
+}
+void RenderDevice::SetMemoryBudget(uint64_t bytes)
+{
+	_memory_budget = bytes;
+}
+bool RenderDevice::QueryDriverMemoryInfo(uint32_t& total_kb, uint32_t& available_kb) const
+{
+	total_kb = 0;
+	available_kb = 0;
+
+#ifndef PLATFORM_MACOSX // Neither extension is exposed on OSX.
+	if(GLEW_NVX_gpu_memory_info)
+	{
+		GLint total = 0, available = 0;
+		glGetIntegerv(GL_GPU_MEMORY_INFO_DEDICATED_VIDMEM_NVX, &total);
+		glGetIntegerv(GL_GPU_MEMORY_INFO_CURRENT_AVAILABLE_VIDMEM_NVX, &available);
+
+		total_kb = (uint32_t)total;
+		available_kb = (uint32_t)available;
+		return true;
+	}
+	if(GLEW_ATI_meminfo)
+	{
+		// ATI only reports free memory: total free, largest free block, total auxiliary free and largest auxiliary free block.
+		GLint info[4] = { 0, 0, 0, 0 };
+		glGetIntegerv(GL_VBO_FREE_MEMORY_ATI, info);
+
+		available_kb = (uint32_t)info[0];
+		return true;
+	}
+#endif
+	return false;
+}
+void RenderDevice::DumpDebugMessageStats() const
+{
+#ifndef PLATFORM_MACOSX
+	debug::Printf("Driver messages:\n");
+	for(std::map<uint64_t, DebugMessageStats>::const_iterator it = _debug_messages.begin(); 
+		it != _debug_messages.end(); ++it)
+	{
+		const DebugMessageStats& stats = it->second;
+		debug::Printf("  [%s/%s/%s] id %u: %u time(s), at most %u in one frame\n    %s\n", 
+			DebugSourceName(stats.source), DebugTypeName(stats.type), DebugSeverityName(stats.severity), stats.id,
+			stats.total_count, stats.max_frame_count, stats.message.c_str());
+	}
+#endif
+}
+#ifndef PLATFORM_MACOSX
+void GLAPIENTRY RenderDevice::DebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, 
+	GLsizei , const GLchar* message, GLvoid* user_param)
+{
+	((RenderDevice*)user_param)->OnDebugMessage(source, type, id, severity, message);
+}
+void RenderDevice::OnDebugMessage(GLenum source, GLenum type, GLuint id, GLenum severity, const GLchar* message)
+{
+	// Group messages by their id, ids are only unique within their source.
+	uint64_t key = ((uint64_t)source << 32) | id;
+
+	std::map<uint64_t, DebugMessageStats>::iterator it = _debug_messages.find(key);
+	if(it == _debug_messages.end())
+	{
+		DebugMessageStats stats;
+		stats.source = source;
+		stats.type = type;
+		stats.severity = severity;
+		stats.id = id;
+		stats.message = message;
+		stats.total_count = 0;
+		stats.frame_count = 0;
+		stats.max_frame_count = 0;
+
+		it = _debug_messages.insert(std::pair<uint64_t, DebugMessageStats>(key, stats)).first;
+	}
+
+	DebugMessageStats& stats = it->second;
+	stats.total_count++;
+	stats.frame_count++;
+	if(stats.frame_count > stats.max_frame_count)
+		stats.max_frame_count = stats.frame_count;
+
+	// Avoid flooding the output with messages repeated every frame, the counts are still available through DumpDebugMessageStats.
+	if(stats.total_count <= MAX_DEBUG_MESSAGE_REPEATS)
+	{
+		debug::Printf("RenderDevice: [%s/%s/%s] id %u: %s\n", DebugSourceName(source), DebugTypeName(type), 
+			DebugSeverityName(severity), id, message);
+
+		if(stats.total_count == MAX_DEBUG_MESSAGE_REPEATS)
+			debug::Printf("RenderDevice: Further occurrences of message %u will be suppressed.\n", id);
+	}
+}
+#endif
+void RenderDevice::SetObjectLabel(GLenum identifier, GLuint name, const char* label)
+{
+#ifndef PLATFORM_MACOSX
+	if(_debug_output)
+		glObjectLabel(identifier, name, -1, label);
+#endif
+}
+void RenderDevice::TrackMemory(const ResourceMemory& resource)
+{
+	MemoryStats* stats[2] = { &_memory_stats[resource.category], &_total_memory_stats };
+	for(int i = 0; i < 2; ++i)
+	{
+		stats[i]->allocated += resource.size;
+		stats[i]->resource_count++;
+		if(stats[i]->allocated > stats[i]->high_water_mark)
+			stats[i]->high_water_mark = stats[i]->allocated;
+	}
+
+	if(_memory_budget && _total_memory_stats.allocated > _memory_budget)
+	{
+		debug::Printf("RenderDevice: [Warning] GPU memory budget exceeded (%llu of %llu bytes) when allocating %u bytes for '%s'.\n",
+			(unsigned long long)_total_memory_stats.allocated, (unsigned long long)_memory_budget, resource.size,
+			resource.debug_name.size() ? resource.debug_name.c_str() : "<unnamed>");
+	}
+}
+void RenderDevice::UntrackMemory(const ResourceMemory& resource)
+{
+	MemoryStats* stats[2] = { &_memory_stats[resource.category], &_total_memory_stats };
+	for(int i = 0; i < 2; ++i)
+	{
+		assert(stats[i]->allocated >= resource.size && stats[i]->resource_count > 0);
+		stats[i]->allocated -= resource.size;
+		stats[i]->resource_count--;
+	}
+}
+int RenderDevice::AddHardwareBuffer(GLuint buffer, const ResourceMemory& memory)
+{
+	int id = -1;
+
+	// Check for any free slots in the buffer container
+	if(_free_hardware_buffer_ids.size())
+	{
+		id = _free_hardware_buffer_ids.back();
+		_free_hardware_buffer_ids.pop_back();
+
+		_hardware_buffers[id] = buffer;
+		_hardware_buffer_memory[id] = memory;
+	}
+	else
+	{
+		// Otherwise just push it to the back.
+	
+		id = (int)_hardware_buffers.size();
+		_hardware_buffers.push_back(buffer);
+		_hardware_buffer_memory.push_back(memory);
+	}
+
+	TrackMemory(memory);
+
+	return id;
+}
+int RenderDevice::AddShader(const Shader& shader)
+{
+	int id = -1;
+
+	// Check for any free slots in the shader container
+	if(_free_shader_ids.size())
+	{
+		id = _free_shader_ids.back();
+		_free_shader_ids.pop_back();
+
+		_shaders[id] = shader;
+	}
+	else
+	{
+		// Otherwise just push it to the back.
+	
+		id = (int)_shaders.size();
+		_shaders.push_back(shader);
+	}
+
+	return id;
 }
 void RenderDevice::PrintShaderInfoLog(GLuint shader)
 {
@@ -509,4 +1653,291 @@ void RenderDevice::PrintShaderInfoLog(GLuint shader)
 
 	debug::Printf("%s\n", info_log);
 }
+void RenderDevice::RequestCapture(const char* path)
+{
+	assert(path && *path);
+	_capture_path = path;
+}
+bool RenderDevice::IsCapturing() const
+{
+	return _capture != NULL;
+}
+void RenderDevice::StartCapture()
+{
+	assert(!_capture);
+
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	_capture = new CaptureWriter();
+	if(!_capture->Open(_capture_path.c_str(), viewport[2], viewport[3]))
+	{
+		delete _capture;
+		_capture = NULL;
+	}
+	else
+	{
+		debug::Printf("RenderDevice: Capturing frame to '%s'.\n", _capture_path.c_str());
+
+		_captured_buffers.assign(_hardware_buffers.size(), 0);
+		WriteCaptureSnapshot();
+		_capture->BeginCommand(capture_command::CC_BEGIN_FRAME);
+	}
+	_capture_path.clear();
+}
+void RenderDevice::WriteCaptureSnapshot()
+{
+	// Objects waiting for release are included as well, the frame may still refer to them.
+
+	for(uint32_t i = 0; i < _vertex_array_objects.size(); ++i)
+	{
+		if(_vertex_array_objects[i] != 0)
+			CaptureHandleCommand(capture_command::CC_CREATE_VERTEX_ARRAY_OBJECT, i);
+	}
+
+	// Buffers are recreated through the vertex array object they're bound to, any buffer not currently 
+	//	bound can't be drawn from and is left out.
+	for(uint32_t i = 0; i < _vertex_array_bindings.size(); ++i)
+	{
+		if(_vertex_array_objects[i] == 0)
+			continue;
+
+		if(_vertex_array_bindings[i].vertex_buffer != -1)
+			CaptureBuffer(i, false);
+		if(_vertex_array_bindings[i].index_buffer != -1)
+			CaptureBuffer(i, true);
+	}
+
+	for(uint32_t i = 0; i < _shader_stages.size(); ++i)
+	{
+		if(_shader_stages[i].program == 0)
+			continue;
+
+		_capture->BeginCommand(capture_command::CC_CREATE_SHADER_STAGE);
+		_capture->WriteInt(i);
+		_capture->WriteUInt(_shader_stages[i].stage);
+		_capture->WriteString(_shader_stages[i].source.c_str());
+	}
+
+	std::vector<char> source;
+	for(uint32_t i = 0; i < _shaders.size(); ++i)
+	{
+		const Shader& shader = _shaders[i];
+		if(shader.pipeline != 0)
+		{
+			_capture->BeginCommand(capture_command::CC_CREATE_SHADER_PIPELINE);
+			_capture->WriteInt(i);
+			_capture->WriteInt(shader.vertex_stage);
+			_capture->WriteInt(shader.fragment_stage);
+		}
+		else if(shader.program != 0)
+		{
+			// The driver keeps the sources of the shader objects, including any definitions of variants.
+			_capture->BeginCommand(capture_command::CC_CREATE_SHADER);
+			_capture->WriteInt(i);
+
+			GLuint shader_objects[2] = { shader.vertex_shader, shader.fragment_shader };
+			for(int s = 0; s < 2; ++s)
+			{
+				GLint length = 0;
+				glGetShaderiv(shader_objects[s], GL_SHADER_SOURCE_LENGTH, &length);
+				source.resize(length + 1);
+				glGetShaderSource(shader_objects[s], length + 1, NULL, &source[0]);
+				source[length] = '\0';
+
+				_capture->WriteString(&source[0]);
+			}
+		}
+	}
+
+	for(uint32_t i = 0; i < _queries.size(); ++i)
+	{
+		if(_queries[i].query != 0)
+			CaptureHandleCommand(capture_command::CC_CREATE_QUERY, i);
+	}
+
+	// State set directly by the application rather than through the device.
+	GLint viewport[4];
+	glGetIntegerv(GL_VIEWPORT, viewport);
+
+	_capture->BeginCommand(capture_command::CC_SET_RENDER_STATE);
+	for(int i = 0; i < 4; ++i)
+		_capture->WriteInt(viewport[i]);
+	_capture->WriteUInt(glIsEnabled(GL_CULL_FACE));
+	_capture->WriteUInt(glIsEnabled(GL_DEPTH_TEST));
+
+	GLfloat clear_color[4];
+	glGetFloatv(GL_COLOR_CLEAR_VALUE, clear_color);
+	_capture->BeginCommand(capture_command::CC_SET_CLEAR_COLOR);
+	_capture->WriteFloats(clear_color, 4);
+}
+void RenderDevice::CaptureBuffer(int vertex_array_object, bool index_buffer)
+{
+	const VertexArrayBinding& binding = _vertex_array_bindings[vertex_array_object];
+	int buffer = index_buffer ? binding.index_buffer : binding.vertex_buffer;
+
+	// Several vertex array objects may share a buffer, e.g. the levels of detail of a mesh.
+	if((uint32_t)buffer < _captured_buffers.size() && _captured_buffers[buffer])
+	{
+		_capture->BeginCommand(index_buffer ? capture_command::CC_ATTACH_INDEX_BUFFER : capture_command::CC_ATTACH_VERTEX_BUFFER);
+		_capture->WriteInt(buffer);
+		_capture->WriteInt(vertex_array_object);
+		if(!index_buffer)
+			_capture->WriteUInt(binding.format);
+		return;
+	}
+
+	uint32_t size = _hardware_buffer_memory[buffer].size;
 
+	// Read back the contents from the GPU
+	std::vector<uint8_t> contents(std::max(size, 1u));
+	glBindBuffer(GL_COPY_READ_BUFFER, _hardware_buffers[buffer]);
+	glGetBufferSubData(GL_COPY_READ_BUFFER, 0, size, &contents[0]);
+	glBindBuffer(GL_COPY_READ_BUFFER, 0);
+
+	if(index_buffer)
+	{
+		_capture->BeginCommand(capture_command::CC_CREATE_INDEX_BUFFER);
+		_capture->WriteInt(buffer);
+		_capture->WriteInt(vertex_array_object);
+		_capture->WriteUInt(size);
+	}
+	else
+	{
+		_capture->BeginCommand(capture_command::CC_CREATE_VERTEX_BUFFER);
+		_capture->WriteInt(buffer);
+		_capture->WriteInt(vertex_array_object);
+		_capture->WriteUInt(binding.format);
+		_capture->WriteUInt(size);
+	}
+	_capture->WriteData(&contents[0], size);
+	MarkBufferCaptured(buffer);
+}
+void RenderDevice::MarkBufferCaptured(int buffer)
+{
+	if((uint32_t)buffer >= _captured_buffers.size())
+		_captured_buffers.resize(buffer + 1, 0);
+	_captured_buffers[buffer] = 1;
+}
+void RenderDevice::CaptureHandleCommand(capture_command::Command command, int handle)
+{
+	_capture->BeginCommand(command);
+	_capture->WriteInt(handle);
+}
+void RenderDevice::CaptureUniform(const char* name, const float* values, uint32_t count)
+{
+	_capture->BeginCommand(capture_command::CC_SET_UNIFORM);
+	_capture->WriteString(name);
+	_capture->WriteUInt(count);
+	_capture->WriteFloats(values, count);
+}
+void RenderDevice::ProcessReleaseBatches(bool wait)
+{
+	int budget = MAX_RELEASES_PER_FRAME;
+
+	while(_release_batches.size() && (wait || budget > 0))
+	{
+		ReleaseBatch& batch = _release_batches.front();
+
+		if(batch.fence)
+		{
+			// Fences are signaled in order so if this one isn't signaled, none of the later ones are either.
+			GLenum result = glClientWaitSync(batch.fence, GL_SYNC_FLUSH_COMMANDS_BIT, wait ? GL_TIMEOUT_IGNORED : 0);
+			if(result == GL_TIMEOUT_EXPIRED)
+				break;
+			if(result == GL_WAIT_FAILED)
+				debug::Printf("RenderDevice: Failed waiting for release fence, destroying objects anyway.\n");
+
+			glDeleteSync(batch.fence);
+			batch.fence = 0;
+		}
+		_completed_frames = std::max(_completed_frames, batch.frame + 1);
+
+		// Destroy the objects, limited by the budget to spread the teardown of large scenes over several frames.
+		while(batch.releases.size() && (wait || budget > 0))
+		{
+			const PendingRelease& release = batch.releases.back();
+			switch(release.type)
+			{
+			case RT_HARDWARE_BUFFER:
+				{
+					glDeleteBuffers(1, &_hardware_buffers[release.handle]);
+					_hardware_buffers[release.handle] = 0;
+
+					UntrackMemory(_hardware_buffer_memory[release.handle]);
+					_hardware_buffer_memory[release.handle] = ResourceMemory();
+
+					// The id may be reused, make sure no vertex array object refers to it anymore.
+					for(std::vector<VertexArrayBinding>::iterator it = _vertex_array_bindings.begin(); 
+						it != _vertex_array_bindings.end(); ++it)
+					{
+						if(it->vertex_buffer == release.handle)
+							it->vertex_buffer = -1;
+						if(it->index_buffer == release.handle)
+							it->index_buffer = -1;
+					}
+
+					// Release the id so that it later can be reused
+					_free_hardware_buffer_ids.push_back(release.handle);
+				}
+				break;
+			case RT_VERTEX_ARRAY_OBJECT:
+				{
+					glDeleteVertexArrays(1, &_vertex_array_objects[release.handle]);
+					_vertex_array_objects[release.handle] = 0; // Mark it as deleted
+					_vertex_array_bindings[release.handle] = VertexArrayBinding();
+
+					if(_current_vertex_array_object == release.handle)
+						_current_vertex_array_object = -1;
+
+					// Release the id so that it later can be reused
+					_free_vao_ids.push_back(release.handle);
+				}
+				break;
+			case RT_SHADER:
+				{
+					Shader& shader = _shaders[release.handle];
+
+					if(shader.vertex_shader != 0)
+						glDeleteShader(shader.vertex_shader);
+					if(shader.fragment_shader != 0)
+						glDeleteShader(shader.fragment_shader);
+
+					if(shader.program != 0)
+						glDeleteProgram(shader.program);
+					if(shader.pipeline != 0)
+						glDeleteProgramPipelines(1, &shader.pipeline);
+
+					shader.vertex_shader = 0;
+					shader.fragment_shader = 0;
+					shader.program = 0;
+					shader.pipeline = 0;
+
+					// Release the id so that it later can be reused
+					_free_shader_ids.push_back(release.handle);
+				}
+				break;
+			case RT_SHADER_STAGE:
+				{
+					ShaderStage& shader_stage = _shader_stages[release.handle];
+
+					glDeleteProgram(shader_stage.program);
+					shader_stage.program = 0;
+					shader_stage.source.clear();
+
+					// Release the id so that it later can be reused
+					_free_shader_stage_ids.push_back(release.handle);
+				}
+				break;
+			};
+
+			batch.releases.pop_back();
+			--budget;
+		}
+
+		if(batch.releases.size())
+			break; // Out of budget, continue next frame.
+
+		_release_batches.erase(_release_batches.begin());
+	}
+}
@@ -1,14 +1,62 @@
 #ifndef __RENDERDEVICE_H__
 #define __RENDERDEVICE_H__
 
+#include "FrameCapture.h"
+
 namespace vertex_format
 {
 	/// Describes the format of a vertex in a vertex buffer.
 	enum VertexFormat
 	{
 		VF_POSITION3F, // Each vertex holds only a position: x, y, z
-		VF_POSITION3F_NORMAL3F // Each vertex first holds the position (Px, Py, Pz) and then the normal (Nx, Ny, Nz)
+		VF_POSITION3F_NORMAL3F, // Each vertex first holds the position (Px, Py, Pz) and then the normal (Nx, Ny, Nz)
+		VF_POSITION3US_NORMAL2S, // Quantized position as 16-bit unsigned normalized integers (Px, Py, Pz, padding) followed by an octahedral normal as 16-bit signed normalized integers (Ox, Oy), see vertex_quantizer
+		VF_POSITION3US_NORMAL3I10, // Quantized position as 16-bit unsigned normalized integers (Px, Py, Pz, padding) followed by the normal as signed normalized 10-10-10-2 integers (Nx, Ny, Nz, unused)
+		VF_COUNT
 	};
+
+	/// @brief Returns the size of a single vertex of the specified format in bytes.
+	uint32_t VertexSize(VertexFormat format);
+};
+
+namespace memory_category
+{
+	/// Categories used when tracking the GPU memory held by resources.
+	enum Category
+	{
+		MC_VERTEX_BUFFER,
+		MC_INDEX_BUFFER,
+		MC_TEXTURE,
+		MC_RENDER_TARGET,
+		MC_COUNT
+	};
+};
+
+/// GPU memory statistics for a set of resources.
+struct MemoryStats
+{
+	uint64_t allocated; // Number of bytes currently allocated.
+	uint64_t high_water_mark; // The highest number of bytes allocated at any one time.
+	uint32_t resource_count; // Number of live resources.
+
+	MemoryStats() : allocated(0), high_water_mark(0), resource_count(0) {}
+};
+
+namespace shader_stage
+{
+	/// Stages of the programmable pipeline.
+	enum Stage
+	{
+		SS_VERTEX,
+		SS_FRAGMENT
+	};
+};
+
+/// Preprocessor definition used when compiling a shader variant, results in "#define name value".
+struct ShaderDefine
+{
+	const char* name;
+	int value;
 };
 
 /// Contains all the information needed to perform a draw call.
@@ -20,10 +68,13 @@ struct DrawCall
 	int vertex_count;
 
 	int index_count; // Number of indices, setting this to 0 will specify to not use an index buffer.
+	int index_offset; // Offset to the first index in the index buffer, in number of indices.
+	GLenum index_type; // Type of the indices in the index buffer, GL_UNSIGNED_SHORT or GL_UNSIGNED_INT.
+	int base_vertex; // Constant added to each index when fetching vertices.
 
 	int vertex_array_object;
 
-	DrawCall() : vertex_offset(0), vertex_count(0), index_count(0), vertex_array_object(-1) {}
+	DrawCall() : vertex_offset(0), vertex_count(0), index_count(0), index_offset(0), index_type(GL_UNSIGNED_SHORT), base_vertex(0), vertex_array_object(-1) {}
 };
 
 /// @brief Render device handling low-level opengl calls.
@@ -39,6 +90,18 @@ public:
 
 	/// @brief Shuts down the render device, performing any necessary clean up.
 	void Shutdown();
+
+	/// @brief Marks the end of the current frame, this should be called once every frame after all rendering is done.
+	///		Resources released during the frame are fenced and any resources no longer in use by the GPU are destroyed.
+	void EndFrame();
+
+	/// @brief Returns the number of the frame currently being recorded, counting from 0.
+	uint32_t FrameNumber() const;
+
+	/// @brief Checks whether the GPU have finished all commands of the specified frame, as of the last EndFrame.
+	///		Ranges of a buffer that were in use during the frame can be overwritten once it's complete.
+	/// @param frame Frame number returned by FrameNumber.
+	bool IsFrameComplete(uint32_t frame) const;
 	
 
 	/// @brief Binds the specified shader program to the pipeline.
@@ -65,10 +128,22 @@ public:
 	/// @param value Specifies the new value.
 	void SetUniformMatrix4f(const char* name, const Mat4x4& value);
 
+	/// @brief Specifies the value of a uniform variable.
+	/// @param name Name of the uniform variable.
+	/// @param value Specifies the new value.
+	void SetUniformMatrix3f(const char* name, const Mat3x3& value);
+
 
 	/// @param draw_mode Specifies what kind of primitives to render.
 	void Draw(const DrawCall& draw_call);
 
+	/// @brief Draws several ranges of indices with a single call, e.g. the visible clusters of a mesh.
+	/// @param draw_call Draw call for the whole mesh, everything but the index offset and count is used for all ranges.
+	/// @param index_offsets Offset to the first index of each range, in number of indices from the start of the buffer.
+	/// @param index_counts Number of indices in each range.
+	/// @param draw_count Number of ranges.
+	void MultiDraw(const DrawCall& draw_call, const int* index_offsets, const int* index_counts, int draw_count);
+
 	
 	/// @brief Clears the specified frame buffers. Clear the color and depth buffer.
 	/// @param mask Specifies which buffers to be cleared, possible values are GL_COLOR_BUFFER_BIT, GL_DEPTH_BUFFER_BIT, and GL_STENCIL_BUFFER_BIT.
@@ -77,11 +152,46 @@ public:
 	/// @brief Specifies the clear color for when clearing the back buffer. 
 	void SetClearColor(float r, float g, float b, float a);
 
+	/// @brief Enables or disables writing to the color buffer.
+	void SetColorWrite(bool enable);
+
+	/// @brief Enables or disables writing to the depth buffer.
+	void SetDepthWrite(bool enable);
+
+
+	/// @brief Creates a new occlusion query object.
+	/// @return Handle to the query.
+	/// @sa ReleaseQuery
+	int CreateQuery();
+
+	/// @brief Releases a query created by CreateQuery.
+	void ReleaseQuery(int query);
+
+	/// @brief Starts counting the samples passing the depth test for all following draw calls.
+	///		Only one occlusion query can be active at a time.
+	void BeginOcclusionQuery(int query);
+
+	/// @brief Stops counting samples for the active occlusion query.
+	void EndOcclusionQuery();
+
+	/// @brief Retrieves the result of an occlusion query without waiting for the GPU.
+	/// @param samples Receives the number of samples that passed the depth test.
+	/// @return False if the result is not available yet or if the query never have been issued.
+	bool GetQueryResult(int query, uint32_t& samples);
+
+	/// @brief Starts conditional rendering, the following draw calls are discarded by the GPU if no samples passed 
+	///		during the specified query. The GPU doesn't wait for the result, if it's not ready the draws are performed.
+	void BeginConditionalRender(int query);
+
+	/// @brief Ends conditional rendering started by BeginConditionalRender.
+	void EndConditionalRender();
+
 
 	/// @brief Creates a new vertex array object, this can later be used when creating the vertex and index buffers.
 	int CreateVertexArrayObject();
 
 	/// @brief Releases a vertex array object created by CreateVertexArrayObject.
+	///	The object is destroyed once the GPU have finished all frames that may use it.
 	void ReleaseVertexArrayObject(int vertex_array_object);
 
 
@@ -91,20 +201,57 @@ public:
 	/// @param size The total size of the buffer in bytes.
 	/// @param vertex_data A pointer to the data that should be copied to the buffer.
 	///						NULL means the buffer will be empty.
+	/// @param debug_name Optional name used to identify the buffer in memory dumps.
 	/// @return Handle to the new vertex buffer.
 	/// @sa ReleaseHardwareBuffer
-	int CreateVertexBuffer(int vertex_array_object, vertex_format::VertexFormat format, uint32_t size, void* vertex_data);
+	int CreateVertexBuffer(int vertex_array_object, vertex_format::VertexFormat format, uint32_t size, const void* vertex_data, const char* debug_name = NULL);
 	
 	/// @brief Creates a new index buffer.
 	/// @param vertex_array_object Specifies which vertex array object to bind this buffer to.
 	/// @param index_count The total number of indices in the buffer.
 	/// @param index_data A pointer to the data that should be copied to the buffer.
 	///						NULL means the buffer will be empty. Indices are assumed to unsigned shorts.
+	/// @param debug_name Optional name used to identify the buffer in memory dumps.
 	/// @return Handle to the new index buffer.
 	/// @sa ReleaseHardwareBuffer
-	int CreateIndexBuffer(int vertex_array_object, uint32_t index_count, uint16_t* index_data);
+	int CreateIndexBuffer(int vertex_array_object, uint32_t index_count, const uint16_t* index_data, const char* debug_name = NULL);
+
+	/// @brief Creates a new index buffer with 32-bit indices, for meshes with more vertices than 16-bit indices can address.
+	///		Draw calls using the buffer needs to specify GL_UNSIGNED_INT as index type.
+	/// @sa CreateIndexBuffer
+	int CreateIndexBuffer32(int vertex_array_object, uint32_t index_count, const uint32_t* index_data, const char* debug_name = NULL);
+
+	/// @brief Registers a buffer created outside the device, e.g. by the resource uploader on a shared context.
+	///		The device takes ownership of the buffer, it's released through ReleaseHardwareBuffer as any other buffer.
+	/// @param buffer The opengl buffer object.
+	/// @param category Specifies whether it's a vertex or an index buffer.
+	/// @param size Size of the buffer in bytes.
+	/// @param debug_name Optional name used to identify the buffer in memory dumps.
+	/// @return Handle to the buffer.
+	int RegisterHardwareBuffer(GLuint buffer, memory_category::Category category, uint32_t size, const char* debug_name = NULL);
+
+	/// @brief Binds a vertex buffer to a vertex array object, replacing any previously bound vertex buffer.
+	/// @param format Describes the format of a vertex in the vertex buffer.
+	void AttachVertexBuffer(int vertex_array_object, int buffer, vertex_format::VertexFormat format);
+
+	/// @brief Binds an index buffer to a vertex array object, replacing any previously bound index buffer.
+	void AttachIndexBuffer(int vertex_array_object, int buffer);
+
+	/// @brief Uploads data to a region of an existing hardware buffer.
+	/// @param buffer Handle to the buffer.
+	/// @param offset Offset in bytes from the start of the buffer.
+	/// @param size Size of the data in bytes.
+	/// @param data The data that should be copied to the buffer.
+	void UpdateHardwareBuffer(int buffer, uint32_t offset, uint32_t size, const void* data);
+
+	/// @brief Copies data from the start of one hardware buffer to the start of another.
+	/// @param source Handle to the buffer to copy from.
+	/// @param destination Handle to the buffer to copy to.
+	/// @param size Number of bytes to copy.
+	void CopyHardwareBuffer(int source, int destination, uint32_t size);
 
 	/// @brief Releases the specified hardware buffer.
+	///	The buffer is destroyed once the GPU have finished all frames that may use it.
 	/// @param buffer Handle to the buffer.
 	/// @sa CreateVertexBuffer CreateIndexBuffer
 	void ReleaseHardwareBuffer(int buffer);
@@ -113,18 +260,91 @@ public:
 	/// @brief Creates a new shader program consisting of a vertex shader and a fragment shader.
 	/// @param vertex_shader_src String containing the GLSL source code for the vertex shader.
 	/// @param fragment_shader_src String containing the GLSL source code for the fragment shader.
+	/// @param debug_name Optional name used to identify the program in driver messages.
 	/// @return Returns a handle to the shader if shader was created successful, returns -1 if it failed.
 	/// @sa ReleaseShader
-	int CreateShader(const char* vertex_shader_src, const char* fragment_shader_src);
+	int CreateShader(const char* vertex_shader_src, const char* fragment_shader_src, const char* debug_name = NULL);
+
+	/// @brief Returns true if separable programs and program pipelines (GL_ARB_separate_shader_objects) are supported.
+	bool SupportsSeparablePrograms() const;
+
+	/// @brief Creates a separable program for a single shader stage. Stages are cached by their source, 
+	///		creating a stage with the same source as an existing stage returns the existing stage.
+	/// @param stage Specifies which stage the source is for.
+	/// @param src String containing the GLSL source code for the stage.
+	/// @param debug_name Optional name used to identify the program in driver messages.
+	/// @return Handle to the stage, -1 if the creation failed or separable programs aren't supported.
+	/// @sa ReleaseShaderStage CreateShaderPipeline
+	int CreateShaderStage(shader_stage::Stage stage, const char* src, const char* debug_name = NULL);
+
+	/// @brief Releases a stage created by CreateShaderStage, every call to CreateShaderStage needs a matching release.
+	void ReleaseShaderStage(int stage);
+
+	/// @brief Creates a shader mixing a vertex and a fragment stage through a program pipeline object. 
+	///		This requires no linking so any combination of stages is cheap, pipelines are cached per combination.
+	/// @return Handle to a shader that can be bound with BindShader, every call needs a matching ReleaseShader.
+	///		The pipeline holds a reference to both stages, which are kept alive until the pipeline is released.
+	int CreateShaderPipeline(int vertex_stage, int fragment_stage);
+
+	/// @brief Creates a shader template which variants can be compiled from, each with a different set of 
+	///		preprocessor definitions.
+	/// @param vertex_shader_src String containing the GLSL source code for the vertex shader.
+	/// @param fragment_shader_src String containing the GLSL source code for the fragment shader.
+	/// @param debug_name Optional name used to identify the variants in driver messages.
+	/// @return Handle to the new template.
+	/// @sa GetShaderVariant ReleaseShaderTemplate
+	int CreateShaderTemplate(const char* vertex_shader_src, const char* fragment_shader_src, const char* debug_name = NULL);
+
+	/// @brief Returns the variant of a shader template with the specified definitions. Variants are cached by a 
+	///		hash of their definitions and compiled on first request, so calling this ahead of time precompiles the variant.
+	/// @param shader_template Handle to the template.
+	/// @param defines Definitions inserted after the #version directive. The order is significant for the cache.
+	/// @param define_count Number of definitions.
+	/// @return Handle to a shader that can be bound with BindShader, -1 if the compilation failed.
+	///		The shader is owned by the template and should not be released with ReleaseShader.
+	int GetShaderVariant(int shader_template, const ShaderDefine* defines, int define_count);
+
+	/// @brief Releases a shader template together with all of its variants.
+	void ReleaseShaderTemplate(int shader_template);
 
 	/// @brief Releases a shader that have been created with CreateShader.
+	///	The shader is destroyed once the GPU have finished all frames that may use it.
 	/// @sa CreateShader
 	void ReleaseShader(int shader_handle);
 
-private:
-	/// @brief Prints the shader info log for the specified shader.
-	void PrintShaderInfoLog(GLuint shader);
-	
+
+	/// @brief Returns the memory statistics for all resources of the specified category.
+	const MemoryStats& GetMemoryStats(memory_category::Category category) const;
+
+	/// @brief Returns the memory statistics for all resources.
+	const MemoryStats& GetTotalMemoryStats() const;
+
+	/// @brief Prints the memory statistics together with a list of all live resources.
+	void DumpMemoryUsage() const;
+
+	/// @brief Specifies a budget for the total GPU memory, a warning is printed whenever an allocation exceeds it.
+	/// @param bytes The budget in bytes, setting this to 0 disables the budget.
+	void SetMemoryBudget(uint64_t bytes);
+
+	/// @brief Queries the driver for the amount of video memory, using GL_NVX_gpu_memory_info or GL_ATI_meminfo.
+	/// @param total_kb Total amount of dedicated video memory in kB, 0 if the driver doesn't report it.
+	/// @param available_kb Amount of currently available video memory in kB.
+	/// @return False if the driver doesn't support any of the extensions.
+	bool QueryDriverMemoryInfo(uint32_t& total_kb, uint32_t& available_kb) const;
+
+
+	/// @brief Prints statistics for all messages received from the driver through KHR_debug.
+	void DumpDebugMessageStats() const;
+
+
+	/// @brief Requests a capture of the next frame to the specified file. The capture starts at the next call 
+	///		to EndFrame, with a snapshot of all live resources, and records every call to the device until the 
+	///		following EndFrame. The capture can be replayed with the Replay program.
+	void RequestCapture(const char* path);
+
+	/// @brief Returns true if a frame is currently being captured.
+	bool IsCapturing() const;
+
 private:
 	struct Shader
 	{
@@ -132,18 +352,232 @@ private:
 		GLuint fragment_shader;
 
 		GLuint program; // Shader program that combines all our shaders above (vertex shader, fragment shader)
+
+		GLuint pipeline; // Program pipeline object, used instead of the program for shaders created from separate stages.
+		int vertex_stage; // The pipeline holds a reference to both stages until it's released.
+		int fragment_stage;
+		int ref_count; // Number of CreateShaderPipeline calls that returned the pipeline, 1 for other shaders.
+	};
+
+	/// A separable program for a single shader stage.
+	struct ShaderStage
+	{
+		GLuint program;
+		shader_stage::Stage stage;
+		uint64_t key; // Hash of the stage and source, used as key in the stage cache.
+		int ref_count;
+
+		std::string source; // Kept for frame captures, separable programs have no shader objects to query.
 	};
+
+	/// Buffers bound to a vertex array object.
+	struct VertexArrayBinding
+	{
+		int vertex_buffer; // -1 if none
+		vertex_format::VertexFormat format;
+		int index_buffer; // -1 if none
+
+		VertexArrayBinding() : vertex_buffer(-1), format(vertex_format::VF_POSITION3F), index_buffer(-1) {}
+	};
+
+	enum { MAX_DEBUG_MESSAGE_REPEATS = 3 }; // Number of times the same driver message is printed before it's suppressed.
+
+	/// Statistics for a single driver message, identified by its source and id.
+	struct DebugMessageStats
+	{
+		GLenum source;
+		GLenum type;
+		GLenum severity;
+		GLuint id;
+		std::string message; // The first message received with this id.
+
+		uint32_t total_count;
+		uint32_t frame_count; // Number of occurrences during the current frame.
+		uint32_t max_frame_count; // Highest number of occurrences during a single frame.
+	};
+
+#ifndef PLATFORM_MACOSX
+	/// @brief Callback invoked by the driver for debug messages (KHR_debug).
+	static void GLAPIENTRY DebugMessageCallback(GLenum source, GLenum type, GLuint id, GLenum severity, 
+		GLsizei length, const GLchar* message, GLvoid* user_param);
+
+	/// @brief Records and prints (rate-limited) a message received from the driver.
+	void OnDebugMessage(GLenum source, GLenum type, GLuint id, GLenum severity, const GLchar* message);
+#endif
+
+	/// @brief Attaches a label to an opengl object, making driver messages refer to the object by name.
+	void SetObjectLabel(GLenum identifier, GLuint name, const char* label);
+
+	/// Memory information for a single resource.
+	struct ResourceMemory
+	{
+		memory_category::Category category;
+		uint32_t size; // Size in bytes
+		std::string debug_name;
+
+		ResourceMemory() : category(memory_category::MC_VERTEX_BUFFER), size(0) {}
+	};
+
+	/// @brief Adds the size of the specified resource to the memory statistics.
+	void TrackMemory(const ResourceMemory& resource);
+	/// @brief Removes the size of the specified resource from the memory statistics.
+	void UntrackMemory(const ResourceMemory& resource);
+
+	/// @brief Creates an index buffer and binds it to the specified vertex array object.
+	/// @param size Size of the buffer in bytes.
+	int CreateIndexBufferFromData(int vertex_array_object, uint32_t size, const void* index_data, const char* debug_name);
+
+	/// @brief Specifies the vertex attributes for the specified format, reading from the currently bound vertex buffer.
+	void SetupVertexAttributes(vertex_format::VertexFormat format);
+
+	/// @brief Inserts a new hardware buffer into a free slot.
+	/// @return Handle to the buffer.
+	int AddHardwareBuffer(GLuint buffer, const ResourceMemory& memory);
+
+	/// @brief Inserts a new shader into a free slot.
+	/// @return Handle to the shader.
+	int AddShader(const Shader& shader);
+
+	/// Location of a uniform within a program.
+	struct UniformLocation
+	{
+		GLuint program;
+		GLint location;
+	};
+
+	/// @brief Finds the locations of a uniform in the currently bound shader.
+	/// @param locations Receives the locations, needs space for MAX_PIPELINE_STAGES locations.
+	/// @return Number of locations found, pipelines may have the uniform in several stages.
+	int FindUniformLocations(const char* name, UniformLocation* locations);
+
+	/// @brief Makes glUniform* affect the specified program when a pipeline is bound.
+	void SetActiveUniformProgram(GLuint program);
+
+	/// @brief Creates a new shader program from sources split into several strings.
+	/// @return Returns a handle to the shader if shader was created successful, returns -1 if it failed.
+	int CreateShaderFromSources(const char** vertex_shader_src, int vertex_source_count, 
+		const char** fragment_shader_src, int fragment_source_count, const char* debug_name);
+
+	/// @brief Splits shader source at the end of the #version directive, putting the definitions between the two parts.
+	/// @param version Receives the part of the source up to and including the #version directive.
+	/// @param sources Receives the resulting source strings, needs space for at least three strings.
+	/// @return The number of source strings.
+	int SplitShaderVersion(const std::string& source, const std::string& define_block, std::string& version, const char** sources);
+
+	/// @brief Prints the shader info log for the specified shader.
+	void PrintShaderInfoLog(GLuint shader);
+
+	/// @brief Opens the requested capture file and writes a snapshot of all live resources.
+	void StartCapture();
+
+	/// @brief Writes the commands needed to recreate all live resources and the current render state.
+	void WriteCaptureSnapshot();
+
+	/// @brief Writes the creation of a buffer bound to a vertex array object to the capture, reading back its contents.
+	///		Buffers already in the capture are only attached, buffers shared by several vertex array objects are
+	///		written once.
+	/// @param index_buffer Specifies whether the buffer is the index buffer or the vertex buffer of the vertex array object.
+	void CaptureBuffer(int vertex_array_object, bool index_buffer);
+
+	/// @brief Marks a buffer as written to the current capture, see CaptureBuffer.
+	void MarkBufferCaptured(int buffer);
+
+	/// @brief Writes a command taking a single handle to the capture.
+	void CaptureHandleCommand(capture_command::Command command, int handle);
+
+	/// @brief Writes a uniform to the capture.
+	void CaptureUniform(const char* name, const float* values, uint32_t count);
+
+	/// @brief Destroys released objects for all fenced frames that the GPU have finished.
+	/// @param wait Specifies whether to wait for the GPU rather than stopping at the first unfinished frame.
+	void ProcessReleaseBatches(bool wait);
 	
+private:
+	enum { MAX_RELEASES_PER_FRAME = 256 }; // Limits the number of objects destroyed each frame.
+	enum { MAX_PIPELINE_STAGES = 2 };
+
+	/// Types of objects that can be queued for release.
+	enum ReleaseType
+	{
+		RT_HARDWARE_BUFFER,
+		RT_VERTEX_ARRAY_OBJECT,
+		RT_SHADER,
+		RT_SHADER_STAGE
+	};
+
+	struct Query
+	{
+		GLuint query;
+		bool issued; // Specifies whether the query have been issued at least once, no result is available before that.
+	};
+
+	struct PendingRelease
+	{
+		ReleaseType type;
+		int handle; // Handle of the released object, the slot is not reused until the object is destroyed.
+	};
+
+	/// All objects released during one frame, together with the fence marking the end of that frame.
+	struct ReleaseBatch
+	{
+		GLsync fence;
+		uint32_t frame; // Number of the frame the batch was released in.
+		std::vector<PendingRelease> releases;
+	};
+
+
 	std::vector<GLuint> _vertex_array_objects;
+	std::vector<VertexArrayBinding> _vertex_array_bindings; // Buffers bound to each slot in _vertex_array_objects
 	std::vector<int> _free_vao_ids; // Holds indices for any free slots in _vertex_array_objects
 
 	std::vector<GLuint> _hardware_buffers;
+	std::vector<ResourceMemory> _hardware_buffer_memory; // Memory information for each slot in _hardware_buffers
 	std::vector<int> _free_hardware_buffer_ids;
 
 	std::vector<Shader> _shaders;
 	std::vector<int> _free_shader_ids;
 
+	struct ShaderTemplate
+	{
+		std::string vertex_shader_src;
+		std::string fragment_shader_src;
+		std::string debug_name;
+
+		std::map<uint64_t, int> variants; // Compiled variants, maps the hash of the definitions to a shader handle, -1 for variants that failed to compile.
+	};
+
+	std::vector<ShaderStage> _shader_stages;
+	std::vector<int> _free_shader_stage_ids;
+	std::map<uint64_t, int> _shader_stage_cache; // Maps the hash of a stage source to the stage handle.
+	std::map<uint64_t, int> _shader_pipeline_cache; // Maps a pair of stage handles to the pipeline shader handle.
+
+	std::vector<ShaderTemplate> _shader_templates;
+	std::vector<int> _free_shader_template_ids;
+
+	std::vector<Query> _queries;
+	std::vector<int> _free_query_ids;
+	int _active_query; // Id of the currently active occlusion query, -1 if none.
+
+	std::vector<PendingRelease> _pending_releases; // Objects released during the current frame.
+	std::vector<ReleaseBatch> _release_batches; // Fenced batches waiting for the GPU, oldest first.
+
+	uint32_t _frame_number; // Number of the frame currently being recorded.
+	uint32_t _completed_frames; // Number of frames the GPU is known to have finished.
+
+	MemoryStats _memory_stats[memory_category::MC_COUNT];
+	MemoryStats _total_memory_stats;
+	uint64_t _memory_budget; // Budget for the total memory in bytes, 0 if no budget.
+
+	bool _debug_output; // Specifies whether KHR_debug output is enabled.
+	bool _separable_programs; // Specifies whether separable programs are supported.
+	std::map<uint64_t, DebugMessageStats> _debug_messages; // Driver messages, keyed by source and id.
+
+	CaptureWriter* _capture; // Writer for the frame currently being captured, NULL if not capturing.
+	std::string _capture_path; // Path for a requested capture, empty if no capture have been requested.
+	std::vector<uint8_t> _captured_buffers; // Specifies for each buffer slot whether it's in the current capture.
+
 	int _current_shader; // Id of the currently bound shader, -1 means no shader is bound.
+	int _current_vertex_array_object; // Id of the currently bound vertex array object, -1 means none or unknown.
 };
 
 #endif // __RENDERDEVICE_H__
@@ -0,0 +1,362 @@
+#include "Common.h"
+
+#include "ResourceUploader.h"
+
+namespace
+{
+	/// @brief Creates a buffer and fills it with the specified data.
+	///	The buffer is filled through GL_COPY_WRITE_BUFFER so that no vertex array object state is touched.
+	/// @return The new buffer, 0 if the buffer couldn't be created.
+	GLuint CreateBuffer(uint32_t size, const void* data)
+	{
+		// Errors left by earlier calls would be taken for a failure of this one.
+		while(glGetError() != GL_NO_ERROR) {}
+
+		GLuint buffer = 0;
+		glGenBuffers(1, &buffer);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, buffer);
+		glBufferData(GL_COPY_WRITE_BUFFER, size, data, GL_STATIC_DRAW);
+		glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+		if(glGetError() == GL_OUT_OF_MEMORY)
+		{
+			glDeleteBuffers(1, &buffer);
+			return 0;
+		}
+		return buffer;
+	}
+};
+
+
+ResourceUploader::ResourceUploader(RenderDevice* render_device)
+	: _render_device(render_device),
+	_upload_window(NULL),
+	_upload_context(NULL),
+	_thread(NULL),
+	_mutex(NULL),
+	_job_signal(NULL),
+	_quit(false)
+{
+}
+ResourceUploader::~ResourceUploader()
+{
+	assert(!_thread);
+}
+
+bool ResourceUploader::Initialize(SDL_Window* main_window, SDL_GLContext main_context)
+{
+	// The upload context needs a drawable of its own to be made current with on the worker thread.
+	_upload_window = SDL_CreateWindow("Upload", 0, 0, 1, 1, SDL_WINDOW_OPENGL | SDL_WINDOW_HIDDEN);
+	if(!_upload_window)
+	{
+		debug::Printf("ResourceUploader: SDL_CreateWindow failed, uploading synchronously: %s\n", SDL_GetError());
+		return false;
+	}
+
+	// Creating a context makes it current, so the main context is restored afterwards.
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 1);
+	_upload_context = SDL_GL_CreateContext(_upload_window);
+	SDL_GL_SetAttribute(SDL_GL_SHARE_WITH_CURRENT_CONTEXT, 0);
+
+	SDL_GL_MakeCurrent(main_window, main_context);
+
+	if(!_upload_context)
+	{
+		debug::Printf("ResourceUploader: Failed to create shared context, uploading synchronously: %s\n", SDL_GetError());
+		SDL_DestroyWindow(_upload_window);
+		_upload_window = NULL;
+		return false;
+	}
+
+	_mutex = SDL_CreateMutex();
+	_job_signal = SDL_CreateCond();
+	_quit = false;
+
+	_thread = SDL_CreateThread(WorkerMain, "ResourceUploader", this);
+	if(!_thread)
+	{
+		debug::Printf("ResourceUploader: SDL_CreateThread failed, uploading synchronously: %s\n", SDL_GetError());
+		Shutdown();
+		return false;
+	}
+	return true;
+}
+void ResourceUploader::Shutdown()
+{
+	if(_thread)
+	{
+		SDL_LockMutex(_mutex);
+		_quit = true;
+		SDL_CondSignal(_job_signal);
+		SDL_UnlockMutex(_mutex);
+
+		SDL_WaitThread(_thread, NULL);
+		_thread = NULL;
+	}
+
+	// The worker have stopped so the results can be collected without locking. The objects are shared
+	//	between the contexts and can be deleted from the main context.
+	_pending_results.insert(_pending_results.end(), _results.begin(), _results.end());
+	_results.clear();
+	_jobs.clear();
+
+	for(std::vector<Result>::iterator it = _pending_results.begin(); it != _pending_results.end(); ++it)
+	{
+		if(it->fence)
+			glDeleteSync(it->fence);
+		if(it->buffer)
+			glDeleteBuffers(1, &it->buffer);
+	}
+	_pending_results.clear();
+
+	_uploads.clear();
+	_free_upload_ids.clear();
+
+	if(_job_signal)
+	{
+		SDL_DestroyCond(_job_signal);
+		_job_signal = NULL;
+	}
+	if(_mutex)
+	{
+		SDL_DestroyMutex(_mutex);
+		_mutex = NULL;
+	}
+	if(_upload_context)
+	{
+		SDL_GL_DeleteContext(_upload_context);
+		_upload_context = NULL;
+	}
+	if(_upload_window)
+	{
+		SDL_DestroyWindow(_upload_window);
+		_upload_window = NULL;
+	}
+}
+
+int ResourceUploader::UploadVertexBuffer(int vertex_array_object, vertex_format::VertexFormat format, uint32_t size, const void* vertex_data, const char* debug_name)
+{
+	Upload upload;
+	upload.status = US_PENDING;
+	upload.target = GL_ARRAY_BUFFER;
+	upload.vertex_array_object = vertex_array_object;
+	upload.format = format;
+	upload.size = size;
+	if(debug_name)
+		upload.debug_name = debug_name;
+	upload.buffer = -1;
+
+	int id = AddUpload(upload);
+	Submit(id, vertex_data);
+	return id;
+}
+int ResourceUploader::UploadIndexBuffer(int vertex_array_object, uint32_t index_count, const uint16_t* index_data, const char* debug_name)
+{
+	return UploadIndexData(vertex_array_object, index_count * sizeof(uint16_t), index_data, debug_name);
+}
+int ResourceUploader::UploadIndexBuffer32(int vertex_array_object, uint32_t index_count, const uint32_t* index_data, const char* debug_name)
+{
+	return UploadIndexData(vertex_array_object, index_count * sizeof(uint32_t), index_data, debug_name);
+}
+ResourceUploader::UploadStatus ResourceUploader::PollUpload(int upload, int& buffer)
+{
+	assert(	upload >= 0 &&
+			(uint32_t)upload < _uploads.size());
+
+	UploadStatus status = _uploads[upload].status;
+	if(status == US_PENDING)
+		return status;
+
+	buffer = _uploads[upload].buffer;
+
+	// The upload is done, release the slot.
+	_uploads[upload].debug_name.clear();
+	_free_upload_ids.push_back(upload);
+
+	return status;
+}
+void ResourceUploader::Update()
+{
+	if(!_thread)
+		return;
+
+	SDL_LockMutex(_mutex);
+	_pending_results.insert(_pending_results.end(), _results.begin(), _results.end());
+	_results.clear();
+	SDL_UnlockMutex(_mutex);
+
+	uint32_t published = 0;
+	for( ; published < _pending_results.size(); ++published)
+	{
+		Result& result = _pending_results[published];
+		if(result.fence)
+		{
+			// Fences are signaled in order so if this one isn't signaled, none of the later ones are either.
+			GLenum wait_result = glClientWaitSync(result.fence, 0, 0);
+			if(wait_result == GL_TIMEOUT_EXPIRED)
+				break;
+
+			glDeleteSync(result.fence);
+			result.fence = 0;
+		}
+
+		if(result.buffer)
+		{
+			Publish(result.upload, result.buffer);
+		}
+		else
+		{
+			_uploads[result.upload].status = US_FAILED;
+		}
+	}
+	_pending_results.erase(_pending_results.begin(), _pending_results.begin() + published);
+}
+void ResourceUploader::Finish()
+{
+	while(_thread)
+	{
+		Update();
+
+		// Released slots keep the status they had when polled, so only queued uploads are still pending.
+		bool pending = false;
+		for(std::vector<Upload>::iterator it = _uploads.begin(); it != _uploads.end(); ++it)
+		{
+			if(it->status == US_PENDING)
+			{
+				pending = true;
+				break;
+			}
+		}
+		if(!pending)
+			break;
+
+		SDL_Delay(1);
+	}
+}
+bool ResourceUploader::IsAsynchronous() const
+{
+	return _thread != NULL;
+}
+
+int ResourceUploader::AddUpload(const Upload& upload)
+{
+	if(!_free_upload_ids.empty())
+	{
+		int id = _free_upload_ids.back();
+		_free_upload_ids.pop_back();
+		_uploads[id] = upload;
+		return id;
+	}
+
+	_uploads.push_back(upload);
+	return (int)_uploads.size() - 1;
+}
+int ResourceUploader::UploadIndexData(int vertex_array_object, uint32_t size, const void* index_data, const char* debug_name)
+{
+	Upload upload;
+	upload.status = US_PENDING;
+	upload.target = GL_ELEMENT_ARRAY_BUFFER;
+	upload.vertex_array_object = vertex_array_object;
+	upload.format = vertex_format::VF_POSITION3F; // Unused for index buffers
+	upload.size = size;
+	if(debug_name)
+		upload.debug_name = debug_name;
+	upload.buffer = -1;
+
+	int id = AddUpload(upload);
+	Submit(id, index_data);
+	return id;
+}
+void ResourceUploader::Submit(int upload, const void* data)
+{
+	if(!_thread)
+	{
+		// No worker, upload directly on the main context.
+		GLuint buffer = CreateBuffer(_uploads[upload].size, data);
+		if(buffer)
+		{
+			Publish(upload, buffer);
+		}
+		else
+		{
+			_uploads[upload].status = US_FAILED;
+		}
+		return;
+	}
+
+	Job job;
+	job.upload = upload;
+	job.size = _uploads[upload].size;
+	job.data = data;
+
+	SDL_LockMutex(_mutex);
+	_jobs.push_back(job);
+	SDL_CondSignal(_job_signal);
+	SDL_UnlockMutex(_mutex);
+}
+void ResourceUploader::Publish(int upload, GLuint buffer)
+{
+	Upload& u = _uploads[upload];
+	const char* debug_name = u.debug_name.empty() ? NULL : u.debug_name.c_str();
+
+	if(u.target == GL_ARRAY_BUFFER)
+	{
+		u.buffer = _render_device->RegisterHardwareBuffer(buffer, memory_category::MC_VERTEX_BUFFER, u.size, debug_name);
+		_render_device->AttachVertexBuffer(u.vertex_array_object, u.buffer, u.format);
+	}
+	else
+	{
+		u.buffer = _render_device->RegisterHardwareBuffer(buffer, memory_category::MC_INDEX_BUFFER, u.size, debug_name);
+		_render_device->AttachIndexBuffer(u.vertex_array_object, u.buffer);
+	}
+	u.status = US_READY;
+}
+int SDLCALL ResourceUploader::WorkerMain(void* data)
+{
+	((ResourceUploader*)data)->RunWorker();
+	return 0;
+}
+void ResourceUploader::RunWorker()
+{
+	if(SDL_GL_MakeCurrent(_upload_window, _upload_context) != 0)
+	{
+		debug::Printf("ResourceUploader: Failed to make upload context current: %s\n", SDL_GetError());
+	}
+
+	std::vector<Job> jobs;
+	std::vector<Result> results;
+
+	SDL_LockMutex(_mutex);
+	while(!_quit)
+	{
+		if(_jobs.empty())
+		{
+			SDL_CondWait(_job_signal, _mutex);
+			continue;
+		}
+
+		// Take all queued jobs so the main thread isn't blocked while uploading.
+		jobs.swap(_jobs);
+		SDL_UnlockMutex(_mutex);
+
+		results.clear();
+		for(std::vector<Job>::iterator it = jobs.begin(); it != jobs.end(); ++it)
+		{
+			Result result;
+			result.upload = it->upload;
+			result.buffer = CreateBuffer(it->size, it->data);
+			result.fence = result.buffer ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+			results.push_back(result);
+		}
+		jobs.clear();
+
+		// The fences have to be flushed, otherwise the main thread may never see them signaled.
+		glFlush();
+
+		SDL_LockMutex(_mutex);
+		_results.insert(_results.end(), results.begin(), results.end());
+	}
+	SDL_UnlockMutex(_mutex);
+
+	SDL_GL_MakeCurrent(_upload_window, NULL);
+}
@@ -0,0 +1,133 @@
+#ifndef __RESOURCEUPLOADER_H__
+#define __RESOURCEUPLOADER_H__
+
+#include "RenderDevice.h"
+
+#include <SDL.h>
+
+/// @brief Uploads hardware buffers on a background thread owning a second opengl context shared with
+///	the main context. Uploads are queued from the main thread and the worker creates and fills the buffers
+///	on its own context, fencing each upload. Update(), called once every frame on the main thread, publishes
+///	the buffers whose fences have signaled by registering them with the render device and attaching them to
+///	their vertex array objects. This keeps large glBufferData calls from stalling the main thread.
+///
+///	If the shared context can't be created the uploader falls back to uploading directly on the main thread,
+///	in which case uploads are ready immediately.
+class ResourceUploader
+{
+public:
+	enum UploadStatus
+	{
+		US_PENDING, // The upload haven't been published yet.
+		US_READY, // The buffer is attached to its vertex array object.
+		US_FAILED // The buffer couldn't be created.
+	};
+
+	ResourceUploader(RenderDevice* render_device);
+	~ResourceUploader();
+
+	/// @brief Creates the shared context and starts the worker thread.
+	/// @param main_window The window the main context renders to.
+	/// @param main_context The main opengl context, needs to be current on the calling thread.
+	/// @return False if the uploader only can upload synchronously.
+	bool Initialize(SDL_Window* main_window, SDL_GLContext main_context);
+
+	/// @brief Stops the worker thread and releases any buffers not yet published.
+	void Shutdown();
+
+	/// @brief Queues the upload of a vertex buffer, see RenderDevice::CreateVertexBuffer.
+	///	The vertex data needs to stay valid until the upload is no longer pending.
+	/// @return Handle to the upload, used with PollUpload.
+	int UploadVertexBuffer(int vertex_array_object, vertex_format::VertexFormat format, uint32_t size, const void* vertex_data, const char* debug_name = NULL);
+
+	/// @brief Queues the upload of an index buffer, see RenderDevice::CreateIndexBuffer.
+	///	The index data needs to stay valid until the upload is no longer pending.
+	/// @return Handle to the upload, used with PollUpload.
+	int UploadIndexBuffer(int vertex_array_object, uint32_t index_count, const uint16_t* index_data, const char* debug_name = NULL);
+
+	/// @brief Queues the upload of an index buffer with 32-bit indices, see RenderDevice::CreateIndexBuffer32.
+	///	The index data needs to stay valid until the upload is no longer pending.
+	/// @return Handle to the upload, used with PollUpload.
+	int UploadIndexBuffer32(int vertex_array_object, uint32_t index_count, const uint32_t* index_data, const char* debug_name = NULL);
+
+	/// @brief Returns the status of an upload. Once the upload is no longer pending the handle is released
+	///	and can't be polled again, so every upload needs to be polled until it's done to free its slot.
+	/// @param buffer Receives the handle of the hardware buffer if the upload is ready, the caller is
+	///		responsible for releasing it through the render device.
+	UploadStatus PollUpload(int upload, int& buffer);
+
+	/// @brief Publishes all finished uploads, call once every frame from the main thread.
+	void Update();
+
+	/// @brief Blocks until every queued upload have been published, e.g. before releasing the data of
+	///	uploads that are still pending. The uploads still need to be polled.
+	void Finish();
+
+	/// @brief Returns true if uploads are performed on the worker thread.
+	bool IsAsynchronous() const;
+
+private:
+	/// Job sent to the worker thread.
+	struct Job
+	{
+		int upload;
+		uint32_t size;
+		const void* data;
+	};
+
+	/// Buffer created by the worker thread, waiting for its fence.
+	struct Result
+	{
+		int upload;
+		GLuint buffer; // 0 if the buffer couldn't be created.
+		GLsync fence;
+	};
+
+	struct Upload
+	{
+		UploadStatus status;
+		GLenum target;
+		int vertex_array_object;
+		vertex_format::VertexFormat format;
+		uint32_t size;
+		std::string debug_name;
+		int buffer; // Handle to the published hardware buffer.
+	};
+
+	/// @brief Allocates a new upload slot.
+	int AddUpload(const Upload& upload);
+
+	/// @brief Queues the upload of an index buffer of the specified size in bytes.
+	int UploadIndexData(int vertex_array_object, uint32_t size, const void* index_data, const char* debug_name);
+
+	/// @brief Hands a job over to the worker, or performs it directly if there is no worker.
+	void Submit(int upload, const void* data);
+
+	/// @brief Registers the buffer with the render device and attaches it to its vertex array object.
+	void Publish(int upload, GLuint buffer);
+
+	/// @brief Entry point for the worker thread.
+	static int SDLCALL WorkerMain(void* data);
+
+	/// @brief Processes jobs until the uploader shuts down, runs on the worker thread.
+	void RunWorker();
+
+	RenderDevice* _render_device;
+
+	SDL_Window* _upload_window; // Hidden window the upload context is made current with.
+	SDL_GLContext _upload_context;
+	SDL_Thread* _thread;
+
+	SDL_mutex* _mutex; // Guards _jobs, _results and _quit.
+	SDL_cond* _job_signal; // Signaled when a job is queued or the worker should quit.
+	std::vector<Job> _jobs;
+	std::vector<Result> _results;
+	bool _quit;
+
+	std::vector<Result> _pending_results; // Results waiting for their fence, only touched by the main thread.
+
+	std::vector<Upload> _uploads;
+	std::vector<int> _free_upload_ids;
+};
+
+#endif // __RESOURCEUPLOADER_H__
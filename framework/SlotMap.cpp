@@ -0,0 +1,115 @@
+#include "Common.h"
+
+#include "SlotMap.h"
+
+namespace
+{
+	const uint32_t index_mask = (1u << SlotMap::INDEX_BITS) - 1;
+	const uint32_t generation_mask = (1u << SlotMap::GENERATION_BITS) - 1;
+
+	uint32_t HandleSlot(SlotMap::Handle handle)
+	{
+		return handle & index_mask;
+	}
+	uint32_t HandleGeneration(SlotMap::Handle handle)
+	{
+		return handle >> SlotMap::INDEX_BITS;
+	}
+};
+
+const SlotMap::Handle SlotMap::INVALID_HANDLE;
+
+SlotMap::SlotMap() : _free_slot(MAX_SLOTS)
+{
+}
+SlotMap::~SlotMap()
+{
+}
+SlotMap::Handle SlotMap::Insert()
+{
+	uint32_t slot;
+	if(_free_slot != MAX_SLOTS)
+	{
+		slot = _free_slot;
+		_free_slot = _slots[slot].index;
+	}
+	else
+	{
+		assert(_slots.size() < MAX_SLOTS);
+		slot = (uint32_t)_slots.size();
+
+		Slot new_slot;
+		new_slot.generation = 0;
+		_slots.push_back(new_slot);
+	}
+
+	_slots[slot].index = (uint32_t)_dense_slots.size();
+	_dense_slots.push_back(slot);
+
+	return (_slots[slot].generation << INDEX_BITS) | slot;
+}
+uint32_t SlotMap::Remove(Handle handle)
+{
+	assert(IsValid(handle));
+	uint32_t slot = HandleSlot(handle);
+	uint32_t index = _slots[slot].index;
+
+	// The last element takes the place of the removed one.
+	uint32_t moved_slot = _dense_slots.back();
+	_dense_slots[index] = moved_slot;
+	_slots[moved_slot].index = index;
+	_dense_slots.pop_back();
+
+	FreeSlot(slot);
+	return index;
+}
+void SlotMap::Clear()
+{
+	for(std::vector<uint32_t>::iterator it = _dense_slots.begin();
+		it != _dense_slots.end(); ++it)
+	{
+		FreeSlot(*it);
+	}
+	_dense_slots.clear();
+}
+bool SlotMap::IsValid(Handle handle) const
+{
+	uint32_t slot = HandleSlot(handle);
+	if(slot >= _slots.size() || _slots[slot].generation != HandleGeneration(handle))
+		return false;
+
+	// Free slots keep their generation until reused, the dense index tells if the slot is in use.
+	uint32_t index = _slots[slot].index;
+	return (index < _dense_slots.size() && _dense_slots[index] == slot);
+}
+uint32_t SlotMap::Index(Handle handle) const
+{
+	assert(IsValid(handle));
+	return _slots[HandleSlot(handle)].index;
+}
+SlotMap::Handle SlotMap::HandleAt(uint32_t index) const
+{
+	assert(index < _dense_slots.size());
+	uint32_t slot = _dense_slots[index];
+	return (_slots[slot].generation << INDEX_BITS) | slot;
+}
+uint32_t SlotMap::Size() const
+{
+	return (uint32_t)_dense_slots.size();
+}
+void SlotMap::FreeSlot(uint32_t slot)
+{
+	// Any remaining handles to the slot are invalidated by the new generation. Wrapping around would bring
+	//	back handles from the first generation, so a slot at the last generation is retired instead and never
+	//	reused. Its index is left out of range, keeping the handles of the last generation invalid.
+	Slot& s = _slots[slot];
+	if(s.generation == generation_mask)
+	{
+		s.index = MAX_SLOTS;
+		return;
+	}
+
+	s.generation++;
+	s.index = _free_slot;
+	_free_slot = slot;
+}
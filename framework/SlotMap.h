@@ -0,0 +1,74 @@
+#ifndef __SLOTMAP_H__
+#define __SLOTMAP_H__
+
+/// @brief Hands out stable handles to elements stored in packed (dense) arrays owned by the caller. Every
+///	handle holds the index of a slot and the generation of the slot when the handle was created. The slot
+///	maps to the current position of the element in the dense arrays, and its generation is increased when
+///	the element is removed, so handles to removed elements are detected rather than silently referring to
+///	whatever element reuses the slot.
+///
+///	Removing an element moves the last element into its place (swap and pop), which keeps the dense arrays
+///	packed. The slot map tracks the move itself, the caller only has to mirror it in its own arrays.
+///	Inserting, removing and looking up elements are all constant time.
+///
+///	A slot whose generation is exhausted is retired rather than wrapped around to the first generation, so
+///	a stale handle is never mistaken for a new one, at the cost of a few bytes per retired slot.
+class SlotMap
+{
+public:
+	typedef uint32_t Handle;
+
+	enum
+	{
+		INDEX_BITS = 22,
+		GENERATION_BITS = 32 - INDEX_BITS,
+		MAX_SLOTS = (1 << INDEX_BITS) - 1 // The largest index is never used, keeping INVALID_HANDLE invalid.
+	};
+
+	static const Handle INVALID_HANDLE = 0xffffffff;
+
+	SlotMap();
+	~SlotMap();
+
+	/// @brief Adds an element to the end of the dense arrays.
+	/// @return Handle to the new element, its dense index is Size() - 1 after the call.
+	Handle Insert();
+
+	/// @brief Removes an element. The caller needs to move the last element of its dense arrays into the
+	///		returned index and then remove the last element.
+	/// @return The dense index of the removed element.
+	uint32_t Remove(Handle handle);
+
+	/// @brief Removes all elements, invalidating every handle. No elements are moved.
+	void Clear();
+
+	/// @brief Returns true if the handle refers to an element that haven't been removed.
+	bool IsValid(Handle handle) const;
+
+	/// @brief Returns the dense index of the element, the handle needs to be valid.
+	uint32_t Index(Handle handle) const;
+
+	/// @brief Returns the handle of the element at the specified dense index.
+	Handle HandleAt(uint32_t index) const;
+
+	/// @brief Returns the number of elements.
+	uint32_t Size() const;
+
+private:
+	/// @brief Bumps the generation of a slot and adds it to the free list, or retires it if the generation
+	///		can't be increased any further.
+	void FreeSlot(uint32_t slot);
+
+	struct Slot
+	{
+		uint32_t index; // Dense index of the element, the next free slot if the slot is free, MAX_SLOTS if retired.
+		uint32_t generation;
+	};
+
+	std::vector<Slot> _slots;
+	std::vector<uint32_t> _dense_slots; // Slot of the element at every dense index.
+
+	uint32_t _free_slot; // First slot in the free list, MAX_SLOTS if the list is empty.
+};
+
+#endif // __SLOTMAP_H__
@@ -76,3 +76,8 @@ Vec2 vector::Subtract(const Vec2& lhs, const Vec2& rhs)
 {
 	return Vec2(lhs.x - rhs.x, lhs.y - rhs.y);
 }
+
+Vec3 vector::Multiply(const Vec3& lhs, float rhs)
+{
+	return Vec3(lhs.x * rhs, lhs.y * rhs, lhs.z * rhs);
+}
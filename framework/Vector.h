@@ -57,6 +57,9 @@ namespace vector
 
 	/// @brief Subtracts two vectors in the specified order.
 	Vec2 Subtract(const Vec2& lhs, const Vec2& rhs);
+
+	/// @brief Multiplies a vector with a scalar.
+	Vec3 Multiply(const Vec3& lhs, float rhs);
 };
 
 
@@ -0,0 +1,218 @@
+#include "Common.h"
+
+#include "VertexQuantizer.h"
+
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+namespace
+{
+	float SignNotZero(float value)
+	{
+		return (value < 0.0f) ? -1.0f : 1.0f;
+	}
+
+	/// @brief Converts a value in [0, 1] to an unsigned normalized integer.
+	uint16_t QuantizeUnorm16(float value)
+	{
+		return (uint16_t)(std::min(std::max(value, 0.0f), 1.0f) * 65535.0f + 0.5f);
+	}
+
+	/// @brief Converts a value in [-1, 1] to a signed normalized integer with the specified number of bits.
+	int QuantizeSnorm(float value, int bits)
+	{
+		float max_value = (float)((1 << (bits - 1)) - 1);
+		float scaled = std::min(std::max(value, -1.0f), 1.0f) * max_value;
+		return (int)(scaled + (scaled < 0.0f ? -0.5f : 0.5f));
+	}
+
+	/// @brief Converts a signed normalized integer back to [-1, 1], following the OpenGL 4.2 conversion rules.
+	float DequantizeSnorm(int value, int bits)
+	{
+		return std::max((float)value / (float)((1 << (bits - 1)) - 1), -1.0f);
+	}
+
+	/// @brief Angle between two unit vectors, in degrees.
+	float AngleBetween(const Vec3& a, const Vec3& b)
+	{
+		float cos_angle = std::min(std::max(vector::Dot(a, b), -1.0f), 1.0f);
+		return acosf(cos_angle) * 180.0f / (float)MATH_PI;
+	}
+};
+
+
+vertex_format::VertexFormat vertex_quantizer::QuantizedFormat(NormalEncoding encoding)
+{
+	return (encoding == NE_OCTAHEDRAL) ? vertex_format::VF_POSITION3US_NORMAL2S : vertex_format::VF_POSITION3US_NORMAL3I10;
+}
+vertex_quantizer::Dequantization vertex_quantizer::Quantize(const float* vertices, uint32_t vertex_count, NormalEncoding encoding,
+															  void* output, QuantizationStats* stats)
+{
+	Vec3 bounds_min(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vec3 bounds_max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+	for(uint32_t v = 0; v < vertex_count; ++v)
+	{
+		const float* p = vertices + v*6;
+		bounds_min = Vec3(std::min(bounds_min.x, p[0]), std::min(bounds_min.y, p[1]), std::min(bounds_min.z, p[2]));
+		bounds_max = Vec3(std::max(bounds_max.x, p[0]), std::max(bounds_max.y, p[1]), std::max(bounds_max.z, p[2]));
+	}
+
+	// The same scale on every axis, which keeps the normal matrix valid. This costs precision on the
+	//	shorter axes, but the step is still 1/65535 of the largest extent.
+	Dequantization dequantization;
+	if(vertex_count)
+	{
+		Vec3 extent = vector::Subtract(bounds_max, bounds_min);
+		float max_extent = std::max(std::max(extent.x, extent.y), extent.z);
+		dequantization.offset = bounds_min;
+		dequantization.scale = (max_extent > 0.0f) ? max_extent : 1.0f;
+	}
+
+	vertex_format::VertexFormat format = QuantizedFormat(encoding);
+	uint32_t vertex_size = vertex_format::VertexSize(format);
+
+	float max_position_error = 0.0f;
+	float max_normal_error = 0.0f;
+	for(uint32_t v = 0; v < vertex_count; ++v)
+	{
+		const float* source = vertices + v*6;
+		uint8_t* target = (uint8_t*)output + v * vertex_size;
+
+		// Position, padded to 4 components to keep the normal 4-byte aligned.
+		uint16_t position[4] = { 0, 0, 0, 0 };
+		Vec3 decoded_position;
+		float* decoded = &decoded_position.x;
+		const float* offset = &dequantization.offset.x;
+		for(int i = 0; i < 3; ++i)
+		{
+			position[i] = QuantizeUnorm16((source[i] - offset[i]) / dequantization.scale);
+			decoded[i] = offset[i] + (position[i] / 65535.0f) * dequantization.scale;
+		}
+		memcpy(target, position, sizeof(position));
+
+		Vec3 original_position(source[0], source[1], source[2]);
+		max_position_error = std::max(max_position_error, vector::Length(vector::Subtract(decoded_position, original_position)));
+
+		// Normal
+		Vec3 normal(source[3], source[4], source[5]);
+		if(vector::Length(normal) > 0.0f)
+			vector::Normalize(normal);
+		else
+			normal = Vec3(0.0f, 0.0f, 1.0f); // Anything is better than encoding a zero vector
+
+		Vec3 decoded_normal;
+		if(encoding == NE_OCTAHEDRAL)
+		{
+			int16_t encoded[2];
+			EncodeOctahedral(normal, encoded);
+			memcpy(target + sizeof(position), encoded, sizeof(encoded));
+			decoded_normal = DecodeOctahedral(encoded);
+		}
+		else
+		{
+			uint32_t packed = PackNormal(normal);
+			memcpy(target + sizeof(position), &packed, sizeof(packed));
+			decoded_normal = UnpackNormal(packed);
+		}
+		max_normal_error = std::max(max_normal_error, AngleBetween(normal, decoded_normal));
+	}
+
+	if(stats)
+	{
+		stats->source_size = vertex_count * vertex_format::VertexSize(vertex_format::VF_POSITION3F_NORMAL3F);
+		stats->quantized_size = vertex_count * vertex_size;
+		stats->max_position_error = max_position_error;
+		stats->max_normal_error = max_normal_error;
+	}
+	return dequantization;
+}
+void vertex_quantizer::Dequantize(const void* input, uint32_t vertex_count, NormalEncoding encoding, const Dequantization& dequantization, 
+								  float* vertices)
+{
+	uint32_t vertex_size = vertex_format::VertexSize(QuantizedFormat(encoding));
+	const float* offset = &dequantization.offset.x;
+
+	for(uint32_t v = 0; v < vertex_count; ++v)
+	{
+		const uint8_t* source = (const uint8_t*)input + v * vertex_size;
+		float* target = vertices + v*6;
+
+		uint16_t position[4];
+		memcpy(position, source, sizeof(position));
+		for(int i = 0; i < 3; ++i)
+			target[i] = offset[i] + (position[i] / 65535.0f) * dequantization.scale;
+
+		Vec3 normal;
+		if(encoding == NE_OCTAHEDRAL)
+		{
+			int16_t encoded[2];
+			memcpy(encoded, source + sizeof(position), sizeof(encoded));
+			normal = DecodeOctahedral(encoded);
+		}
+		else
+		{
+			uint32_t packed;
+			memcpy(&packed, source + sizeof(position), sizeof(packed));
+			normal = UnpackNormal(packed);
+		}
+		target[3] = normal.x;
+		target[4] = normal.y;
+		target[5] = normal.z;
+	}
+}
+Mat4x4 vertex_quantizer::DequantizationMatrix(const Dequantization& dequantization)
+{
+	float scale = dequantization.scale;
+	return matrix::Multiply(matrix::CreateTranslation(dequantization.offset), matrix::CreateScaling(Vec3(scale, scale, scale)));
+}
+void vertex_quantizer::EncodeOctahedral(const Vec3& normal, int16_t encoded[2])
+{
+	// Project onto the octahedron |x| + |y| + |z| = 1 and fold the lower half over the upper half.
+	float sum = fabsf(normal.x) + fabsf(normal.y) + fabsf(normal.z);
+	float x = (sum > 0.0f) ? normal.x / sum : 0.0f;
+	float y = (sum > 0.0f) ? normal.y / sum : 0.0f;
+	if(normal.z < 0.0f)
+	{
+		float folded_x = (1.0f - fabsf(y)) * SignNotZero(x);
+		float folded_y = (1.0f - fabsf(x)) * SignNotZero(y);
+		x = folded_x;
+		y = folded_y;
+	}
+	encoded[0] = (int16_t)QuantizeSnorm(x, 16);
+	encoded[1] = (int16_t)QuantizeSnorm(y, 16);
+}
+Vec3 vertex_quantizer::DecodeOctahedral(const int16_t encoded[2])
+{
+	Vec3 normal;
+	normal.x = DequantizeSnorm(encoded[0], 16);
+	normal.y = DequantizeSnorm(encoded[1], 16);
+	normal.z = 1.0f - fabsf(normal.x) - fabsf(normal.y);
+	if(normal.z < 0.0f)
+	{
+		float x = (1.0f - fabsf(normal.y)) * SignNotZero(normal.x);
+		float y = (1.0f - fabsf(normal.x)) * SignNotZero(normal.y);
+		normal.x = x;
+		normal.y = y;
+	}
+	vector::Normalize(normal);
+	return normal;
+}
+uint32_t vertex_quantizer::PackNormal(const Vec3& normal)
+{
+	uint32_t x = (uint32_t)QuantizeSnorm(normal.x, 10) & 0x3ff;
+	uint32_t y = (uint32_t)QuantizeSnorm(normal.y, 10) & 0x3ff;
+	uint32_t z = (uint32_t)QuantizeSnorm(normal.z, 10) & 0x3ff;
+	return x | (y << 10) | (z << 20); // w is left at 0
+}
+Vec3 vertex_quantizer::UnpackNormal(uint32_t packed)
+{
+	// Shift each component to the top to sign extend it
+	Vec3 normal;
+	normal.x = DequantizeSnorm((int32_t)(packed << 22) >> 22, 10);
+	normal.y = DequantizeSnorm((int32_t)(packed << 12) >> 22, 10);
+	normal.z = DequantizeSnorm((int32_t)(packed << 2) >> 22, 10);
+	if(vector::Length(normal) > 0.0f)
+		vector::Normalize(normal);
+	return normal;
+}
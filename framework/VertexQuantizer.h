@@ -0,0 +1,71 @@
+#ifndef __VERTEXQUANTIZER_H__
+#define __VERTEXQUANTIZER_H__
+
+#include "RenderDevice.h"
+
+/// @brief Compresses VF_POSITION3F_NORMAL3F vertices to half their size to reduce vertex fetch bandwidth.
+///	Positions are stored as 16-bit normalized integers relative to the bounds of the mesh. The bounds are
+///	scaled uniformly so that normals can keep using the normal matrix of the model, the dequantization
+///	is folded into the model matrix instead of being done by the vertex shader.
+namespace vertex_quantizer
+{
+	enum NormalEncoding
+	{
+		/// Octahedral mapping to 2x16-bit normalized integers, VF_POSITION3US_NORMAL2S. The vertex shader
+		///	needs to decode the normal, see DecodeOctahedral.
+		NE_OCTAHEDRAL,
+
+		/// Signed 10-10-10-2 integers, VF_POSITION3US_NORMAL3I10. Decoded by the hardware, but requires
+		///	OpenGL 3.3 or ARB_vertex_type_2_10_10_10_rev.
+		NE_PACKED_10_10_10_2
+	};
+
+	/// Transform from quantized positions in [0, 1] to object space: position = offset + quantized * scale
+	struct Dequantization
+	{
+		Vec3 offset;
+		float scale;
+
+		Dequantization() : offset(0.0f, 0.0f, 0.0f), scale(1.0f) {}
+	};
+
+	struct QuantizationStats
+	{
+		uint32_t source_size; // Size of the vertex data before quantization, in bytes.
+		uint32_t quantized_size; // Size of the vertex data after quantization, in bytes.
+		float max_position_error; // Largest distance between an original and a decoded position, in object space units.
+		float max_normal_error; // Largest angle between an original and a decoded normal, in degrees.
+	};
+
+	/// @brief Returns the vertex format produced by the specified normal encoding.
+	vertex_format::VertexFormat QuantizedFormat(NormalEncoding encoding);
+
+	/// @brief Quantizes vertices in the VF_POSITION3F_NORMAL3F format.
+	/// @param output Receives the quantized vertices, VertexSize(QuantizedFormat(encoding)) bytes per vertex.
+	/// @param stats Optional, receives the memory saved and the largest errors introduced.
+	/// @return The transform to apply to the model matrix when rendering the quantized vertices.
+	Dequantization Quantize(const float* vertices, uint32_t vertex_count, NormalEncoding encoding, void* output, QuantizationStats* stats = NULL);
+
+	/// @brief Decodes quantized vertices back to the VF_POSITION3F_NORMAL3F format, in object space.
+	/// @param input Quantized vertices, VertexSize(QuantizedFormat(encoding)) bytes per vertex.
+	/// @param vertices Receives the decoded vertices, 6 floats per vertex.
+	void Dequantize(const void* input, uint32_t vertex_count, NormalEncoding encoding, const Dequantization& dequantization, float* vertices);
+
+	/// @brief Returns the matrix transforming quantized positions to object space.
+	Mat4x4 DequantizationMatrix(const Dequantization& dequantization);
+
+	/// @brief Encodes a unit vector with the octahedral mapping.
+	void EncodeOctahedral(const Vec3& normal, int16_t encoded[2]);
+
+	/// @brief Decodes a normal encoded by EncodeOctahedral, the same way as the vertex shader should:
+	///		n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y)); if(n.z < 0) n.xy = (1.0 - abs(n.yx)) * sign(n.xy);
+	Vec3 DecodeOctahedral(const int16_t encoded[2]);
+
+	/// @brief Packs a unit vector into signed 10-10-10-2 integers, as read by GL_INT_2_10_10_10_REV.
+	uint32_t PackNormal(const Vec3& normal);
+
+	/// @brief Unpacks a normal packed by PackNormal.
+	Vec3 UnpackNormal(uint32_t packed);
+};
+
+#endif // __VERTEXQUANTIZER_H__
@@ -0,0 +1,531 @@
+#include <framework/Common.h>
+
+#include "ReplayApp.h"
+
+#include <framework/RenderDevice.h>
+
+#include <algorithm>
+
+
+ReplayApp::ReplayApp(const char* capture_path, uint32_t iteration_count)
+	: _capture_path(capture_path),
+	_iteration_count(iteration_count),
+	_iteration(0),
+	_frame_start(0),
+	_in_frame(false),
+	_skip_conditional_render(false),
+	_command_count(0),
+	_draw_count(0)
+{
+}
+ReplayApp::~ReplayApp()
+{
+}
+
+bool ReplayApp::Initialize()
+{
+	if(!_reader.Open(_capture_path.c_str()))
+		return false;
+
+	// The window matches the viewport of the captured application.
+	uint32_t width = _reader.Width() ? _reader.Width() : 1024;
+	uint32_t height = _reader.Height() ? _reader.Height() : 768;
+	if(!InitializeSDL(width, height))
+		return false;
+
+	SetWindowTitle("OpenGL - Replay");
+
+	// Recreate the snapshot, everything up to the start of the frame.
+	if(!ExecuteCommands(capture_command::CC_BEGIN_FRAME))
+	{
+		debug::Printf("[Error] The capture doesn't contain any frame.\n");
+		return false;
+	}
+	_frame_start = _reader.Position();
+
+	_submit_times.reserve(_iteration_count);
+	_frame_times.reserve(_iteration_count);
+
+	debug::Printf("Replaying '%s' %u times.\n", _capture_path.c_str(), _iteration_count);
+	return true;
+}
+void ReplayApp::Shutdown()
+{
+	if(_submit_times.size())
+		PrintStatistics();
+
+	// Any remaining resources are destroyed by the device.
+	ShutdownSDL();
+}
+void ReplayApp::Render(float )
+{
+	if(_iteration >= _iteration_count)
+	{
+		Stop();
+		return;
+	}
+
+	_reader.Seek(_frame_start);
+	_in_frame = true;
+	_command_count = 0;
+	_draw_count = 0;
+
+	uint64_t start = SDL_GetPerformanceCounter();
+
+	if(!ExecuteCommands(capture_command::CC_END_FRAME))
+	{
+		debug::Printf("[Error] The captured frame is incomplete.\n");
+		Stop();
+	}
+
+	uint64_t submitted = SDL_GetPerformanceCounter();
+
+	// Wait for the GPU, giving the total time for the frame.
+	glFinish();
+
+	uint64_t finished = SDL_GetPerformanceCounter();
+
+	double ms_per_tick = 1000.0 / (double)SDL_GetPerformanceFrequency();
+	_submit_times.push_back((submitted - start) * ms_per_tick);
+	_frame_times.push_back((finished - start) * ms_per_tick);
+
+	// Resources created during the frame are created again by the next iteration.
+	_in_frame = false;
+	for(int type = 0; type < RT_COUNT; ++type)
+	{
+		for(std::map<int, int>::iterator it = _frame_handles[type].begin();
+			it != _frame_handles[type].end(); ++it)
+		{
+			ReleaseResource((ResourceType)type, it->second);
+		}
+		_frame_handles[type].clear();
+	}
+
+	++_iteration;
+}
+void ReplayApp::OnEvent(SDL_Event* evt)
+{
+	if(evt->type == SDL_KEYDOWN && evt->key.keysym.scancode == SDL_SCANCODE_ESCAPE)
+		Stop();
+}
+
+bool ReplayApp::ExecuteCommands(capture_command::Command end_command)
+{
+	capture_command::Command command;
+	while(_reader.ReadCommand(command))
+	{
+		if(command == end_command)
+			return true;
+
+		ExecuteCommand(command);
+		if(_reader.Failed())
+			break;
+	}
+	return false;
+}
+void ReplayApp::ExecuteCommand(capture_command::Command command)
+{
+	if(_in_frame)
+		++_command_count;
+
+	switch(command)
+	{
+	case capture_command::CC_CREATE_VERTEX_ARRAY_OBJECT:
+		{
+			int captured = _reader.ReadInt();
+			AddHandle(RT_VERTEX_ARRAY_OBJECT, captured, _render_device->CreateVertexArrayObject());
+		}
+		break;
+	case capture_command::CC_RELEASE_VERTEX_ARRAY_OBJECT:
+		{
+			ReleaseHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+		}
+		break;
+	case capture_command::CC_CREATE_VERTEX_BUFFER:
+		{
+			int captured = _reader.ReadInt();
+			int vertex_array_object = MapHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+			vertex_format::VertexFormat format = (vertex_format::VertexFormat)_reader.ReadUInt();
+			uint32_t size = _reader.ReadUInt();
+			uint32_t data_size = 0;
+			const void* data = _reader.ReadData(data_size);
+
+			if(vertex_array_object != -1 && format < vertex_format::VF_COUNT)
+			{
+				int buffer = _render_device->CreateVertexBuffer(vertex_array_object, format, size, data);
+				AddHandle(RT_HARDWARE_BUFFER, captured, buffer);
+			}
+		}
+		break;
+	case capture_command::CC_CREATE_INDEX_BUFFER:
+		{
+			int captured = _reader.ReadInt();
+			int vertex_array_object = MapHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+			uint32_t size = _reader.ReadUInt();
+			uint32_t data_size = 0;
+			const void* data = _reader.ReadData(data_size);
+
+			if(vertex_array_object != -1)
+			{
+				// The index type is specified by the draw calls, the buffer is just a block of data.
+				int buffer = _render_device->CreateIndexBuffer(vertex_array_object, size / sizeof(uint16_t), (const uint16_t*)data);
+				AddHandle(RT_HARDWARE_BUFFER, captured, buffer);
+			}
+		}
+		break;
+	case capture_command::CC_ATTACH_VERTEX_BUFFER:
+		{
+			int buffer = MapHandle(RT_HARDWARE_BUFFER, _reader.ReadInt());
+			int vertex_array_object = MapHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+			vertex_format::VertexFormat format = (vertex_format::VertexFormat)_reader.ReadUInt();
+
+			if(buffer != -1 && vertex_array_object != -1 && format < vertex_format::VF_COUNT)
+				_render_device->AttachVertexBuffer(vertex_array_object, buffer, format);
+		}
+		break;
+	case capture_command::CC_ATTACH_INDEX_BUFFER:
+		{
+			int buffer = MapHandle(RT_HARDWARE_BUFFER, _reader.ReadInt());
+			int vertex_array_object = MapHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+
+			if(buffer != -1 && vertex_array_object != -1)
+				_render_device->AttachIndexBuffer(vertex_array_object, buffer);
+		}
+		break;
+	case capture_command::CC_UPDATE_HARDWARE_BUFFER:
+		{
+			int buffer = MapHandle(RT_HARDWARE_BUFFER, _reader.ReadInt());
+			uint32_t offset = _reader.ReadUInt();
+			uint32_t size = 0;
+			const void* data = _reader.ReadData(size);
+
+			if(buffer != -1 && data)
+				_render_device->UpdateHardwareBuffer(buffer, offset, size, data);
+		}
+		break;
+	case capture_command::CC_COPY_HARDWARE_BUFFER:
+		{
+			int source = MapHandle(RT_HARDWARE_BUFFER, _reader.ReadInt());
+			int destination = MapHandle(RT_HARDWARE_BUFFER, _reader.ReadInt());
+			uint32_t size = _reader.ReadUInt();
+
+			if(source != -1 && destination != -1)
+				_render_device->CopyHardwareBuffer(source, destination, size);
+		}
+		break;
+	case capture_command::CC_RELEASE_HARDWARE_BUFFER:
+		{
+			ReleaseHandle(RT_HARDWARE_BUFFER, _reader.ReadInt());
+		}
+		break;
+	case capture_command::CC_CREATE_SHADER:
+		{
+			int captured = _reader.ReadInt();
+			const char* vertex_shader_src = _reader.ReadString();
+			const char* fragment_shader_src = _reader.ReadString();
+
+			AddHandle(RT_SHADER, captured, _render_device->CreateShader(vertex_shader_src, fragment_shader_src));
+		}
+		break;
+	case capture_command::CC_CREATE_SHADER_STAGE:
+		{
+			int captured = _reader.ReadInt();
+			shader_stage::Stage stage = (shader_stage::Stage)_reader.ReadUInt();
+			const char* src = _reader.ReadString();
+
+			AddHandle(RT_SHADER_STAGE, captured, _render_device->CreateShaderStage(stage, src));
+		}
+		break;
+	case capture_command::CC_CREATE_SHADER_PIPELINE:
+		{
+			int captured = _reader.ReadInt();
+			int vertex_stage = MapHandle(RT_SHADER_STAGE, _reader.ReadInt());
+			int fragment_stage = MapHandle(RT_SHADER_STAGE, _reader.ReadInt());
+
+			if(vertex_stage != -1 && fragment_stage != -1)
+				AddHandle(RT_SHADER, captured, _render_device->CreateShaderPipeline(vertex_stage, fragment_stage));
+		}
+		break;
+	case capture_command::CC_RELEASE_SHADER:
+		{
+			ReleaseHandle(RT_SHADER, _reader.ReadInt());
+		}
+		break;
+	case capture_command::CC_RELEASE_SHADER_STAGE:
+		{
+			ReleaseHandle(RT_SHADER_STAGE, _reader.ReadInt());
+		}
+		break;
+	case capture_command::CC_CREATE_QUERY:
+		{
+			int captured = _reader.ReadInt();
+			AddHandle(RT_QUERY, captured, _render_device->CreateQuery());
+		}
+		break;
+	case capture_command::CC_RELEASE_QUERY:
+		{
+			ReleaseHandle(RT_QUERY, _reader.ReadInt());
+		}
+		break;
+	case capture_command::CC_SET_RENDER_STATE:
+		{
+			GLint viewport[4];
+			for(int i = 0; i < 4; ++i)
+				viewport[i] = _reader.ReadInt();
+			bool cull_face = _reader.ReadUInt() != 0;
+			bool depth_test = _reader.ReadUInt() != 0;
+
+			glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+			if(cull_face)
+				glEnable(GL_CULL_FACE);
+			else
+				glDisable(GL_CULL_FACE);
+			if(depth_test)
+				glEnable(GL_DEPTH_TEST);
+			else
+				glDisable(GL_DEPTH_TEST);
+		}
+		break;
+	case capture_command::CC_BIND_SHADER:
+		{
+			int captured = _reader.ReadInt();
+			_render_device->BindShader(captured == -1 ? -1 : MapHandle(RT_SHADER, captured));
+		}
+		break;
+	case capture_command::CC_SET_UNIFORM:
+		{
+			const char* name = _reader.ReadString();
+			uint32_t count = _reader.ReadUInt();
+			const float* values = _reader.ReadFloats(count);
+
+			switch(count)
+			{
+			case 1:
+				_render_device->SetUniform1f(name, values[0]);
+				break;
+			case 3:
+				_render_device->SetUniform3f(name, Vec3(values[0], values[1], values[2]));
+				break;
+			case 4:
+				_render_device->SetUniform4f(name, Vec4(values[0], values[1], values[2], values[3]));
+				break;
+			case 9:
+				{
+					Mat3x3 m;
+					for(int c = 0; c < 3; ++c)
+						m.col[c] = Vec3(values[c*3], values[c*3+1], values[c*3+2]);
+					_render_device->SetUniformMatrix3f(name, m);
+				}
+				break;
+			case 16:
+				{
+					Mat4x4 m;
+					for(int c = 0; c < 4; ++c)
+						m.col[c] = Vec4(values[c*4], values[c*4+1], values[c*4+2], values[c*4+3]);
+					_render_device->SetUniformMatrix4f(name, m);
+				}
+				break;
+			default:
+				debug::Printf("ReplayApp: Unsupported uniform '%s' with %u components.\n", name, count);
+			};
+		}
+		break;
+	case capture_command::CC_DRAW:
+		{
+			DrawCall draw_call;
+			draw_call.draw_mode = _reader.ReadUInt();
+			draw_call.vertex_offset = _reader.ReadInt();
+			draw_call.vertex_count = _reader.ReadInt();
+			draw_call.index_count = _reader.ReadInt();
+			draw_call.index_offset = _reader.ReadInt();
+			draw_call.index_type = _reader.ReadUInt();
+			draw_call.base_vertex = _reader.ReadInt();
+			draw_call.vertex_array_object = MapHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+
+			if(draw_call.vertex_array_object != -1)
+			{
+				_render_device->Draw(draw_call);
+				++_draw_count;
+			}
+		}
+		break;
+	case capture_command::CC_MULTI_DRAW:
+		{
+			DrawCall draw_call;
+			draw_call.draw_mode = _reader.ReadUInt();
+			draw_call.index_type = _reader.ReadUInt();
+			draw_call.base_vertex = _reader.ReadInt();
+			draw_call.vertex_array_object = MapHandle(RT_VERTEX_ARRAY_OBJECT, _reader.ReadInt());
+
+			// The ranges are used in place, keeping the heap out of the timings. A draw count that doesn't fit in 
+			//	the rest of the capture, negative ones included, fails the reads rather than being allocated.
+			int draw_count = _reader.ReadInt();
+			const int32_t* index_offsets = _reader.ReadInts((uint32_t)draw_count);
+			const int32_t* index_counts = _reader.ReadInts((uint32_t)draw_count);
+			if(!index_offsets || !index_counts)
+			{
+				debug::Printf("ReplayApp: Invalid draw count %d.\n", draw_count);
+				break;
+			}
+
+			bool valid = true;
+			for(int i = 0; i < draw_count; ++i)
+				valid &= (index_offsets[i] >= 0 && index_counts[i] >= 0);
+			if(!valid)
+			{
+				debug::Printf("ReplayApp: Invalid index range in multi-draw.\n");
+				break;
+			}
+
+			if(draw_call.vertex_array_object != -1 && draw_count > 0)
+			{
+				_render_device->MultiDraw(draw_call, index_offsets, index_counts, draw_count);
+				++_draw_count;
+			}
+		}
+		break;
+	case capture_command::CC_CLEAR:
+		{
+			_render_device->Clear(_reader.ReadUInt());
+		}
+		break;
+	case capture_command::CC_SET_CLEAR_COLOR:
+		{
+			const float* color = _reader.ReadFloats(4);
+			_render_device->SetClearColor(color[0], color[1], color[2], color[3]);
+		}
+		break;
+	case capture_command::CC_SET_COLOR_WRITE:
+		{
+			_render_device->SetColorWrite(_reader.ReadInt() != 0);
+		}
+		break;
+	case capture_command::CC_SET_DEPTH_WRITE:
+		{
+			_render_device->SetDepthWrite(_reader.ReadInt() != 0);
+		}
+		break;
+	case capture_command::CC_BEGIN_OCCLUSION_QUERY:
+		{
+			int query = MapHandle(RT_QUERY, _reader.ReadInt());
+			if(query != -1)
+			{
+				_render_device->BeginOcclusionQuery(query);
+				_issued_queries[query] = true;
+			}
+		}
+		break;
+	case capture_command::CC_END_OCCLUSION_QUERY:
+		{
+			_render_device->EndOcclusionQuery();
+		}
+		break;
+	case capture_command::CC_BEGIN_CONDITIONAL_RENDER:
+		{
+			// The query may have been issued in an earlier frame of the captured application, in which case there's
+			//	no result during the first iteration and the draws are performed unconditionally.
+			int query = MapHandle(RT_QUERY, _reader.ReadInt());
+			_skip_conditional_render = (query == -1 || _issued_queries.find(query) == _issued_queries.end());
+			if(!_skip_conditional_render)
+				_render_device->BeginConditionalRender(query);
+		}
+		break;
+	case capture_command::CC_END_CONDITIONAL_RENDER:
+		{
+			if(!_skip_conditional_render)
+				_render_device->EndConditionalRender();
+			_skip_conditional_render = false;
+		}
+		break;
+	default:
+		debug::Printf("ReplayApp: Unexpected command %d.\n", command);
+	};
+}
+int ReplayApp::MapHandle(ResourceType type, int captured_handle)
+{
+	std::map<int, int>::iterator it = _frame_handles[type].find(captured_handle);
+	if(it != _frame_handles[type].end())
+		return it->second;
+
+	it = _handles[type].find(captured_handle);
+	if(it != _handles[type].end())
+		return it->second;
+
+	return -1;
+}
+void ReplayApp::AddHandle(ResourceType type, int captured_handle, int handle)
+{
+	if(handle == -1)
+		return;
+
+	if(_in_frame)
+		_frame_handles[type][captured_handle] = handle;
+	else
+		_handles[type][captured_handle] = handle;
+}
+void ReplayApp::ReleaseHandle(ResourceType type, int captured_handle)
+{
+	if(!_in_frame)
+	{
+		// Released before the frame started, nothing in the frame can refer to it.
+		std::map<int, int>::iterator it = _handles[type].find(captured_handle);
+		if(it != _handles[type].end())
+		{
+			ReleaseResource(type, it->second);
+			_handles[type].erase(it);
+		}
+		return;
+	}
+
+	// Resources from the snapshot are kept for the next iteration.
+	std::map<int, int>::iterator it = _frame_handles[type].find(captured_handle);
+	if(it != _frame_handles[type].end())
+	{
+		ReleaseResource(type, it->second);
+		_frame_handles[type].erase(it);
+	}
+}
+void ReplayApp::ReleaseResource(ResourceType type, int handle)
+{
+	switch(type)
+	{
+	case RT_HARDWARE_BUFFER:
+		_render_device->ReleaseHardwareBuffer(handle);
+		break;
+	case RT_VERTEX_ARRAY_OBJECT:
+		_render_device->ReleaseVertexArrayObject(handle);
+		break;
+	case RT_SHADER:
+		_render_device->ReleaseShader(handle);
+		break;
+	case RT_SHADER_STAGE:
+		_render_device->ReleaseShaderStage(handle);
+		break;
+	case RT_QUERY:
+		_issued_queries.erase(handle);
+		_render_device->ReleaseQuery(handle);
+		break;
+	default:
+		assert(false);
+	};
+}
+void ReplayApp::PrintStatistics()
+{
+	debug::Printf("Frame: %u commands, %u draw calls.\n", _command_count, _draw_count);
+	debug::Printf("Iterations: %u\n", (uint32_t)_submit_times.size());
+
+	std::vector<double>* times[2] = { &_submit_times, &_frame_times };
+	const char* names[2] = { "Submit", "GPU finished" };
+	for(int i = 0; i < 2; ++i)
+	{
+		std::vector<double>& t = *times[i];
+		std::sort(t.begin(), t.end());
+
+		double total = 0.0;
+		for(std::vector<double>::iterator it = t.begin(); it != t.end(); ++it)
+			total += *it;
+
+		debug::Printf("%-14s min %8.3f ms, avg %8.3f ms, median %8.3f ms, max %8.3f ms\n", names[i],
+			t.front(), total / t.size(), t[t.size() / 2], t.back());
+	}
+}
@@ -0,0 +1,84 @@
+#ifndef __REPLAY_APP_H__
+#define __REPLAY_APP_H__
+
+#include <framework/App.h>
+#include <framework/FrameCapture.h>
+
+/// @brief Replays a frame capture written by RenderDevice a number of times and reports the timings.
+///	The resources in the snapshot at the start of the capture are created once, after which the captured
+///	frame is issued once every frame. Resources created during the captured frame are released again at the
+///	end of every iteration, and releases of snapshot resources are skipped, so that every iteration starts
+///	from the same state.
+class ReplayApp : public App
+{
+public:
+	/// @param capture_path Path to the capture file.
+	/// @param iteration_count Number of times to replay the captured frame.
+	ReplayApp(const char* capture_path, uint32_t iteration_count);
+	~ReplayApp();
+
+protected:
+	bool Initialize();
+	void Shutdown();
+
+	/// @brief Replays one iteration of the captured frame.
+	void Render(float dtime);
+
+	void OnEvent(SDL_Event* evt);
+
+private:
+	enum ResourceType
+	{
+		RT_HARDWARE_BUFFER,
+		RT_VERTEX_ARRAY_OBJECT,
+		RT_SHADER,
+		RT_SHADER_STAGE,
+		RT_QUERY,
+		RT_COUNT
+	};
+
+	/// @brief Executes commands until the specified command is read or the capture ends.
+	/// @return False if the capture ended before the specified command.
+	bool ExecuteCommands(capture_command::Command end_command);
+
+	/// @brief Reads the arguments of a command and executes it.
+	void ExecuteCommand(capture_command::Command command);
+
+	/// @brief Translates a handle in the capture to the handle of the replayed resource.
+	/// @return The replayed handle, -1 if the resource is unknown.
+	int MapHandle(ResourceType type, int captured_handle);
+
+	/// @brief Registers a newly created resource.
+	void AddHandle(ResourceType type, int captured_handle, int handle);
+
+	/// @brief Handles a release from the capture, only resources created within the frame are released.
+	void ReleaseHandle(ResourceType type, int captured_handle);
+
+	/// @brief Releases a replayed resource.
+	void ReleaseResource(ResourceType type, int handle);
+
+	/// @brief Prints statistics for all iterations.
+	void PrintStatistics();
+
+	std::string _capture_path;
+	uint32_t _iteration_count;
+	uint32_t _iteration;
+
+	CaptureReader _reader;
+	uint32_t _frame_start; // Read position of the first command of the captured frame.
+	bool _in_frame; // Specifies whether the commands currently executed belong to the captured frame.
+
+	std::map<int, int> _handles[RT_COUNT]; // Maps captured handles to resources created from the snapshot.
+	std::map<int, int> _frame_handles[RT_COUNT]; // Maps captured handles to resources created in the current iteration.
+
+	std::map<int, bool> _issued_queries; // Queries issued at least once, conditional rendering requires a result.
+	bool _skip_conditional_render; // Specifies whether the current conditional render was skipped.
+
+	uint32_t _command_count; // Number of commands in the captured frame.
+	uint32_t _draw_count; // Number of draw calls in the captured frame.
+
+	std::vector<double> _submit_times; // Time spent issuing the commands of each iteration, in milliseconds.
+	std::vector<double> _frame_times; // Time until the GPU have finished each iteration, in milliseconds.
+};
+
+#endif // __REPLAY_APP_H__
@@ -0,0 +1,31 @@
+// The replayer is a console program taking arguments, so SDL shouldn't replace main.
+#define SDL_MAIN_HANDLED
+
+#include <framework/Common.h>
+#include "ReplayApp.h"
+
+#include <stdlib.h>
+
+
+int main(int argc, char* argv[])
+{
+	if(argc < 2)
+	{
+		debug::Printf("Usage: %s <capture file> [iterations]\n", argv[0]);
+		return 1;
+	}
+
+	int iterations = (argc > 2) ? atoi(argv[2]) : 100;
+	if(iterations <= 0)
+	{
+		debug::Printf("[Error] Invalid number of iterations: %s\n", argv[2]);
+		return 1;
+	}
+
+	SDL_SetMainReady();
+
+	ReplayApp app(argv[1], (uint32_t)iterations);
+	app.Run();
+
+	return 0;
+}
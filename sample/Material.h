@@ -18,8 +18,9 @@ struct Material
 	Color diffuse;
 
 	int shader;
+	int shader_template; // Template used to select a shader variant for the current lights, -1 to always use the shader above.
 
-	Material() : shader(-1) {}
+	Material() : shader(-1), shader_template(-1) {}
 };
 
 
@@ -65,6 +65,25 @@ void MatrixStack::Scale3f(const Vec3& scale)
 	current_state.model_matrix = matrix::Multiply(current_state.model_matrix, scale_matrix);
 	_state_dirty = true;
 }
+void MatrixStack::MultiplyMatrix(const Mat4x4& matrix)
+{
+	State& current_state = _states.top();
+	current_state.model_matrix = matrix::Multiply(current_state.model_matrix, matrix);
+	_state_dirty = true;
+}
+const Mat4x4& MatrixStack::ModelMatrix() const
+{
+	return _states.top().model_matrix;
+}
+const Mat4x4& MatrixStack::ViewMatrix() const
+{
+	return _states.top().view_matrix;
+}
+const Mat4x4& MatrixStack::ProjectionMatrix() const
+{
+	return _states.top().projection_matrix;
+}
+
 void MatrixStack::Apply(RenderDevice& render_device)
 {
 	if(_state_dirty)
@@ -77,6 +96,9 @@ void MatrixStack::Apply(RenderDevice& render_device)
 		Mat4x4 model_view = matrix::Multiply(current_state.view_matrix, current_state.model_matrix);
 		render_device.SetUniformMatrix4f("model_view_matrix", model_view);
 
+		// The normal matrix is computed once per draw here rather than for every vertex in the shader.
+		render_device.SetUniformMatrix3f("normal_matrix", matrix::CreateNormalMatrix(model_view));
+
 		// Build our model view projection matrix
 		//	model_view_projection = projection * view * model
 		Mat4x4 model_view_projection = matrix::Multiply(current_state.projection_matrix, model_view);
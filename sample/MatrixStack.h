@@ -25,6 +25,16 @@ public:
 	void Rotate3f(float head, float pitch, float roll);
 	void Scale3f(const Vec3& scale);
 
+	/// @brief Multiplies the model matrix at the top of the stack with the specified matrix.
+	void MultiplyMatrix(const Mat4x4& matrix);
+
+	/// @brief Returns the model matrix at the top of the stack.
+	const Mat4x4& ModelMatrix() const;
+	/// @brief Returns the view matrix at the top of the stack.
+	const Mat4x4& ViewMatrix() const;
+	/// @brief Returns the projection matrix at the top of the stack.
+	const Mat4x4& ProjectionMatrix() const;
+
 	/// Applies the current matrices to the pipeline, this assumes that a shader with 
 	///		the appropriate uniforms is bound.
 	void Apply(RenderDevice& render_device);
@@ -3,127 +3,1090 @@
 #include "PrimitiveFactory.h"
 
 #include <framework/RenderDevice.h>
+#include <framework/FrameAllocator.h>
+#include <framework/MeshOptimizer.h>
+#include <framework/MeshImporter.h>
+#include <framework/MeshSimplifier.h>
+#include <framework/Meshlet.h>
 
-PrimitiveFactory::PrimitiveFactory(RenderDevice* render_device) : _render_device(render_device)
+#include <stdio.h>
+#include <string.h>
+#include <float.h>
+#include <algorithm>
+
+namespace
+{
+	/// Encoding of the normals of all primitives, octahedral normals are decoded by the sample shader.
+	const vertex_quantizer::NormalEncoding normal_encoding = vertex_quantizer::NE_OCTAHEDRAL;
+
+	/// Fraction of the triangles kept at each level of imported meshes.
+	const float mesh_lod_ratios[PrimitiveLodChain::MAX_LOD_COUNT] = { 1.0f, 0.5f, 0.25f, 0.1f };
+
+	/// Largest error allowed when simplifying imported meshes, relative to the bounding radius.
+	const float mesh_lod_max_error = 0.05f;
+
+	/// Largest error a level is allowed to project to on screen, relative to half the screen height.
+	///	This is about a pixel at 1080p.
+	const float mesh_lod_screen_error = 0.002f;
+
+	/// Levels of imported meshes with at least this many indices are split into meshlets.
+	const uint32_t mesh_meshlet_min_index_count = 8 * meshlet::MAX_TRIANGLES * 3;
+
+	/// @brief Optimizes each level of detail for vertex cache and overdraw, then the vertices for fetching
+	///		in the order of the first level. Works on both 16-bit and 32-bit indices.
+	/// @param vertex_count Number of vertices, receives the new number of vertices.
+	template<typename IndexType>
+	void OptimizeMeshLods(float* vertex_data, int& vertex_count, IndexType* index_data, const mesh_simplifier::Lod* lods, 
+		uint32_t lod_count, const char* name)
+	{
+		const uint32_t vertex_size = vertex_format::VertexSize(vertex_format::VF_POSITION3F_NORMAL3F);
+		uint32_t index_count = 0;
+		mesh_optimizer::VertexCacheStats before[PrimitiveLodChain::MAX_LOD_COUNT];
+		for(uint32_t i = 0; i < lod_count; ++i)
+		{
+			IndexType* level_indices = index_data + lods[i].first_index;
+			before[i] = mesh_optimizer::AnalyzeVertexCache(level_indices, lods[i].index_count, vertex_count);
+
+			mesh_optimizer::OptimizeVertexCache(level_indices, lods[i].index_count, vertex_count);
+			mesh_optimizer::OptimizeOverdraw(level_indices, lods[i].index_count, vertex_data, vertex_count, vertex_size);
+
+			index_count = std::max(index_count, lods[i].first_index + lods[i].index_count);
+		}
+
+		// The vertices are ordered by the most detailed level, which comes first.
+		int original_vertex_count = vertex_count;
+		vertex_count = mesh_optimizer::OptimizeVertexFetch(vertex_data, vertex_count, vertex_size, index_data, index_count);
+
+		// ATVR is relative to the vertices of the whole chain, as all levels share them.
+		for(uint32_t i = 0; i < lod_count; ++i)
+		{
+			mesh_optimizer::VertexCacheStats after = mesh_optimizer::AnalyzeVertexCache(index_data + lods[i].first_index, 
+				lods[i].index_count, vertex_count);
+			debug::Printf("PrimitiveFactory: Optimized %s level %u (%d -> %d vertices, %u triangles): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", 
+				name, i, original_vertex_count, vertex_count, lods[i].index_count / 3, before[i].acmr, after.acmr, before[i].atvr, after.atvr);
+		}
+	}
+};
+
+PrimitiveFactory::PrimitiveFactory(RenderDevice* render_device, ResourceUploader* resource_uploader) 
+	: _render_device(render_device), _resource_uploader(resource_uploader), _geometry_counter(0), _loader_quit(false)
 {
+	// All our primitives use the same vertex format, so they can all share one arena.
+	_geometry_arena = new GeometryArena(_render_device, vertex_quantizer::QuantizedFormat(normal_encoding), 16384, 65536);
+
+	// Importing and processing a mesh takes far longer than a frame, so it's kept off the main thread.
+	_loader_mutex = SDL_CreateMutex();
+	_load_signal = SDL_CreateCond();
+	_loader_thread = SDL_CreateThread(LoaderMain, "PrimitiveFactory", this);
+	if(!_loader_thread)
+		debug::Printf("PrimitiveFactory: SDL_CreateThread failed, loading meshes on the main thread: %s\n", SDL_GetError());
 }
 PrimitiveFactory::~PrimitiveFactory()
 {
+	if(_loader_thread)
+	{
+		SDL_LockMutex(_loader_mutex);
+		_loader_quit = true;
+		SDL_CondSignal(_load_signal);
+		SDL_UnlockMutex(_loader_mutex);
+
+		SDL_WaitThread(_loader_thread, NULL);
+		_loader_thread = NULL;
+	}
+
+	// Meshes still queued are never loaded, the finished ones are never uploaded.
+	_load_jobs.insert(_load_jobs.end(), _load_results.begin(), _load_results.end());
+	for(std::vector<MeshLoad*>::iterator it = _load_jobs.begin(); it != _load_jobs.end(); ++it)
+	{
+		delete (*it)->source;
+		delete (*it);
+	}
+	_load_jobs.clear();
+	_load_results.clear();
+
+	SDL_DestroyCond(_load_signal);
+	_load_signal = NULL;
+	SDL_DestroyMutex(_loader_mutex);
+	_loader_mutex = NULL;
+
+	// The uploader may still be reading from the source data of abandoned meshes.
+	if(!_abandoned_uploads.empty())
+	{
+		_resource_uploader->Finish();
+		Update();
+	}
+
+	if(!_cache_lookup.empty())
+		debug::Printf("PrimitiveFactory: %u primitives still referenced at shutdown.\n", (uint32_t)_cache_lookup.size());
+
+	delete _geometry_arena;
+	_geometry_arena = NULL;
 }
 
-Primitive PrimitiveFactory::CreateSphere(float radius)
+namespace
 {
-	const int ring_count = 32;
-	const int sector_count = 32;
+	/// Tessellation of each level in the sphere LOD chain, and the smallest projected size it's used for.
+	const int sphere_lod_ring_counts[PrimitiveLodChain::MAX_LOD_COUNT] = { 32, 16, 10, 6 };
+	const float sphere_lod_min_screen_sizes[PrimitiveLodChain::MAX_LOD_COUNT] = { 0.25f, 0.1f, 0.04f, 0.0f };
 
-	Primitive primitive;
-	primitive.draw_call.draw_mode = GL_TRIANGLES;
-	primitive.draw_call.vertex_count = ring_count * sector_count; // +1 for the center vertex 
-	primitive.draw_call.vertex_offset = 0;
+	/// Subdivision of each level in the icosphere LOD chain, using the same screen sizes as the UV sphere.
+	const int icosphere_lod_subdivisions[PrimitiveLodChain::MAX_LOD_COUNT] = { 3, 2, 1, 0 };
+
+	/// @brief Returns the index of the vertex halfway along the edge between two vertices, creating it on the
+	///		unit sphere if the edge haven't been split before. Each edge is shared by two triangles, so the
+	///		cache keeps the neighbouring triangles from getting vertices of their own.
+	uint16_t EdgeMidpoint(uint16_t a, uint16_t b, std::map<uint32_t, uint16_t>& midpoints, Vec3* positions, uint32_t& vertex_count)
+	{
+		uint32_t key = (a < b) ? ((uint32_t)a << 16) | b : ((uint32_t)b << 16) | a;
+		std::map<uint32_t, uint16_t>::iterator it = midpoints.find(key);
+		if(it != midpoints.end())
+			return it->second;
+
+		Vec3 midpoint = vector::Add(positions[a], positions[b]);
+		vector::Normalize(midpoint);
+
+		uint16_t index = (uint16_t)vertex_count++;
+		positions[index] = midpoint;
+		midpoints[key] = index;
+		return index;
+	}
+
+	/// @brief Generates a UV sphere as a VF_POSITION3F_NORMAL3F triangle list.
+	/// @return The bounding radius.
+	float GenerateSphere(float radius, int ring_count, int sector_count, std::vector<float>& vertex_data, std::vector<uint16_t>& index_data)
+	{
+		assert(ring_count >= 2 && sector_count >= 2);
+
+		vertex_data.resize(ring_count*sector_count*3*2);
+		int vertex_idx = 0;
+
+		float const inv_rings = 1.0f/(float)(ring_count-1);
+		float const inv_sectors = 1.0f/(float)(sector_count-1);
+		for(int r = 0; r < ring_count; r++)
+		{
+			float y = sin(-(float)MATH_HALF_PI + (float)MATH_PI * r * inv_rings);
+			for(int s = 0; s < sector_count; s++) 
+			{
+				float x = cos((float)MATH_TWO_PI * s * inv_sectors) * sin((float)MATH_PI * r * inv_rings);
+				float z = sin((float)MATH_TWO_PI * s * inv_sectors) * sin((float)MATH_PI * r * inv_rings);
+
+				vertex_data[vertex_idx++] = x * radius;
+				vertex_data[vertex_idx++] = y * radius;
+				vertex_data[vertex_idx++] = z * radius;
 
-	float vertex_data[ring_count*sector_count*3*2];
-	int vertex_idx = 0;
+				// Normals
+				vertex_data[vertex_idx++] = x;
+				vertex_data[vertex_idx++] = y;
+				vertex_data[vertex_idx++] = z;
+			}
+		}
+
+		// Index data
+		index_data.resize((ring_count-1) * (sector_count-1) * 6);
+		int index_idx = 0;
+
+		for(int r = 0; r < ring_count-1; r++)
+		{
+			for(int s = 0; s < sector_count-1; s++) 
+			{
+				index_data[index_idx++] = (uint16_t)(r * sector_count + s);
+				index_data[index_idx++] = (uint16_t)((r + 1) * sector_count + s);
+				index_data[index_idx++] = (uint16_t)((r + 1) * sector_count + s + 1);
+				
+				index_data[index_idx++] = (uint16_t)(r * sector_count + s);
+				index_data[index_idx++] = (uint16_t)((r + 1) * sector_count + s + 1);
+				index_data[index_idx++] = (uint16_t)(r * sector_count + s + 1);
+			}
+		}
+		return radius;
+	}
 
-    float const inv_rings = 1.0f/(float)(ring_count-1);
-    float const inv_sectors = 1.0f/(float)(sector_count-1);
-	for(int r = 0; r < ring_count; r++)
+	/// @brief Generates an icosphere, an icosahedron subdivided and projected onto the sphere.
+	/// @return The bounding radius.
+	float GenerateIcosphere(float radius, int subdivisions, std::vector<float>& vertex_data, std::vector<uint16_t>& indices)
 	{
-		float y = sin(-(float)MATH_HALF_PI + (float)MATH_PI * r * inv_rings);
-		for(int s = 0; s < sector_count; s++) 
+		// Limited by the 16-bit indices, level 6 would need 40962 vertices but level 5 is already plenty.
+		assert(subdivisions >= 0 && subdivisions <= 5);
+
+		FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+		FrameAllocatorScope allocator_scope(allocator);
+
+		// Each subdivision quadruples the number of triangles, adding one vertex per edge.
+		uint32_t max_triangle_count = 20 << (2 * subdivisions);
+		uint32_t max_vertex_count = max_triangle_count / 2 + 2;
+
+		Vec3* positions = allocator.AllocateArray<Vec3>(max_vertex_count);
+		uint16_t* index_data = allocator.AllocateArray<uint16_t>(max_triangle_count * 3);
+		uint16_t* subdivided = allocator.AllocateArray<uint16_t>(max_triangle_count * 3);
+
+		// Icosahedron, made of three orthogonal golden rectangles.
+		const float t = (1.0f + sqrtf(5.0f)) * 0.5f;
+		const float icosahedron_vertices[12][3] = {
+			{ -1.0f, t, 0.0f }, { 1.0f, t, 0.0f }, { -1.0f, -t, 0.0f }, { 1.0f, -t, 0.0f },
+			{ 0.0f, -1.0f, t }, { 0.0f, 1.0f, t }, { 0.0f, -1.0f, -t }, { 0.0f, 1.0f, -t },
+			{ t, 0.0f, -1.0f }, { t, 0.0f, 1.0f }, { -t, 0.0f, -1.0f }, { -t, 0.0f, 1.0f }
+		};
+		const uint16_t icosahedron_indices[20*3] = {
+			0, 11, 5,	0, 5, 1,	0, 1, 7,	0, 7, 10,	0, 10, 11,
+			1, 5, 9,	5, 11, 4,	11, 10, 2,	10, 7, 6,	7, 1, 8,
+			3, 9, 4,	3, 4, 2,	3, 2, 6,	3, 6, 8,	3, 8, 9,
+			4, 9, 5,	2, 4, 11,	6, 2, 10,	8, 6, 7,	9, 8, 1
+		};
+
+		uint32_t vertex_count = 12;
+		for(uint32_t i = 0; i < vertex_count; ++i)
+		{
+			positions[i] = Vec3(icosahedron_vertices[i][0], icosahedron_vertices[i][1], icosahedron_vertices[i][2]);
+			vector::Normalize(positions[i]);
+		}
+
+		uint32_t triangle_count = 20;
+		memcpy(index_data, icosahedron_indices, sizeof(icosahedron_indices));
+
+		std::map<uint32_t, uint16_t> midpoints;
+		for(int level = 0; level < subdivisions; ++level)
 		{
-			float x = cos((float)MATH_TWO_PI * s * inv_sectors) * sin((float)MATH_PI * r * inv_rings);
-			float z = sin((float)MATH_TWO_PI * s * inv_sectors) * sin((float)MATH_PI * r * inv_rings);
+			// Split every triangle into four, one in each corner and one in the middle.
+			midpoints.clear();
+			for(uint32_t i = 0; i < triangle_count; ++i)
+			{
+				uint16_t v0 = index_data[i*3], v1 = index_data[i*3+1], v2 = index_data[i*3+2];
+				uint16_t a = EdgeMidpoint(v0, v1, midpoints, positions, vertex_count);
+				uint16_t b = EdgeMidpoint(v1, v2, midpoints, positions, vertex_count);
+				uint16_t c = EdgeMidpoint(v2, v0, midpoints, positions, vertex_count);
 
-			vertex_data[vertex_idx++] = x * radius;
-			vertex_data[vertex_idx++] = y * radius;
-			vertex_data[vertex_idx++] = z * radius;
+				uint16_t* out = subdivided + i*12;
+				out[0] = v0;	out[1] = a;		out[2] = c;
+				out[3] = v1;	out[4] = b;		out[5] = a;
+				out[6] = v2;	out[7] = c;		out[8] = b;
+				out[9] = a;		out[10] = b;	out[11] = c;
+			}
+			triangle_count *= 4;
+			std::swap(index_data, subdivided);
+		}
+		assert(vertex_count <= max_vertex_count);
+
+		// Every vertex is on the unit sphere, so the position doubles as the normal.
+		vertex_data.resize(vertex_count*3*2);
+		for(uint32_t i = 0; i < vertex_count; ++i)
+		{
+			vertex_data[i*6] = positions[i].x * radius;
+			vertex_data[i*6+1] = positions[i].y * radius;
+			vertex_data[i*6+2] = positions[i].z * radius;
 
-			// Normals
-			vertex_data[vertex_idx++] = x;
-			vertex_data[vertex_idx++] = y;
-			vertex_data[vertex_idx++] = z;
+			vertex_data[i*6+3] = positions[i].x;
+			vertex_data[i*6+4] = positions[i].y;
+			vertex_data[i*6+5] = positions[i].z;
 		}
+		indices.assign(index_data, index_data + triangle_count * 3);
+		return radius;
 	}
-	primitive.draw_call.vertex_array_object = _render_device->CreateVertexArrayObject();
 
-	primitive.vertex_buffer = _render_device->CreateVertexBuffer(primitive.draw_call.vertex_array_object, vertex_format::VF_POSITION3F_NORMAL3F,
-		3*2*primitive.draw_call.vertex_count*sizeof(float), vertex_data);
+	/// @brief Generates a plane facing up, as 6 vertices without indices.
+	/// @return The bounding radius.
+	float GeneratePlane(const Vec2& size, std::vector<float>& vertex_data)
+	{
+		vertex_data.resize(6*6); // 6 vertices, 6 floats each (Px, Py, Pz, Nx, Ny, Nz)
+		int i = 0;
+
+		Vec2 half_size;
+		half_size.x = size.x * 0.5f;
+		half_size.y = size.y * 0.5f;
+		
+		// Top
+		Vec3 normal = Vec3(0.0f, 1.0f, 0.0f); // Up
 
-	// Index data
-	primitive.draw_call.index_count = (ring_count-1) * (sector_count-1) * 6;
-	uint16_t index_data[(ring_count-1) * (sector_count-1) * 6];
-	int index_idx = 0;
+		vertex_data[i++] = -half_size.x;	vertex_data[i++] = 0.0f;		vertex_data[i++] = -half_size.y; // Bottom left
+		vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
+		vertex_data[i++] = half_size.x;		vertex_data[i++] = 0.0f;		vertex_data[i++] = half_size.y; // Top right
+		vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
+		vertex_data[i++] = half_size.x;		vertex_data[i++] = 0.0f;		vertex_data[i++] = -half_size.y; // Bottom right
+		vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
+		
+		vertex_data[i++] = -half_size.x;	vertex_data[i++] = 0.0f;		vertex_data[i++] = -half_size.y; // Bottom left
+		vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
+		vertex_data[i++] = -half_size.x;	vertex_data[i++] = 0.0f;		vertex_data[i++] = half_size.y; // Top left
+		vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
+		vertex_data[i++] = half_size.x;		vertex_data[i++] = 0.0f;		vertex_data[i++] = half_size.y; // Top right
+		vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
 
-	for(int r = 0; r < ring_count-1; r++)
+		return sqrtf(half_size.x * half_size.x + half_size.y * half_size.y);
+	}
+
+	/// @brief Generates a box centered around the origin.
+	/// @return The bounding radius.
+	float GenerateBox(const Vec3& half_size, std::vector<float>& vertex_data, std::vector<uint16_t>& index_data)
 	{
-		for(int s = 0; s < sector_count-1; s++) 
+		// Each face have its own four vertices so that the normals stay flat.
+		vertex_data.resize(6*4*6); // 24 vertices, 6 floats each (Px, Py, Pz, Nx, Ny, Nz)
+		index_data.resize(6*6);
+		int vertex_idx = 0, index_idx = 0;
+
+		for(int face = 0; face < 6; ++face)
 		{
-			index_data[index_idx++] = (uint16_t)(r * sector_count + s);
-			index_data[index_idx++] = (uint16_t)((r + 1) * sector_count + s);
-			index_data[index_idx++] = (uint16_t)((r + 1) * sector_count + s + 1);
-			
-			index_data[index_idx++] = (uint16_t)(r * sector_count + s);
-			index_data[index_idx++] = (uint16_t)((r + 1) * sector_count + s + 1);
-			index_data[index_idx++] = (uint16_t)(r * sector_count + s + 1);
+			// Faces are ordered +x, -x, +y, -y, +z, -z
+			int axis = face / 2;
+			float sign = (face % 2) ? -1.0f : 1.0f;
+
+			// The two axes spanning the face, ordered to give counter-clockwise winding seen from outside.
+			int u = (axis + 1) % 3;
+			int v = (axis + 2) % 3;
+
+			const float corners[4][2] = { { -1.0f, -1.0f }, { 1.0f, -1.0f }, { 1.0f, 1.0f }, { -1.0f, 1.0f } };
+			for(int c = 0; c < 4; ++c)
+			{
+				float position[3], normal[3] = { 0.0f, 0.0f, 0.0f };
+				position[axis] = sign * (&half_size.x)[axis];
+				position[u] = corners[c][0] * sign * (&half_size.x)[u];
+				position[v] = corners[c][1] * (&half_size.x)[v];
+				normal[axis] = sign;
+
+				vertex_data[vertex_idx++] = position[0];	vertex_data[vertex_idx++] = position[1];	vertex_data[vertex_idx++] = position[2];
+				vertex_data[vertex_idx++] = normal[0];		vertex_data[vertex_idx++] = normal[1];		vertex_data[vertex_idx++] = normal[2];
+			}
+
+			uint16_t first = (uint16_t)(face * 4);
+			index_data[index_idx++] = first;
+			index_data[index_idx++] = (uint16_t)(first + 1);
+			index_data[index_idx++] = (uint16_t)(first + 2);
+
+			index_data[index_idx++] = first;
+			index_data[index_idx++] = (uint16_t)(first + 2);
+			index_data[index_idx++] = (uint16_t)(first + 3);
 		}
+		return vector::Length(half_size);
 	}
-	primitive.index_buffer = _render_device->CreateIndexBuffer(primitive.draw_call.vertex_array_object, primitive.draw_call.index_count, index_data);
-	
-	primitive.bounding_radius = radius;
+};
 
+PrimitiveFactory::CacheKey::CacheKey(PrimitiveType t, float p0, float p1, float p2) : type(t)
+{
+	params[0] = p0;
+	params[1] = p1;
+	params[2] = p2;
+}
+PrimitiveFactory::CacheKey::CacheKey(PrimitiveType t, const std::string& n) : type(t), name(n)
+{
+	params[0] = params[1] = params[2] = 0.0f;
+}
+bool PrimitiveFactory::CacheKey::operator<(const CacheKey& other) const
+{
+	if(type != other.type)
+		return type < other.type;
+	for(int i = 0; i < 3; ++i)
+	{
+		if(params[i] != other.params[i])
+			return params[i] < other.params[i];
+	}
+	return name < other.name;
+}
+
+Primitive PrimitiveFactory::CreateSphere(float radius, int ring_count, int sector_count)
+{
+	CacheKey key(PT_SPHERE, radius, (float)ring_count, (float)sector_count);
+
+	Primitive primitive;
+	if(!AcquireCached(key, primitive))
+	{
+		primitive = BuildPrimitive(key, "sphere");
+		AddToCache(key, primitive);
+	}
+	return primitive;
+}
+Primitive PrimitiveFactory::CreateIcosphere(float radius, int subdivisions)
+{
+	CacheKey key(PT_ICOSPHERE, radius, (float)subdivisions, 0.0f);
+
+	Primitive primitive;
+	if(!AcquireCached(key, primitive))
+	{
+		primitive = BuildPrimitive(key, "icosphere");
+		AddToCache(key, primitive);
+	}
 	return primitive;
 }
 Primitive PrimitiveFactory::CreatePlane(const Vec2& size)
 {
+	CacheKey key(PT_PLANE, size.x, size.y, 0.0f);
+
+	Primitive primitive;
+	if(!AcquireCached(key, primitive))
+	{
+		primitive = BuildPrimitive(key, "plane");
+		AddToCache(key, primitive);
+	}
+	return primitive;
+}
+Primitive PrimitiveFactory::CreateBox(const Vec3& half_size)
+{
+	CacheKey key(PT_BOX, half_size.x, half_size.y, half_size.z);
+
+	Primitive primitive;
+	if(!AcquireCached(key, primitive))
+	{
+		primitive = BuildPrimitive(key, "box");
+		AddToCache(key, primitive);
+	}
+	return primitive;
+}
+PrimitiveLodChain PrimitiveFactory::CreateMeshLodChain(const char* path)
+{
+	CacheKey key(PT_MESH_LOD_CHAIN, path);
+
+	// Every level holds a reference to the same entry, which owns the geometry of all levels.
 	Primitive primitive;
+	if(AcquireCached(key, primitive))
+	{
+		CacheEntry& entry = _cache_entries[primitive.cache_id];
+		entry.ref_count += entry.lod_chain.lod_count - 1;
+		return MeshLodChain(entry);
+	}
+
+	// The number of levels isn't known until the mesh is loaded, until then the chain holds a reference for
+	//	every possible level. The levels have nothing to draw, not even a vertex array object.
 	primitive.draw_call.draw_mode = GL_TRIANGLES;
+	AddToCache(key, primitive);
+
+	CacheEntry& entry = _cache_entries[primitive.cache_id];
+	for(uint32_t i = 0; i < PrimitiveLodChain::MAX_LOD_COUNT; ++i)
+	{
+		entry.lod_chain.lods[i] = primitive;
+		entry.lod_chain.min_screen_size[i] = 0.0f;
+	}
+	entry.lod_chain.lod_count = PrimitiveLodChain::MAX_LOD_COUNT;
+	entry.ref_count = PrimitiveLodChain::MAX_LOD_COUNT;
+
+	MeshLoad* load = new MeshLoad;
+	load->path = path;
+	load->source = new MeshSource;
+	load->bounding_radius = 0.0f;
+	load->loaded = false;
+	load->cache_id = primitive.cache_id;
+	entry.mesh_load = load;
+	QueueMeshLoad(load);
+
+	return MeshLodChain(entry);
+}
+bool PrimitiveFactory::UpdateLodChain(PrimitiveLodChain& chain)
+{
+	assert(chain.lod_count > 0 && (uint32_t)chain.lods[0].cache_id < _cache_entries.size());
+
+	const CacheEntry& entry = _cache_entries[chain.lods[0].cache_id];
+	if(entry.mesh_load || entry.mesh_source)
+		return false;
+
+	// Chains created while the mesh was loading hold references for levels the mesh may not have. The last
+	//	reference may release the entry, so the levels are copied first.
+	PrimitiveLodChain loaded = entry.lod_chain;
+	for(uint32_t i = loaded.lod_count; i < chain.lod_count; ++i)
+		DestroyPrimitive(chain.lods[i]);
+
+	chain = loaded;
+	return true;
+}
+void PrimitiveFactory::Update()
+{
+	std::vector<MeshLoad*> loads;
+	SDL_LockMutex(_loader_mutex);
+	loads.swap(_load_results);
+	SDL_UnlockMutex(_loader_mutex);
+
+	for(std::vector<MeshLoad*>::iterator it = loads.begin(); it != loads.end(); ++it)
+	{
+		MeshLoad* load = *it;
+		if(load->cache_id != -1)
+		{
+			FinishMeshLoad(load->cache_id, *load);
+		}
+		else
+		{
+			// Every reference was destroyed while the mesh was loading.
+			delete load->source;
+		}
+		delete load;
+	}
+
+	_geometry_arena->Update();
+
+	for(std::vector<int>::iterator it = _uploading_entries.begin(); it != _uploading_entries.end(); )
+	{
+		if(PollMeshUpload(_cache_entries[*it]))
+			it = _uploading_entries.erase(it);
+		else
+			++it;
+	}
+
+	// Nothing references the abandoned meshes, their buffers are released as soon as they're published.
+	for(std::vector<AbandonedUpload>::iterator it = _abandoned_uploads.begin(); it != _abandoned_uploads.end(); )
+	{
+		if(mesh_file::PollUpload(*_resource_uploader, it->buffers) == ResourceUploader::US_PENDING)
+		{
+			++it;
+			continue;
+		}
+
+		MeshFile::Release(*_render_device, it->buffers);
+		delete it->source;
+		it = _abandoned_uploads.erase(it);
+	}
+}
+Primitive PrimitiveFactory::BuildPrimitive(const CacheKey& key, const char* name)
+{
+	std::vector<float> vertices;
+	std::vector<uint16_t> indices;
+
+	Primitive primitive;
+	primitive.draw_call.draw_mode = GL_TRIANGLES;
+	primitive.draw_call.vertex_offset = 0;
+	primitive.bounding_radius = GenerateGeometry(key, vertices, indices);
+	primitive.draw_call.vertex_count = (int)vertices.size() / 6;
+	primitive.draw_call.index_count = (int)indices.size();
+
+	if(!indices.empty())
+		OptimizeMesh(&vertices[0], primitive.draw_call.vertex_count, &indices[0], primitive.draw_call.index_count, name);
+
+	AllocateGeometry(primitive, &vertices[0], indices.empty() ? NULL : &indices[0]);
+	return primitive;
+}
+float PrimitiveFactory::GenerateGeometry(const CacheKey& key, std::vector<float>& vertices, std::vector<uint16_t>& indices)
+{
+	switch(key.type)
+	{
+	case PT_SPHERE:
+		return GenerateSphere(key.params[0], (int)key.params[1], (int)key.params[2], vertices, indices);
+	case PT_ICOSPHERE:
+		return GenerateIcosphere(key.params[0], (int)key.params[1], vertices, indices);
+	case PT_PLANE:
+		return GeneratePlane(Vec2(key.params[0], key.params[1]), vertices);
+	case PT_BOX:
+		return GenerateBox(Vec3(key.params[0], key.params[1], key.params[2]), vertices, indices);
+	default:
+		assert(false);
+		return 0.0f;
+	}
+}
+void PrimitiveFactory::LoadMesh(MeshLoad& load)
+{
+	// The cache holds the mesh exactly as it's uploaded, a hit is uploaded straight from the mapping without
+	//	any processing. Caches written with another vertex format are rebuilt.
+	const char* path = load.path.c_str();
+	MeshSource& source = *load.source;
+	if(mesh_importer::OpenCache(path, source.file) && 
+		source.file.GetHeader().vertex_format == (uint32_t)vertex_quantizer::QuantizedFormat(normal_encoding))
+	{
+		source.file.GetMeshData(load.mesh);
+		load.bounding_radius = source.file.GetHeader().bounding_radius;
+		load.loaded = true;
+		return;
+	}
+
+	source.file.Close();
+	if(!ProcessMesh(path, source.processed))
+		return;
 
-	primitive.draw_call.vertex_count = 6; 
-
-	float vertex_data[6*6]; // 6 vertices, 6 floats each (Px, Py, Pz, Nx, Ny, Nz)
-	int i = 0;
-
-	Vec2 half_size;
-	half_size.x = size.x * 0.5f;
-	half_size.y = size.y * 0.5f;
-	
-	// Top
-	Vec3 normal = Vec3(0.0f, 1.0f, 0.0f); // Up
-
-	vertex_data[i++] = -half_size.x;	vertex_data[i++] = 0.0f;		vertex_data[i++] = -half_size.y; // Bottom left
-	vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
-	vertex_data[i++] = half_size.x;		vertex_data[i++] = 0.0f;		vertex_data[i++] = half_size.y; // Top right
-	vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
-	vertex_data[i++] = half_size.x;		vertex_data[i++] = 0.0f;		vertex_data[i++] = -half_size.y; // Bottom right
-	vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
-	
-	vertex_data[i++] = -half_size.x;	vertex_data[i++] = 0.0f;		vertex_data[i++] = -half_size.y; // Bottom left
-	vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
-	vertex_data[i++] = -half_size.x;	vertex_data[i++] = 0.0f;		vertex_data[i++] = half_size.y; // Top left
-	vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
-	vertex_data[i++] = half_size.x;		vertex_data[i++] = 0.0f;		vertex_data[i++] = half_size.y; // Top right
-	vertex_data[i++] = normal.x;		vertex_data[i++] = normal.y;	vertex_data[i++] = normal.z;
-	
-	primitive.draw_call.vertex_array_object = _render_device->CreateVertexArrayObject();
-
-	primitive.vertex_buffer = _render_device->CreateVertexBuffer(primitive.draw_call.vertex_array_object, vertex_format::VF_POSITION3F_NORMAL3F,
-		6*primitive.draw_call.vertex_count*sizeof(float), vertex_data);
+	// A cache that can't be written only costs the processing on the next load.
+	mesh_file::Write(mesh_importer::CachePath(path).c_str(), source.processed.data);
 
+	load.mesh = source.processed.data;
+	load.bounding_radius = source.processed.bounding_radius;
+	load.loaded = true;
+}
+void PrimitiveFactory::FinishMeshLoad(int cache_id, MeshLoad& load)
+{
+	CacheEntry& entry = _cache_entries[cache_id];
+	assert(entry.mesh_load == &load);
+	entry.mesh_load = NULL;
+
+	if(!load.loaded)
+	{
+		debug::Printf("PrimitiveFactory: Failed to load %s.\n", load.path.c_str());
+
+		// Failed imports aren't cached, so a fixed file can be loaded later. The entry itself is released
+		//	with the references of the chains waiting for it, see UpdateLodChain.
+		_cache_lookup.erase(entry.key);
+		entry.lod_chain.lod_count = 0;
+		delete load.source;
+		return;
+	}
+
+	const mesh_file::MeshData& mesh = load.mesh;
+	mesh_file::Upload(*_resource_uploader, *_render_device, mesh, entry.buffers, load.path.c_str());
+
+	PrimitiveLodChain& chain = entry.lod_chain;
+	for(uint32_t i = 0; i < entry.buffers.lod_count; ++i)
+	{
+		const mesh_file::Lod& lod = mesh.lods[i];
+
+		Primitive& primitive = chain.lods[i];
+		primitive = Primitive();
+		primitive.draw_call = entry.buffers.lods[i];
+		primitive.bounding_radius = load.bounding_radius;
+		primitive.dequantization = mesh.dequantization;
+		primitive.cache_id = cache_id;
+		if(lod.meshlet_count)
+		{
+			primitive.meshlets = new MeshletCuller(mesh.meshlets + lod.first_meshlet, lod.meshlet_count);
+			entry.meshlet_cullers.push_back(primitive.meshlets);
+		}
+
+		chain.min_screen_size[i] = lod.min_screen_size;
+	}
+	chain.lod_count = entry.buffers.lod_count;
+	entry.primitive = chain.lods[0];
+	entry.mesh_source = load.source;
+
+	// Without a worker thread the upload is already done.
+	if(!PollMeshUpload(entry))
+		_uploading_entries.push_back(cache_id);
+}
+void PrimitiveFactory::QueueMeshLoad(MeshLoad* load)
+{
+	if(!_loader_thread)
+	{
+		LoadMesh(*load);
+		_load_results.push_back(load);
+		return;
+	}
+
+	SDL_LockMutex(_loader_mutex);
+	_load_jobs.push_back(load);
+	SDL_CondSignal(_load_signal);
+	SDL_UnlockMutex(_loader_mutex);
+}
+int SDLCALL PrimitiveFactory::LoaderMain(void* data)
+{
+	((PrimitiveFactory*)data)->RunLoader();
+	return 0;
+}
+void PrimitiveFactory::RunLoader()
+{
+	SDL_LockMutex(_loader_mutex);
+	while(!_loader_quit)
+	{
+		if(_load_jobs.empty())
+		{
+			SDL_CondWait(_load_signal, _loader_mutex);
+			continue;
+		}
+
+		// Meshes are loaded in the order they were requested.
+		MeshLoad* load = _load_jobs.front();
+		_load_jobs.erase(_load_jobs.begin());
+		SDL_UnlockMutex(_loader_mutex);
+
+		LoadMesh(*load);
+
+		SDL_LockMutex(_loader_mutex);
+		_load_results.push_back(load);
+	}
+	SDL_UnlockMutex(_loader_mutex);
+}
+PrimitiveLodChain PrimitiveFactory::MeshLodChain(const CacheEntry& entry) const
+{
+	PrimitiveLodChain chain = entry.lod_chain;
+	if(entry.mesh_source)
+	{
+		// The vertex array object have no buffers attached yet.
+		for(uint32_t i = 0; i < chain.lod_count; ++i)
+		{
+			chain.lods[i].draw_call.vertex_count = 0;
+			chain.lods[i].draw_call.index_count = 0;
+			chain.lods[i].meshlets = NULL;
+		}
+	}
+	return chain;
+}
+bool PrimitiveFactory::PollMeshUpload(CacheEntry& entry)
+{
+	assert(entry.mesh_source);
+
+	ResourceUploader::UploadStatus status = mesh_file::PollUpload(*_resource_uploader, entry.buffers);
+	if(status == ResourceUploader::US_PENDING)
+		return false;
+
+	if(status == ResourceUploader::US_FAILED)
+	{
+		debug::Printf("PrimitiveFactory: Failed to upload %s.\n", entry.key.name.c_str());
+
+		// The levels are kept so the references are released as usual, but there is nothing to draw.
+		PrimitiveLodChain empty = MeshLodChain(entry);
+		for(uint32_t i = 0; i < empty.lod_count; ++i)
+			entry.lod_chain.lods[i] = empty.lods[i];
+	}
+
+	delete entry.mesh_source;
+	entry.mesh_source = NULL;
+	return true;
+}
+bool PrimitiveFactory::ProcessMesh(const char* path, ProcessedMesh& processed)
+{
+	ImportedMesh mesh;
+	if(!mesh_importer::Import(path, mesh) || mesh.indices.empty())
+		return false;
+
+	// The bounding sphere is centered around the origin, like for the other primitives.
+	float radius_sq = 0.0f;
+	for(uint32_t i = 0; i < mesh.VertexCount(); ++i)
+	{
+		const float* p = &mesh.vertices[i*6];
+		radius_sq = std::max(radius_sq, p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+	}
+	float radius = sqrtf(radius_sq);
+
+	// All levels share the vertices and are stored one after the other in the same index buffer.
+	const uint32_t vertex_size = vertex_format::VertexSize(vertex_format::VF_POSITION3F_NORMAL3F);
+	std::vector<uint32_t> lod_indices;
+	mesh_simplifier::Lod lods[PrimitiveLodChain::MAX_LOD_COUNT];
+	uint32_t lod_count = mesh_simplifier::GenerateLods(&mesh.indices[0], (uint32_t)mesh.indices.size(), &mesh.vertices[0], mesh.VertexCount(), 
+		vertex_size, mesh_lod_ratios, PrimitiveLodChain::MAX_LOD_COUNT, mesh_lod_max_error * radius, lod_indices, lods);
+
+	for(uint32_t i = 1; i < lod_count; ++i)
+	{
+		debug::Printf("PrimitiveFactory: Simplified %s level %u: %u -> %u triangles, error %g\n", 
+			path, i, lods[0].index_count / 3, lods[i].index_count / 3, lods[i].error);
+	}
+
+	mesh_file::MeshData& data = processed.data;
+	int vertex_count = (int)mesh.VertexCount();
+
+	// Levels large enough are split into meshlets, letting the hidden parts be culled on the CPU.
+	if(mesh.VertexCount() <= 0x10000)
+	{
+		processed.indices16.assign(lod_indices.begin(), lod_indices.end());
+		OptimizeMeshLods(&mesh.vertices[0], vertex_count, &processed.indices16[0], lods, lod_count, path);
+
+		for(uint32_t i = 0; i < lod_count; ++i)
+		{
+			data.lods[i].first_meshlet = (uint32_t)processed.meshlets.size();
+			if(lods[i].index_count >= mesh_meshlet_min_index_count)
+			{
+				meshlet::BuildMeshlets(&processed.indices16[lods[i].first_index], lods[i].index_count, &mesh.vertices[0], 
+					vertex_count, vertex_size, processed.meshlets);
+			}
+			data.lods[i].meshlet_count = (uint32_t)processed.meshlets.size() - data.lods[i].first_meshlet;
+		}
+		data.index_type = mesh_file::IT_UINT16;
+		data.indices = &processed.indices16[0];
+	}
+	else
+	{
+		// Too many vertices for 16-bit indices
+		processed.indices32.swap(lod_indices);
+		OptimizeMeshLods(&mesh.vertices[0], vertex_count, &processed.indices32[0], lods, lod_count, path);
+
+		for(uint32_t i = 0; i < lod_count; ++i)
+		{
+			data.lods[i].first_meshlet = (uint32_t)processed.meshlets.size();
+			if(lods[i].index_count >= mesh_meshlet_min_index_count)
+			{
+				meshlet::BuildMeshlets(&processed.indices32[lods[i].first_index], lods[i].index_count, &mesh.vertices[0], 
+					vertex_count, vertex_size, processed.meshlets);
+			}
+			data.lods[i].meshlet_count = (uint32_t)processed.meshlets.size() - data.lods[i].first_meshlet;
+		}
+		data.index_type = mesh_file::IT_UINT32;
+		data.indices = &processed.indices32[0];
+	}
+
+	// A level is good enough once its error projects to less than mesh_lod_screen_error, the more detailed
+	//	level is used for anything larger.
+	for(uint32_t i = 0; i < lod_count; ++i)
+	{
+		mesh_file::Lod& lod = data.lods[i];
+		lod.first_index = lods[i].first_index;
+		lod.index_count = lods[i].index_count;
+		lod.error = lods[i].error;
+		if(lod.meshlet_count)
+			debug::Printf("PrimitiveFactory: Split %s level %u into %u meshlets\n", path, i, lod.meshlet_count);
+
+		lod.min_screen_size = 0.0f;
+		if(i + 1 < lod_count)
+		{
+			float error = std::max(lods[i + 1].error / std::max(radius, FLT_MIN), FLT_MIN);
+			lod.min_screen_size = std::min(mesh_lod_screen_error / error, (i > 0) ? data.lods[i - 1].min_screen_size : FLT_MAX);
+		}
+	}
+	data.lod_count = lod_count;
+
+	uint32_t quantized_size = vertex_format::VertexSize(vertex_quantizer::QuantizedFormat(normal_encoding));
+	processed.vertices.resize(vertex_count * quantized_size);
+	vertex_quantizer::QuantizationStats stats;
+	data.dequantization = vertex_quantizer::Quantize(&mesh.vertices[0], vertex_count, normal_encoding, &processed.vertices[0], &stats);
+	debug::Printf("PrimitiveFactory: Quantized %s: %u -> %u bytes (%u saved), max position error %g, max normal error %.3f degrees\n",
+		path, stats.source_size, stats.quantized_size, stats.source_size - stats.quantized_size, stats.max_position_error, stats.max_normal_error);
+
+	data.format = vertex_quantizer::QuantizedFormat(normal_encoding);
+	data.vertices = &processed.vertices[0];
+	data.vertex_count = vertex_count;
+	data.index_count = (uint32_t)(processed.indices16.size() + processed.indices32.size());
+	data.meshlets = processed.meshlets.empty() ? NULL : &processed.meshlets[0];
+	data.meshlet_count = (uint32_t)processed.meshlets.size();
+	data.source_hash = mesh.source_hash;
+
+	processed.bounding_radius = radius;
+	return true;
+}
+bool PrimitiveFactory::AcquireCached(const CacheKey& key, Primitive& primitive)
+{
+	std::map<CacheKey, int>::iterator it = _cache_lookup.find(key);
+	if(it == _cache_lookup.end())
+		return false;
+
+	CacheEntry& entry = _cache_entries[it->second];
+	entry.ref_count++;
+	primitive = entry.primitive;
+	return true;
+}
+void PrimitiveFactory::AddToCache(const CacheKey& key, Primitive& primitive)
+{
+	int id;
+	if(!_free_cache_ids.empty())
+	{
+		id = _free_cache_ids.back();
+		_free_cache_ids.pop_back();
+		_cache_entries[id] = CacheEntry(primitive, key);
+	}
+	else
+	{
+		_cache_entries.push_back(CacheEntry(primitive, key));
+		id = (int)_cache_entries.size() - 1;
+	}
+
+	primitive.cache_id = id;
+	_cache_entries[id].primitive.cache_id = id;
+	_cache_lookup[key] = id;
+}
+void PrimitiveFactory::OptimizeMesh(float* vertex_data, int& vertex_count, uint16_t* index_data, int index_count, const char* name)
+{
+	const uint32_t vertex_size = vertex_format::VertexSize(vertex_format::VF_POSITION3F_NORMAL3F);
+	mesh_optimizer::VertexCacheStats before = mesh_optimizer::AnalyzeVertexCache(index_data, index_count, vertex_count);
+
+	mesh_optimizer::OptimizeVertexCache(index_data, index_count, vertex_count);
+	mesh_optimizer::OptimizeOverdraw(index_data, index_count, vertex_data, vertex_count, vertex_size);
+	vertex_count = mesh_optimizer::OptimizeVertexFetch(vertex_data, vertex_count, vertex_size, index_data, index_count);
+
+	mesh_optimizer::VertexCacheStats after = mesh_optimizer::AnalyzeVertexCache(index_data, index_count, vertex_count);
+	debug::Printf("PrimitiveFactory: Optimized %s (%d vertices, %d triangles): ACMR %.3f -> %.3f, ATVR %.3f -> %.3f\n", 
+		name, vertex_count, index_count / 3, before.acmr, after.acmr, before.atvr, after.atvr);
+}
+void PrimitiveFactory::AllocateBuffers(Primitive& primitive, const float* vertex_data, const uint32_t* index_data, MeshBuffers& buffers, 
+									   const char* name)
+{
+	uint32_t vertex_count = primitive.draw_call.vertex_count;
+	uint32_t quantized_size = vertex_format::VertexSize(vertex_quantizer::QuantizedFormat(normal_encoding));
+	std::vector<uint8_t> quantized(vertex_count * quantized_size);
+	primitive.dequantization = QuantizeMesh(vertex_data, vertex_count, &quantized[0]);
+
+	buffers.vertex_array_object = _render_device->CreateVertexArrayObject();
+	buffers.vertex_buffer = _render_device->CreateVertexBuffer(buffers.vertex_array_object, vertex_quantizer::QuantizedFormat(normal_encoding),
+		(uint32_t)quantized.size(), &quantized[0], name);
+	buffers.index_buffer = _render_device->CreateIndexBuffer32(buffers.vertex_array_object, primitive.draw_call.index_count, index_data, name);
+
+	primitive.draw_call.index_offset = 0;
+	primitive.draw_call.index_type = GL_UNSIGNED_INT;
+	primitive.draw_call.base_vertex = 0;
+	primitive.draw_call.vertex_array_object = buffers.vertex_array_object;
+}
+void PrimitiveFactory::AllocateGeometry(Primitive& primitive, const float* vertex_data, const uint16_t* index_data)
+{
+	FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+	FrameAllocatorScope allocator_scope(allocator);
+
+	uint32_t vertex_size = vertex_format::VertexSize(vertex_quantizer::QuantizedFormat(normal_encoding));
+	uint8_t* quantized = allocator.AllocateArray<uint8_t>(primitive.draw_call.vertex_count * vertex_size);
+	primitive.dequantization = QuantizeMesh(vertex_data, primitive.draw_call.vertex_count, quantized);
+
+	primitive.geometry = _geometry_arena->Allocate(primitive.draw_call.vertex_count, quantized, primitive.draw_call.index_count, index_data);
+	_geometry_arena->SetupDrawCall(primitive.geometry, primitive.draw_call);
+}
+vertex_quantizer::Dequantization PrimitiveFactory::QuantizeMesh(const float* vertex_data, uint32_t vertex_count, void* output)
+{
+	return vertex_quantizer::Quantize(vertex_data, vertex_count, normal_encoding, output);
+}
+PrimitiveLodChain PrimitiveFactory::CreateSphereLodChain(float radius)
+{
+	PrimitiveLodChain chain;
+	for(int i = 0; i < PrimitiveLodChain::MAX_LOD_COUNT; ++i)
+	{
+		chain.lods[i] = CreateSphere(radius, sphere_lod_ring_counts[i], sphere_lod_ring_counts[i]);
+		chain.min_screen_size[i] = sphere_lod_min_screen_sizes[i];
+	}
+	chain.lod_count = PrimitiveLodChain::MAX_LOD_COUNT;
+	return chain;
+}
+PrimitiveLodChain PrimitiveFactory::CreateIcosphereLodChain(float radius)
+{
+	PrimitiveLodChain chain;
+	for(int i = 0; i < PrimitiveLodChain::MAX_LOD_COUNT; ++i)
+	{
+		chain.lods[i] = CreateIcosphere(radius, icosphere_lod_subdivisions[i]);
+		chain.min_screen_size[i] = sphere_lod_min_screen_sizes[i];
+	}
+	chain.lod_count = PrimitiveLodChain::MAX_LOD_COUNT;
+	return chain;
+}
+Primitive PrimitiveFactory::CreateFromGeometry(const float* vertex_data, uint32_t vertex_count, const uint32_t* index_data, uint32_t index_count, 
+											  const char* name)
+{
+	assert(vertex_count > 0 && index_count > 0);
+
+	// The geometry is never shared, the key only needs to be unique.
+	char key_name[256];
+	sprintf(key_name, "%.200s#%u", name, _geometry_counter++);
+	CacheKey key(PT_GEOMETRY, key_name);
+
+	Primitive primitive;
+	primitive.draw_call.draw_mode = GL_TRIANGLES;
 	primitive.draw_call.vertex_offset = 0;
-	primitive.index_buffer = -1; // Specify that we don't want to use an index buffer
+	primitive.draw_call.vertex_count = vertex_count;
+	primitive.draw_call.index_count = index_count;
+
+	float radius_sq = 0.0f;
+	for(uint32_t i = 0; i < vertex_count; ++i)
+	{
+		const float* p = vertex_data + i*6;
+		radius_sq = std::max(radius_sq, p[0]*p[0] + p[1]*p[1] + p[2]*p[2]);
+	}
+	primitive.bounding_radius = sqrtf(radius_sq);
 
-	primitive.bounding_radius = sqrtf(half_size.x * half_size.x + half_size.y * half_size.y);
+	MeshBuffers buffers;
+	if(vertex_count <= 0x10000)
+	{
+		std::vector<uint16_t> indices(index_data, index_data + index_count);
+		AllocateGeometry(primitive, vertex_data, &indices[0]);
+	}
+	else
+	{
+		AllocateBuffers(primitive, vertex_data, index_data, buffers, name);
+	}
 
+	AddToCache(key, primitive);
+	_cache_entries[primitive.cache_id].buffers = buffers;
 	return primitive;
 }
+bool PrimitiveFactory::GetGeometry(const Primitive& primitive, std::vector<float>& vertices, std::vector<uint32_t>& indices)
+{
+	const DrawCall& draw_call = primitive.draw_call;
+	if(primitive.cache_id == -1 || draw_call.draw_mode != GL_TRIANGLES || draw_call.vertex_count == 0)
+		return false;
+
+	// Nothing is kept on the CPU once the geometry is uploaded. Generated primitives are generated again and
+	//	imported meshes are read back from the mesh cache, only costing anything for geometry being merged.
+	const CacheEntry& entry = _cache_entries[primitive.cache_id];
+	if(entry.key.type == PT_MESH_LOD_CHAIN)
+		return ReadMeshGeometry(entry.key.name.c_str(), draw_call, vertices, indices);
+	if(entry.key.type == PT_GEOMETRY)
+		return false;
+
+	std::vector<uint16_t> generated_indices;
+	GenerateGeometry(entry.key, vertices, generated_indices);
+	if(generated_indices.empty())
+	{
+		uint32_t vertex_count = (uint32_t)vertices.size() / 6;
+		indices.resize(vertex_count);
+		for(uint32_t i = 0; i < vertex_count; ++i)
+			indices[i] = i;
+	}
+	else
+	{
+		indices.assign(generated_indices.begin(), generated_indices.end());
+	}
+	return true;
+}
+bool PrimitiveFactory::ReadMeshGeometry(const char* path, const DrawCall& draw_call, std::vector<float>& vertices, std::vector<uint32_t>& indices)
+{
+	MeshFile file;
+	ProcessedMesh processed;
+	mesh_file::MeshData mesh;
+	if(mesh_importer::OpenCache(path, file) && 
+		file.GetHeader().vertex_format == (uint32_t)vertex_quantizer::QuantizedFormat(normal_encoding))
+	{
+		file.GetMeshData(mesh);
+	}
+	else
+	{
+		// The cache couldn't be written when the mesh was loaded, the mesh is processed all over again.
+		file.Close();
+		if(!ProcessMesh(path, processed))
+			return false;
+		mesh = processed.data;
+	}
+
+	// The file may have changed since the mesh was uploaded, only geometry matching the level is merged.
+	if(mesh.vertex_count != (uint32_t)draw_call.vertex_count || 
+		(uint64_t)draw_call.index_offset + draw_call.index_count > mesh.index_count)
+	{
+		debug::Printf("PrimitiveFactory: %s changed since it was loaded and can't be merged.\n", path);
+		return false;
+	}
+
+	indices.resize(draw_call.index_count);
+	for(uint32_t i = 0; i < (uint32_t)draw_call.index_count; ++i)
+	{
+		uint32_t index = draw_call.index_offset + i;
+		indices[i] = (mesh.index_type == mesh_file::IT_UINT32) ? ((const uint32_t*)mesh.indices)[index] : ((const uint16_t*)mesh.indices)[index];
+	}
+
+	vertices.resize(mesh.vertex_count * 6);
+	vertex_quantizer::Dequantize(mesh.vertices, mesh.vertex_count, normal_encoding, mesh.dequantization, &vertices[0]);
+	return true;
+}
 void PrimitiveFactory::DestroyPrimitive(Primitive& primitive)
 {
-	// Delete the buffers that the primitive holds
-	
-	if(primitive.vertex_buffer != -1)
-		_render_device->ReleaseHardwareBuffer(primitive.vertex_buffer);
-	if(primitive.index_buffer != -1)
-		_render_device->ReleaseHardwareBuffer(primitive.index_buffer);
+	if(primitive.cache_id == -1)
+		return;
+
+	assert(	(uint32_t)primitive.cache_id < _cache_entries.size() &&
+			_cache_entries[primitive.cache_id].ref_count > 0);
+
+	CacheEntry& entry = _cache_entries[primitive.cache_id];
+	if(--entry.ref_count == 0)
+	{
+		// Last reference, return the geometry of the primitive to the arena. A mesh still loading is dropped
+		//	once the loader thread is done with it. The source data and the vertex array object of a mesh
+		//	still being uploaded are kept until the upload is done.
+		if(entry.mesh_load)
+		{
+			entry.mesh_load->cache_id = -1;
+			entry.mesh_load = NULL;
+		}
+		else if(entry.mesh_source)
+		{
+			AbandonedUpload upload;
+			upload.buffers = entry.buffers;
+			upload.source = entry.mesh_source;
+			_abandoned_uploads.push_back(upload);
 
-	_render_device->ReleaseVertexArrayObject(primitive.draw_call.vertex_array_object);
+			_uploading_entries.erase(std::find(_uploading_entries.begin(), _uploading_entries.end(), primitive.cache_id));
+			entry.mesh_source = NULL;
+			entry.buffers = MeshBuffers();
+		}
+		else if(entry.buffers.vertex_array_object != -1)
+		{
+			MeshFile::Release(*_render_device, entry.buffers);
+		}
+		else if(entry.key.type != PT_MESH_LOD_CHAIN)
+		{
+			_geometry_arena->Release(entry.primitive.geometry);
+		}
+
+		for(std::vector<const MeshletCuller*>::iterator it = entry.meshlet_cullers.begin(); 
+			it != entry.meshlet_cullers.end(); ++it)
+		{
+			delete (*it);
+		}
+		entry.meshlet_cullers.clear();
+
+		// Meshes that failed to load are already gone from the lookup, and may have been loaded again since.
+		std::map<CacheKey, int>::iterator it = _cache_lookup.find(entry.key);
+		if(it != _cache_lookup.end() && it->second == primitive.cache_id)
+			_cache_lookup.erase(it);
+		_free_cache_ids.push_back(primitive.cache_id);
+	}
+	primitive = Primitive();
+}
+void PrimitiveFactory::DestroyLodChain(PrimitiveLodChain& chain)
+{
+	for(uint32_t i = 0; i < chain.lod_count; ++i)
+		DestroyPrimitive(chain.lods[i]);
+	chain.lod_count = 0;
 }
@@ -4,41 +4,304 @@
 #include "Material.h"
 
 #include <framework/RenderDevice.h>
+#include <framework/GeometryArena.h>
+#include <framework/MeshFile.h>
+#include <framework/VertexQuantizer.h>
+#include <framework/MeshSimplifier.h>
+#include <framework/Meshlet.h>
+
+#include <SDL.h>
 
 /// @brief Struct representing a primitive that can be rendered.
 struct Primitive
 {
 	DrawCall draw_call;
-	int vertex_buffer;
-	int index_buffer;
+	GeometryAllocation geometry; // The geometry of the primitive, allocated from the factory's geometry arena.
 
 	float bounding_radius; // Bounding sphere used for intersection testing.
+
+	/// The vertices are quantized, this transform needs to be applied to the model matrix before rendering.
+	vertex_quantizer::Dequantization dequantization;
+
+	/// Clusters of the primitive for culling on the CPU, NULL if the primitive haven't been split into meshlets.
+	///	The index ranges are relative to the first index of the draw call. Owned by the factory.
+	const MeshletCuller* meshlets;
+
+	int cache_id; // Entry in the factory's primitive cache, -1 if the primitive haven't been created by the factory.
+
+	Primitive() : bounding_radius(0.0f), meshlets(NULL), cache_id(-1) {}
+};
+
+/// @brief Versions of a primitive at decreasing level of detail, all sharing the factory's geometry arena.
+struct PrimitiveLodChain
+{
+	enum { MAX_LOD_COUNT = 4 };
+
+	Primitive lods[MAX_LOD_COUNT]; // The most detailed level first.
+
+	/// Smallest projected size each level is used for, as the ratio between the projected radius of the 
+	///	bounding sphere and half the screen height. The size for the last level is always 0.
+	float min_screen_size[MAX_LOD_COUNT];
+
+	uint32_t lod_count;
+
+	PrimitiveLodChain() : lod_count(0) {}
 };
 
 
 class RenderDevice;
 
 /// @brief Factory used for creating primitives that can be rendered onto the scene.
+///	Primitives are cached by their type and parameters, creating a primitive identical to an existing one 
+///	returns the existing geometry with an additional reference. Every created primitive needs to be 
+///	destroyed through DestroyPrimitive, the geometry is released when the last reference is destroyed.
 class PrimitiveFactory
 {
 public:
-	PrimitiveFactory(RenderDevice* _render_device);
+	/// @param resource_uploader Uploads the buffers of imported meshes off the main thread.
+	PrimitiveFactory(RenderDevice* render_device, ResourceUploader* resource_uploader);
 	~PrimitiveFactory();
 
 	/// @brief Creates a sphere.
 	/// @param radius The radius of the sphere.
-	Primitive CreateSphere(float radius);
+	/// @param ring_count Number of rings of vertices from pole to pole.
+	/// @param sector_count Number of vertices around each ring.
+	Primitive CreateSphere(float radius, int ring_count = 32, int sector_count = 32);
+
+	/// @brief Creates a chain of spheres with decreasing tessellation.
+	/// @param radius The radius of the sphere.
+	PrimitiveLodChain CreateSphereLodChain(float radius);
+
+	/// @brief Creates a sphere by subdividing an icosahedron, giving a uniform triangle density without 
+	///		the degenerate triangles at the poles of a UV sphere.
+	/// @param radius The radius of the sphere.
+	/// @param subdivisions Number of times each triangle is split into four, at most 5. Level n have 20*4^n triangles.
+	Primitive CreateIcosphere(float radius, int subdivisions = 3);
+
+	/// @brief Creates a chain of icospheres with decreasing subdivision.
+	/// @param radius The radius of the sphere.
+	PrimitiveLodChain CreateIcosphereLodChain(float radius);
 	
 	/// @brief Creates a plane.
 	/// @param size Size of the plane.
 	Primitive CreatePlane(const Vec2& size);
 
-	/// @brief Destroys the specified primitive, releasing any resources it haves.
+	/// @brief Creates an axis-aligned box centered around origo.
+	/// @param half_size Half the size of the box along each axis.
+	Primitive CreateBox(const Vec3& half_size);
+
+	/// @brief Creates levels of detail for a mesh imported from a Wavefront OBJ or PLY file, see mesh_importer
+	///		and mesh_simplifier. The levels share vertices and index buffer, each level is a range of indices. 
+	///		The screen sizes are chosen from the simplification error of each level, and large levels are split
+	///		into meshlets, see Primitive::meshlets.
+	///
+	///		The first load optimizes, simplifies and quantizes the mesh and writes the result to the mesh cache
+	///		next to the file. Later loads upload the cached mesh straight from a mapping of the cache, as long
+	///		as the file haven't changed. Imported meshes get buffers of their own rather than sharing the arena.
+	///
+	///		The mesh is loaded and processed on the loader thread of the factory, and the buffers are uploaded
+	///		through the resource uploader. Until both are done the chain holds a reference for every possible
+	///		level, none of which have anything to draw, see UpdateLodChain.
+	/// @param path Path to the file, which is also the key the chain is cached by.
+	PrimitiveLodChain CreateMeshLodChain(const char* path);
+
+	/// @brief Completes a chain created by CreateMeshLodChain once the mesh is loaded and its buffers are uploaded,
+	///		releasing the references held for levels the mesh doesn't have.
+	/// @return False while the mesh is still loading or uploading. If the mesh couldn't be loaded the chain is left
+	///		without any levels, if the upload failed the levels are left with nothing to draw.
+	bool UpdateLodChain(PrimitiveLodChain& chain);
+
+	/// @brief Queues the upload of meshes loaded by the loader thread, publishes the meshes whose buffers have
+	///		finished uploading and reclaims released geometry, call once every frame after ResourceUploader::Update.
+	void Update();
+
+	/// @brief Creates a primitive from geometry built elsewhere, e.g. merged from other primitives. The primitive
+	///		is never shared, every call creates new geometry.
+	/// @param vertex_data Vertices in the VF_POSITION3F_NORMAL3F format.
+	/// @param index_data Triangle list.
+	/// @param name Name used for the buffers.
+	Primitive CreateFromGeometry(const float* vertex_data, uint32_t vertex_count, const uint32_t* index_data, uint32_t index_count, 
+		const char* name);
+
+	/// @brief Returns the geometry of a primitive, e.g. to merge it with other geometry. No copy is kept on the CPU,
+	///		generated primitives are generated again and imported meshes are read from the mesh cache, so
+	///		this is only meant for when the geometry is actually needed.
+	/// @param vertices Receives the vertices in object space, in the VF_POSITION3F_NORMAL3F format.
+	/// @param indices Receives a triangle list indexing the vertices.
+	/// @return False if the primitive isn't a triangle list created by the factory, or have nothing to draw yet.
+	///		Primitives created by CreateFromGeometry are never merged again and return false as well.
+	bool GetGeometry(const Primitive& primitive, std::vector<float>& vertices, std::vector<uint32_t>& indices);
+
+	/// @brief Releases a reference to the specified primitive, the resources are released with the last reference.
 	void DestroyPrimitive(Primitive& primitive);
 
+	/// @brief Destroys all primitives in the specified chain.
+	void DestroyLodChain(PrimitiveLodChain& chain);
+
 
 private:
+	enum PrimitiveType
+	{
+		PT_SPHERE,
+		PT_ICOSPHERE,
+		PT_PLANE,
+		PT_BOX,
+		PT_MESH_LOD_CHAIN,
+		PT_GEOMETRY
+	};
+
+	/// Identifies a primitive in the cache by its type and the parameters it was created with.
+	struct CacheKey
+	{
+		PrimitiveType type;
+		float params[3];
+		std::string name; // Source file for imported meshes.
+
+		CacheKey(PrimitiveType t, float p0, float p1, float p2);
+		CacheKey(PrimitiveType t, const std::string& n);
+		bool operator<(const CacheKey& other) const;
+	};
+
+	/// Imported mesh prepared for rendering, as written to the mesh cache.
+	struct ProcessedMesh
+	{
+		std::vector<uint8_t> vertices; // Quantized vertices
+		std::vector<uint16_t> indices16; // Indices for meshes with at most 65536 vertices.
+		std::vector<uint32_t> indices32; // Indices for larger meshes.
+		std::vector<meshlet::Meshlet> meshlets;
+		float bounding_radius;
+
+		mesh_file::MeshData data; // Describes the mesh, pointing into the arrays above.
+
+		ProcessedMesh() : bounding_radius(0.0f) {}
+	};
+
+	/// Data the buffers of an imported mesh are uploaded from, kept until the upload is done.
+	struct MeshSource
+	{
+		MeshFile file; // Mapping of the mesh cache, if the mesh was loaded from the cache.
+		ProcessedMesh processed; // The imported mesh otherwise.
+	};
+
+	/// Mesh loaded on the loader thread, see LoadMesh.
+	struct MeshLoad
+	{
+		std::string path;
+		MeshSource* source; // Receives the loaded mesh.
+		mesh_file::MeshData mesh; // Describes the loaded mesh, pointing into the source.
+		float bounding_radius;
+		bool loaded; // False if the mesh couldn't be loaded.
+
+		/// Entry waiting for the mesh, -1 if every reference was destroyed while loading. Only touched by the main thread.
+		int cache_id;
+	};
+
+	/// Upload of a mesh whose last reference was destroyed before the upload was done.
+	struct AbandonedUpload
+	{
+		MeshBuffers buffers;
+		MeshSource* source;
+	};
+
+	struct CacheEntry
+	{
+		Primitive primitive;
+		CacheKey key;
+		uint32_t ref_count;
+		MeshBuffers buffers; // Buffers of imported meshes that didn't fit in the geometry arena.
+		PrimitiveLodChain lod_chain; // Levels of detail sharing the entry, created by CreateMeshLodChain.
+		std::vector<const MeshletCuller*> meshlet_cullers; // Meshlets of the primitive or its levels, deleted with the geometry.
+		MeshLoad* mesh_load; // Load in progress on the loader thread, NULL once the mesh is loaded.
+		MeshSource* mesh_source; // Data the buffers are uploaded from, NULL once the upload is done.
+
+		CacheEntry(const Primitive& p, const CacheKey& k) : primitive(p), key(k), ref_count(1), mesh_load(NULL), mesh_source(NULL) {}
+	};
+
+	/// @brief Looks up a primitive in the cache, adding a reference if it's found.
+	/// @return True if the primitive was found.
+	bool AcquireCached(const CacheKey& key, Primitive& primitive);
+
+	/// @brief Adds a newly created primitive to the cache, holding one reference.
+	void AddToCache(const CacheKey& key, Primitive& primitive);
+
+	/// @brief Generates a sphere, icosphere, plane or box from the parameters of its key, then optimizes it 
+	///		and allocates it from the arena.
+	/// @param name Name of the primitive, used when reporting the optimization.
+	Primitive BuildPrimitive(const CacheKey& key, const char* name);
+
+	/// @brief Generates the geometry of a sphere, icosphere, plane or box from the parameters of its key, in 
+	///		the VF_POSITION3F_NORMAL3F format. GetGeometry uses this to get the geometry back without keeping a copy.
+	/// @param indices Receives the triangle list, left empty if the primitive isn't indexed.
+	/// @return The bounding radius.
+	static float GenerateGeometry(const CacheKey& key, std::vector<float>& vertices, std::vector<uint16_t>& indices);
+
+	/// @brief Loads a mesh with all its levels of detail from the mesh cache, or imports and caches it if the
+	///		cache is missing or outdated. Runs on the loader thread, so it doesn't touch the factory.
+	static void LoadMesh(MeshLoad& load);
+
+	/// @brief Sets up the levels of a loaded mesh and queues the upload of its buffers, on the main thread.
+	void FinishMeshLoad(int cache_id, MeshLoad& load);
+
+	/// @brief Hands a mesh over to the loader thread, or loads it directly if there is no loader thread.
+	///		Either way the result is picked up by Update.
+	void QueueMeshLoad(MeshLoad* load);
+
+	/// @brief Entry point for the loader thread.
+	static int SDLCALL LoaderMain(void* data);
+
+	/// @brief Loads meshes until the factory is destroyed, runs on the loader thread.
+	void RunLoader();
+
+	/// @brief Returns the levels of an imported mesh, without anything to draw while the upload is in progress.
+	PrimitiveLodChain MeshLodChain(const CacheEntry& entry) const;
+
+	/// @brief Polls the upload of an imported mesh, releasing the source data once the upload is done.
+	/// @return True if the upload is done.
+	bool PollMeshUpload(CacheEntry& entry);
+
+	/// @brief Imports a mesh, generates the levels of detail, optimizes, quantizes and splits the levels into meshlets.
+	/// @return False if the mesh couldn't be imported.
+	static bool ProcessMesh(const char* path, ProcessedMesh& mesh);
+
+	/// @brief Reads the geometry of a level of an imported mesh back from the mesh cache, for GetGeometry.
+	/// @return False if the mesh couldn't be read or no longer matches the level.
+	bool ReadMeshGeometry(const char* path, const DrawCall& draw_call, std::vector<float>& vertices, std::vector<uint32_t>& indices);
+
+	/// @brief Quantizes the vertices and allocates the geometry of the primitive from the arena, setting up 
+	///		the draw call and the dequantization. The vertex and index counts are taken from the draw call.
+	/// @param index_data Indices, or NULL if the primitive isn't indexed.
+	void AllocateGeometry(Primitive& primitive, const float* vertex_data, const uint16_t* index_data);
+
+	/// @brief Quantizes the vertices into buffers of their own with 32-bit indices, for geometry too large for the arena.
+	///		The vertex and index counts are taken from the draw call.
+	/// @param buffers Receives the buffers, released together with the primitive.
+	void AllocateBuffers(Primitive& primitive, const float* vertex_data, const uint32_t* index_data, MeshBuffers& buffers, const char* name);
+
+	/// @brief Quantizes VF_POSITION3F_NORMAL3F vertices with the normal encoding used by all primitives.
+	vertex_quantizer::Dequantization QuantizeMesh(const float* vertex_data, uint32_t vertex_count, void* output);
+
+	/// @brief Reorders an indexed mesh for vertex cache, overdraw and vertex fetch efficiency before it's uploaded.
+	/// @param vertex_count Number of vertices, receives the new number of vertices.
+	void OptimizeMesh(float* vertex_data, int& vertex_count, uint16_t* index_data, int index_count, const char* name);
+
 	RenderDevice* _render_device;
+	ResourceUploader* _resource_uploader;
+	GeometryArena* _geometry_arena; // Arena holding the geometry for all primitives.
+
+	std::vector<CacheEntry> _cache_entries;
+	std::vector<int> _free_cache_ids;
+	std::map<CacheKey, int> _cache_lookup; // Maps the key of a primitive to its entry.
+	uint32_t _geometry_counter; // Used to give every primitive created by CreateFromGeometry a unique key.
+
+	SDL_Thread* _loader_thread; // Loads imported meshes, NULL if they're loaded on the main thread.
+	SDL_mutex* _loader_mutex; // Guards _load_jobs, _load_results and _loader_quit.
+	SDL_cond* _load_signal; // Signaled when a mesh is queued or the loader thread should quit.
+	std::vector<MeshLoad*> _load_jobs;
+	std::vector<MeshLoad*> _load_results;
+	bool _loader_quit;
+
+	std::vector<int> _uploading_entries; // Entries of imported meshes whose buffers are being uploaded.
+	std::vector<AbandonedUpload> _abandoned_uploads; // Released once the upload is done.
 
 };
 
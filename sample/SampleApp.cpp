@@ -11,26 +11,36 @@ static const char* vertex_shader_src = " \
 	#version 150 \n\
 	uniform mat4 model_view_projection_matrix; \
 	uniform mat4 model_view_matrix; \
+	uniform mat3 normal_matrix; /* Inverse transpose of the model view matrix */ \
 	\
-	in vec3 vertex_position; \
-	in vec3 vertex_normal; \
+	in vec3 vertex_position; /* Quantized, the dequantization is part of the model matrix */ \
+	in vec2 vertex_normal; /* Octahedral encoding */ \
 	\
 	out vec3 normal_view; /* Normal in view-space */ \
 	out vec3 position_view; /* Vertex position in view-space */ \
 	\
+	vec3 DecodeNormal(vec2 e) \
+	{ \
+		vec3 n = vec3(e.xy, 1.0 - abs(e.x) - abs(e.y)); \
+		if(n.z < 0.0) \
+			n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0); \
+		return n; \
+	} \
+	\
 	void main() \
 	{ \
 		gl_Position = model_view_projection_matrix * vec4(vertex_position, 1.0); \
 		\
 		/* Transform normals into view-space */ \
-		normal_view = (transpose(inverse(model_view_matrix)) * vec4(normalize(vertex_normal), 0.0)).xyz; \
-		normal_view = normalize(normal_view); \
+		normal_view = normalize(normal_matrix * DecodeNormal(vertex_normal)); \
 		position_view = (model_view_matrix * vec4(vertex_position, 1.0)).xyz; \
 	}";
 
 static const char* fragment_shader_src = " \
 	#version 150 \n\
-	#define MAX_LIGHT_COUNT 16 \n\
+	#ifndef LIGHT_COUNT \n\
+	#define LIGHT_COUNT 16 \n\
+	#endif \n\
 	in vec3 normal_view; /* Normal in view-space */ \
 	in vec3 position_view; /* Vertex position in view space */ \
 	uniform mat4 model_view_matrix; \
@@ -46,7 +56,7 @@ static const char* fragment_shader_src = " \
 		float radius; \
 	}; \
 	\
-	uniform Light lights[MAX_LIGHT_COUNT]; \
+	uniform Light lights[LIGHT_COUNT]; \
 	\
 	/* Material uniforms */ \
 	uniform struct \
@@ -65,7 +75,7 @@ static const char* fragment_shader_src = " \
 		vec3 v = normalize(-position_view); /* Direction to the camera (The camera is at (0,0,0) as we calculate in view-space) */ \
 		\
 		vec4 light_accumulation = material.ambient; \
-		for(int i = 0; i < MAX_LIGHT_COUNT; ++i) \
+		for(int i = 0; i < LIGHT_COUNT; ++i) \
 		{ \
 			vec4 ambient_term = lights[i].ambient; \
 			vec4 diffuse_term = material.diffuse * lights[i].diffuse; \
@@ -99,6 +109,10 @@ SampleApp::SampleApp() : _camera_angle(0.0f), _primitive_factory(NULL)
 SampleApp::~SampleApp()
 {
 }
+void SampleApp::SetMeshPath(const char* path)
+{
+	_mesh_path = path;
+}
 
 bool SampleApp::Initialize()
 {
@@ -126,38 +140,45 @@ bool SampleApp::Initialize()
 	_camera.direction = Vec3(0.0f, 0.0f, -1.0f);
 	_matrix_stack.SetProjectionMatrix(_camera.projection);
 
-	_primitive_factory = new PrimitiveFactory(_render_device);
+	_primitive_factory = new PrimitiveFactory(_render_device, _resource_uploader);
 	
-	_default_shader = _render_device->CreateShader(vertex_shader_src, fragment_shader_src);
+	// The default shader is compiled in several variants, one for each number of lights the scene selects between.
+	_default_shader = _render_device->CreateShaderTemplate(vertex_shader_src, fragment_shader_src, "Default shader");
 
 	Material default_material;
-	default_material.shader = _default_shader;
+	default_material.shader_template = _default_shader;
 	default_material.diffuse = Color(0.0f, 0.0f, 1.0f, 1.0f);
 	default_material.specular = Color(0.5f, 0.5f, 0.5f, 1.0f);
 	default_material.ambient = Color(0.0f, 0.0f, 0.0f, 1.0f);
-	_scene = new Scene(default_material, _primitive_factory);
+	_scene = new Scene(default_material, _primitive_factory, _render_device);
+	_scene->PrecompileShaderVariants(*_render_device);
 
 
 	{
-		_scene->CreateEntity(Entity::ET_SPHERE)->position = Vec3(2.5f, 0.0f, -2.5f);
-		_scene->CreateEntity(Entity::ET_SPHERE)->position = Vec3(-2.5f, 0.0f, -2.5f);
-		_scene->CreateEntity(Entity::ET_SPHERE)->position = Vec3(0.0f, 0.0f, -3.0f);
+		_scene->SetEntityPosition(_scene->CreateEntity(Entity::ET_SPHERE), Vec3(2.5f, 0.0f, -2.5f));
+		_scene->SetEntityPosition(_scene->CreateEntity(Entity::ET_SPHERE), Vec3(-2.5f, 0.0f, -2.5f));
+		_scene->SetEntityPosition(_scene->CreateEntity(Entity::ET_SPHERE), Vec3(0.0f, 0.0f, -3.0f));
 
-		Light* light = (Light*)_scene->CreateEntity(Entity::ET_LIGHT);
+		EntityId light_entity = _scene->CreateEntity(Entity::ET_LIGHT);
+		_scene->SetEntityPosition(light_entity, Vec3(0.0f, 5.0f, 2.0f));
 
+		Light* light = _scene->EntityLight(light_entity);
 		light->ambient = Color(0.0f, 0.0f, 0.0f, 1.0f);
 		light->specular = Color(0.25f, 0.25f, 0.25f, 1.0f);
 		light->diffuse = Color(0.25f, 0.25f, 0.25f, 1.0f);
-		light->position = Vec3(0.0f, 5.0f, 2.0f);
 		light->radius = 10.0f;
 	}
 
+	// Failures are reported by the primitive factory once the mesh is loaded.
+	if(!_mesh_path.empty())
+		_scene->CreateMeshEntity(_mesh_path.c_str());
+
 
 	return true;
 }
 void SampleApp::Shutdown()
 {
-	_render_device->ReleaseShader(_default_shader);
+	_render_device->ReleaseShaderTemplate(_default_shader);
 	_default_shader = -1;
 
 	delete _scene;
@@ -169,6 +190,9 @@ void SampleApp::Shutdown()
 }
 void SampleApp::Render(float )
 {
+	// Meshes whose buffers were published by the uploader this frame are drawn from this frame on.
+	_primitive_factory->Update();
+
 	_camera.position = Vec3(35.0f*sinf(_camera_angle), 15.0f, 35.0f*cosf(_camera_angle));
 	_camera.direction = vector::Subtract(Vec3(0.0f, 0.0f, 0.0f), _camera.position);
 	vector::Normalize(_camera.direction);
@@ -178,7 +202,7 @@ void SampleApp::Render(float )
 	// Setup camera transforms
 	_matrix_stack.SetViewMatrix(matrix::LookAt(_camera.position, vector::Add(_camera.position, _camera.direction), Vec3(0.0f, 1.0f, 0.0f)));
 
-	_scene->Render(*_render_device, _matrix_stack);
+	_scene->Render(*_render_device, _matrix_stack, _camera);
 	
 	_matrix_stack.Pop();
 }
@@ -195,8 +219,8 @@ void SampleApp::OnEvent(SDL_Event* evt)
 			Vec2 mouse_position = Vec2(	2.0f * (float)evt->button.x / (float)_viewport.width - 1.0f,
 										1.0f - (2.0f * (float)evt->button.y / (float)_viewport.height)); // Flip y-axis as OpenGL has y=0 at the bottom.
 
-			Entity* entity = _scene->SelectEntity(mouse_position, _camera);
-			if(entity)
+			EntityId entity = _scene->SelectEntity(mouse_position, _camera);
+			if(entity != INVALID_ENTITY_ID)
 			{
 				SelectEntity(entity, mouse_position);
 
@@ -210,7 +234,7 @@ void SampleApp::OnEvent(SDL_Event* evt)
 				}
 
 			}
-			else if(_selection.entity) 
+			else if(_selection.entity != INVALID_ENTITY_ID) 
 			{
 				// User clicked outside any entity and we currently have one selected so we unselect it.
 				UnselectEntity();
@@ -219,9 +243,16 @@ void SampleApp::OnEvent(SDL_Event* evt)
 		break;
 	case SDL_MOUSEBUTTONUP:
 		{
-			if(_selection.entity)
+			if(_selection.entity != INVALID_ENTITY_ID)
 			{
 				_selection.mode = Selection::IDLE;
+
+				// The batch of a dragged static entity is only rebuilt once it's released.
+				if(_selection.restore_static)
+				{
+					_scene->SetEntityStatic(_selection.entity, true);
+					_selection.restore_static = false;
+				}
 			}
 		}
 		break;
@@ -231,12 +262,19 @@ void SampleApp::OnEvent(SDL_Event* evt)
 			{
 				_camera_angle += evt->motion.xrel * 0.01f;
 			}
-			else if(_selection.entity)
+			else if(_selection.entity != INVALID_ENTITY_ID)
 			{
 				// Normalize mouse position ([-1.0, 1.0])
 				Vec2 mouse_position = Vec2(	2.0f * (float)evt->motion.x / (float)_viewport.width - 1.0f,
 											1.0f - (2.0f * (float)evt->motion.y / (float)_viewport.height)); // Flip y-axis as OpenGL has y=0 at the bottom.
 
+				// Moving a static entity would rebuild its batch on every motion, so it's drawn on its own until released.
+				if(_selection.mode != Selection::IDLE && _scene->IsEntityStatic(_selection.entity))
+				{
+					_scene->SetEntityStatic(_selection.entity, false);
+					_selection.restore_static = true;
+				}
+
 				if(_selection.mode == Selection::MOVE)
 				{
 					MoveEntity(_selection.entity, mouse_position, (key_states[SDL_SCANCODE_LCTRL] != 0), _selection.offset);
@@ -267,15 +305,67 @@ void SampleApp::OnEvent(SDL_Event* evt)
 				break;
 			case SDL_SCANCODE_1:
 				{
-					Entity* entity = _scene->CreateEntity(Entity::ET_SPHERE);
-					entity->position = world_position;
+					EntityId entity = _scene->CreateEntity(Entity::ET_SPHERE);
+					_scene->SetEntityPosition(entity, world_position);
 				}
 				break;
 			case SDL_SCANCODE_2:
 				{
-					Entity* entity = _scene->CreateEntity(Entity::ET_LIGHT);
-					entity->position = world_position;
-					entity->position.y = 5.0f;
+					EntityId entity = _scene->CreateEntity(Entity::ET_LIGHT);
+					_scene->SetEntityPosition(entity, Vec3(world_position.x, 5.0f, world_position.z));
+				}
+				break;
+			case SDL_SCANCODE_M:
+				{
+					_render_device->DumpMemoryUsage();
+				}
+				break;
+			case SDL_SCANCODE_C:
+				{
+					// The capture covers the next full frame, it can be replayed with the Replay program.
+					_render_device->RequestCapture("frame.capture");
+				}
+				break;
+			case SDL_SCANCODE_O:
+				{
+					// Cycle between the culling methods
+					Scene::OcclusionCullingMode mode = (Scene::OcclusionCullingMode)((_scene->OcclusionCulling() + 1) % Scene::OCCLUSION_MODE_COUNT);
+					_scene->SetOcclusionCulling(mode);
+
+					const char* mode_names[] = { "disabled", "hardware queries", "software rasterization" };
+					debug::Printf("Occlusion culling: %s\n", mode_names[mode]);
+				}
+				break;
+			case SDL_SCANCODE_I:
+				{
+					// Toggle between UV spheres and icospheres
+					Scene::SphereMeshType type = (Scene::SphereMeshType)((_scene->SphereMesh() + 1) % Scene::SPHERE_MESH_COUNT);
+					_scene->SetSphereMesh(type);
+
+					const char* type_names[] = { "UV sphere", "icosphere" };
+					debug::Printf("Sphere mesh: %s\n", type_names[type]);
+				}
+				break;
+			case SDL_SCANCODE_K:
+				{
+					// Toggle meshlet culling, printing what was culled during the last frame
+					const MeshletCullStats& stats = _scene->MeshletStats();
+					debug::Printf("Meshlets: %u visible, %u backfacing, %u outside the frustum, %u too small\n", 
+						stats.visible, stats.backfacing, stats.outside_frustum, stats.too_small);
+
+					_scene->SetMeshletCulling(!_scene->MeshletCulling());
+					debug::Printf("Meshlet culling: %s\n", _scene->MeshletCulling() ? "enabled" : "disabled");
+				}
+				break;
+			case SDL_SCANCODE_T:
+				{
+					// Toggle whether the selected entity is static, static entities are merged into batches
+					if(_selection.entity != INVALID_ENTITY_ID && _scene->GetEntityType(_selection.entity) != Entity::ET_LIGHT)
+					{
+						_scene->SetEntityStatic(_selection.entity, !_scene->IsEntityStatic(_selection.entity));
+						_selection.restore_static = false;
+						debug::Printf("Entity is now %s\n", _scene->IsEntityStatic(_selection.entity) ? "static" : "dynamic");
+					}
 				}
 				break;
 			case SDL_SCANCODE_DELETE:
@@ -285,13 +375,13 @@ void SampleApp::OnEvent(SDL_Event* evt)
 					{
 						_scene->DestroyAllEntities();
 					}
-					if(_selection.entity)
+					else if(_selection.entity != INVALID_ENTITY_ID)
 					{
 						_scene->DestroyEntity(_selection.entity);
-
-						_selection.mode = Selection::IDLE;
-						_selection.entity = NULL;
 					}
+					_selection.mode = Selection::IDLE;
+					_selection.entity = INVALID_ENTITY_ID;
+					_selection.restore_static = false;
 				}
 				break;
 			default:
@@ -301,7 +391,7 @@ void SampleApp::OnEvent(SDL_Event* evt)
 		break;
 	};
 }
-void SampleApp::MoveEntity(Entity* entity, const Vec2& mouse_position, bool y_axis, const Vec3& offset)
+void SampleApp::MoveEntity(EntityId entity, const Vec2& mouse_position, bool y_axis, const Vec3& offset)
 {
 	if(y_axis)
 	{
@@ -325,51 +415,53 @@ void SampleApp::MoveEntity(Entity* entity, const Vec2& mouse_position, bool y_ax
 
 		Vec3 intersection;
 		// We add an offset to the plane to make sure we're actually moving the object relative to it's previous position and not relative to (0, 0, 0).
-		Plane p(plane_normal, -vector::Dot(entity->position, plane_normal));
+		Plane p(plane_normal, -vector::Dot(_scene->EntityPosition(entity), plane_normal));
 
 		RayPlaneIntersect(_camera.position, Vec3(ray_world.x, ray_world.y, ray_world.z), p, intersection);
 
 		// We add the saved offset to avoid any popping effect caused by the user not clicking in the absolute middle of the object.
-		entity->position = intersection;
+		_scene->SetEntityPosition(entity, intersection);
 	}
 	else
 	{
 		// Move the object in the x-axis and the z-axis.
 
 		// Calculate the position in world coordinates
-		Vec3 world_position = _scene->ToWorld(mouse_position, _camera, entity->position.y);
+		Vec3 world_position = _scene->ToWorld(mouse_position, _camera, _scene->EntityPosition(entity).y);
 		// We add the saved offset to avoid any popping effect caused by the user not clicking in the absolute middle of the object.
-		entity->position = vector::Add(world_position, offset);
+		_scene->SetEntityPosition(entity, vector::Add(world_position, offset));
 	}
 }
 
-void SampleApp::ScaleEntity(Entity* entity, const Vec2& mouse_position)
+void SampleApp::ScaleEntity(EntityId entity, const Vec2& mouse_position)
 {
-	if(entity->type == Entity::ET_LIGHT)
+	const Vec3& position = _scene->EntityPosition(entity);
+	Entity::EntityType type = _scene->GetEntityType(entity);
+	if(type == Entity::ET_LIGHT)
 	{	
-		Vec3 world_position = _scene->ToWorld(mouse_position, _camera, entity->position.y);
-		Vec3 d = vector::Subtract(world_position, entity->position);
+		Vec3 world_position = _scene->ToWorld(mouse_position, _camera, position.y);
+		Vec3 d = vector::Subtract(world_position, position);
 
 		// If the scaled entity is a light, scale its light radius rather than the object size
-		Light* light = (Light*)_selection.entity;
+		Light* light = _scene->EntityLight(entity);
 		light->radius = vector::Length(d);
 	}
-	else if(entity->type == Entity::ET_SPHERE)
+	else if(type == Entity::ET_SPHERE)
 	{
 		// Only allow scaling one axis of the sphere
 
-		Vec3 world_position = _scene->ToWorld(mouse_position, _camera, entity->position.y);
-		Vec3 d = vector::Subtract(world_position, entity->position);
+		Vec3 world_position = _scene->ToWorld(mouse_position, _camera, position.y);
+		Vec3 d = vector::Subtract(world_position, position);
 
 		float r = vector::Length(d);
-		entity->scale = Vec3(r, r, r);
+		_scene->SetEntityScale(entity, Vec3(r, r, r));
 	}
 }
 
-void SampleApp::SelectEntity(Entity* entity, const Vec2& mouse_position)
+void SampleApp::SelectEntity(EntityId entity, const Vec2& mouse_position)
 {
 	// Unselect any previous selection first
-	if(_selection.entity)
+	if(_selection.entity != INVALID_ENTITY_ID)
 	{
 		UnselectEntity();
 	}
@@ -379,14 +471,19 @@ void SampleApp::SelectEntity(Entity* entity, const Vec2& mouse_position)
 	
 
 	// Calculate the offset between the object origin and the mouse position, this is used later to avoid snapping.
-	Vec3 world_position = _scene->ToWorld(mouse_position, _camera, _selection.entity->position.y);
-	_selection.offset = vector::Subtract(_selection.entity->position, world_position);
+	const Vec3& position = _scene->EntityPosition(_selection.entity);
+	Vec3 world_position = _scene->ToWorld(mouse_position, _camera, position.y);
+	_selection.offset = vector::Subtract(position, world_position);
 }
 void SampleApp::UnselectEntity()
 {
-	if(!_selection.entity)
+	if(_selection.entity == INVALID_ENTITY_ID)
 		return;
 
+	if(_selection.restore_static)
+		_scene->SetEntityStatic(_selection.entity, true);
+
 	_selection.mode = Selection::IDLE;
-	_selection.entity = NULL;
+	_selection.entity = INVALID_ENTITY_ID;
+	_selection.restore_static = false;
 }
@@ -5,6 +5,7 @@
 
 #include "MatrixStack.h"
 #include "Material.h"
+#include "Scene.h"
 
 struct Viewport
 {
@@ -19,9 +20,7 @@ struct Camera
 	Vec3 direction; // Which direction the camera is looking
 };
 
-class Scene;
 class PrimitiveFactory;
-struct Entity;
 
 class SampleApp : public App
 {
@@ -29,6 +28,9 @@ public:
 	SampleApp();
 	~SampleApp();
 
+	/// @brief Specifies a mesh file to add to the scene at startup, this needs to be called before Run.
+	void SetMeshPath(const char* path);
+
 
 protected:
 	bool Initialize();
@@ -43,13 +45,13 @@ protected:
 	/// @brief Move the specified entity
 	/// @param y_axis Specifies if the object should be moved in the y-axis.
 	/// @param offset Offset from the object origin and the mouse position (In world space).
-	void MoveEntity(Entity* entity, const Vec2& mouse_position, bool y_axis, const Vec3& offset);
+	void MoveEntity(EntityId entity, const Vec2& mouse_position, bool y_axis, const Vec3& offset);
 
 	/// @brief Scales the specified entity
-	void ScaleEntity(Entity* entity, const Vec2& mouse_position);
+	void ScaleEntity(EntityId entity, const Vec2& mouse_position);
 
 	/// @brief Called when the user wants to select an entity.
-	void SelectEntity(Entity* entity, const Vec2& mouse_position);
+	void SelectEntity(EntityId entity, const Vec2& mouse_position);
 	/// @brief Called when the user wants to unselect the current entity.
 	void UnselectEntity();
 
@@ -63,13 +65,15 @@ private:
 			SCALE
 		};
 
-		Entity* entity; // Selected entity, NULL if none is selected
+		EntityId entity; // Selected entity, INVALID_ENTITY_ID if none is selected
 		Mode mode;
 
 		Vec2 position; // Mouse position when the entity was selected
 		Vec3 offset; // Offset from entity center to mouse position
 
-		Selection() : entity(NULL), mode(IDLE) {}
+		bool restore_static; // The entity is static but drawn as dynamic while dragged, it's made static again when released.
+
+		Selection() : entity(INVALID_ENTITY_ID), mode(IDLE), restore_static(false) {}
 	};
 
 	MatrixStack _matrix_stack;
@@ -80,7 +84,8 @@ private:
 	PrimitiveFactory* _primitive_factory;
 	Scene* _scene;
 
-	int _default_shader;
+	int _default_shader; // Shader template for the default material
+	std::string _mesh_path; // Mesh added to the scene at startup, empty if none.
 
 	Selection _selection;
 };
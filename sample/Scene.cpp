@@ -3,92 +3,128 @@
 #include "Scene.h"
 #include "SampleApp.h"
 #include "MatrixStack.h"
+#include "StaticBatch.h"
 
 #include <framework/RenderDevice.h>
 #include <framework/Ray.h>
+#include <framework/OcclusionBuffer.h>
+#include <framework/FrameAllocator.h>
 
 #include <algorithm>
-#include <sstream>
-#include <fstream>
-
-Scene::Scene(const Material& material, PrimitiveFactory* factory) 
-	: _primitive_factory(factory), _material_template(material)
-{
-	// Create a floor
-	_floor_entity = new Entity;
-	_floor_entity->primitive = _primitive_factory->CreatePlane(Vec2(25.0f, 25.0f));
-	_floor_entity->scale = Vec3(1.0f, 1.0f, 1.0f);
-	_floor_entity->position = Vec3(0.0f, -0.5f, 0.0f);
-	_floor_entity->material = material;
-	_floor_entity->material.diffuse = Color(0.40f, 0.40f, 0.40f);
-	_floor_entity->material.specular = Color(0.40f, 0.40f, 0.40f);
-
-	// Create sphere template that will be copied for every new sphere.
-	//	This allows us to easily re-use our sphere primitive rather than creating a new one for each entity,
+#include <stdio.h>
+#include <float.h>
+
+namespace
+{
+	/// Light counts that the shader variants are compiled for.
+	const uint32_t shader_light_counts[] = { 1, 2, 4, 8, Scene::MAX_LIGHT_COUNT };
+	const int shader_light_count_variants = sizeof(shader_light_counts) / sizeof(shader_light_counts[0]);
+
+	const float floor_size = 25.0f;
+
+	/// Resolution of the software occlusion buffer, a fraction of the window with the same aspect ratio.
+	const uint32_t occlusion_buffer_width = 256;
+	const uint32_t occlusion_buffer_height = 192;
+
+	/// An entity only switches to a coarser level of detail once its projected size is this fraction below
+	///	the threshold, which keeps entities right at a threshold from switching back and forth.
+	const float lod_hysteresis = 0.15f;
+
+	/// Meshlets with a projected radius below this fraction of half the screen height are culled, about half
+	///	a pixel at 1080p.
+	const float meshlet_min_screen_size = 0.001f;
+
+	/// Imported meshes are scaled to this bounding radius.
+	const float mesh_entity_radius = 2.0f;
+
+	/// Entities can move this far before their leaf in the bounding volume tree needs to be reinserted.
+	const float entity_tree_margin = 0.25f;
+
+	/// Orders colors component by component.
+	bool ColorLess(const Color& lhs, const Color& rhs)
+	{
+		if(lhs.r != rhs.r) return lhs.r < rhs.r;
+		if(lhs.g != rhs.g) return lhs.g < rhs.g;
+		if(lhs.b != rhs.b) return lhs.b < rhs.b;
+		return lhs.a < rhs.a;
+	}
+
+	/// Removes an element by moving the last element into its place.
+	template<typename T>
+	void RemoveAt(std::vector<T>& v, uint32_t index)
+	{
+		v[index] = v.back();
+		v.pop_back();
+	}
+};
+
+Scene::Scene(const Material& material, PrimitiveFactory* factory, RenderDevice* render_device)
+	: _entity_tree(entity_tree_margin), _floor_position(0.0f, -0.5f, 0.0f), _floor_material(0), _sphere_mesh(SPHERE_UV), _primitive_factory(factory), _render_device(render_device),
+	_material_template(material), _occlusion_culling(OCCLUSION_NONE), _meshlet_culling(true)
+{
+	// Create a floor, it's always drawn through a static batch.
+	_floor_primitive = _primitive_factory->CreatePlane(Vec2(floor_size, floor_size));
+
+	Material floor_material = material;
+	floor_material.diffuse = Color(0.40f, 0.40f, 0.40f);
+	floor_material.specular = Color(0.40f, 0.40f, 0.40f);
+	_floor_material = AcquireMaterial(floor_material);
+	MarkStaticBatchDirty(_floor_material);
+
+	// All spheres share the same levels of detail rather than creating a new primitive for each entity,
 	//	they will all be the same anyway and only the transformation properties will be unique.
-	_sphere_template = new Entity;
-	_sphere_template->primitive = _primitive_factory->CreateSphere(0.5f);
-	_sphere_template->scale = Vec3(1.0f, 1.0f, 1.0f);
-	_sphere_template->position = Vec3(0.0f, 0.0f, 0.0f);
-	_sphere_template->material = material;
+	_sphere_lods = _primitive_factory->CreateSphereLodChain(0.5f);
+
+	// Unit box, scaled to the bounding sphere of each entity when testing for occlusion.
+	_occlusion_proxy = _primitive_factory->CreateBox(Vec3(1.0f, 1.0f, 1.0f));
 
+	_occlusion_buffer = new OcclusionBuffer(occlusion_buffer_width, occlusion_buffer_height);
 }
 Scene::~Scene()
 {
 	// Destroy remaning entities
 	DestroyAllEntities();
-	
-	delete _sphere_template;
-	_sphere_template = NULL;
 
-	// Destroy the floor
-	delete _floor_entity;
-	_floor_entity = NULL;
-}
+	for(std::map<uint32_t, StaticBatch*>::iterator it = _static_batches.begin();
+		it != _static_batches.end(); ++it)
+	{
+		delete it->second;
+	}
+	_static_batches.clear();
 
-struct EntityDepthSort
-{
-	Vec3 _camera_position;
+	_primitive_factory->DestroyLodChain(_sphere_lods);
 
-	EntityDepthSort(const Vec3& camera_position) : _camera_position(camera_position) {}
+	_primitive_factory->DestroyPrimitive(_occlusion_proxy);
 
-	bool operator() (Entity* ent1, Entity* ent2) 
-	{
-		float d1 = vector::Length(vector::Subtract(ent1->position, _camera_position));
-		float d2 = vector::Length(vector::Subtract(ent2->position, _camera_position));
-		
-		return (d1 < d2);
-	}
-};
+	delete _occlusion_buffer;
+	_occlusion_buffer = NULL;
 
-Entity* Scene::SelectEntity(const Vec2& mouse_position, const Camera& camera)
-{
-	// Make sure entities are sorted by depth, this way the select will always chose the closest possible entity.
-	std::sort(_entities.begin(), _entities.end(), EntityDepthSort(camera.position));
+	// Destroy the floor
+	_primitive_factory->DestroyPrimitive(_floor_primitive);
+	ReleaseMaterial(_floor_material);
+}
 
+EntityId Scene::SelectEntity(const Vec2& mouse_position, const Camera& camera)
+{
 	// Ray in clip-space
-	Vec4 ray_clip = Vec4(mouse_position.x, mouse_position.y, -1.0f, 1.0f); 
-	
+	Vec4 ray_clip = Vec4(mouse_position.x, mouse_position.y, -1.0f, 1.0f);
+
 	// Transform ray into view-space
 	Vec4 ray_view = matrix::Multiply(matrix::Inverse(camera.projection), ray_clip);
 	ray_view = Vec4(ray_view.x, ray_view.y, -1.0f, 0.0f);
 
 	Mat4x4 view = matrix::LookAt(camera.position, vector::Add(camera.position, camera.direction), Vec3(0.0f, 1.0f, 0.0f)); // Build the view matrix
-	
+
 	// Transform ray into world-space by multiplying the ray with the inverse of the view matrix.
 	Vec4 ray_world = matrix::Multiply(matrix::Inverse(view), ray_view);
 	vector::Normalize(ray_world);
-	
-	for(std::vector<Entity*>::iterator it = _entities.begin(); 
-		it != _entities.end(); ++it)
-	{
-		float radius = std::max(std::max((*it)->scale.x, (*it)->scale.y), (*it)->scale.z) * (*it)->primitive.bounding_radius; // Scale bounding radius
-		if(RaySphereIntersect(camera.position, Vec3(ray_world.x, ray_world.y, ray_world.z), (*it)->position, radius))
-		{
-			return (*it);
-		}
-	}
-	return NULL;
+
+	// The tree returns the closest entity hit by the ray.
+	AabbTree::RayHit hit;
+	if(_entity_tree.RayCast(camera.position, Vec3(ray_world.x, ray_world.y, ray_world.z), hit))
+		return hit.user_data;
+
+	return INVALID_ENTITY_ID;
 }
 Vec3 Scene::ToWorld(const Vec2& mouse_position, const Camera& camera, float height)
 {
@@ -112,187 +148,941 @@ Vec3 Scene::ToWorld(const Vec2& mouse_position, const Camera& camera, float heig
 	return intersect;
 }
 
-Entity* Scene::CreateEntity(Entity::EntityType type)
+
+EntityId Scene::CreateEntity(Entity::EntityType type)
 {
-	Entity* entity = NULL;
+	EntityId id = INVALID_ENTITY_ID;
+	Material material = _material_template;
 
 	switch(type)
 	{
 	case Entity::ET_SPHERE:
 		{
-			entity = new Entity(*_sphere_template); // Copy our sphere template.
+			// Randomize colors for the new object
+			material.diffuse.r = (rand() % 255) / 255.0f;
+			material.diffuse.g = (rand() % 255) / 255.0f;
+			material.diffuse.b = (rand() % 255) / 255.0f;
+
+			material.specular = material.diffuse;
+
+			id = AddEntity(type, _sphere_lods.lods[0], &_sphere_lods, material);
 		}
 		break;
 	case Entity::ET_LIGHT:
 		{
 			assert(_lights.size() < MAX_LIGHT_COUNT);
-			entity = new Light;
-			entity->primitive = _primitive_factory->CreateSphere(0.15f);
+
+			// Light nodes are all white
+			material.ambient = Color(1.0f, 1.0f, 1.0f, 1.0f);
+			material.diffuse = Color(1.0f, 1.0f, 1.0f, 1.0f);
+
+			// All lights share the same cached sphere, each light holding a reference to it.
+			id = AddEntity(type, _primitive_factory->CreateSphere(0.15f), NULL, material);
+
+			_entities[EntityIndex(id)].light = (int)_lights.size();
+
+			Light light;
+			light.entity = id;
+			light.ambient = Color(0.0f, 0.0f, 0.0f);
+
+			// Randomize colors for the new light
+			light.diffuse.r = (rand() % 255) / 255.0f;
+			light.diffuse.g = (rand() % 255) / 255.0f;
+			light.diffuse.b = (rand() % 255) / 255.0f;
+
+			light.specular = Color(0.25f, 0.25f, 0.25f);
+			light.radius = 7.5f;
+
+			_lights.push_back(light);
 		}
 		break;
 	default:
 		assert(false);
 	};
 
-	entity->type = type;
-	entity->position = Vec3(0.0f, 0.0f, 0.0f);
-	entity->rotation = Vec3(0.0f, 0.0f, 0.0f);
-	entity->scale = Vec3(1.0f, 1.0f, 1.0f);
-	entity->material = _material_template;
+	return id;
+}
+EntityId Scene::CreateMeshEntity(const char* path)
+{
+	// Every mesh entity owns a chain holding its own references to the cached levels, as lights do for their sphere.
+	PrimitiveLodChain chain = _primitive_factory->CreateMeshLodChain(path);
+
+	Material material = _material_template;
+	material.diffuse = Color(0.75f, 0.75f, 0.75f);
+	material.specular = Color(0.25f, 0.25f, 0.25f);
+
+	// The mesh is loaded in the background, the entity is scaled and starts drawing once it's done.
+	PrimitiveLodChain* lod_chain = new PrimitiveLodChain(chain);
+	EntityId id = AddEntity(Entity::ET_MESH, chain.lods[0], lod_chain, material);
+	_loading_entities.push_back(id);
+
+	return id;
+}
+void Scene::DestroyEntity(EntityId id)
+{
+	uint32_t entity_index = EntityIndex(id);
+	_entity_tree.Remove(_entities[entity_index].tree_leaf);
+	ReleaseEntity(entity_index);
+
+	// Mirror the move done by the slot map, the last entity takes the place of the destroyed one.
+	uint32_t index = _entity_slots.Remove(id);
+
+	RemoveAt(_entities, index);
+	RemoveAt(_positions, index);
+	RemoveAt(_rotations, index);
+	RemoveAt(_scales, index);
+	RemoveAt(_world_matrices, index);
+	RemoveAt(_bounds_x, index);
+	RemoveAt(_bounds_y, index);
+	RemoveAt(_bounds_z, index);
+	RemoveAt(_bounds_radius, index);
+	RemoveAt(_visible, index);
+	RemoveAt(_material_indices, index);
+	RemoveAt(_primitives, index);
+}
+
+void Scene::DestroyAllEntities()
+{
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
+		ReleaseEntity(i);
+
+	// Nothing needs to be moved when everything is removed, the arrays are simply emptied.
+	_entity_slots.Clear();
+	_entity_tree.Clear();
+	_entities.clear();
+	_positions.clear();
+	_rotations.clear();
+	_scales.clear();
+	_world_matrices.clear();
+	_bounds_x.clear();
+	_bounds_y.clear();
+	_bounds_z.clear();
+	_bounds_radius.clear();
+	_visible.clear();
+	_material_indices.clear();
+	_primitives.clear();
 
+	_lights.clear();
+	_loading_entities.clear();
+}
+uint32_t Scene::EntityCount() const
+{
+	return (uint32_t)_entities.size();
+}
+bool Scene::IsEntityValid(EntityId id) const
+{
+	return _entity_slots.IsValid(id);
+}
+Entity::EntityType Scene::GetEntityType(EntityId id) const
+{
+	return _entities[EntityIndex(id)].type;
+}
+const Vec3& Scene::EntityPosition(EntityId id) const
+{
+	return _positions[EntityIndex(id)];
+}
+void Scene::SetEntityPosition(EntityId id, const Vec3& position)
+{
+	uint32_t index = EntityIndex(id);
+	_positions[index] = position;
+	UpdateTreeBounds(index);
+	if(_entities[index].is_static)
+		MarkStaticBatchDirty(_material_indices[index]);
+}
+const Vec3& Scene::EntityRotation(EntityId id) const
+{
+	return _rotations[EntityIndex(id)];
+}
+void Scene::SetEntityRotation(EntityId id, const Vec3& rotation)
+{
+	uint32_t index = EntityIndex(id);
+	_rotations[index] = rotation;
+	if(_entities[index].is_static)
+		MarkStaticBatchDirty(_material_indices[index]);
+}
+const Vec3& Scene::EntityScale(EntityId id) const
+{
+	return _scales[EntityIndex(id)];
+}
+void Scene::SetEntityScale(EntityId id, const Vec3& scale)
+{
+	uint32_t index = EntityIndex(id);
+	_scales[index] = scale;
+	UpdateTreeBounds(index);
+	if(_entities[index].is_static)
+		MarkStaticBatchDirty(_material_indices[index]);
+}
+Light* Scene::EntityLight(EntityId id)
+{
+	int light = _entities[EntityIndex(id)].light;
+	return (light != -1) ? &_lights[light] : NULL;
+}
+void Scene::SetEntityStatic(EntityId id, bool is_static)
+{
+	Entity& entity = _entities[EntityIndex(id)];
+	assert(entity.type != Entity::ET_LIGHT);
+	if(entity.is_static == is_static)
+		return;
+
+	// Dynamic entities keep their occlusion state, static ones are never tested.
+	ReleaseOcclusionQuery(entity);
+	entity.is_static = is_static;
+	MarkStaticBatchDirty(_material_indices[EntityIndex(id)]);
+}
+bool Scene::IsEntityStatic(EntityId id) const
+{
+	return _entities[EntityIndex(id)].is_static;
+}
+uint32_t Scene::StaticBatchCount() const
+{
+	return (uint32_t)_static_batches.size();
+}
+EntityId Scene::AddEntity(Entity::EntityType type, const Primitive& primitive, PrimitiveLodChain* lod_chain, const Material& material)
+{
+	EntityId id = _entity_slots.Insert();
+	assert(_entity_slots.Index(id) == _entities.size());
+
+	Entity entity;
+	entity.type = type;
+	entity.lod_chain = lod_chain;
+	entity.tree_leaf = _entity_tree.Insert(Vec3(0.0f, 0.0f, 0.0f), primitive.bounding_radius, id);
 	_entities.push_back(entity);
 
-	if(type == Entity::ET_LIGHT)
+	_positions.push_back(Vec3(0.0f, 0.0f, 0.0f));
+	_rotations.push_back(Vec3(0.0f, 0.0f, 0.0f));
+	_scales.push_back(Vec3(1.0f, 1.0f, 1.0f));
+	_world_matrices.push_back(matrix::CreateIdentity());
+
+	_bounds_x.push_back(0.0f);
+	_bounds_y.push_back(0.0f);
+	_bounds_z.push_back(0.0f);
+	_bounds_radius.push_back(primitive.bounding_radius);
+	_visible.push_back(1);
+
+	_material_indices.push_back(AcquireMaterial(material));
+	_primitives.push_back(primitive);
+
+	return id;
+}
+void Scene::ReleaseEntity(uint32_t index)
+{
+	Entity& entity = _entities[index];
+	if(entity.is_static)
+		MarkStaticBatchDirty(_material_indices[index]);
+
+	if(entity.light != -1)
 	{
-		// Light nodes are all white
-		entity->material.ambient = Color(1.0f, 1.0f, 1.0f, 1.0f);
-		entity->material.diffuse = Color(1.0f, 1.0f, 1.0f, 1.0f);
-		
-		Light* light = (Light*)entity;
-		light->ambient = Color(0.0f, 0.0f, 0.0f);
+		// The last light takes the place of the released one.
+		_entities[EntityIndex(_lights.back().entity)].light = entity.light;
+		RemoveAt(_lights, (uint32_t)entity.light);
+		entity.light = -1;
+	}
 
-		// Randomize colors for the new object
-		light->diffuse.r = (rand() % 255) / 255.0f;
-		light->diffuse.g = (rand() % 255) / 255.0f;
-		light->diffuse.b = (rand() % 255) / 255.0f;
+	ReleaseOcclusionQuery(entity);
+	if(!entity.lod_chain)
+	{
+		_primitive_factory->DestroyPrimitive(_primitives[index]);
+	}
+	else if(entity.type == Entity::ET_MESH)
+	{
+		// Mesh entities own their chain, see CreateMeshEntity.
+		_primitive_factory->DestroyLodChain(*entity.lod_chain);
+		delete entity.lod_chain;
+		entity.lod_chain = NULL;
+	}
+	ReleaseMaterial(_material_indices[index]);
+}
+uint32_t Scene::EntityIndex(EntityId id) const
+{
+	return _entity_slots.Index(id);
+}
+uint32_t Scene::AcquireMaterial(const Material& material)
+{
+	std::map<Material, uint32_t, MaterialLess>::iterator it = _material_lookup.find(material);
+	if(it != _material_lookup.end())
+	{
+		++_material_references[it->second];
+		return it->second;
+	}
 
-		light->specular = Color(0.25f, 0.25f, 0.25f);
-		light->radius = 7.5f;
+	uint32_t index;
+	if(!_free_materials.empty())
+	{
+		index = _free_materials.back();
+		_free_materials.pop_back();
 
-		_lights.push_back(light);
+		_materials[index] = material;
+		_material_references[index] = 1;
 	}
 	else
 	{
-		// Randomize colors for the new object
-		entity->material.diffuse.r = (rand() % 255) / 255.0f;
-		entity->material.diffuse.g = (rand() % 255) / 255.0f;
-		entity->material.diffuse.b = (rand() % 255) / 255.0f;
+		index = (uint32_t)_materials.size();
+		_materials.push_back(material);
+		_material_references.push_back(1);
+	}
 
-		entity->material.specular = entity->material.diffuse;
+	_material_lookup[material] = index;
+	return index;
+}
+void Scene::ReleaseMaterial(uint32_t index)
+{
+	assert(_material_references[index] > 0);
+	if(--_material_references[index] == 0)
+	{
+		_material_lookup.erase(_materials[index]);
+		_free_materials.push_back(index);
+	}
+}
+bool Scene::MaterialLess::operator()(const Material& lhs, const Material& rhs) const
+{
+	if(lhs.shader != rhs.shader)
+		return lhs.shader < rhs.shader;
+	if(lhs.shader_template != rhs.shader_template)
+		return lhs.shader_template < rhs.shader_template;
+	if(ColorLess(lhs.ambient, rhs.ambient)) return true;
+	if(ColorLess(rhs.ambient, lhs.ambient)) return false;
+	if(ColorLess(lhs.diffuse, rhs.diffuse)) return true;
+	if(ColorLess(rhs.diffuse, lhs.diffuse)) return false;
+	return ColorLess(lhs.specular, rhs.specular);
+}
+void Scene::Render(RenderDevice& device, MatrixStack& matrix_stack, const Camera& camera)
+{
+	UpdateLoadingEntities();
+	UpdateTransforms();
+	UpdateLods(camera);
+	CullEntities(matrix::Multiply(matrix_stack.ProjectionMatrix(), matrix_stack.ViewMatrix()));
+	_meshlet_stats = MeshletCullStats();
+
+	if(!_dirty_static_batches.empty())
+		RebuildStaticBatches();
+
+	if(_occlusion_culling == OCCLUSION_QUERIES)
+	{
+		RenderWithOcclusionQueries(device, matrix_stack, camera);
+		return;
+	}
+	if(_occlusion_culling == OCCLUSION_SOFTWARE)
+	{
+		RenderWithSoftwareOcclusion(device, matrix_stack, camera);
+		return;
+	}
+
+	// Render the floor and any other static entities
+	RenderStaticBatches(device, matrix_stack);
+
+	// Render the rest of the entities
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		if(_visible[i] && !_entities[i].is_static)
+			RenderEntity(device, matrix_stack, i);
 	}
 
-	return entity;
 }
-void Scene::DestroyEntity(Entity* entity)
+
+void Scene::SetOcclusionCulling(OcclusionCullingMode mode)
 {
-	if(entity->type == Entity::ET_LIGHT)
+	if(_occlusion_culling == mode)
+		return;
+
+	if(_occlusion_culling == OCCLUSION_QUERIES)
 	{
-		std::vector<Light*>::iterator it = std::find(_lights.begin(), _lights.end(), entity);
-		if(it != _lights.end())
-			_lights.erase(it);
+		// Drop all query results, they will be outdated if queries are enabled again.
+		for(std::vector<Entity>::iterator it = _entities.begin();
+			it != _entities.end(); ++it)
+		{
+			ReleaseOcclusionQuery(*it);
+		}
 	}
+	_occlusion_culling = mode;
+}
+Scene::OcclusionCullingMode Scene::OcclusionCulling() const
+{
+	return _occlusion_culling;
+}
+void Scene::SetSphereMesh(SphereMeshType type)
+{
+	if(_sphere_mesh == type)
+		return;
+
+	// Build the new chain before releasing the old one, both are reference counted by the factory.
+	PrimitiveLodChain lods = (type == SPHERE_ICOSPHERE) ?
+		_primitive_factory->CreateIcosphereLodChain(0.5f) : _primitive_factory->CreateSphereLodChain(0.5f);
+	_primitive_factory->DestroyLodChain(_sphere_lods);
+	_sphere_lods = lods;
+	_sphere_mesh = type;
 
-	std::vector<Entity*>::iterator it = std::find(_entities.begin(), _entities.end(), entity);
-	if(it != _entities.end())
+	// Entities keep their selected level, only the primitive is replaced.
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
 	{
-		delete (*it);
-		_entities.erase(it);
+		if(_entities[i].lod_chain == &_sphere_lods)
+		{
+			_primitives[i] = _sphere_lods.lods[_entities[i].lod];
+			UpdateTreeBounds(i);
+
+			// Static spheres are part of the batches, which needs the new geometry.
+			if(_entities[i].is_static)
+				MarkStaticBatchDirty(_material_indices[i]);
+		}
 	}
+}
+Scene::SphereMeshType Scene::SphereMesh() const
+{
+	return _sphere_mesh;
+}
+void Scene::SetMeshletCulling(bool enable)
+{
+	_meshlet_culling = enable;
+}
+bool Scene::MeshletCulling() const
+{
+	return _meshlet_culling;
+}
+const MeshletCullStats& Scene::MeshletStats() const
+{
+	return _meshlet_stats;
+}
+void Scene::UpdateTransforms()
+{
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		const Vec3& position = _positions[i];
+		const Vec3& rotation = _rotations[i];
+		const Vec3& scale = _scales[i];
+
+		// Same order as when applied through the matrix stack, translation * scale * rotation.
+		_world_matrices[i] = matrix::Multiply(matrix::Multiply(matrix::CreateTranslation(position), matrix::CreateScaling(scale)),
+			matrix::CreateRotationXYZ(rotation.x, rotation.y, rotation.z));
 
+		_bounds_x[i] = position.x;
+		_bounds_y[i] = position.y;
+		_bounds_z[i] = position.z;
+		_bounds_radius[i] = std::max(std::max(scale.x, scale.y), scale.z) * _primitives[i].bounding_radius;
+	}
+}
+void Scene::UpdateTreeBounds(uint32_t index)
+{
+	const Vec3& scale = _scales[index];
+	float radius = std::max(std::max(scale.x, scale.y), scale.z) * _primitives[index].bounding_radius;
+	_entity_tree.Move(_entities[index].tree_leaf, _positions[index], radius);
 }
+void Scene::CullEntities(const Mat4x4& view_projection)
+{
+	uint32_t entity_count = (uint32_t)_entities.size();
+	if(entity_count == 0)
+		return;
 
-void Scene::DestroyAllEntities()
+	Plane planes[6];
+	matrix::ExtractFrustumPlanes(view_projection, planes);
+
+	const float* x = &_bounds_x[0];
+	const float* y = &_bounds_y[0];
+	const float* z = &_bounds_z[0];
+	const float* radius = &_bounds_radius[0];
+	uint8_t* visible = &_visible[0];
+
+	std::fill(_visible.begin(), _visible.end(), (uint8_t)1);
+
+	// One plane at a time without any branches, letting the compiler vectorize the inner loop.
+	for(int p = 0; p < 6; ++p)
+	{
+		const Plane& plane = planes[p];
+		for(uint32_t i = 0; i < entity_count; ++i)
+		{
+			float distance = plane.n.x * x[i] + plane.n.y * y[i] + plane.n.z * z[i] + plane.d;
+			visible[i] &= (uint8_t)(distance >= -radius[i]);
+		}
+	}
+}
+void Scene::UpdateLoadingEntities()
 {
-	_lights.clear();
+	for(std::vector<EntityId>::iterator it = _loading_entities.begin(); it != _loading_entities.end(); )
+	{
+		// Entities destroyed while loading released their chain along with them.
+		if(!IsEntityValid(*it))
+		{
+			it = _loading_entities.erase(it);
+			continue;
+		}
 
-	for(std::vector<Entity*>::iterator it = _entities.begin(); 
-		it != _entities.end(); ++it)
+		EntityId id = *it;
+		uint32_t index = EntityIndex(id);
+		Entity& entity = _entities[index];
+		if(!_primitive_factory->UpdateLodChain(*entity.lod_chain))
+		{
+			++it;
+			continue;
+		}
+
+		it = _loading_entities.erase(it);
+
+		// The mesh couldn't be loaded, there's nothing left to draw.
+		const PrimitiveLodChain& chain = *entity.lod_chain;
+		if(chain.lod_count == 0)
+		{
+			DestroyEntity(id);
+			continue;
+		}
+
+		entity.lod = std::min(entity.lod, chain.lod_count - 1);
+		_primitives[index] = chain.lods[entity.lod];
+
+		// All levels share the bounding sphere of the mesh, which is scaled to a fixed size.
+		float radius = chain.lods[0].bounding_radius;
+		if(radius > 0.0f)
+			SetEntityScale(id, vector::Multiply(_scales[index], mesh_entity_radius / radius));
+
+		// Static meshes are merged into the batches, which were built without their geometry.
+		if(entity.is_static)
+			MarkStaticBatchDirty(_material_indices[index]);
+	}
+}
+void Scene::UpdateLods(const Camera& camera)
+{
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
 	{
-		delete (*it);
+		Entity& entity = _entities[i];
+		const PrimitiveLodChain* chain = entity.lod_chain;
+		if(!chain || entity.is_static)
+			continue;
+
+		// Projected radius relative to half the screen height, projection.col[1].y is cot(fov/2).
+		float radius = _bounds_radius[i];
+		float distance = vector::Length(vector::Subtract(_positions[i], camera.position));
+		float screen_size = (distance > radius) ? radius * camera.projection.col[1].y / distance : FLT_MAX;
+
+		uint32_t lod = entity.lod;
+		while(lod > 0 && screen_size >= chain->min_screen_size[lod - 1])
+			--lod;
+		while(lod + 1 < chain->lod_count && screen_size < chain->min_screen_size[lod] * (1.0f - lod_hysteresis))
+			++lod;
+
+		if(lod == entity.lod)
+			continue;
+
+		entity.lod = lod;
+		_primitives[i] = chain->lods[lod];
+		UpdateTreeBounds(i);
 	}
-	_entities.clear();
 }
+bool Scene::IsOcclusionCandidate(uint32_t index) const
+{
+	// Lights are small and cheap, testing them would cost more than drawing them. Static entities are drawn in batches.
+	const Entity& entity = _entities[index];
+	return (entity.type != Entity::ET_LIGHT && !entity.is_static && _primitives[index].draw_call.index_count >= OCCLUSION_MIN_INDEX_COUNT);
+}
+void Scene::RenderWithOcclusionQueries(RenderDevice& device, MatrixStack& matrix_stack, const Camera& camera)
+{
+	// Distance to the near plane, extracted from the perspective projection.
+	float near_distance = camera.projection.col[3].z / (camera.projection.col[2].z - 1.0f);
 
-void Scene::Render(RenderDevice& device, MatrixStack& matrix_stack)
+	uint32_t entity_count = (uint32_t)_entities.size();
+
+	// Collect any results that have arrived since the last frame. We never wait for a result, entities simply
+	//	keep their previous state until a new result is available.
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		if(!IsOcclusionCandidate(i))
+			continue;
+
+		Entity& entity = _entities[i];
+		if(entity.query_pending)
+		{
+			uint32_t samples = 0;
+			if(device.GetQueryResult(entity.occlusion_query, samples))
+			{
+				entity.occluded = (samples == 0);
+				entity.query_pending = false;
+			}
+		}
+
+		// The proxy would be clipped by the near plane if the camera is inside it, always treat the entity as visible then.
+		float radius = _bounds_radius[i];
+		float distance = vector::Length(vector::Subtract(_positions[i], camera.position));
+		if(distance < radius * 1.7321f + near_distance) // sqrt(3) * radius is the distance to the corners of the proxy.
+		{
+			entity.occluded = false;
+		}
+	}
+
+	// Render floor and other static entities, the floor is our main occluder.
+	RenderStaticBatches(device, matrix_stack);
+
+	// Render all entities that were visible, filling the depth buffer for the proxies.
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		if(_visible[i] && !_entities[i].is_static && (!IsOcclusionCandidate(i) || !_entities[i].occluded))
+			RenderEntity(device, matrix_stack, i);
+	}
+
+	// Test the proxies against the depth buffer, without touching either the color or the depth buffer.
+	device.SetColorWrite(false);
+	device.SetDepthWrite(false);
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		// Entities still waiting for their previous result are not tested again, reissuing the query
+		//	would discard the pending result and a slow GPU would never deliver any results.
+		if(_visible[i] && IsOcclusionCandidate(i) && !_entities[i].query_pending)
+			RenderOcclusionProxy(device, matrix_stack, i);
+	}
+	device.SetColorWrite(true);
+	device.SetDepthWrite(true);
+
+	// Entities hidden in the previous frame are rendered conditionally on their latest query. This lets the GPU
+	//	draw them in the same frame they become visible, rather than one frame late when the result is read back.
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		if(_visible[i] && IsOcclusionCandidate(i) && _entities[i].occluded)
+		{
+			device.BeginConditionalRender(_entities[i].occlusion_query);
+			RenderEntity(device, matrix_stack, i);
+			device.EndConditionalRender();
+		}
+	}
+}
+void Scene::RenderWithSoftwareOcclusion(RenderDevice& device, MatrixStack& matrix_stack, const Camera& camera)
 {
-	// Render floor
-	RenderEntity(device, matrix_stack, _floor_entity);
+	Mat4x4 view = matrix::LookAt(camera.position, vector::Add(camera.position, camera.direction), Vec3(0.0f, 1.0f, 0.0f));
 
-	// Render the rest of the entities
-	for(std::vector<Entity*>::iterator it = _entities.begin(); 
-		it != _entities.end(); ++it)
+	_occlusion_buffer->Clear();
+	_occlusion_buffer->SetCamera(view, camera.projection);
+	RenderOccluders(camera, view);
+
+	// The floor is always rendered, it's the main occluder.
+	RenderStaticBatches(device, matrix_stack);
+
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		if(!_visible[i] || _entities[i].is_static)
+			continue;
+
+		// Hidden entities are skipped before any GL calls are made for them.
+		if(_occlusion_buffer->IsSphereVisible(Vec3(_bounds_x[i], _bounds_y[i], _bounds_z[i]), _bounds_radius[i]))
+			RenderEntity(device, matrix_stack, i);
+	}
+}
+void Scene::MarkStaticBatchDirty(uint32_t material)
+{
+	if(std::find(_dirty_static_batches.begin(), _dirty_static_batches.end(), material) == _dirty_static_batches.end())
+		_dirty_static_batches.push_back(material);
+}
+void Scene::RebuildStaticBatches()
+{
+	for(std::vector<uint32_t>::iterator it = _dirty_static_batches.begin();
+		it != _dirty_static_batches.end(); ++it)
+	{
+		RebuildStaticBatch(*it);
+	}
+	_dirty_static_batches.clear();
+}
+void Scene::RebuildStaticBatch(uint32_t material)
+{
+	// Entities with a LOD chain are merged at their most detailed level.
+	std::vector<StaticBatch::Source> sources;
+	if(material == _floor_material)
+	{
+		StaticBatch::Source floor;
+		floor.primitive = _floor_primitive;
+		floor.transform = matrix::CreateTranslation(_floor_position);
+		sources.push_back(floor);
+	}
+
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
 	{
-		RenderEntity(device, matrix_stack, *it);
+		const Entity& entity = _entities[i];
+		if(!entity.is_static || _material_indices[i] != material)
+			continue;
+
+		StaticBatch::Source source;
+		source.primitive = entity.lod_chain ? entity.lod_chain->lods[0] : _primitives[i];
+		source.transform = _world_matrices[i];
+		sources.push_back(source);
+	}
+
+	std::map<uint32_t, StaticBatch*>::iterator it = _static_batches.find(material);
+	StaticBatch* batch = (it != _static_batches.end()) ? it->second : new StaticBatch(_primitive_factory);
+	if(batch->Build(sources, material))
+	{
+		_static_batches[material] = batch;
+		return;
+	}
+
+	delete batch;
+	if(it != _static_batches.end())
+		_static_batches.erase(it);
+}
+void Scene::RenderStaticBatches(RenderDevice& device, MatrixStack& matrix_stack)
+{
+	Plane planes[6];
+	matrix::ExtractFrustumPlanes(matrix::Multiply(matrix_stack.ProjectionMatrix(), matrix_stack.ViewMatrix()), planes);
+
+	// The geometry of the batches is already in world space.
+	Mat4x4 identity = matrix::CreateIdentity();
+
+	for(std::map<uint32_t, StaticBatch*>::iterator it = _static_batches.begin();
+		it != _static_batches.end(); ++it)
+	{
+		StaticBatch* batch = it->second;
+		for(uint32_t c = 0; c < batch->CellCount(); ++c)
+		{
+			bool visible = true;
+			for(int p = 0; p < 6 && visible; ++p)
+				visible = (vector::Dot(planes[p].n, batch->CellCenter(c)) + planes[p].d >= -batch->CellRadius(c));
+
+			if(visible)
+				RenderPrimitive(device, matrix_stack, batch->CellPrimitive(c), _materials[batch->MaterialIndex()], identity);
+		}
+	}
+}
+void Scene::RenderOccluders(const Camera& camera, const Mat4x4& view)
+{
+	const uint16_t quad_indices[6] = { 0, 1, 2, 0, 2, 3 };
+
+	// Floor
+	float half_size = floor_size * 0.5f;
+	Vec3 floor_vertices[4];
+	for(int i = 0; i < 4; ++i)
+	{
+		Vec3 corner(((i == 1 || i == 2) ? half_size : -half_size), 0.0f, ((i >= 2) ? half_size : -half_size));
+		floor_vertices[i] = vector::Add(_floor_position, corner);
 	}
+	_occlusion_buffer->RenderTriangles(floor_vertices, quad_indices, 6);
+
+	// Large spheres are approximated by a camera-facing square through their center, inscribed in the circle
+	//	where the plane cuts the sphere. Every point of the square is inside the sphere, so the square is always
+	//	behind the visible surface and never hides anything the sphere doesn't.
+	Vec3 right(view.col[0].x, view.col[1].x, view.col[2].x);
+	Vec3 up(view.col[0].y, view.col[1].y, view.col[2].y);
+	float pixels_per_unit = camera.projection.col[1].y * 0.5f * _occlusion_buffer->Height(); // At distance 1
 
+	uint32_t entity_count = (uint32_t)_entities.size();
+	for(uint32_t i = 0; i < entity_count; ++i)
+	{
+		if(_entities[i].type != Entity::ET_SPHERE)
+			continue;
+
+		const Vec3& position = _positions[i];
+		float radius = _bounds_radius[i];
+		float distance = vector::Dot(vector::Subtract(position, camera.position), camera.direction);
+		if(distance <= radius || radius * pixels_per_unit < OCCLUDER_MIN_SCREEN_RADIUS * distance)
+			continue;
+
+		float h = radius * 0.7071f; // Half the side of the inscribed square, r / sqrt(2)
+		Vec3 sphere_vertices[4];
+		for(int v = 0; v < 4; ++v)
+		{
+			float s = (v == 1 || v == 2) ? h : -h;
+			float t = (v >= 2) ? h : -h;
+			sphere_vertices[v] = vector::Add(position, vector::Add(vector::Multiply(right, s), vector::Multiply(up, t)));
+		}
+		_occlusion_buffer->RenderTriangles(sphere_vertices, quad_indices, 6);
+	}
 }
+void Scene::RenderOcclusionProxy(RenderDevice& device, MatrixStack& matrix_stack, uint32_t index)
+{
+	uint32_t light_count = 0;
+	int shader = SelectShader(device, _materials[_material_indices[index]], light_count);
+	if(shader == -1)
+		return;
+
+	Entity& entity = _entities[index];
+	if(entity.occlusion_query == -1)
+		entity.occlusion_query = device.CreateQuery();
+
+	// No other uniforms are needed as nothing is written to the color buffer.
+	device.BindShader(shader);
+
+	matrix_stack.Push();
 
-void Scene::BindMaterialUniforms(RenderDevice& device, Entity* entity)
+	// Scale the unit box to enclose the bounding sphere, this makes the rotation irrelevant.
+	float radius = _bounds_radius[index];
+	matrix_stack.Translate3f(_positions[index]);
+	matrix_stack.Scale3f(Vec3(radius, radius, radius));
+	matrix_stack.MultiplyMatrix(vertex_quantizer::DequantizationMatrix(_occlusion_proxy.dequantization));
+	matrix_stack.Apply(device);
+
+	device.BeginOcclusionQuery(entity.occlusion_query);
+	device.Draw(_occlusion_proxy.draw_call);
+	device.EndOcclusionQuery();
+
+	matrix_stack.Pop();
+
+	entity.query_pending = true;
+}
+void Scene::ReleaseOcclusionQuery(Entity& entity)
 {
-	device.SetUniform4f("material.ambient",  Vec4(	entity->material.ambient.r, entity->material.ambient.g, 
-													entity->material.ambient.b, entity->material.ambient.a));
+	if(entity.occlusion_query != -1)
+	{
+		_render_device->ReleaseQuery(entity.occlusion_query);
+		entity.occlusion_query = -1;
+	}
+	entity.query_pending = false;
+	entity.occluded = false;
+}
 
-	device.SetUniform4f("material.diffuse",  Vec4(	entity->material.diffuse.r, entity->material.diffuse.g, 
-													entity->material.diffuse.b, entity->material.diffuse.a));
+void Scene::PrecompileShaderVariants(RenderDevice& device)
+{
+	if(_material_template.shader_template == -1)
+		return;
 
-	device.SetUniform4f("material.specular",  Vec4(	entity->material.specular.r, entity->material.specular.g, 
-													entity->material.specular.b, entity->material.specular.a));
+	for(int i = 0; i < shader_light_count_variants; ++i)
+	{
+		ShaderDefine define = { "LIGHT_COUNT", (int)shader_light_counts[i] };
+		device.GetShaderVariant(_material_template.shader_template, &define, 1);
+	}
 }
-void Scene::BindLightUniforms(RenderDevice& device)
+uint32_t Scene::ShaderLightCount() const
 {
-	// OpenGL seems to have a weird way working with uniforms for arrays of structures so we cannot set all our data at once, 
-	//	we need to set each variable separately.
-	for(uint32_t i = 0; i < MAX_LIGHT_COUNT; ++i)
+	// Pick the smallest variant that covers all lights, fragments don't have to pay for lights that doesn't exist.
+	for(int i = 0; i < shader_light_count_variants; ++i)
+	{
+		if(shader_light_counts[i] >= _lights.size())
+			return shader_light_counts[i];
+	}
+	return MAX_LIGHT_COUNT;
+}
+int Scene::SelectShader(RenderDevice& device, const Material& material, uint32_t& light_count)
+{
+	if(material.shader_template == -1)
+	{
+		light_count = MAX_LIGHT_COUNT;
+		return material.shader;
+	}
+
+	light_count = ShaderLightCount();
+
+	ShaderDefine define = { "LIGHT_COUNT", (int)light_count };
+	return device.GetShaderVariant(material.shader_template, &define, 1);
+}
+void Scene::BindMaterialUniforms(RenderDevice& device, const Material& material)
+{
+	device.SetUniform4f("material.ambient",  Vec4(	material.ambient.r, material.ambient.g,
+													material.ambient.b, material.ambient.a));
+
+	device.SetUniform4f("material.diffuse",  Vec4(	material.diffuse.r, material.diffuse.g,
+													material.diffuse.b, material.diffuse.a));
+
+	device.SetUniform4f("material.specular",  Vec4(	material.specular.r, material.specular.g,
+													material.specular.b, material.specular.a));
+}
+void Scene::BindLightUniforms(RenderDevice& device, uint32_t light_count)
+{
+	// OpenGL seems to have a weird way working with uniforms for arrays of structures so we cannot set all our data at once,
+	//	we need to set each variable separately. The names are formatted into a buffer on the stack to avoid any heap allocations.
+	char name[64];
+	for(uint32_t i = 0; i < light_count; ++i)
 	{
 		if(_lights.size() > i)
 		{
-			Light* l = _lights[i];
-
-			std::stringstream ss;
-			ss << "lights[" << i << "].ambient";
-			device.SetUniform4f(ss.str().c_str(), Vec4(l->ambient.r, l->ambient.g, l->ambient.b, l->ambient.a));
-			
-			ss.str("");
-			ss << "lights[" << i << "].diffuse";
-			device.SetUniform4f(ss.str().c_str(), Vec4(l->diffuse.r, l->diffuse.g, l->diffuse.b, l->diffuse.a));
-			
-			ss.str("");
-			ss << "lights[" << i << "].specular";
-			device.SetUniform4f(ss.str().c_str(), Vec4(l->specular.r, l->specular.g, l->specular.b, l->specular.a));
-
-			ss.str("");
-			ss << "lights[" << i << "].position";
-			device.SetUniform3f(ss.str().c_str(), l->position);
-			
-			ss.str("");
-			ss << "lights[" << i << "].radius";
-			device.SetUniform1f(ss.str().c_str(), l->radius);
+			const Light& l = _lights[i];
+
+			sprintf(name, "lights[%u].ambient", i);
+			device.SetUniform4f(name, Vec4(l.ambient.r, l.ambient.g, l.ambient.b, l.ambient.a));
+
+			sprintf(name, "lights[%u].diffuse", i);
+			device.SetUniform4f(name, Vec4(l.diffuse.r, l.diffuse.g, l.diffuse.b, l.diffuse.a));
+
+			sprintf(name, "lights[%u].specular", i);
+			device.SetUniform4f(name, Vec4(l.specular.r, l.specular.g, l.specular.b, l.specular.a));
+
+			sprintf(name, "lights[%u].position", i);
+			device.SetUniform3f(name, _positions[EntityIndex(l.entity)]);
+
+			sprintf(name, "lights[%u].radius", i);
+			device.SetUniform1f(name, l.radius);
 		}
 		else
 		{
 			// Just set the radius to 0 for any "non-existing" lights in the array.
-			std::stringstream ss;
-			ss << "lights[" << i << "].radius";
-			device.SetUniform1f(ss.str().c_str(), 0.0f);
-
+			sprintf(name, "lights[%u].radius", i);
+			device.SetUniform1f(name, 0.0f);
 		}
 
 	}
 }
-void Scene::RenderEntity(RenderDevice& device, MatrixStack& matrix_stack, Entity* entity)
+void Scene::RenderEntity(RenderDevice& device, MatrixStack& matrix_stack, uint32_t index)
 {
+	RenderPrimitive(device, matrix_stack, _primitives[index], _materials[_material_indices[index]], _world_matrices[index]);
+}
+void Scene::RenderPrimitive(RenderDevice& device, MatrixStack& matrix_stack, const Primitive& primitive, const Material& material,
+	const Mat4x4& world)
+{
+	// Meshes still loading have no vertex array object yet.
+	if(primitive.draw_call.vertex_array_object == -1)
+		return;
+
+	// Select the shader variant for the current number of lights
+	uint32_t light_count = 0;
+	int shader = SelectShader(device, material, light_count);
+
 	// Make sure the material have a shader, otherwise we have nothing to render
-	if(entity->material.shader != -1)
+	if(shader != -1)
 	{
 		// Bind shader and set material parameters
-		device.BindShader(entity->material.shader);
-		
-		BindLightUniforms(device);
-		BindMaterialUniforms(device, entity);
-		
+		device.BindShader(shader);
+
+		BindLightUniforms(device, light_count);
+		BindMaterialUniforms(device, material);
+
 		matrix_stack.Push();
 
 		// Transform object
-		matrix_stack.Translate3f(entity->position);
-		matrix_stack.Scale3f(entity->scale);
-		matrix_stack.Rotate3f(entity->rotation.x, entity->rotation.y, entity->rotation.z);
+		matrix_stack.MultiplyMatrix(world);
+
+		// The meshlet bounds are in object space, they're tested before the dequantization is applied.
+		bool cull_meshlets = _meshlet_culling && primitive.meshlets;
+		Mat4x4 model_view;
+		if(cull_meshlets)
+			model_view = matrix::Multiply(matrix_stack.ViewMatrix(), matrix_stack.ModelMatrix());
+
+		// Quantized vertex positions to object space
+		matrix_stack.MultiplyMatrix(vertex_quantizer::DequantizationMatrix(primitive.dequantization));
 
 		// Apply transformations to pipeline
 		matrix_stack.Apply(device);
 
 		// Perform the actual draw call
-		device.Draw(entity->primitive.draw_call);
+		if(cull_meshlets)
+			DrawMeshlets(device, primitive, model_view, matrix_stack.ProjectionMatrix());
+		else
+			device.Draw(primitive.draw_call);
 
 		matrix_stack.Pop();
 	}
 }
+void Scene::DrawMeshlets(RenderDevice& device, const Primitive& primitive, const Mat4x4& model_view, const Mat4x4& projection)
+{
+	const MeshletCuller* meshlets = primitive.meshlets;
+
+	// The camera is at the origin of view space.
+	Vec4 camera_position = matrix::Multiply(matrix::Inverse(model_view), Vec4(0.0f, 0.0f, 0.0f, 1.0f));
+
+	// The ratio between radius and distance is preserved by uniform scaling, projection.col[1].y is cot(fov/2).
+	float min_radius_ratio = meshlet_min_screen_size / projection.col[1].y;
+
+	FrameAllocator& allocator = frame_allocator::ThreadAllocator();
+	FrameAllocatorScope allocator_scope(allocator);
+
+	int* index_offsets = allocator.AllocateArray<int>(meshlets->MeshletCount());
+	int* index_counts = allocator.AllocateArray<int>(meshlets->MeshletCount());
+
+	MeshletCullStats stats;
+	uint32_t range_count = meshlets->Cull(matrix::Multiply(projection, model_view), 
+		Vec3(camera_position.x, camera_position.y, camera_position.z), min_radius_ratio, index_offsets, index_counts, &stats);
+
+	_meshlet_stats.visible += stats.visible;
+	_meshlet_stats.backfacing += stats.backfacing;
+	_meshlet_stats.outside_frustum += stats.outside_frustum;
+	_meshlet_stats.too_small += stats.too_small;
+
+	for(uint32_t i = 0; i < range_count; ++i)
+		index_offsets[i] += primitive.draw_call.index_offset;
+
+	device.MultiDraw(primitive.draw_call, index_offsets, index_counts, (int)range_count);
+}
@@ -3,31 +3,52 @@
 
 #include "PrimitiveFactory.h"
 
-/// @brief Represents an object in the scene.
+#include <framework/SlotMap.h>
+#include <framework/AabbTree.h>
+
+/// Stable handle to an entity in a scene, handles to destroyed entities are detected rather than reused.
+typedef SlotMap::Handle EntityId;
+
+const EntityId INVALID_ENTITY_ID = SlotMap::INVALID_HANDLE;
+
+/// @brief Per-entity state that is rarely touched while rendering. The transforms, bounds, materials and primitives 
+///	of the entities are kept in separate arrays in the scene, so the per-frame passes can stream through them.
 struct Entity
 {
 	enum EntityType
 	{
 		ET_SPHERE,
-		ET_LIGHT
+		ET_LIGHT,
+		ET_MESH
 	};
 	EntityType type;
 
-	Primitive primitive;
-	Material material;
+	PrimitiveLodChain* lod_chain; // Levels of detail to select the primitive from, NULL if the entity only have one.
+								//	Entities without a LOD chain hold a reference to their primitive, released when the entity is destroyed.
+								//	Mesh entities own their chain, holding a reference to every level. The chain have nothing to 
+								//	draw until the buffers of the mesh are uploaded, see PrimitiveFactory::UpdateLodChain.
+	uint32_t lod; // Index of the currently selected level in the LOD chain.
+
+	bool is_static; // Static entities never move, they're drawn as part of a static batch rather than on their own.
+
+	int light; // Index of the light parameters of light entities, -1 for all other entities.
 
-	// Transform
+	int tree_leaf; // Leaf holding the bounding sphere of the entity in the scene's bounding volume tree.
 
-	Vec3 rotation; // Head, pitch, roll
-	Vec3 position;
-	Vec3 scale;
+	// Occlusion culling
 
-	Entity() : rotation(0.0f, 0.0f, 0.0f), position(0.0f, 0.0f, 0.0f), scale(1.0f, 1.0f, 1.0f) {}
+	int occlusion_query; // Query for the bounding proxy of the entity, -1 if the entity haven't been tested yet.
+	bool query_pending; // Specifies whether the result of the last issued query haven't been read yet.
+	bool occluded; // Specifies whether the entity was hidden according to the latest available query result.
+
+	Entity() : type(ET_SPHERE), lod_chain(NULL), lod(0), is_static(false), light(-1), tree_leaf(-1), occlusion_query(-1), query_pending(false), occluded(false) {}
 };
 
-/// Point-light
-struct Light : public Entity
+/// Point-light, positioned by the entity it's attached to.
+struct Light
 {
+	EntityId entity;
+
 	Color ambient;
 	Color diffuse;
 	Color specular;
@@ -39,53 +60,274 @@ struct Light : public Entity
 struct Camera;
 class RenderDevice;
 class MatrixStack;
+class OcclusionBuffer;
+class StaticBatch;
 
 class Scene
 {
 public:
 	enum { MAX_LIGHT_COUNT = 16 };
 
+	/// Entities need at least this many indices to be considered worth testing for occlusion.
+	enum { OCCLUSION_MIN_INDEX_COUNT = 1024 };
+	/// Spheres needs a radius of at least this many pixels in the occlusion buffer to be used as occluders.
+	enum { OCCLUDER_MIN_SCREEN_RADIUS = 8 };
+
+	/// Methods for skipping entities hidden behind other geometry.
+	enum OcclusionCullingMode
+	{
+		OCCLUSION_NONE,
+		OCCLUSION_QUERIES, // Hardware occlusion queries, using the results from the previous frame.
+		OCCLUSION_SOFTWARE, // Occluders rasterized on the CPU, no entity is submitted to the GPU if hidden.
+		OCCLUSION_MODE_COUNT
+	};
+
+	/// Meshes the sphere template can be built from.
+	enum SphereMeshType
+	{
+		SPHERE_UV, // Rings and sectors, dense at the poles.
+		SPHERE_ICOSPHERE, // Subdivided icosahedron, uniform triangle density.
+		SPHERE_MESH_COUNT
+	};
+
 	/// @param material Material template that will be used by all new entities.
-	Scene(const Material& material, PrimitiveFactory* factory);
+	Scene(const Material& material, PrimitiveFactory* factory, RenderDevice* render_device);
 	~Scene();
 
 	/// @brief Tries to select an entity at the specified mouse position.
-	/// @return The entity selected or NULL if no entity was found.
-	Entity* SelectEntity(const Vec2& mouse_position, const Camera& camera);
+	/// @return The closest entity under the mouse or INVALID_ENTITY_ID if no entity was found.
+	EntityId SelectEntity(const Vec2& mouse_position, const Camera& camera);
 
 	/// @brief Converts the specified mouse position to world coordinates.
 	/// @param height Height above the ground.
 	Vec3 ToWorld(const Vec2& mouse_position, const Camera& camera, float height);
 
 	/// @brief Creates an entity of the specified type and adds it to the scene.
-	Entity* CreateEntity(Entity::EntityType type);
+	EntityId CreateEntity(Entity::EntityType type);
+
+	/// @brief Creates an entity from a mesh file, scaled to a fixed size and placed at the center of the scene.
+	///		The level of detail is selected from the projected size of the entity, as for spheres. The mesh is 
+	///		loaded in the background, the entity is destroyed if it couldn't be imported.
+	/// @param path Path to a Wavefront OBJ or PLY file.
+	EntityId CreateMeshEntity(const char* path);
 
 	/// @brief Destroys the specified entity.
-	void DestroyEntity(Entity* entity);
+	void DestroyEntity(EntityId id);
 
 	/// @brief Destroys all entities in the scene.
 	void DestroyAllEntities();
 
+	/// @brief Returns the number of entities in the scene.
+	uint32_t EntityCount() const;
+
+	/// @brief Returns true if the handle refers to an entity that haven't been destroyed.
+	bool IsEntityValid(EntityId id) const;
+
+	/// @brief Returns the type of the specified entity.
+	Entity::EntityType GetEntityType(EntityId id) const;
+
+	const Vec3& EntityPosition(EntityId id) const;
+	void SetEntityPosition(EntityId id, const Vec3& position);
+
+	const Vec3& EntityRotation(EntityId id) const;
+	void SetEntityRotation(EntityId id, const Vec3& rotation);
+
+	const Vec3& EntityScale(EntityId id) const;
+	void SetEntityScale(EntityId id, const Vec3& scale);
+
+	/// @brief Returns the light parameters of a light entity, NULL if the entity isn't a light. The pointer is only
+	///		valid until the next light is created or destroyed.
+	Light* EntityLight(EntityId id);
+
+	/// @brief Marks an entity as static or dynamic. Static entities sharing material are merged into static batches.
+	///		A batch is rebuilt before the next frame whenever one of its entities is added, removed or moved, batches of
+	///		other materials are left as they are. Lights can't be static.
+	void SetEntityStatic(EntityId id, bool is_static);
+
+	/// @brief Returns true if the entity is static.
+	bool IsEntityStatic(EntityId id) const;
+
+	/// @brief Returns the number of static batches, built during the last rendered frame.
+	uint32_t StaticBatchCount() const;
+
 	/// @brief Renders the scene with the specified device.
-	void Render(RenderDevice& device, MatrixStack& matrix_stack);
+	/// @param camera The camera the scene is viewed from, used for occlusion culling.
+	void Render(RenderDevice& device, MatrixStack& matrix_stack, const Camera& camera);
+
+	/// @brief Selects the method used for occlusion culling. 
+	///		With OCCLUSION_QUERIES the bounding proxies of heavy entities are tested with occlusion queries and entities 
+	///		hidden in the previous frame are only drawn if their proxy is visible.
+	///		With OCCLUSION_SOFTWARE the floor and large spheres are rasterized into a depth buffer on the CPU, which 
+	///		the bounding spheres of all entities are tested against before rendering.
+	void SetOcclusionCulling(OcclusionCullingMode mode);
+	
+	/// @brief Returns the method currently used for occlusion culling.
+	OcclusionCullingMode OcclusionCulling() const;
+
+	/// @brief Selects the mesh used for all spheres, existing spheres are switched over as well.
+	void SetSphereMesh(SphereMeshType type);
+
+	/// @brief Returns the mesh currently used for spheres.
+	SphereMeshType SphereMesh() const;
+
+	/// @brief Enables or disables culling of individual meshlets for entities with meshlets.
+	void SetMeshletCulling(bool enable);
+
+	/// @brief Returns true if meshlet culling is enabled.
+	bool MeshletCulling() const;
+
+	/// @brief Returns the number of meshlets culled by each test during the last rendered frame.
+	const MeshletCullStats& MeshletStats() const;
+
+	/// @brief Compiles the shader variants for all light counts ahead of time, avoiding stalls when lights are added.
+	void PrecompileShaderVariants(RenderDevice& device);
 
 private:
 	/// Binds material specific shader uniforms.
-	void BindMaterialUniforms(RenderDevice& device, Entity* entity);
+	void BindMaterialUniforms(RenderDevice& device, const Material& material);
 	/// Binds light specific shader uniforms.
-	void BindLightUniforms(RenderDevice& device);
+	/// @param light_count Number of lights in the bound shader variant.
+	void BindLightUniforms(RenderDevice& device, uint32_t light_count);
+
+	/// @brief Returns the number of lights in the smallest shader variant covering all lights in the scene.
+	uint32_t ShaderLightCount() const;
+
+	/// @brief Selects the shader to use for rendering with the specified material.
+	/// @param light_count Receives the number of lights the selected shader handles.
+	int SelectShader(RenderDevice& device, const Material& material, uint32_t& light_count);
+
+	/// @brief Adds an entity to the end of the entity arrays.
+	/// @param lod_chain Chain the primitive was selected from, NULL if the entity holds a reference to the primitive.
+	EntityId AddEntity(Entity::EntityType type, const Primitive& primitive, PrimitiveLodChain* lod_chain, const Material& material);
 
-	void RenderEntity(RenderDevice& device, MatrixStack& matrix_stack, Entity* entity); 
+	/// @brief Releases the resources held by the entity at the specified index in the entity arrays.
+	void ReleaseEntity(uint32_t index);
 
-	std::vector<Entity*> _entities;
-	Entity* _floor_entity;
-	Entity* _sphere_template;
+	/// @brief Returns the index of an entity in the entity arrays.
+	uint32_t EntityIndex(EntityId id) const;
 
-	std::vector<Light*> _lights;
+	/// Orders materials by all their fields, equal materials share an entry in the material table.
+	struct MaterialLess
+	{
+		bool operator()(const Material& lhs, const Material& rhs) const;
+	};
+
+	/// @brief Returns the index of a material in the material table, adding it if no equal material exists.
+	///		Every call holds a reference to the material that needs to be released with ReleaseMaterial.
+	uint32_t AcquireMaterial(const Material& material);
+	void ReleaseMaterial(uint32_t index);
+
+	/// @brief Builds the world matrix and bounding sphere of every entity.
+	void UpdateTransforms();
+
+	/// @brief Moves the bounding sphere of an entity in the bounding volume tree after changing its transform or primitive.
+	void UpdateTreeBounds(uint32_t index);
+
+	/// @brief Tests the bounding sphere of every entity against the view frustum, filling _visible.
+	void CullEntities(const Mat4x4& view_projection);
+
+	/// @brief Renders a primitive with the specified material and object to world transform.
+	void RenderPrimitive(RenderDevice& device, MatrixStack& matrix_stack, const Primitive& primitive, const Material& material, 
+		const Mat4x4& world);
+
+	/// @brief Renders the entity at the specified index in the entity arrays.
+	void RenderEntity(RenderDevice& device, MatrixStack& matrix_stack, uint32_t index); 
+
+	/// @brief Marks the static batch of a material for rebuilding before the next frame.
+	void MarkStaticBatchDirty(uint32_t material);
+
+	/// @brief Rebuilds the static batches of all materials marked as dirty.
+	void RebuildStaticBatches();
+
+	/// @brief Merges the static entities with the specified material into one batch, the floor included if it
+	///		shares the material. The batch is released if no static entities are left.
+	void RebuildStaticBatch(uint32_t material);
+
+	/// @brief Renders the static batches within the view frustum, this includes the floor.
+	void RenderStaticBatches(RenderDevice& device, MatrixStack& matrix_stack);
+
+	/// @brief Culls the meshlets of a primitive and draws the visible ones with a single multi-draw.
+	/// @param model_view Transform from the object space of the primitive to view space, without the dequantization.
+	void DrawMeshlets(RenderDevice& device, const Primitive& primitive, const Mat4x4& model_view, const Mat4x4& projection);
+
+	/// @brief Completes the chains of mesh entities whose buffers have finished uploading.
+	void UpdateLoadingEntities();
+
+	/// @brief Selects the level of detail for all entities with a LOD chain from their projected size.
+	void UpdateLods(const Camera& camera);
+
+	/// @brief Returns true if the entity at the specified index is expensive enough to be tested for occlusion.
+	bool IsOcclusionCandidate(uint32_t index) const;
+
+	/// @brief Renders the scene, skipping entities hidden during the previous frame.
+	void RenderWithOcclusionQueries(RenderDevice& device, MatrixStack& matrix_stack, const Camera& camera);
+
+	/// @brief Renders the scene, skipping entities hidden behind the occluders in the software occlusion buffer.
+	void RenderWithSoftwareOcclusion(RenderDevice& device, MatrixStack& matrix_stack, const Camera& camera);
+
+	/// @brief Rasterizes the floor and any spheres large enough on screen into the occlusion buffer.
+	void RenderOccluders(const Camera& camera, const Mat4x4& view);
+
+	/// @brief Draws the bounding proxy of an entity into the depth buffer within the entity's occlusion query.
+	void RenderOcclusionProxy(RenderDevice& device, MatrixStack& matrix_stack, uint32_t index);
+
+	/// @brief Releases the occlusion query held by the specified entity.
+	void ReleaseOcclusionQuery(Entity& entity);
+
+	// Entities, stored in parallel arrays. Removing an entity moves the last entity into its place, so the
+	//	arrays are always packed and the index of an entity may change. The slot map tracks the current index.
+
+	SlotMap _entity_slots;
+	std::vector<Entity> _entities;
+
+	std::vector<Vec3> _positions;
+	std::vector<Vec3> _rotations; // Head, pitch, roll
+	std::vector<Vec3> _scales;
+	std::vector<Mat4x4> _world_matrices; // Built from the transforms at the start of each frame.
+
+	// Bounding spheres in world space, separate arrays for every component to let the culling vectorize.
+	std::vector<float> _bounds_x;
+	std::vector<float> _bounds_y;
+	std::vector<float> _bounds_z;
+	std::vector<float> _bounds_radius;
+	std::vector<uint8_t> _visible; // Non-zero if the entity is within the view frustum of the current frame.
+
+	std::vector<uint32_t> _material_indices; // Index into _materials.
+	std::vector<Primitive> _primitives; // The primitive currently rendered, the selected level of the LOD chain if the entity have one.
+
+	AabbTree _entity_tree; // Bounding spheres of all entities, for picking.
+
+	// Material table, shared by all entities with equal material. Unused entries are reused by new materials.
+	std::vector<Material> _materials;
+	std::vector<uint32_t> _material_references;
+	std::vector<uint32_t> _free_materials;
+	std::map<Material, uint32_t, MaterialLess> _material_lookup; // Maps every material in use to its entry in the table.
+
+	Primitive _floor_primitive;
+	Vec3 _floor_position;
+	uint32_t _floor_material;
+
+	std::vector<EntityId> _loading_entities; // Mesh entities whose buffers are still being uploaded.
+
+	PrimitiveLodChain _sphere_lods; // Levels of detail shared by all spheres.
+	SphereMeshType _sphere_mesh;
+
+	std::vector<Light> _lights; // Packed as the entities, removing a light moves the last light into its place.
 
 	PrimitiveFactory* _primitive_factory;
+	RenderDevice* _render_device;
 	Material _material_template; // Template material which will be used for all new entities.
 
+	OcclusionCullingMode _occlusion_culling;
+	Primitive _occlusion_proxy; // Unit box used as bounding proxy when testing entities for occlusion.
+	OcclusionBuffer* _occlusion_buffer; // Depth buffer used for software occlusion culling.
+
+	std::map<uint32_t, StaticBatch*> _static_batches; // Batch of every material with static entities, by material index.
+	std::vector<uint32_t> _dirty_static_batches; // Materials whose batch needs to be rebuilt before rendering.
+
+	bool _meshlet_culling;
+	MeshletCullStats _meshlet_stats; // Meshlets culled during the current frame.
+
 };
 
 
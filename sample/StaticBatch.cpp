@@ -0,0 +1,183 @@
+#include <framework/Common.h>
+
+#include "StaticBatch.h"
+#include "PrimitiveFactory.h"
+
+#include <algorithm>
+#include <float.h>
+
+namespace
+{
+	/// Size of the cells of the grid that static entities are grouped by. A 16-bit quantized position within a
+	///	cell of this size is precise to about half a millimeter.
+	const float static_batch_cell_size = 32.0f;
+};
+
+StaticBatch::StaticBatch(PrimitiveFactory* factory)
+	: _primitive_factory(factory), _material(0), _source_count(0)
+{
+}
+StaticBatch::~StaticBatch()
+{
+	Release();
+}
+bool StaticBatch::Build(const std::vector<Source>& sources, uint32_t material)
+{
+	Release();
+	if(sources.empty())
+		return false;
+
+	// Sources are grouped by the cell their origin is in, so that the merged geometry of each cell can be 
+	//	quantized over small bounds. Sources larger than a cell, like the floor, would stretch the bounds of
+	//	the cell they're in, so they're given cells of their own.
+	std::map<std::pair<int, std::pair<int, int> >, std::vector<const Source*> > cells;
+	std::vector<const Source*> large_sources;
+	for(std::vector<Source>::const_iterator it = sources.begin(); it != sources.end(); ++it)
+	{
+		const Mat4x4& model = it->transform;
+		float scale = 0.0f;
+		for(int c = 0; c < 3; ++c)
+			scale = std::max(scale, vector::Length(Vec3(model.col[c].x, model.col[c].y, model.col[c].z)));
+
+		if(it->primitive.bounding_radius * scale * 2.0f > static_batch_cell_size)
+		{
+			large_sources.push_back(&(*it));
+			continue;
+		}
+
+		const Vec4& origin = model.col[3];
+		std::pair<int, std::pair<int, int> > cell((int)floorf(origin.x / static_batch_cell_size), 
+			std::make_pair((int)floorf(origin.y / static_batch_cell_size), (int)floorf(origin.z / static_batch_cell_size)));
+		cells[cell].push_back(&(*it));
+	}
+
+	// Sources usually share a few primitives, the geometry of each primitive is only fetched and dequantized
+	//	once. Levels of the same chain share cache entry, so the key includes the index range as well.
+	std::map<std::pair<int, int>, FetchedGeometry> geometries;
+	for(std::map<std::pair<int, std::pair<int, int> >, std::vector<const Source*> >::iterator it = cells.begin(); 
+		it != cells.end(); ++it)
+	{
+		BuildCell(it->second, geometries);
+	}
+	for(std::vector<const Source*>::iterator it = large_sources.begin(); it != large_sources.end(); ++it)
+	{
+		BuildCell(std::vector<const Source*>(1, *it), geometries);
+	}
+
+	if(_cells.empty())
+	{
+		_source_count = 0;
+		return false;
+	}
+	_material = material;
+	return true;
+}
+void StaticBatch::BuildCell(const std::vector<const Source*>& sources, std::map<std::pair<int, int>, FetchedGeometry>& geometries)
+{
+	std::vector<float> vertices;
+	std::vector<uint32_t> indices;
+	Vec3 bounds_min(FLT_MAX, FLT_MAX, FLT_MAX);
+	Vec3 bounds_max(-FLT_MAX, -FLT_MAX, -FLT_MAX);
+
+	for(std::vector<const Source*>::const_iterator it = sources.begin();
+		it != sources.end(); ++it)
+	{
+		const Primitive& primitive = (*it)->primitive;
+
+		std::pair<int, int> key(primitive.cache_id, primitive.draw_call.index_offset);
+		std::map<std::pair<int, int>, FetchedGeometry>::iterator source_it = geometries.find(key);
+		if(source_it == geometries.end())
+		{
+			source_it = geometries.insert(std::make_pair(key, FetchedGeometry())).first;
+			FetchedGeometry& source = source_it->second;
+			source.valid = _primitive_factory->GetGeometry(primitive, source.vertices, source.indices);
+		}
+
+		const FetchedGeometry& source = source_it->second;
+		if(!source.valid)
+			continue;
+
+		const Mat4x4& model = (*it)->transform;
+		Mat3x3 normal_matrix = matrix::CreateNormalMatrix(model);
+
+		uint32_t first_vertex = (uint32_t)vertices.size() / 6;
+		uint32_t vertex_count = (uint32_t)source.vertices.size() / 6;
+		vertices.resize(vertices.size() + source.vertices.size());
+
+		for(uint32_t v = 0; v < vertex_count; ++v)
+		{
+			const float* src = &source.vertices[v*6];
+			float* dst = &vertices[(first_vertex + v)*6];
+
+			Vec4 position = matrix::Multiply(model, Vec4(src[0], src[1], src[2], 1.0f));
+			Vec3 normal = vector::Add(vector::Add(	vector::Multiply(normal_matrix.col[0], src[3]),
+													vector::Multiply(normal_matrix.col[1], src[4])),
+													vector::Multiply(normal_matrix.col[2], src[5]));
+			if(vector::Length(normal) > 0.0f)
+				vector::Normalize(normal);
+
+			dst[0] = position.x; dst[1] = position.y; dst[2] = position.z;
+			dst[3] = normal.x; dst[4] = normal.y; dst[5] = normal.z;
+
+			bounds_min = Vec3(std::min(bounds_min.x, position.x), std::min(bounds_min.y, position.y), std::min(bounds_min.z, position.z));
+			bounds_max = Vec3(std::max(bounds_max.x, position.x), std::max(bounds_max.y, position.y), std::max(bounds_max.z, position.z));
+		}
+
+		for(std::vector<uint32_t>::const_iterator index = source.indices.begin();
+			index != source.indices.end(); ++index)
+		{
+			indices.push_back(first_vertex + *index);
+		}
+		++_source_count;
+	}
+
+	if(indices.empty())
+		return;
+
+	Cell cell;
+	cell.center = vector::Multiply(vector::Add(bounds_min, bounds_max), 0.5f);
+	cell.radius = 0.0f;
+	for(size_t v = 0; v < vertices.size(); v += 6)
+	{
+		Vec3 position(vertices[v], vertices[v+1], vertices[v+2]);
+		cell.radius = std::max(cell.radius, vector::Length(vector::Subtract(position, cell.center)));
+	}
+
+	cell.primitive = _primitive_factory->CreateFromGeometry(&vertices[0], (uint32_t)vertices.size() / 6,
+		&indices[0], (uint32_t)indices.size(), "static batch");
+	_cells.push_back(cell);
+}
+void StaticBatch::Release()
+{
+	for(std::vector<Cell>::iterator it = _cells.begin(); it != _cells.end(); ++it)
+		_primitive_factory->DestroyPrimitive(it->primitive);
+	_cells.clear();
+	_source_count = 0;
+}
+uint32_t StaticBatch::MaterialIndex() const
+{
+	return _material;
+}
+uint32_t StaticBatch::CellCount() const
+{
+	return (uint32_t)_cells.size();
+}
+const Primitive& StaticBatch::CellPrimitive(uint32_t cell) const
+{
+	assert(cell < _cells.size());
+	return _cells[cell].primitive;
+}
+const Vec3& StaticBatch::CellCenter(uint32_t cell) const
+{
+	assert(cell < _cells.size());
+	return _cells[cell].center;
+}
+float StaticBatch::CellRadius(uint32_t cell) const
+{
+	assert(cell < _cells.size());
+	return _cells[cell].radius;
+}
+uint32_t StaticBatch::SourceCount() const
+{
+	return _source_count;
+}
@@ -0,0 +1,78 @@
+#ifndef __STATICBATCH_H__
+#define __STATICBATCH_H__
+
+#include "PrimitiveFactory.h"
+
+/// @brief Static entities sharing material, merged into primitives with their geometry transformed to world
+///	space. Entities are grouped by the cell of a world space grid they're placed in, and each cell is drawn
+///	with one draw call and a single transform upload, at the cost of having to rebuild the batch whenever an
+///	entity is added, removed or changed. The merged vertices are quantized over the bounds of their cell
+///	rather than the whole batch, keeping the precision close to that of the entities drawn on their own.
+class StaticBatch
+{
+public:
+	/// Primitive to merge into the batch, placed in the world by the transform.
+	struct Source
+	{
+		Primitive primitive;
+		Mat4x4 transform;
+	};
+
+	StaticBatch(PrimitiveFactory* factory);
+	~StaticBatch();
+
+	/// @brief Merges the geometry of the sources, replacing any previous contents.
+	/// @param material Index of the material shared by all sources, in the material table of the scene.
+	/// @return False if none of the sources had any geometry that could be merged.
+	bool Build(const std::vector<Source>& sources, uint32_t material);
+
+	/// @brief Releases the merged geometry.
+	void Release();
+
+	/// @brief Returns the index of the material of the batch.
+	uint32_t MaterialIndex() const;
+
+	/// @brief Returns the number of cells holding merged geometry.
+	uint32_t CellCount() const;
+
+	/// @brief Returns the primitive holding the merged geometry of a cell, in world space.
+	const Primitive& CellPrimitive(uint32_t cell) const;
+
+	/// @brief Returns the center of the bounding sphere of the entities in a cell, in world space.
+	const Vec3& CellCenter(uint32_t cell) const;
+
+	/// @brief Returns the radius of the bounding sphere of the entities in a cell.
+	float CellRadius(uint32_t cell) const;
+
+	/// @brief Returns the number of sources merged into the batch.
+	uint32_t SourceCount() const;
+
+private:
+	/// Geometry of a source primitive fetched from the factory, in object space.
+	struct FetchedGeometry
+	{
+		std::vector<float> vertices;
+		std::vector<uint32_t> indices;
+		bool valid;
+	};
+
+	/// Merged geometry of the sources placed within one cell of the grid.
+	struct Cell
+	{
+		Primitive primitive;
+		Vec3 center;
+		float radius;
+	};
+
+	/// @brief Merges the sources into a new cell.
+	/// @param geometries Geometry already fetched for the source primitives, shared by all cells.
+	void BuildCell(const std::vector<const Source*>& sources, std::map<std::pair<int, int>, FetchedGeometry>& geometries);
+
+	PrimitiveFactory* _primitive_factory;
+
+	std::vector<Cell> _cells; // Empty if the batch haven't been built.
+	uint32_t _material;
+	uint32_t _source_count;
+};
+
+#endif // __STATICBATCH_H__
@@ -9,6 +9,15 @@ int main(int argc, char* argv[])
 #endif
 {
 	SampleApp app;
+
+	// A mesh file can be passed on the command line: Sample [mesh.obj|mesh.ply]
+#ifdef PLATFORM_WIN32
+	int argc = __argc;
+	char** argv = __argv;
+#endif
+	if(argc > 1)
+		app.SetMeshPath(argv[1]);
+
 	app.Run();
 }
 